@@ -0,0 +1,699 @@
+#pragma once
+
+// Block activation functions for the models, in three accuracy tiers, vectorized for each CPU tier (see
+// DSPKernels.h for how the CPU tiers work).
+//
+// Max absolute error against a double-precision reference over [-10, 10], and ns/sample on an AVX2 Xeon (1024-sample
+// blocks; nam-bench has the cases to measure your own machine):
+//
+//   Function | Exact (scalar)  | Polynomial      | Rational
+//   ---------+-----------------+-----------------+-----------------
+//   Tanh     | 1.0e-7, 8.4 ns  | 1.2e-7, 0.64 ns | 4.4e-4, 0.41 ns
+//   Sigmoid  | 8.9e-8, 3.8 ns  | 8.9e-8, 0.55 ns | 2.2e-4, 0.43 ns
+//   Hardtanh | Exact in every tier, about 0.1 ns
+//   ReLU     | Exact in every tier, about 0.05 ns
+//
+// * Exact: the standard library, one sample at a time. For renders that should match what the model was trained on
+//   as closely as possible.
+// * Polynomial: exp() from a range-reduced polynomial, then tanh and sigmoid from that. As good as Exact for float.
+// * Rational: the same rational approximation as NAM's fast tanh, so it's what the plugin has always used for live
+//   playing.
+//
+// The tier is chosen per model: ScopedActivationAccuracy puts the tier's activations into NAM's activation registry
+// while a model is built, and the layers keep the ones they were built with. (LSTM models don't use the registry;
+// they follow NAM's global fast tanh switch.)
+
+#include <algorithm> // std::min, std::max
+#include <cmath> // std::tanh, std::exp
+#include <cstdint>
+#include <cstring> // memcpy
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "NeuralAmpModelerCore/NAM/activations.h"
+#include "DSPKernels.h" // NAM_TARGET, architecture
+
+namespace dsp
+{
+namespace activations
+{
+enum class Accuracy
+{
+  Exact = 0,
+  Polynomial,
+  Rational
+};
+
+inline const char* GetAccuracyName(const Accuracy accuracy)
+{
+  switch (accuracy)
+  {
+    case Accuracy::Exact: return "Exact";
+    case Accuracy::Polynomial: return "Polynomial";
+    case Accuracy::Rational:
+    default: return "Rational";
+  }
+}
+
+// All of these work in place on `size` contiguous floats.
+struct ActivationKernels
+{
+  void (*tanh)(float* data, const long size);
+  void (*hardTanh)(float* data, const long size);
+  void (*sigmoid)(float* data, const long size);
+  void (*relu)(float* data, const long size);
+  Accuracy accuracy;
+  cpu_features::Tier tier;
+};
+
+namespace constants
+{
+// exp(x) = 2^n * exp(r), |r| <= ln(2) / 2 (Cephes expf)
+constexpr float kLog2E = 1.44269504088896341f;
+constexpr float kLn2Hi = 0.693359375f;
+constexpr float kLn2Lo = -2.12194440e-4f;
+constexpr float kExpP0 = 1.9875691500e-4f;
+constexpr float kExpP1 = 1.3981999507e-3f;
+constexpr float kExpP2 = 8.3334519073e-3f;
+constexpr float kExpP3 = 4.1665795894e-2f;
+constexpr float kExpP4 = 1.6666665459e-1f;
+constexpr float kExpP5 = 5.0000001201e-1f;
+// Keeps 2^n a normal float
+constexpr float kExpMax = 87.0f;
+// tanh() is 1 in float beyond this
+constexpr float kTanhMax = 9.0f;
+// NAM's fast tanh
+constexpr float kRatA = 2.45550750702956f;
+constexpr float kRatB = 0.893229853513558f;
+constexpr float kRatC = 0.821226666969744f;
+constexpr float kRatD = 2.44506634652299f;
+constexpr float kRatE = 0.814642734961073f;
+}; // namespace constants
+
+namespace generic
+{
+inline float ExpPolynomial(float x)
+{
+  using namespace constants;
+  x = std::min(std::max(x, -kExpMax), kExpMax);
+  const float n = std::nearbyint(x * kLog2E);
+  const float r = x - n * kLn2Hi - n * kLn2Lo;
+  float p = kExpP0;
+  p = p * r + kExpP1;
+  p = p * r + kExpP2;
+  p = p * r + kExpP3;
+  p = p * r + kExpP4;
+  p = p * r + kExpP5;
+  const float e = p * r * r + r + 1.0f;
+  const int32_t bits = ((int32_t)n + 127) << 23;
+  float scale;
+  std::memcpy(&scale, &bits, sizeof(scale));
+  return e * scale;
+}
+
+inline float TanhRationalScalar(const float x)
+{
+  using namespace constants;
+  const float ax = std::fabs(x);
+  const float x2 = x * x;
+  return (x * (kRatA + kRatA * ax + (kRatB + kRatC * ax) * x2)
+          / (kRatD + (kRatD + x2) * std::fabs(x + kRatE * x * ax)));
+}
+
+inline void TanhExact(float* data, const long size)
+{
+  for (long i = 0; i < size; i++)
+    data[i] = std::tanh(data[i]);
+}
+
+inline void TanhPolynomial(float* data, const long size)
+{
+  for (long i = 0; i < size; i++)
+  {
+    const float a = std::min(std::fabs(data[i]), constants::kTanhMax);
+    data[i] = std::copysign(1.0f - 2.0f / (ExpPolynomial(2.0f * a) + 1.0f), data[i]);
+  }
+}
+
+inline void TanhRational(float* data, const long size)
+{
+  for (long i = 0; i < size; i++)
+    data[i] = TanhRationalScalar(data[i]);
+}
+
+inline void SigmoidExact(float* data, const long size)
+{
+  for (long i = 0; i < size; i++)
+    data[i] = 1.0f / (1.0f + std::exp(-data[i]));
+}
+
+inline void SigmoidPolynomial(float* data, const long size)
+{
+  for (long i = 0; i < size; i++)
+    data[i] = 1.0f / (1.0f + ExpPolynomial(-data[i]));
+}
+
+inline void SigmoidRational(float* data, const long size)
+{
+  for (long i = 0; i < size; i++)
+    data[i] = 0.5f + 0.5f * TanhRationalScalar(0.5f * data[i]);
+}
+
+inline void HardTanh(float* data, const long size)
+{
+  for (long i = 0; i < size; i++)
+    data[i] = std::min(std::max(data[i], -1.0f), 1.0f);
+}
+
+inline void ReLU(float* data, const long size)
+{
+  for (long i = 0; i < size; i++)
+    data[i] = std::max(data[i], 0.0f);
+}
+}; // namespace generic
+
+// The vector versions do the same arithmetic as the generic ones, several samples at a time, and finish the block
+// with the generic ones.
+
+#define NAM_ACTIVATION_LOOP(width, load, store, expr, tail)                                                            \
+  long i = 0;                                                                                                          \
+  for (; i + width <= size; i += width)                                                                                \
+  {                                                                                                                    \
+    const auto x = load(data + i);                                                                                     \
+    store(data + i, expr);                                                                                             \
+  }                                                                                                                    \
+  tail(data + i, size - i);
+
+#if defined(ARCH_X86)
+namespace sse2
+{
+NAM_TARGET("sse2")
+inline __m128 Abs(const __m128 x)
+{
+  return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+}
+
+NAM_TARGET("sse2")
+inline __m128 ExpPolynomial(__m128 x)
+{
+  using namespace constants;
+  x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-kExpMax)), _mm_set1_ps(kExpMax));
+  const __m128i ni = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(kLog2E)));
+  const __m128 n = _mm_cvtepi32_ps(ni);
+  const __m128 r = _mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(kLn2Hi))), _mm_mul_ps(n, _mm_set1_ps(kLn2Lo)));
+  __m128 p = _mm_set1_ps(kExpP0);
+  p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(kExpP1));
+  p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(kExpP2));
+  p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(kExpP3));
+  p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(kExpP4));
+  p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(kExpP5));
+  const __m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, r), r), r), _mm_set1_ps(1.0f));
+  const __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(ni, _mm_set1_epi32(127)), 23));
+  return _mm_mul_ps(e, scale);
+}
+
+NAM_TARGET("sse2")
+inline __m128 TanhPolynomialPacked(const __m128 x)
+{
+  const __m128 sign = _mm_and_ps(x, _mm_set1_ps(-0.0f));
+  const __m128 a = _mm_min_ps(Abs(x), _mm_set1_ps(constants::kTanhMax));
+  const __m128 e = ExpPolynomial(_mm_add_ps(a, a));
+  const __m128 t = _mm_sub_ps(_mm_set1_ps(1.0f), _mm_div_ps(_mm_set1_ps(2.0f), _mm_add_ps(e, _mm_set1_ps(1.0f))));
+  return _mm_or_ps(t, sign);
+}
+
+NAM_TARGET("sse2")
+inline __m128 TanhRationalPacked(const __m128 x)
+{
+  using namespace constants;
+  const __m128 ax = Abs(x);
+  const __m128 x2 = _mm_mul_ps(x, x);
+  const __m128 num = _mm_mul_ps(
+    x, _mm_add_ps(_mm_add_ps(_mm_set1_ps(kRatA), _mm_mul_ps(_mm_set1_ps(kRatA), ax)),
+                  _mm_mul_ps(_mm_add_ps(_mm_set1_ps(kRatB), _mm_mul_ps(_mm_set1_ps(kRatC), ax)), x2)));
+  const __m128 bend = Abs(_mm_add_ps(x, _mm_mul_ps(_mm_set1_ps(kRatE), _mm_mul_ps(x, ax))));
+  const __m128 den = _mm_add_ps(_mm_set1_ps(kRatD), _mm_mul_ps(_mm_add_ps(_mm_set1_ps(kRatD), x2), bend));
+  return _mm_div_ps(num, den);
+}
+
+NAM_TARGET("sse2")
+inline void TanhPolynomial(float* data, const long size)
+{
+  NAM_ACTIVATION_LOOP(4, _mm_loadu_ps, _mm_storeu_ps, TanhPolynomialPacked(x), generic::TanhPolynomial)
+}
+
+NAM_TARGET("sse2")
+inline void TanhRational(float* data, const long size)
+{
+  NAM_ACTIVATION_LOOP(4, _mm_loadu_ps, _mm_storeu_ps, TanhRationalPacked(x), generic::TanhRational)
+}
+
+NAM_TARGET("sse2")
+inline void SigmoidPolynomial(float* data, const long size)
+{
+  const __m128 one = _mm_set1_ps(1.0f);
+  NAM_ACTIVATION_LOOP(4, _mm_loadu_ps, _mm_storeu_ps,
+                      _mm_div_ps(one, _mm_add_ps(one, ExpPolynomial(_mm_sub_ps(_mm_setzero_ps(), x)))),
+                      generic::SigmoidPolynomial)
+}
+
+NAM_TARGET("sse2")
+inline void SigmoidRational(float* data, const long size)
+{
+  const __m128 half = _mm_set1_ps(0.5f);
+  NAM_ACTIVATION_LOOP(4, _mm_loadu_ps, _mm_storeu_ps,
+                      _mm_add_ps(half, _mm_mul_ps(half, TanhRationalPacked(_mm_mul_ps(half, x)))),
+                      generic::SigmoidRational)
+}
+
+NAM_TARGET("sse2")
+inline void HardTanh(float* data, const long size)
+{
+  const __m128 lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f);
+  NAM_ACTIVATION_LOOP(4, _mm_loadu_ps, _mm_storeu_ps, _mm_min_ps(_mm_max_ps(x, lo), hi), generic::HardTanh)
+}
+
+NAM_TARGET("sse2")
+inline void ReLU(float* data, const long size)
+{
+  const __m128 zero = _mm_setzero_ps();
+  NAM_ACTIVATION_LOOP(4, _mm_loadu_ps, _mm_storeu_ps, _mm_max_ps(x, zero), generic::ReLU)
+}
+}; // namespace sse2
+
+namespace avx2
+{
+NAM_TARGET("avx2,fma")
+inline __m256 Abs(const __m256 x)
+{
+  return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x);
+}
+
+NAM_TARGET("avx2,fma")
+inline __m256 ExpPolynomial(__m256 x)
+{
+  using namespace constants;
+  x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-kExpMax)), _mm256_set1_ps(kExpMax));
+  const __m256i ni = _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(kLog2E)));
+  const __m256 n = _mm256_cvtepi32_ps(ni);
+  const __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(kLn2Lo), _mm256_fnmadd_ps(n, _mm256_set1_ps(kLn2Hi), x));
+  __m256 p = _mm256_set1_ps(kExpP0);
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP1));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP2));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP3));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP4));
+  p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(kExpP5));
+  const __m256 e = _mm256_add_ps(_mm256_fmadd_ps(_mm256_mul_ps(p, r), r, r), _mm256_set1_ps(1.0f));
+  const __m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(ni, _mm256_set1_epi32(127)), 23));
+  return _mm256_mul_ps(e, scale);
+}
+
+NAM_TARGET("avx2,fma")
+inline __m256 TanhPolynomialPacked(const __m256 x)
+{
+  const __m256 sign = _mm256_and_ps(x, _mm256_set1_ps(-0.0f));
+  const __m256 a = _mm256_min_ps(Abs(x), _mm256_set1_ps(constants::kTanhMax));
+  const __m256 e = ExpPolynomial(_mm256_add_ps(a, a));
+  const __m256 t =
+    _mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_div_ps(_mm256_set1_ps(2.0f), _mm256_add_ps(e, _mm256_set1_ps(1.0f))));
+  return _mm256_or_ps(t, sign);
+}
+
+NAM_TARGET("avx2,fma")
+inline __m256 TanhRationalPacked(const __m256 x)
+{
+  using namespace constants;
+  const __m256 ax = Abs(x);
+  const __m256 x2 = _mm256_mul_ps(x, x);
+  const __m256 num =
+    _mm256_mul_ps(x, _mm256_fmadd_ps(_mm256_fmadd_ps(_mm256_set1_ps(kRatC), ax, _mm256_set1_ps(kRatB)), x2,
+                                     _mm256_fmadd_ps(_mm256_set1_ps(kRatA), ax, _mm256_set1_ps(kRatA))));
+  const __m256 den = _mm256_fmadd_ps(_mm256_add_ps(_mm256_set1_ps(kRatD), x2),
+                                     Abs(_mm256_fmadd_ps(_mm256_set1_ps(kRatE), _mm256_mul_ps(x, ax), x)),
+                                     _mm256_set1_ps(kRatD));
+  return _mm256_div_ps(num, den);
+}
+
+NAM_TARGET("avx2,fma")
+inline void TanhPolynomial(float* data, const long size)
+{
+  NAM_ACTIVATION_LOOP(8, _mm256_loadu_ps, _mm256_storeu_ps, TanhPolynomialPacked(x),
+                      generic::TanhPolynomial)
+}
+
+NAM_TARGET("avx2,fma")
+inline void TanhRational(float* data, const long size)
+{
+  NAM_ACTIVATION_LOOP(8, _mm256_loadu_ps, _mm256_storeu_ps, TanhRationalPacked(x), generic::TanhRational)
+}
+
+NAM_TARGET("avx2,fma")
+inline void SigmoidPolynomial(float* data, const long size)
+{
+  const __m256 one = _mm256_set1_ps(1.0f);
+  NAM_ACTIVATION_LOOP(8, _mm256_loadu_ps, _mm256_storeu_ps,
+                      _mm256_div_ps(one, _mm256_add_ps(one, ExpPolynomial(_mm256_sub_ps(_mm256_setzero_ps(), x)))),
+                      generic::SigmoidPolynomial)
+}
+
+NAM_TARGET("avx2,fma")
+inline void SigmoidRational(float* data, const long size)
+{
+  const __m256 half = _mm256_set1_ps(0.5f);
+  NAM_ACTIVATION_LOOP(8, _mm256_loadu_ps, _mm256_storeu_ps,
+                      _mm256_fmadd_ps(half, TanhRationalPacked(_mm256_mul_ps(half, x)), half), generic::SigmoidRational)
+}
+
+NAM_TARGET("avx2,fma")
+inline void HardTanh(float* data, const long size)
+{
+  const __m256 lo = _mm256_set1_ps(-1.0f), hi = _mm256_set1_ps(1.0f);
+  NAM_ACTIVATION_LOOP(8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_min_ps(_mm256_max_ps(x, lo), hi),
+                      generic::HardTanh)
+}
+
+NAM_TARGET("avx2,fma")
+inline void ReLU(float* data, const long size)
+{
+  const __m256 zero = _mm256_setzero_ps();
+  NAM_ACTIVATION_LOOP(8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_max_ps(x, zero), generic::ReLU)
+}
+}; // namespace avx2
+
+namespace avx512
+{
+// AVX-512F has no float bitwise ops (that's DQ), so the sign bits are handled as integers.
+NAM_TARGET("avx512f")
+inline __m512 ExpPolynomial(__m512 x)
+{
+  using namespace constants;
+  x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-kExpMax)), _mm512_set1_ps(kExpMax));
+  const __m512i ni = _mm512_cvtps_epi32(_mm512_mul_ps(x, _mm512_set1_ps(kLog2E)));
+  const __m512 n = _mm512_cvtepi32_ps(ni);
+  const __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(kLn2Lo), _mm512_fnmadd_ps(n, _mm512_set1_ps(kLn2Hi), x));
+  __m512 p = _mm512_set1_ps(kExpP0);
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP1));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP2));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP3));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP4));
+  p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(kExpP5));
+  const __m512 e = _mm512_add_ps(_mm512_fmadd_ps(_mm512_mul_ps(p, r), r, r), _mm512_set1_ps(1.0f));
+  const __m512 scale = _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(ni, _mm512_set1_epi32(127)), 23));
+  return _mm512_mul_ps(e, scale);
+}
+
+NAM_TARGET("avx512f")
+inline __m512 TanhPolynomialPacked(const __m512 x)
+{
+  const __m512i signMask = _mm512_set1_epi32(INT32_MIN);
+  const __m512i sign = _mm512_and_epi32(_mm512_castps_si512(x), signMask);
+  const __m512 a = _mm512_min_ps(_mm512_abs_ps(x), _mm512_set1_ps(constants::kTanhMax));
+  const __m512 e = ExpPolynomial(_mm512_add_ps(a, a));
+  const __m512 t =
+    _mm512_sub_ps(_mm512_set1_ps(1.0f), _mm512_div_ps(_mm512_set1_ps(2.0f), _mm512_add_ps(e, _mm512_set1_ps(1.0f))));
+  return _mm512_castsi512_ps(_mm512_or_epi32(_mm512_castps_si512(t), sign));
+}
+
+NAM_TARGET("avx512f")
+inline __m512 TanhRationalPacked(const __m512 x)
+{
+  using namespace constants;
+  const __m512 ax = _mm512_abs_ps(x);
+  const __m512 x2 = _mm512_mul_ps(x, x);
+  const __m512 num =
+    _mm512_mul_ps(x, _mm512_fmadd_ps(_mm512_fmadd_ps(_mm512_set1_ps(kRatC), ax, _mm512_set1_ps(kRatB)), x2,
+                                     _mm512_fmadd_ps(_mm512_set1_ps(kRatA), ax, _mm512_set1_ps(kRatA))));
+  const __m512 den = _mm512_fmadd_ps(_mm512_add_ps(_mm512_set1_ps(kRatD), x2),
+                                     _mm512_abs_ps(_mm512_fmadd_ps(_mm512_set1_ps(kRatE), _mm512_mul_ps(x, ax), x)),
+                                     _mm512_set1_ps(kRatD));
+  return _mm512_div_ps(num, den);
+}
+
+NAM_TARGET("avx512f")
+inline void TanhPolynomial(float* data, const long size)
+{
+  NAM_ACTIVATION_LOOP(16, _mm512_loadu_ps, _mm512_storeu_ps, TanhPolynomialPacked(x),
+                      generic::TanhPolynomial)
+}
+
+NAM_TARGET("avx512f")
+inline void TanhRational(float* data, const long size)
+{
+  NAM_ACTIVATION_LOOP(16, _mm512_loadu_ps, _mm512_storeu_ps, TanhRationalPacked(x), generic::TanhRational)
+}
+
+NAM_TARGET("avx512f")
+inline void SigmoidPolynomial(float* data, const long size)
+{
+  const __m512 one = _mm512_set1_ps(1.0f);
+  NAM_ACTIVATION_LOOP(16, _mm512_loadu_ps, _mm512_storeu_ps,
+                      _mm512_div_ps(one, _mm512_add_ps(one, ExpPolynomial(_mm512_sub_ps(_mm512_setzero_ps(), x)))),
+                      generic::SigmoidPolynomial)
+}
+
+NAM_TARGET("avx512f")
+inline void SigmoidRational(float* data, const long size)
+{
+  const __m512 half = _mm512_set1_ps(0.5f);
+  NAM_ACTIVATION_LOOP(16, _mm512_loadu_ps, _mm512_storeu_ps,
+                      _mm512_fmadd_ps(half, TanhRationalPacked(_mm512_mul_ps(half, x)), half), generic::SigmoidRational)
+}
+
+NAM_TARGET("avx512f")
+inline void HardTanh(float* data, const long size)
+{
+  const __m512 lo = _mm512_set1_ps(-1.0f), hi = _mm512_set1_ps(1.0f);
+  NAM_ACTIVATION_LOOP(16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_min_ps(_mm512_max_ps(x, lo), hi),
+                      generic::HardTanh)
+}
+
+NAM_TARGET("avx512f")
+inline void ReLU(float* data, const long size)
+{
+  const __m512 zero = _mm512_setzero_ps();
+  NAM_ACTIVATION_LOOP(16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_max_ps(x, zero), generic::ReLU)
+}
+}; // namespace avx512
+#elif defined(ARCH_ARM64)
+namespace neon
+{
+inline float32x4_t ExpPolynomial(float32x4_t x)
+{
+  using namespace constants;
+  x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(-kExpMax)), vdupq_n_f32(kExpMax));
+  const float32x4_t n = vrndnq_f32(vmulq_n_f32(x, kLog2E));
+  const int32x4_t ni = vcvtq_s32_f32(n);
+  const float32x4_t r = vfmsq_f32(vfmsq_f32(x, n, vdupq_n_f32(kLn2Hi)), n, vdupq_n_f32(kLn2Lo));
+  float32x4_t p = vdupq_n_f32(kExpP0);
+  p = vfmaq_f32(vdupq_n_f32(kExpP1), p, r);
+  p = vfmaq_f32(vdupq_n_f32(kExpP2), p, r);
+  p = vfmaq_f32(vdupq_n_f32(kExpP3), p, r);
+  p = vfmaq_f32(vdupq_n_f32(kExpP4), p, r);
+  p = vfmaq_f32(vdupq_n_f32(kExpP5), p, r);
+  const float32x4_t e = vaddq_f32(vfmaq_f32(r, vmulq_f32(p, r), r), vdupq_n_f32(1.0f));
+  const float32x4_t scale = vreinterpretq_f32_s32(vshlq_n_s32(vaddq_s32(ni, vdupq_n_s32(127)), 23));
+  return vmulq_f32(e, scale);
+}
+
+inline float32x4_t TanhPolynomialPacked(const float32x4_t x)
+{
+  const float32x4_t a = vminq_f32(vabsq_f32(x), vdupq_n_f32(constants::kTanhMax));
+  const float32x4_t e = ExpPolynomial(vaddq_f32(a, a));
+  const float32x4_t t = vsubq_f32(vdupq_n_f32(1.0f), vdivq_f32(vdupq_n_f32(2.0f), vaddq_f32(e, vdupq_n_f32(1.0f))));
+  // Copy the sign of x
+  return vbslq_f32(vdupq_n_u32(0x80000000u), x, t);
+}
+
+inline float32x4_t TanhRationalPacked(const float32x4_t x)
+{
+  using namespace constants;
+  const float32x4_t ax = vabsq_f32(x);
+  const float32x4_t x2 = vmulq_f32(x, x);
+  const float32x4_t num =
+    vmulq_f32(x, vfmaq_f32(vfmaq_f32(vdupq_n_f32(kRatA), vdupq_n_f32(kRatA), ax),
+                           vfmaq_f32(vdupq_n_f32(kRatB), vdupq_n_f32(kRatC), ax), x2));
+  const float32x4_t den = vfmaq_f32(vdupq_n_f32(kRatD), vaddq_f32(vdupq_n_f32(kRatD), x2),
+                                    vabsq_f32(vfmaq_f32(x, vdupq_n_f32(kRatE), vmulq_f32(x, ax))));
+  return vdivq_f32(num, den);
+}
+
+inline void TanhPolynomial(float* data, const long size)
+{
+  NAM_ACTIVATION_LOOP(4, vld1q_f32, vst1q_f32, TanhPolynomialPacked(x), generic::TanhPolynomial)
+}
+
+inline void TanhRational(float* data, const long size)
+{
+  NAM_ACTIVATION_LOOP(4, vld1q_f32, vst1q_f32, TanhRationalPacked(x), generic::TanhRational)
+}
+
+inline void SigmoidPolynomial(float* data, const long size)
+{
+  const float32x4_t one = vdupq_n_f32(1.0f);
+  NAM_ACTIVATION_LOOP(4, vld1q_f32, vst1q_f32, vdivq_f32(one, vaddq_f32(one, ExpPolynomial(vnegq_f32(x)))),
+                      generic::SigmoidPolynomial)
+}
+
+inline void SigmoidRational(float* data, const long size)
+{
+  const float32x4_t half = vdupq_n_f32(0.5f);
+  NAM_ACTIVATION_LOOP(4, vld1q_f32, vst1q_f32, vfmaq_f32(half, half, TanhRationalPacked(vmulq_f32(half, x))),
+                      generic::SigmoidRational)
+}
+
+inline void HardTanh(float* data, const long size)
+{
+  const float32x4_t lo = vdupq_n_f32(-1.0f), hi = vdupq_n_f32(1.0f);
+  NAM_ACTIVATION_LOOP(4, vld1q_f32, vst1q_f32, vminq_f32(vmaxq_f32(x, lo), hi), generic::HardTanh)
+}
+
+inline void ReLU(float* data, const long size)
+{
+  const float32x4_t zero = vdupq_n_f32(0.0f);
+  NAM_ACTIVATION_LOOP(4, vld1q_f32, vst1q_f32, vmaxq_f32(x, zero), generic::ReLU)
+}
+}; // namespace neon
+#endif
+
+#undef NAM_ACTIVATION_LOOP
+
+inline ActivationKernels MakeActivationKernels(const cpu_features::Tier tier, const Accuracy accuracy)
+{
+  using cpu_features::Tier;
+  // Exact is the standard library, one sample at a time, on every CPU tier.
+  if (accuracy == Accuracy::Exact)
+    return {generic::TanhExact, generic::HardTanh, generic::SigmoidExact, generic::ReLU, accuracy, Tier::Generic};
+  const bool polynomial = accuracy == Accuracy::Polynomial;
+#if defined(ARCH_X86)
+  switch (tier)
+  {
+    case Tier::AVX512:
+      return {polynomial ? avx512::TanhPolynomial : avx512::TanhRational, avx512::HardTanh,
+              polynomial ? avx512::SigmoidPolynomial : avx512::SigmoidRational, avx512::ReLU, accuracy, tier};
+    case Tier::AVX2:
+      return {polynomial ? avx2::TanhPolynomial : avx2::TanhRational, avx2::HardTanh,
+              polynomial ? avx2::SigmoidPolynomial : avx2::SigmoidRational, avx2::ReLU, accuracy, tier};
+    case Tier::SSE2:
+      return {polynomial ? sse2::TanhPolynomial : sse2::TanhRational, sse2::HardTanh,
+              polynomial ? sse2::SigmoidPolynomial : sse2::SigmoidRational, sse2::ReLU, accuracy, tier};
+    default: break;
+  }
+#elif defined(ARCH_ARM64)
+  if (tier == Tier::NEON)
+    return {polynomial ? neon::TanhPolynomial : neon::TanhRational, neon::HardTanh,
+            polynomial ? neon::SigmoidPolynomial : neon::SigmoidRational, neon::ReLU, accuracy, tier};
+#endif
+  return {polynomial ? generic::TanhPolynomial : generic::TanhRational, generic::HardTanh,
+          polynomial ? generic::SigmoidPolynomial : generic::SigmoidRational, generic::ReLU, accuracy, Tier::Generic};
+}
+
+// The kernels for the active CPU tier at the given accuracy.
+inline const ActivationKernels& GetActivationKernels(const Accuracy accuracy)
+{
+  using cpu_features::GetActiveTier;
+  static const ActivationKernels tables[] = {MakeActivationKernels(GetActiveTier(), Accuracy::Exact),
+                                             MakeActivationKernels(GetActiveTier(), Accuracy::Polynomial),
+                                             MakeActivationKernels(GetActiveTier(), Accuracy::Rational)};
+  return tables[(int)accuracy];
+}
+
+// Hooking into NAM ==================================================================================================
+
+// One of the kernels above, as a NAM activation.
+class BlockActivation : public nam::activations::Activation
+{
+public:
+  BlockActivation(void (*kernel)(float*, const long))
+  : mKernel(kernel)
+  {
+  }
+  using nam::activations::Activation::apply;
+  void apply(float* data, long size) override { mKernel(data, size); };
+
+private:
+  void (*mKernel)(float*, const long);
+};
+
+// Swaps our activations in and out of NAM's registry (which is only visible to subclasses).
+class ActivationRegistry : public nam::activations::Activation
+{
+public:
+  using Entries = std::unordered_map<std::string, nam::activations::Activation*>;
+
+  // Puts the tier's activations in and returns what was there before.
+  static Entries Install(const Accuracy accuracy)
+  {
+    Entries previous;
+    for (const auto& entry : _GetActivations(accuracy))
+    {
+      auto it = _activations.find(entry.first);
+      previous[entry.first] = it != _activations.end() ? it->second : nullptr;
+      _activations[entry.first] = entry.second;
+    }
+    return previous;
+  }
+
+  static void Restore(const Entries& previous)
+  {
+    for (const auto& entry : previous)
+    {
+      if (entry.second != nullptr)
+        _activations[entry.first] = entry.second;
+      else
+        _activations.erase(entry.first);
+    }
+  }
+
+private:
+  static const Entries& _GetActivations(const Accuracy accuracy)
+  {
+    struct Activations
+    {
+      Activations(const ActivationKernels& kernels)
+      : tanh(kernels.tanh)
+      , hardTanh(kernels.hardTanh)
+      , sigmoid(kernels.sigmoid)
+      , relu(kernels.relu)
+      , entries{{"Tanh", &tanh}, {"Hardtanh", &hardTanh}, {"Sigmoid", &sigmoid}, {"ReLU", &relu}}
+      {
+      }
+      BlockActivation tanh, hardTanh, sigmoid, relu;
+      Entries entries;
+    };
+    static Activations activations[] = {Activations(GetActivationKernels(Accuracy::Exact)),
+                                        Activations(GetActivationKernels(Accuracy::Polynomial)),
+                                        Activations(GetActivationKernels(Accuracy::Rational))};
+    return activations[(int)accuracy].entries;
+  }
+};
+
+// Models look their activations up in the (global) registry while they're built, so every model is built holding this,
+// whoever builds it: nam_file::BuildDSP() and GetDSP() take it. It's recursive so that a ScopedActivationAccuracy can
+// hold it around a build that takes it again.
+inline std::unique_lock<std::recursive_mutex> LockModelBuilding()
+{
+  static std::recursive_mutex mutex;
+  return std::unique_lock<std::recursive_mutex>(mutex);
+}
+
+// Models built while this is alive get the tier's activations. Holds LockModelBuilding(), so no other thread builds a
+// model with the wrong ones in the meantime.
+class ScopedActivationAccuracy
+{
+public:
+  ScopedActivationAccuracy(const Accuracy accuracy)
+  : mLock(LockModelBuilding())
+  , mPrevious(ActivationRegistry::Install(accuracy))
+  {
+  }
+  ~ScopedActivationAccuracy() { ActivationRegistry::Restore(mPrevious); };
+  ScopedActivationAccuracy(const ScopedActivationAccuracy&) = delete;
+  ScopedActivationAccuracy& operator=(const ScopedActivationAccuracy&) = delete;
+
+private:
+  std::unique_lock<std::recursive_mutex> mLock;
+  ActivationRegistry::Entries mPrevious;
+};
+}; // namespace activations
+}; // namespace dsp
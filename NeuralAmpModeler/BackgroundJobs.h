@@ -0,0 +1,77 @@
+#pragma once
+
+// Background work that's superseded rather than waited for (see model_profile::BackgroundProfiler and
+// loudness::BackgroundAnalyzer).
+//
+// Starting a job cancels the ones before it without joining them, so that the thread that starts it (usually the UI
+// thread, loading a model) never waits for a model to finish rendering. The threads of cancelled jobs are joined once
+// they've finished: the next time a job is started, or when the set is destroyed.
+//
+// Owners that hand results back should check the cancel flag and publish under a lock that they also hold while
+// cancelling, so that a cancelled job's result can't land afterwards. Declare the set last, so that it's destroyed (and
+// its threads joined) before anything that they use.
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace background
+{
+class Jobs
+{
+public:
+  // Given the job's cancel flag, which it should poll
+  using Work = std::function<void(const std::atomic<bool>& cancel)>;
+
+  Jobs() = default;
+  ~Jobs()
+  {
+    CancelAll();
+    for (auto& job : mJobs)
+      job->thread.join();
+  };
+  Jobs(const Jobs&) = delete;
+  Jobs& operator=(const Jobs&) = delete;
+
+  // Cancels the others and runs `work` on a thread of its own.
+  void Start(Work work)
+  {
+    CancelAll();
+    for (auto it = mJobs.begin(); it != mJobs.end();)
+    {
+      if ((*it)->done)
+      {
+        (*it)->thread.join();
+        it = mJobs.erase(it);
+      }
+      else
+        ++it;
+    }
+    mJobs.push_back(std::make_unique<Job>());
+    Job* job = mJobs.back().get();
+    job->thread = std::thread([job, work]() {
+      work(job->cancel);
+      job->done = true;
+    });
+  };
+
+  // Doesn't wait for them to stop
+  void CancelAll()
+  {
+    for (auto& job : mJobs)
+      job->cancel = true;
+  };
+
+private:
+  struct Job
+  {
+    std::atomic<bool> cancel = false;
+    std::atomic<bool> done = false;
+    std::thread thread;
+  };
+  // Only the last one can still be running uncancelled.
+  std::vector<std::unique_ptr<Job>> mJobs;
+};
+}; // namespace background
@@ -0,0 +1,378 @@
+#include <algorithm> // std::any_of, std::min, std::max
+#include <cstdlib> // std::getenv, std::atof
+#include <cstring> // memcmp
+#include <fstream>
+
+#include "BlackBox.h"
+
+namespace
+{
+const char kMagic[8] = {'N', 'A', 'M', 'B', 'B', 'O', 'X', '1'};
+constexpr uint32_t kFileVersion = 1;
+// Staging notes kept; older ones are only needed for the state that a dump starts in (see Recorder::Dump()).
+constexpr size_t kMaxStagings = 256;
+
+uint64_t NextPowerOfTwo(const uint64_t n)
+{
+  uint64_t p = 1;
+  while (p < n)
+    p <<= 1;
+  return p;
+}
+
+bool IsModelStaging(const black_box::Staging::Type type)
+{
+  return type == black_box::Staging::Type::Model || type == black_box::Staging::Type::ClearModel;
+}
+
+template <typename T>
+void WriteValue(std::ofstream& file, const T& value)
+{
+  file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool ReadValue(std::ifstream& file, T& value)
+{
+  return (bool)file.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+}; // namespace
+
+void black_box::ApplySetting(engine::Engine& engine, const Setting setting, const double value)
+{
+  switch (setting)
+  {
+    case Setting::InputLevel: engine.SetInputLevel(value); break;
+    case Setting::CalibrateInput: engine.SetCalibrateInput(value != 0.0); break;
+    case Setting::InputCalibrationLevel: engine.SetInputCalibrationLevel(value); break;
+    case Setting::NoiseGateActive: engine.SetNoiseGateActive(value != 0.0); break;
+    case Setting::NoiseGateThreshold: engine.SetNoiseGateThreshold(value); break;
+    case Setting::ToneStackActive: engine.SetToneStackActive(value != 0.0); break;
+    case Setting::Bass: engine.SetBass(value); break;
+    case Setting::Middle: engine.SetMiddle(value); break;
+    case Setting::Treble: engine.SetTreble(value); break;
+    case Setting::IRActive: engine.SetIRActive(value != 0.0); break;
+    case Setting::OutputLevel: engine.SetOutputLevel(value); break;
+    case Setting::OutputMode: engine.SetOutputMode((engine::OutputMode)(int)value); break;
+    case Setting::ResamplerQuality: engine.SetResamplerQuality((ResamplerQuality)(int)value); break;
+    case Setting::IRMaxLength: engine.SetIRMaxLength(value); break;
+    default: break;
+  }
+}
+
+const DSP_SAMPLE* black_box::Recording::GetAudio(const Event& block) const
+{
+  const uint64_t numSamples = (uint64_t)block.a * block.b;
+  if (block.b == 0 || block.audioPosition < audioStart || block.audioPosition + numSamples > audioStart + audio.size())
+    return nullptr;
+  return audio.data() + (block.audioPosition - audioStart);
+}
+
+bool black_box::Recording::Write(const std::filesystem::path& path) const
+{
+  std::ofstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+  file.write(kMagic, sizeof(kMagic));
+  WriteValue(file, kFileVersion);
+  WriteValue(file, (uint32_t)sizeof(DSP_SAMPLE));
+  WriteValue(file, (uint64_t)events.size());
+  WriteValue(file, (uint64_t)stagings.size());
+  WriteValue(file, audioStart);
+  WriteValue(file, (uint64_t)audio.size());
+  file.write(reinterpret_cast<const char*>(events.data()), sizeof(Event) * events.size());
+  for (const Staging& staging : stagings)
+  {
+    const std::string path = staging.path.u8string();
+    WriteValue(file, staging.type);
+    WriteValue(file, staging.accuracy);
+    WriteValue(file, staging.block);
+    WriteValue(file, (uint32_t)path.size());
+    file.write(path.data(), path.size());
+  }
+  file.write(reinterpret_cast<const char*>(audio.data()), sizeof(DSP_SAMPLE) * audio.size());
+  return (bool)file;
+}
+
+std::string black_box::Recording::Read(const std::filesystem::path& path)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return "Can't open " + path.u8string();
+  char magic[sizeof(kMagic)];
+  uint32_t version = 0, sampleSize = 0;
+  uint64_t numEvents = 0, numStagings = 0, numAudio = 0;
+  if (!file.read(magic, sizeof(magic)) || memcmp(magic, kMagic, sizeof(kMagic)) != 0)
+    return path.u8string() + " isn't a black box recording";
+  if (!ReadValue(file, version) || version != kFileVersion)
+    return path.u8string() + ": unsupported version " + std::to_string(version);
+  if (!ReadValue(file, sampleSize) || sampleSize != sizeof(DSP_SAMPLE))
+    return path.u8string() + ": recorded with " + std::to_string(8 * sampleSize) + "-bit samples, but this build uses "
+           + std::to_string(8 * sizeof(DSP_SAMPLE));
+  if (!ReadValue(file, numEvents) || !ReadValue(file, numStagings) || !ReadValue(file, audioStart)
+      || !ReadValue(file, numAudio))
+    return path.u8string() + ": truncated header";
+
+  // Don't trust the counts with an allocation bigger than the file.
+  file.seekg(0, std::ios::end);
+  const uint64_t fileSize = (uint64_t)file.tellg();
+  if (numEvents > fileSize / sizeof(Event) || numAudio > fileSize / sizeof(DSP_SAMPLE) || numStagings > fileSize)
+    return path.u8string() + ": corrupt header";
+  file.seekg(sizeof(kMagic) + 2 * sizeof(uint32_t) + 4 * sizeof(uint64_t));
+
+  events.resize(numEvents);
+  if (!file.read(reinterpret_cast<char*>(events.data()), sizeof(Event) * numEvents))
+    return path.u8string() + ": truncated events";
+  stagings.resize(numStagings);
+  for (Staging& staging : stagings)
+  {
+    uint32_t length = 0;
+    if (!ReadValue(file, staging.type) || !ReadValue(file, staging.accuracy) || !ReadValue(file, staging.block)
+        || !ReadValue(file, length) || length > fileSize)
+      return path.u8string() + ": truncated staging";
+    std::string stagingPath(length, '\0');
+    if (!file.read(&stagingPath[0], length))
+      return path.u8string() + ": truncated staging";
+    staging.path = std::filesystem::u8path(stagingPath);
+  }
+  audio.resize(numAudio);
+  if (!file.read(reinterpret_cast<char*>(audio.data()), sizeof(DSP_SAMPLE) * numAudio))
+    return path.u8string() + ": truncated audio";
+  return "";
+}
+
+black_box::Recorder::Recorder()
+{
+  const char* value = std::getenv("NAM_BLACKBOX");
+  if (value != nullptr)
+    mSeconds = std::min(kMaxSeconds, std::max(0.0, std::atof(value)));
+  mStart = std::chrono::steady_clock::now();
+}
+
+void black_box::Recorder::Reset(const double sampleRate, const int maxBlockSize)
+{
+  if (!IsEnabled() || sampleRate <= 0.0)
+    return;
+  std::lock_guard<std::mutex> lock(mMutex);
+  // Enough blocks for 16-sample buffers, plus keyframes
+  const uint64_t numEvents = (uint64_t)(mSeconds * (sampleRate / 16.0 + 2.0 * (double)Setting::Count));
+  const uint64_t numSamples = (uint64_t)(mSeconds * sampleRate) * kMaxChannels;
+  mEvents.assign(NextPowerOfTwo(std::max<uint64_t>(numEvents, 4 * kEventMargin)), Event());
+  mAudio.assign(NextPowerOfTwo(std::max<uint64_t>(numSamples, 4 * kMaxChannels * (uint64_t)maxBlockSize)), 0);
+  mEventWrite = 0;
+  mAudioWrite = 0;
+  mSampleRate = sampleRate;
+  mMaxBlockSize = maxBlockSize;
+  mResetPending = true;
+}
+
+void black_box::Recorder::BeginBlock(const DSP_SAMPLE* const* inputs, const size_t numChannels, const size_t numFrames)
+{
+  mInBlock = !mEvents.empty();
+  if (!mInBlock)
+    return;
+  mBlock = Event();
+  mBlock.type = Event::Type::Block;
+  mBlock.block = mBlocksStarted.load(std::memory_order_relaxed);
+  // Staging that finishes from here on goes live in the next block (near enough: this one's might still be ahead).
+  mBlocksStarted.store(mBlock.block + 1, std::memory_order_release);
+  mBlock.time = std::chrono::duration<double>(std::chrono::steady_clock::now() - mStart).count();
+
+  mKeyframe = mResetPending || (double)mFramesSinceKeyframe >= kKeyframeInterval * mSampleRate;
+  if (mKeyframe)
+  {
+    mFramesSinceKeyframe = 0;
+    mBlock.keyframe = 1;
+    Event format = mBlock;
+    format.type = Event::Type::Format;
+    format.value = mSampleRate;
+    format.a = (uint32_t)mMaxBlockSize;
+    format.b = mResetPending ? 1 : 0;
+    _WriteEvent(format);
+    mResetPending = false;
+  }
+  mFramesSinceKeyframe += numFrames;
+
+  // A block too big to copy before the dump's margin runs out goes unrecorded; a replay gives it silence.
+  const size_t channels = std::min(numChannels, kMaxChannels);
+  const uint64_t numSamples = (uint64_t)channels * numFrames;
+  mBlock.a = (uint32_t)numFrames;
+  if (numSamples > 0 && numSamples <= mAudio.size() / 4)
+  {
+    const uint64_t mask = mAudio.size() - 1;
+    const uint64_t position = mAudioWrite.load(std::memory_order_relaxed);
+    for (size_t c = 0; c < channels; c++)
+      for (size_t i = 0; i < numFrames; i++)
+        mAudio[(position + c * numFrames + i) & mask] = inputs[c][i];
+    mAudioWrite.store(position + numSamples, std::memory_order_release);
+    mBlock.audioPosition = position;
+    mBlock.b = (uint32_t)channels;
+  }
+}
+
+void black_box::Recorder::RecordSetting(const Setting setting, const double value)
+{
+  if (!mInBlock)
+    return;
+  double& last = mSettings[(size_t)setting];
+  if (!mKeyframe && last == value)
+    return;
+  last = value;
+  Event event = mBlock;
+  event.type = Event::Type::Setting;
+  event.a = (uint32_t)setting;
+  event.b = 0;
+  event.value = value;
+  _WriteEvent(event);
+}
+
+void black_box::Recorder::EndBlock(const double elapsedSeconds)
+{
+  if (!mInBlock)
+    return;
+  mInBlock = false;
+  mBlock.value = elapsedSeconds;
+  _WriteEvent(mBlock);
+  if (elapsedSeconds * mSampleRate > (double)mBlock.a)
+    mDeadlineMissed.store(true, std::memory_order_relaxed);
+}
+
+void black_box::Recorder::NoteStaging(const Staging::Type type, const std::filesystem::path& path,
+                                      const uint32_t accuracy)
+{
+  if (!IsEnabled())
+    return;
+  std::lock_guard<std::mutex> lock(mMutex);
+  Staging staging;
+  staging.type = type;
+  staging.accuracy = accuracy;
+  staging.block = mBlocksStarted.load(std::memory_order_acquire);
+  staging.path = path;
+  mStagings.push_back(staging);
+  if (mStagings.size() <= kMaxStagings)
+    return;
+  // Drop the oldest note that a newer one of the same kind (model or IR) supersedes as a starting state.
+  for (auto it = mStagings.begin(); it != mStagings.end(); ++it)
+  {
+    const bool isModel = IsModelStaging(it->type);
+    if (std::any_of(it + 1, mStagings.end(), [&](const Staging& s) { return IsModelStaging(s.type) == isModel; }))
+    {
+      mStagings.erase(it);
+      return;
+    }
+  }
+}
+
+void black_box::Recorder::_WriteEvent(const Event& event)
+{
+  const uint64_t position = mEventWrite.load(std::memory_order_relaxed);
+  mEvents[position & (mEvents.size() - 1)] = event;
+  mEventWrite.store(position + 1, std::memory_order_release);
+}
+
+template <typename T>
+uint64_t black_box::Recorder::_CopyRing(const std::vector<T>& ring, const std::atomic<uint64_t>& write,
+                                        const uint64_t margin, std::vector<T>& output)
+{
+  const uint64_t capacity = ring.size();
+  const uint64_t end = write.load(std::memory_order_acquire);
+  uint64_t start = end > capacity - margin ? end - (capacity - margin) : 0;
+  output.resize(end - start);
+  for (uint64_t p = start; p < end; p++)
+    output[p - start] = ring[p & (capacity - 1)];
+  // The writer may be filling [after, after + margin), which lands on what was [after - capacity, ...).
+  const uint64_t after = write.load(std::memory_order_acquire);
+  const uint64_t safe = after + margin > capacity ? after + margin - capacity : 0;
+  if (safe > start)
+  {
+    const uint64_t lost = std::min<uint64_t>(safe - start, output.size());
+    output.erase(output.begin(), output.begin() + lost);
+    start += lost;
+  }
+  return start;
+}
+
+std::filesystem::path black_box::Recorder::Dump(std::string& error, const std::filesystem::path& directory)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (mEvents.empty())
+  {
+    error = "The black box isn't recording";
+    return std::filesystem::path();
+  }
+
+  std::vector<Event> events;
+  const uint64_t eventStart = _CopyRing(mEvents, mEventWrite, kEventMargin, events);
+  Recording recording;
+  recording.audioStart = _CopyRing(mAudio, mAudioWrite, mAudio.size() / 4, recording.audio);
+
+  // Start at the first keyframe whose events (and audio) are all there, and stop at the last finished block.
+  size_t first = events.size(), last = 0;
+  for (size_t i = 0; i < events.size(); i++)
+  {
+    const Event& event = events[i];
+    if (event.type != Event::Type::Block)
+      continue;
+    if (first == events.size())
+    {
+      if (!event.keyframe || (event.b > 0 && event.audioPosition < recording.audioStart))
+        continue;
+      // Back to its Format event, which must be preceded by the previous block's events (or nothing at all)
+      size_t begin = i;
+      while (begin > 0 && events[begin - 1].block == event.block)
+        begin--;
+      if (events[begin].type != Event::Type::Format || (begin == 0 && eventStart > 0))
+        continue;
+      first = begin;
+    }
+    last = i + 1;
+  }
+  if (first >= last)
+  {
+    error = "Nothing to dump yet (it needs a keyframe, one every " + std::to_string(kKeyframeInterval) + " s)";
+    return std::filesystem::path();
+  }
+  recording.events.assign(events.begin() + first, events.begin() + last);
+  const uint64_t firstBlock = recording.events.front().block;
+
+  // What was live when it starts, then everything that happens after
+  const Staging* startModel = nullptr;
+  const Staging* startIR = nullptr;
+  for (const Staging& staging : mStagings)
+  {
+    if (staging.block <= firstBlock)
+      (IsModelStaging(staging.type) ? startModel : startIR) = &staging;
+  }
+  for (const Staging* staging : {startModel, startIR})
+  {
+    if (staging != nullptr)
+    {
+      recording.stagings.push_back(*staging);
+      recording.stagings.back().block = firstBlock;
+    }
+  }
+  for (const Staging& staging : mStagings)
+  {
+    if (staging.block > firstBlock)
+      recording.stagings.push_back(staging);
+  }
+
+  std::filesystem::path outputDirectory = directory;
+  if (outputDirectory.empty())
+  {
+    const char* value = std::getenv("NAM_BLACKBOX_DIR");
+    std::error_code ec;
+    outputDirectory = value != nullptr && value[0] != '\0' ? std::filesystem::u8path(value)
+                                                           : std::filesystem::temp_directory_path(ec);
+  }
+  const auto now = std::chrono::system_clock::now().time_since_epoch();
+  const long long seconds = std::chrono::duration_cast<std::chrono::seconds>(now).count();
+  const std::string name = "nam-blackbox-" + std::to_string(seconds) + "-" + std::to_string(mNumDumps++) + ".nambb";
+  const std::filesystem::path path = outputDirectory / name;
+  if (!recording.Write(path))
+  {
+    error = "Couldn't write " + path.u8string();
+    return std::filesystem::path();
+  }
+  return path;
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+// A flight recorder for the audio thread, so that a reported click or spike can be reproduced.
+//
+// While it's on, every block's input, size and processing time go into rings that hold the last few seconds, along
+// with the chain's settings and the models and IRs that were staged. A dump writes what's in the rings to a file, and
+// tools/nam-replay.cpp feeds that file back through the headless engine block for block: the same input, the same
+// block sizes, the same settings changes and model swaps at the same blocks.
+//
+// The audio thread only copies into preallocated rings and never waits. Dumps copy out of the rings while it carries
+// on writing, and keep only what it didn't overwrite in the meantime. Settings are written in full once a second (a
+// keyframe) and whenever they change in between, and a dump starts at its first complete keyframe, so that a replay
+// starts from the state that the chain was really in.
+//
+// Opt-in with NAM_BLACKBOX=<seconds to keep>. Dumps go to NAM_BLACKBOX_DIR, or the temp directory.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Engine.h"
+
+namespace black_box
+{
+// Input channels recorded. The chain mixes its input down to mono, so more than this are rare and get dropped.
+constexpr size_t kMaxChannels = 2;
+// Seconds between keyframes
+constexpr double kKeyframeInterval = 1.0;
+// The longest that NAM_BLACKBOX can ask for
+constexpr double kMaxSeconds = 120.0;
+
+// The engine's settings (see ApplySetting())
+enum class Setting : uint32_t
+{
+  InputLevel = 0,
+  CalibrateInput,
+  InputCalibrationLevel,
+  NoiseGateActive,
+  NoiseGateThreshold,
+  ToneStackActive,
+  Bass,
+  Middle,
+  Treble,
+  IRActive,
+  OutputLevel,
+  OutputMode,
+  // What the deadline monitor gave up (see DeadlineMonitor.h): the ResamplerQuality for models staged from then on,
+  // and the IR's max length in seconds
+  ResamplerQuality,
+  IRMaxLength,
+  Count
+};
+
+void ApplySetting(engine::Engine& engine, const Setting setting, const double value);
+
+// Written by the audio thread
+struct Event
+{
+  enum class Type : uint32_t
+  {
+    // a: frames, b: channels recorded; value: seconds that processing took; audioPosition: its first sample
+    Block = 0,
+    // a: the Setting
+    Setting,
+    // value: sample rate, a: max block size, b: 1 if the engine was reset here (0 if it's a keyframe restating it)
+    Format
+  };
+  Type type = Type::Block;
+  uint32_t a = 0;
+  uint32_t b = 0;
+  // Part of a keyframe
+  uint32_t keyframe = 0;
+  // The block that this is for (the same for a block's format, settings and the block itself)
+  uint64_t block = 0;
+  uint64_t audioPosition = 0;
+  // Seconds since recording started, when the block started
+  double time = 0.0;
+  double value = 0.0;
+};
+
+// Staging, from any thread but the audio one
+struct Staging
+{
+  enum class Type : uint32_t
+  {
+    Model = 0,
+    ClearModel,
+    IR,
+    ClearIR
+  };
+  Type type = Type::Model;
+  // dsp::activations::Accuracy, for models
+  uint32_t accuracy = 0;
+  // Goes live at the start of this block
+  uint64_t block = 0;
+  std::filesystem::path path;
+};
+
+// What's in a dump
+struct Recording
+{
+  std::vector<Event> events;
+  std::vector<Staging> stagings;
+  // Each block's channels one after another, from audioStart on
+  std::vector<DSP_SAMPLE> audio;
+  uint64_t audioStart = 0;
+
+  // The samples for a Block event, or nullptr if they aren't in the recording
+  const DSP_SAMPLE* GetAudio(const Event& block) const;
+
+  bool Write(const std::filesystem::path& path) const;
+  // Returns an empty string on success, or an error message on failure.
+  std::string Read(const std::filesystem::path& path);
+};
+
+class Recorder
+{
+public:
+  // Reads NAM_BLACKBOX.
+  Recorder();
+
+  bool IsEnabled() const { return mSeconds > 0.0; };
+  // Not real-time safe, or safe to call during a block. Sizes the rings for the sample rate.
+  void Reset(const double sampleRate, const int maxBlockSize);
+
+  // Audio thread, around the engine's Process(). `inputs` are what it's about to be given.
+  void BeginBlock(const DSP_SAMPLE* const* inputs, const size_t numChannels, const size_t numFrames);
+  // Between BeginBlock() and EndBlock(). Written if it changed, or for a keyframe.
+  void RecordSetting(const Setting setting, const double value);
+  void EndBlock(const double elapsedSeconds);
+
+  // Any thread but the audio one. Call once the staging is done, so that it goes live at the next block.
+  void NoteStaging(const Staging::Type type, const std::filesystem::path& path = std::filesystem::path(),
+                   const uint32_t accuracy = 0);
+
+  // Whether a block took longer than it lasts since the last call
+  bool ConsumeDeadlineMiss() { return mDeadlineMissed.exchange(false); };
+
+  // Any thread but the audio one. Writes the rings to a new file in `directory` (NAM_BLACKBOX_DIR or the temp
+  // directory if empty) and returns its path, or an empty path and `error`.
+  std::filesystem::path Dump(std::string& error, const std::filesystem::path& directory = std::filesystem::path());
+
+private:
+  static constexpr uint64_t kEventMargin = 64;
+
+  // Copies out everything in a ring that the writer won't have overwritten by the time it's done, i.e. up to `margin`
+  // elements short of a full ring. Returns the position of output[0].
+  template <typename T>
+  static uint64_t _CopyRing(const std::vector<T>& ring, const std::atomic<uint64_t>& write, const uint64_t margin,
+                            std::vector<T>& output);
+  void _WriteEvent(const Event& event);
+
+  double mSeconds = 0.0;
+  // Reset() and Dump() and staging notes
+  std::mutex mMutex;
+
+  // Audio thread
+  std::vector<Event> mEvents;
+  std::atomic<uint64_t> mEventWrite{0};
+  std::vector<DSP_SAMPLE> mAudio;
+  std::atomic<uint64_t> mAudioWrite{0};
+  std::atomic<uint64_t> mBlocksStarted{0};
+  double mSampleRate = 0.0;
+  int mMaxBlockSize = 0;
+  bool mResetPending = false;
+  // BeginBlock() recorded this block
+  bool mInBlock = false;
+  bool mKeyframe = false;
+  uint64_t mFramesSinceKeyframe = 0;
+  Event mBlock;
+  double mSettings[(size_t)Setting::Count] = {};
+  std::chrono::steady_clock::time_point mStart;
+  std::atomic<bool> mDeadlineMissed{false};
+
+  std::vector<Staging> mStagings;
+  uint64_t mNumDumps = 0;
+};
+}; // namespace black_box
@@ -0,0 +1,171 @@
+#pragma once
+
+// Runtime detection of the CPU's SIMD capabilities.
+//
+// architecture.hpp tells us what the compiler was allowed to assume. This tells us what the machine we're actually
+// running on can do, so that one binary built for the baseline ISA can still pick faster kernels when they're
+// available. The tier is decided once, the first time that it's asked for, and never changes afterwards.
+//
+// For testing, the tier can be forced with the environment variable NAM_CPU_TIER (one of "generic", "sse2", "avx2",
+// "avx512", "neon"). Requests for a tier that the machine can't run are ignored.
+
+#include <cstdint>
+#include <cstdlib> // std::getenv
+#include <cstring> // strcmp
+
+#include "architecture.hpp"
+
+#if defined(ARCH_X86)
+  #if defined(_MSC_VER)
+    #include <intrin.h>
+  #else
+    #include <cpuid.h>
+  #endif
+#elif defined(ARCH_ARM64) && defined(__linux__)
+  #include <sys/auxv.h>
+  #include <asm/hwcap.h>
+#endif
+
+namespace cpu_features
+{
+// Ordered from least to most capable within each family.
+enum class Tier
+{
+  Generic = 0,
+  SSE2,
+  AVX2, // Includes FMA
+  AVX512, // AVX-512F
+  NEON, // AArch64 Advanced SIMD
+};
+
+inline const char* GetTierName(const Tier tier)
+{
+  switch (tier)
+  {
+    case Tier::SSE2: return "SSE2";
+    case Tier::AVX2: return "AVX2";
+    case Tier::AVX512: return "AVX-512";
+    case Tier::NEON: return "NEON";
+    case Tier::Generic:
+    default: return "Generic";
+  }
+}
+
+namespace detail
+{
+#if defined(ARCH_X86)
+inline void CPUID(const uint32_t leaf, const uint32_t subleaf, uint32_t regs[4])
+{
+  #if defined(_MSC_VER)
+  int r[4];
+  __cpuidex(r, (int)leaf, (int)subleaf);
+  for (int i = 0; i < 4; i++)
+    regs[i] = (uint32_t)r[i];
+  #else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+  #endif
+}
+
+// Which register states the OS saves on a context switch
+inline uint64_t XGETBV()
+{
+  #if defined(_MSC_VER)
+  return _xgetbv(0);
+  #else
+  uint32_t eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((uint64_t)edx << 32) | eax;
+  #endif
+}
+#endif
+
+inline bool IsSupported(const Tier tier)
+{
+  if (tier == Tier::Generic)
+    return true;
+#if defined(ARCH_X86)
+  uint32_t regs[4] = {0, 0, 0, 0}; // eax, ebx, ecx, edx
+  CPUID(0, 0, regs);
+  const uint32_t maxLeaf = regs[0];
+  if (maxLeaf < 1)
+    return false;
+  CPUID(1, 0, regs);
+  const bool sse2 = (regs[3] & (1u << 26)) != 0;
+  const bool osxsave = (regs[2] & (1u << 27)) != 0;
+  const bool avx = (regs[2] & (1u << 28)) != 0;
+  const bool fma = (regs[2] & (1u << 12)) != 0;
+  if (tier == Tier::SSE2)
+    return sse2;
+  if (tier != Tier::AVX2 && tier != Tier::AVX512)
+    return false;
+  // The CPU having the instructions isn't enough; the OS has to be saving the wide registers too.
+  if (!(osxsave && avx && fma) || maxLeaf < 7)
+    return false;
+  const uint64_t xcr0 = XGETBV();
+  const bool osSavesYMM = (xcr0 & 0x6) == 0x6;
+  const bool osSavesZMM = (xcr0 & 0xe6) == 0xe6;
+  CPUID(7, 0, regs);
+  const bool avx2 = (regs[1] & (1u << 5)) != 0;
+  const bool avx512f = (regs[1] & (1u << 16)) != 0;
+  if (tier == Tier::AVX2)
+    return osSavesYMM && avx2;
+  return osSavesZMM && avx2 && avx512f;
+#elif defined(ARCH_ARM64)
+  if (tier != Tier::NEON)
+    return false;
+  #if defined(__linux__)
+  return (getauxval(AT_HWCAP) & HWCAP_ASIMD) != 0;
+  #else
+  // Advanced SIMD is mandatory on AArch64 (macOS, iOS, Windows)
+  return true;
+  #endif
+#else
+  return false;
+#endif
+}
+
+inline Tier DetectBestTier()
+{
+  const Tier candidates[] = {Tier::AVX512, Tier::AVX2, Tier::SSE2, Tier::NEON};
+  for (const Tier t : candidates)
+    if (IsSupported(t))
+      return t;
+  return Tier::Generic;
+}
+
+inline bool ParseTier(const char* str, Tier& tier)
+{
+  const struct
+  {
+    const char* name;
+    Tier tier;
+  } names[] = {{"generic", Tier::Generic}, {"sse2", Tier::SSE2}, {"avx2", Tier::AVX2},
+               {"avx512", Tier::AVX512}, {"neon", Tier::NEON}};
+  for (const auto& n : names)
+  {
+    if (strcmp(str, n.name) == 0)
+    {
+      tier = n.tier;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline Tier ChooseTier()
+{
+  const char* forced = std::getenv("NAM_CPU_TIER");
+  Tier tier = Tier::Generic;
+  if (forced != nullptr && ParseTier(forced, tier) && IsSupported(tier))
+    return tier;
+  return DetectBestTier();
+}
+}; // namespace detail
+
+// The tier that the kernels were chosen for. Decided on the first call.
+inline Tier GetActiveTier()
+{
+  static const Tier tier = detail::ChooseTier();
+  return tier;
+}
+}; // namespace cpu_features
@@ -0,0 +1,449 @@
+#pragma once
+
+// Hot loops owned by the plugin, compiled once per CPU tier and picked at runtime.
+//
+// Each tier's kernels are compiled with that tier's instruction set enabled via function attributes (GCC/Clang) or
+// simply by using the intrinsics (MSVC), so the rest of the plugin can still be built for the baseline ISA. The table
+// is chosen once (see cpu_features::GetActiveTier()) and the audio thread only ever does an indirect call through it.
+//
+// That covers the engine's own loops (input mixdown, output gain, silence detection) and the IR's convolution. The
+// models' math belongs to NAM core (Eigen, plus the activations in Activations.h) and the resamplers to AudioDSPTools;
+// neither goes through this table.
+
+#include <algorithm> // std::clamp, std::max
+#include <cmath> // std::fabs
+#include <cstddef>
+
+#include "AudioDSPTools/dsp/dsp.h"
+#include "CPUFeatures.h"
+
+#if defined(ARCH_X86)
+  #include <immintrin.h>
+#elif defined(ARCH_ARM64)
+  #include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+  #define NAM_TARGET(x)
+#else
+  #define NAM_TARGET(x) __attribute__((target(x)))
+#endif
+
+namespace dsp
+{
+namespace kernels
+{
+struct KernelTable
+{
+  // output[s] = gain * sum_c inputs[c][s]
+  void (*mixdown)(const DSP_SAMPLE* const* inputs, const size_t numChannels, const size_t numFrames, const double gain,
+                  DSP_SAMPLE* output);
+  // output[s] = gain * input[s]
+  void (*gain)(const DSP_SAMPLE* input, const size_t numFrames, const double gain, DSP_SAMPLE* output);
+  // output[s] = clamp(gain * input[s], lo, hi)
+  void (*gainClamped)(const DSP_SAMPLE* input, const size_t numFrames, const double gain, const double lo,
+                      const double hi, DSP_SAMPLE* output);
+  // max_s |input[s]|
+  double (*peak)(const DSP_SAMPLE* input, const size_t numFrames);
+  // sum_i a[i] * b[i], for the IR's convolution (see ir_blend::Convolver)
+  float (*dot)(const float* a, const float* b, const size_t n);
+  cpu_features::Tier tier;
+};
+
+namespace generic
+{
+inline void Mixdown(const DSP_SAMPLE* const* inputs, const size_t numChannels, const size_t numFrames,
+                    const double gain, DSP_SAMPLE* output)
+{
+  for (size_t s = 0; s < numFrames; s++)
+    output[s] = numChannels > 0 ? gain * inputs[0][s] : 0.0;
+  for (size_t c = 1; c < numChannels; c++)
+    for (size_t s = 0; s < numFrames; s++)
+      output[s] += gain * inputs[c][s];
+}
+
+inline void Gain(const DSP_SAMPLE* input, const size_t numFrames, const double gain, DSP_SAMPLE* output)
+{
+  for (size_t s = 0; s < numFrames; s++)
+    output[s] = gain * input[s];
+}
+
+inline void GainClamped(const DSP_SAMPLE* input, const size_t numFrames, const double gain, const double lo,
+                        const double hi, DSP_SAMPLE* output)
+{
+  for (size_t s = 0; s < numFrames; s++)
+    output[s] = std::clamp<DSP_SAMPLE>(gain * input[s], lo, hi);
+}
+
+inline double Peak(const DSP_SAMPLE* input, const size_t numFrames)
+{
+  double peak = 0.0;
+  for (size_t s = 0; s < numFrames; s++)
+    peak = std::max(peak, (double)std::fabs(input[s]));
+  return peak;
+}
+
+inline float Dot(const float* a, const float* b, const size_t n)
+{
+  float sum = 0.0f;
+  for (size_t i = 0; i < n; i++)
+    sum += a[i] * b[i];
+  return sum;
+}
+}; // namespace generic
+
+// Vectorized kernels are written for double-precision samples, which is what the plugin uses.
+#ifndef DSP_SAMPLE_FLOAT
+
+  #if defined(ARCH_X86)
+namespace sse2
+{
+NAM_TARGET("sse2")
+inline void Mixdown(const double* const* inputs, const size_t numChannels, const size_t numFrames, const double gain,
+                    double* output)
+{
+  const __m128d g = _mm_set1_pd(gain);
+  size_t s = 0;
+  for (; s + 2 <= numFrames; s += 2)
+  {
+    __m128d acc = _mm_setzero_pd();
+    for (size_t c = 0; c < numChannels; c++)
+      acc = _mm_add_pd(acc, _mm_loadu_pd(inputs[c] + s));
+    _mm_storeu_pd(output + s, _mm_mul_pd(g, acc));
+  }
+  for (; s < numFrames; s++)
+  {
+    double acc = 0.0;
+    for (size_t c = 0; c < numChannels; c++)
+      acc += inputs[c][s];
+    output[s] = gain * acc;
+  }
+}
+
+NAM_TARGET("sse2")
+inline void Gain(const double* input, const size_t numFrames, const double gain, double* output)
+{
+  const __m128d g = _mm_set1_pd(gain);
+  size_t s = 0;
+  for (; s + 2 <= numFrames; s += 2)
+    _mm_storeu_pd(output + s, _mm_mul_pd(g, _mm_loadu_pd(input + s)));
+  for (; s < numFrames; s++)
+    output[s] = gain * input[s];
+}
+
+NAM_TARGET("sse2")
+inline void GainClamped(const double* input, const size_t numFrames, const double gain, const double lo,
+                        const double hi, double* output)
+{
+  const __m128d g = _mm_set1_pd(gain), vlo = _mm_set1_pd(lo), vhi = _mm_set1_pd(hi);
+  size_t s = 0;
+  for (; s + 2 <= numFrames; s += 2)
+    _mm_storeu_pd(output + s, _mm_min_pd(vhi, _mm_max_pd(vlo, _mm_mul_pd(g, _mm_loadu_pd(input + s)))));
+  for (; s < numFrames; s++)
+    output[s] = std::clamp(gain * input[s], lo, hi);
+}
+
+NAM_TARGET("sse2")
+inline double Peak(const double* input, const size_t numFrames)
+{
+  const __m128d signBit = _mm_set1_pd(-0.0);
+  __m128d peak = _mm_setzero_pd();
+  size_t s = 0;
+  for (; s + 2 <= numFrames; s += 2)
+    peak = _mm_max_pd(peak, _mm_andnot_pd(signBit, _mm_loadu_pd(input + s)));
+  double lanes[2];
+  _mm_storeu_pd(lanes, peak);
+  double result = std::max(lanes[0], lanes[1]);
+  for (; s < numFrames; s++)
+    result = std::max(result, std::fabs(input[s]));
+  return result;
+}
+
+NAM_TARGET("sse2")
+inline float Dot(const float* a, const float* b, const size_t n)
+{
+  __m128 acc = _mm_setzero_ps();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+  float lanes[4];
+  _mm_storeu_ps(lanes, acc);
+  float sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  for (; i < n; i++)
+    sum += a[i] * b[i];
+  return sum;
+}
+}; // namespace sse2
+
+namespace avx2
+{
+NAM_TARGET("avx2,fma")
+inline void Mixdown(const double* const* inputs, const size_t numChannels, const size_t numFrames, const double gain,
+                    double* output)
+{
+  const __m256d g = _mm256_set1_pd(gain);
+  size_t s = 0;
+  for (; s + 4 <= numFrames; s += 4)
+  {
+    __m256d acc = _mm256_setzero_pd();
+    for (size_t c = 0; c < numChannels; c++)
+      acc = _mm256_fmadd_pd(g, _mm256_loadu_pd(inputs[c] + s), acc);
+    _mm256_storeu_pd(output + s, acc);
+  }
+  for (; s < numFrames; s++)
+  {
+    double acc = 0.0;
+    for (size_t c = 0; c < numChannels; c++)
+      acc += gain * inputs[c][s];
+    output[s] = acc;
+  }
+}
+
+NAM_TARGET("avx2,fma")
+inline void Gain(const double* input, const size_t numFrames, const double gain, double* output)
+{
+  const __m256d g = _mm256_set1_pd(gain);
+  size_t s = 0;
+  for (; s + 4 <= numFrames; s += 4)
+    _mm256_storeu_pd(output + s, _mm256_mul_pd(g, _mm256_loadu_pd(input + s)));
+  for (; s < numFrames; s++)
+    output[s] = gain * input[s];
+}
+
+NAM_TARGET("avx2,fma")
+inline void GainClamped(const double* input, const size_t numFrames, const double gain, const double lo,
+                        const double hi, double* output)
+{
+  const __m256d g = _mm256_set1_pd(gain), vlo = _mm256_set1_pd(lo), vhi = _mm256_set1_pd(hi);
+  size_t s = 0;
+  for (; s + 4 <= numFrames; s += 4)
+    _mm256_storeu_pd(
+      output + s, _mm256_min_pd(vhi, _mm256_max_pd(vlo, _mm256_mul_pd(g, _mm256_loadu_pd(input + s)))));
+  for (; s < numFrames; s++)
+    output[s] = std::clamp(gain * input[s], lo, hi);
+}
+
+NAM_TARGET("avx2,fma")
+inline double Peak(const double* input, const size_t numFrames)
+{
+  const __m256d signBit = _mm256_set1_pd(-0.0);
+  __m256d peak = _mm256_setzero_pd();
+  size_t s = 0;
+  for (; s + 4 <= numFrames; s += 4)
+    peak = _mm256_max_pd(peak, _mm256_andnot_pd(signBit, _mm256_loadu_pd(input + s)));
+  double lanes[4];
+  _mm256_storeu_pd(lanes, peak);
+  double result = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+  for (; s < numFrames; s++)
+    result = std::max(result, std::fabs(input[s]));
+  return result;
+}
+
+NAM_TARGET("avx2,fma")
+inline float Dot(const float* a, const float* b, const size_t n)
+{
+  // Two accumulators, to keep two FMAs in flight
+  __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+  {
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+  }
+  for (; i + 8 <= n; i += 8)
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+  const __m256 acc = _mm256_add_ps(acc0, acc1);
+  __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+  half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+  half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+  float sum = _mm_cvtss_f32(half);
+  for (; i < n; i++)
+    sum += a[i] * b[i];
+  return sum;
+}
+}; // namespace avx2
+
+namespace avx512
+{
+NAM_TARGET("avx512f")
+inline void Mixdown(const double* const* inputs, const size_t numChannels, const size_t numFrames, const double gain,
+                    double* output)
+{
+  const __m512d g = _mm512_set1_pd(gain);
+  size_t s = 0;
+  for (; s + 8 <= numFrames; s += 8)
+  {
+    __m512d acc = _mm512_setzero_pd();
+    for (size_t c = 0; c < numChannels; c++)
+      acc = _mm512_fmadd_pd(g, _mm512_loadu_pd(inputs[c] + s), acc);
+    _mm512_storeu_pd(output + s, acc);
+  }
+  for (; s < numFrames; s++)
+  {
+    double acc = 0.0;
+    for (size_t c = 0; c < numChannels; c++)
+      acc += gain * inputs[c][s];
+    output[s] = acc;
+  }
+}
+
+NAM_TARGET("avx512f")
+inline void Gain(const double* input, const size_t numFrames, const double gain, double* output)
+{
+  const __m512d g = _mm512_set1_pd(gain);
+  size_t s = 0;
+  for (; s + 8 <= numFrames; s += 8)
+    _mm512_storeu_pd(output + s, _mm512_mul_pd(g, _mm512_loadu_pd(input + s)));
+  for (; s < numFrames; s++)
+    output[s] = gain * input[s];
+}
+
+NAM_TARGET("avx512f")
+inline void GainClamped(const double* input, const size_t numFrames, const double gain, const double lo,
+                        const double hi, double* output)
+{
+  const __m512d g = _mm512_set1_pd(gain), vlo = _mm512_set1_pd(lo), vhi = _mm512_set1_pd(hi);
+  size_t s = 0;
+  for (; s + 8 <= numFrames; s += 8)
+    _mm512_storeu_pd(
+      output + s, _mm512_min_pd(vhi, _mm512_max_pd(vlo, _mm512_mul_pd(g, _mm512_loadu_pd(input + s)))));
+  for (; s < numFrames; s++)
+    output[s] = std::clamp(gain * input[s], lo, hi);
+}
+
+NAM_TARGET("avx512f")
+inline double Peak(const double* input, const size_t numFrames)
+{
+  const __m512i magnitudeBits = _mm512_set1_epi64(0x7FFFFFFFFFFFFFFFll);
+  __m512d peak = _mm512_setzero_pd();
+  size_t s = 0;
+  for (; s + 8 <= numFrames; s += 8)
+  {
+    const __m512i bits = _mm512_castpd_si512(_mm512_loadu_pd(input + s));
+    peak = _mm512_max_pd(peak, _mm512_castsi512_pd(_mm512_and_si512(bits, magnitudeBits)));
+  }
+  double lanes[8];
+  _mm512_storeu_pd(lanes, peak);
+  double result = 0.0;
+  for (const double lane : lanes)
+    result = std::max(result, lane);
+  for (; s < numFrames; s++)
+    result = std::max(result, std::fabs(input[s]));
+  return result;
+}
+
+NAM_TARGET("avx512f")
+inline float Dot(const float* a, const float* b, const size_t n)
+{
+  __m512 acc = _mm512_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+    acc = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc);
+  float sum = _mm512_reduce_add_ps(acc);
+  for (; i < n; i++)
+    sum += a[i] * b[i];
+  return sum;
+}
+}; // namespace avx512
+  #elif defined(ARCH_ARM64)
+namespace neon
+{
+inline void Mixdown(const double* const* inputs, const size_t numChannels, const size_t numFrames, const double gain,
+                    double* output)
+{
+  const float64x2_t g = vdupq_n_f64(gain);
+  size_t s = 0;
+  for (; s + 2 <= numFrames; s += 2)
+  {
+    float64x2_t acc = vdupq_n_f64(0.0);
+    for (size_t c = 0; c < numChannels; c++)
+      acc = vfmaq_f64(acc, g, vld1q_f64(inputs[c] + s));
+    vst1q_f64(output + s, acc);
+  }
+  for (; s < numFrames; s++)
+  {
+    double acc = 0.0;
+    for (size_t c = 0; c < numChannels; c++)
+      acc += gain * inputs[c][s];
+    output[s] = acc;
+  }
+}
+
+inline void Gain(const double* input, const size_t numFrames, const double gain, double* output)
+{
+  const float64x2_t g = vdupq_n_f64(gain);
+  size_t s = 0;
+  for (; s + 2 <= numFrames; s += 2)
+    vst1q_f64(output + s, vmulq_f64(g, vld1q_f64(input + s)));
+  for (; s < numFrames; s++)
+    output[s] = gain * input[s];
+}
+
+inline void GainClamped(const double* input, const size_t numFrames, const double gain, const double lo,
+                        const double hi, double* output)
+{
+  const float64x2_t g = vdupq_n_f64(gain), vlo = vdupq_n_f64(lo), vhi = vdupq_n_f64(hi);
+  size_t s = 0;
+  for (; s + 2 <= numFrames; s += 2)
+    vst1q_f64(output + s, vminq_f64(vhi, vmaxq_f64(vlo, vmulq_f64(g, vld1q_f64(input + s)))));
+  for (; s < numFrames; s++)
+    output[s] = std::clamp(gain * input[s], lo, hi);
+}
+
+inline double Peak(const double* input, const size_t numFrames)
+{
+  float64x2_t peak = vdupq_n_f64(0.0);
+  size_t s = 0;
+  for (; s + 2 <= numFrames; s += 2)
+    peak = vmaxq_f64(peak, vabsq_f64(vld1q_f64(input + s)));
+  double result = vmaxvq_f64(peak);
+  for (; s < numFrames; s++)
+    result = std::max(result, std::fabs(input[s]));
+  return result;
+}
+
+inline float Dot(const float* a, const float* b, const size_t n)
+{
+  float32x4_t acc = vdupq_n_f32(0.0f);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+    acc = vfmaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+  float sum = vaddvq_f32(acc);
+  for (; i < n; i++)
+    sum += a[i] * b[i];
+  return sum;
+}
+}; // namespace neon
+  #endif
+
+#endif // DSP_SAMPLE_FLOAT
+
+inline KernelTable MakeKernelTable(const cpu_features::Tier tier)
+{
+  using cpu_features::Tier;
+#ifndef DSP_SAMPLE_FLOAT
+  #if defined(ARCH_X86)
+  switch (tier)
+  {
+    case Tier::AVX512: return {avx512::Mixdown, avx512::Gain, avx512::GainClamped, avx512::Peak, avx512::Dot, tier};
+    case Tier::AVX2: return {avx2::Mixdown, avx2::Gain, avx2::GainClamped, avx2::Peak, avx2::Dot, tier};
+    case Tier::SSE2: return {sse2::Mixdown, sse2::Gain, sse2::GainClamped, sse2::Peak, sse2::Dot, tier};
+    default: break;
+  }
+  #elif defined(ARCH_ARM64)
+  if (tier == Tier::NEON)
+    return {neon::Mixdown, neon::Gain, neon::GainClamped, neon::Peak, neon::Dot, tier};
+  #endif
+#endif
+  return {generic::Mixdown, generic::Gain, generic::GainClamped, generic::Peak, generic::Dot, Tier::Generic};
+}
+
+// The kernels for the active CPU tier. Chosen on the first call; call it once at load so that the audio thread never
+// pays for the detection.
+inline const KernelTable& GetKernels()
+{
+  static const KernelTable table = MakeKernelTable(cpu_features::GetActiveTier());
+  return table;
+}
+}; // namespace kernels
+}; // namespace dsp
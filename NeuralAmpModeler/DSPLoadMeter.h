@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm> // std::max
+#include <atomic>
+#include <chrono>
+
+// Measures how much of the buffer's deadline a piece of processing uses.
+//
+// Written from one (realtime) thread with Begin()/End(); read from any other thread. A load of 1.0 means the work took
+// exactly as long as the audio it produced lasts, i.e. no headroom at all.
+class DSPLoadMeter
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  void Begin() { mStart = Clock::now(); };
+
+  // :param numFrames: Samples produced by the work since Begin()
+  // :param sampleRate: ...at this sample rate.
+  void End(const int numFrames, const double sampleRate)
+  {
+    const double elapsed = std::chrono::duration<double>(Clock::now() - mStart).count();
+    Add(elapsed, numFrames, sampleRate);
+  };
+
+  // For when the elapsed time was measured elsewhere
+  void Add(const double elapsedSeconds, const int numFrames, const double sampleRate)
+  {
+    if (numFrames <= 0 || sampleRate <= 0.0)
+      return;
+    const double deadline = (double)numFrames / sampleRate;
+    const double load = elapsedSeconds / deadline;
+    // About a second's worth of smoothing at typical buffer sizes
+    const double alpha = 0.01;
+    const double previous = mAverage.load(std::memory_order_relaxed);
+    mAverage.store(previous + alpha * (load - previous), std::memory_order_relaxed);
+    mMax.store(std::max(mMax.load(std::memory_order_relaxed), load), std::memory_order_relaxed);
+    const double previousElapsed = mAverageElapsed.load(std::memory_order_relaxed);
+    mAverageElapsed.store(previousElapsed + alpha * (elapsedSeconds - previousElapsed), std::memory_order_relaxed);
+    mMaxElapsed.store(std::max(mMaxElapsed.load(std::memory_order_relaxed), elapsedSeconds), std::memory_order_relaxed);
+    mLastElapsed.store(elapsedSeconds, std::memory_order_relaxed);
+  };
+
+  double GetAverageLoad() const { return mAverage.load(std::memory_order_relaxed); };
+  double GetMaxLoad() const { return mMax.load(std::memory_order_relaxed); };
+  double GetLastElapsed() const { return mLastElapsed.load(std::memory_order_relaxed); };
+  // Seconds per Begin()/End(), however many frames
+  double GetAverageElapsed() const { return mAverageElapsed.load(std::memory_order_relaxed); };
+  double GetMaxElapsed() const { return mMaxElapsed.load(std::memory_order_relaxed); };
+  // Start a new window for the maxes
+  void ResetMax()
+  {
+    mMax.store(0.0, std::memory_order_relaxed);
+    mMaxElapsed.store(0.0, std::memory_order_relaxed);
+  };
+
+private:
+  Clock::time_point mStart;
+  std::atomic<double> mAverage = 0.0;
+  std::atomic<double> mMax = 0.0;
+  std::atomic<double> mLastElapsed = 0.0;
+  std::atomic<double> mAverageElapsed = 0.0;
+  std::atomic<double> mMaxElapsed = 0.0;
+};
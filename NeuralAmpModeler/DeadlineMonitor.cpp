@@ -0,0 +1,156 @@
+#include <cctype> // std::isalnum, std::tolower
+#include <cstdlib> // std::getenv, std::atof
+#include <set>
+#include <stdexcept>
+#include <string>
+
+#include "DeadlineMonitor.h"
+#include "ModelProfile.h"
+#include "NamFile.h"
+
+namespace
+{
+double Seconds(const deadline::Monitor::Clock::duration duration)
+{
+  return std::chrono::duration<double>(duration).count();
+}
+
+// The file name without its size names, lowercased: "Plexi Lite.nam" and "plexi_standard.nam" are both "plexi".
+std::string GetCaptureName(const std::filesystem::path& path)
+{
+  static const std::set<std::string> kSizeNames = {"standard", "std",  "xstd",   "lite",    "light",
+                                                   "feather",  "nano", "complex", "compact", "mini"};
+  const std::string stem = path.stem().u8string();
+  std::string name, word;
+  auto endWord = [&]() {
+    if (!word.empty() && kSizeNames.count(word) == 0)
+      name += (name.empty() ? "" : " ") + word;
+    word.clear();
+  };
+  for (const char c : stem)
+  {
+    if (std::isalnum((unsigned char)c))
+      word += (char)std::tolower((unsigned char)c);
+    else
+      endWord();
+  }
+  endWord();
+  return name;
+}
+
+// Multiply-accumulates per second of audio, or 0 if it can't be read or worked out
+double GetMacsPerSecond(const std::filesystem::path& path)
+{
+  try
+  {
+    nam::dspData data;
+    size_t numWeights = 0;
+    if (!nam_file::ReadConfig(path, data, numWeights))
+      return 0.0;
+    const double modelRate = data.expected_sample_rate > 0.0 ? data.expected_sample_rate : 48000.0;
+    return model_profile::ProfileConfig(data).macsPerSample * modelRate;
+  }
+  catch (const std::exception&)
+  {
+    return 0.0;
+  }
+}
+}; // namespace
+
+const char* deadline::GetDegradationName(const Degradation degradation)
+{
+  switch (degradation)
+  {
+    case Degradation::DraftResampling: return "draft resampling";
+    case Degradation::TrimmedIR: return "trimmed IR";
+    case Degradation::LighterModel: return "lighter model";
+    case Degradation::None:
+    default: return "none";
+  }
+}
+
+deadline::Monitor::Monitor()
+{
+  const char* enabled = std::getenv("NAM_DEGRADE");
+  mEnabled = enabled == nullptr || !(enabled[0] == '0' && enabled[1] == '\0');
+  const char* headroom = std::getenv("NAM_DEGRADE_HEADROOM");
+  if (headroom != nullptr)
+    mHeadroom = std::max(0.0, std::min(0.9, 0.01 * std::atof(headroom)));
+  mLastEvaluation = Clock::now();
+  // As if the last change were long ago
+  mLastChange = mLastRecovery = mLastEvaluation - std::chrono::hours(1);
+}
+
+deadline::Monitor::Action deadline::Monitor::Evaluate(const Clock::time_point now, const bool canDegrade,
+                                                      const bool canRecover)
+{
+  if (Seconds(now - mLastEvaluation) < kEvaluationInterval)
+    return Action::None;
+  mLastEvaluation = now;
+  const uint64_t blocks = mBlocks.exchange(0, std::memory_order_relaxed);
+  const uint64_t blocksOverHeadroom = mBlocksOverHeadroom.exchange(0, std::memory_order_relaxed);
+  const uint64_t overruns = mIntervalOverruns.exchange(0, std::memory_order_relaxed);
+  const uint64_t loadSum = mLoadSum.exchange(0, std::memory_order_relaxed);
+  // No audio that went through the chain (or no monitor), nothing to go on
+  if (!mEnabled || blocks == 0)
+  {
+    mRelaxed = false;
+    return Action::None;
+  }
+
+  const double averageLoad = (double)loadSum / kLoadScale / (double)blocks;
+  if (overruns >= kOverrunsToDegrade || 2 * blocksOverHeadroom > blocks)
+  {
+    mRelaxed = false;
+    if (!canDegrade || Seconds(now - mLastChange) < kSettleTime)
+      return Action::None;
+    // The last step back was one too many.
+    if (Seconds(now - mLastRecovery) < kRelapseTime)
+      mRecoveryHold = std::min(kMaxRecoveryHold, 2.0 * mRecoveryHold);
+    mLastChange = now;
+    return Action::Degrade;
+  }
+
+  if (overruns > 0 || averageLoad > kRecoveryLoad * (1.0 - mHeadroom))
+  {
+    mRelaxed = false;
+    return Action::None;
+  }
+  if (!mRelaxed)
+  {
+    mRelaxed = true;
+    mRelaxedSince = now;
+  }
+  if (!canRecover || Seconds(now - mRelaxedSince) < mRecoveryHold || Seconds(now - mLastChange) < kSettleTime)
+    return Action::None;
+  // Held for long enough since the last relapse that it isn't one
+  if (Seconds(now - mLastChange) > kRelapseTime + mRecoveryHold)
+    mRecoveryHold = kRecoveryHold;
+  mLastChange = mLastRecovery = mRelaxedSince = now;
+  return Action::Recover;
+}
+
+std::filesystem::path deadline::FindLighterSibling(const std::filesystem::path& modelPath)
+{
+  const std::string captureName = GetCaptureName(modelPath);
+  const double macsPerSecond = GetMacsPerSecond(modelPath);
+  if (captureName.empty() || macsPerSecond <= 0.0)
+    return std::filesystem::path();
+
+  std::filesystem::path lighter;
+  double lighterMacsPerSecond = 0.0;
+  std::error_code ec;
+  for (const auto& entry : std::filesystem::directory_iterator(modelPath.parent_path(), ec))
+  {
+    const std::filesystem::path& path = entry.path();
+    if (path.extension() != ".nam" || path.filename() == modelPath.filename() || GetCaptureName(path) != captureName)
+      continue;
+    const double candidate = GetMacsPerSecond(path);
+    if (candidate > 0.0 && candidate < macsPerSecond && candidate > lighterMacsPerSecond)
+    {
+      lighter = path;
+      lighterMacsPerSecond = candidate;
+    }
+  }
+  return lighter;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+// Watches ProcessBlock() against its deadline and trades quality for time when there isn't enough of it.
+//
+// The audio thread reports how long each block took (AddBlock()). Twice a second, the idle timer asks whether to give
+// up a step of quality or take one back (Evaluate()), and makes the change itself, off the audio thread. The steps, in
+// the order that they're given up:
+//
+// 1. Draft resampling, for a model that isn't at the host's sample rate (see ResamplerQuality)
+// 2. A trimmed IR (see ir_blend::Trim())
+// 3. A lighter capture of the same rig from the model's folder, e.g. "Lite" or "Feather" next to "Standard" (see
+//    FindLighterSibling())
+//
+// Steps that don't apply (no resampling, no IR, no lighter capture) are skipped. The activations aren't one of the
+// steps: live playing already uses the fastest ones (see Activations.h).
+//
+// A step is given up when blocks overrun their deadline, or when most of them leave less than the headroom. One is
+// taken back after the load has stayed well under the headroom for a while (kRecoveryHold), and that while doubles
+// each time a recovery is followed by another overrun soon after, so that a chain that's just too heavy doesn't flip
+// back and forth.
+//
+// On by default. NAM_DEGRADE=0 turns it off, and NAM_DEGRADE_HEADROOM=<percent of the deadline> sets the headroom (20).
+
+#include <algorithm> // std::max, std::min
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+
+namespace deadline
+{
+enum class Degradation
+{
+  None = 0,
+  DraftResampling,
+  TrimmedIR,
+  LighterModel,
+  Count
+};
+
+const char* GetDegradationName(const Degradation degradation);
+
+// What the IR is trimmed to
+constexpr double kTrimmedIRLength = 0.02;
+// How often Evaluate() looks at the blocks since the last time
+constexpr double kEvaluationInterval = 0.5;
+// Overruns in one evaluation that give up a step whatever the headroom
+constexpr uint64_t kOverrunsToDegrade = 2;
+// Time for a change to show in the load before the next one
+constexpr double kSettleTime = 2.0;
+// Time well under the headroom before taking a step back, at first and at most
+constexpr double kRecoveryHold = 10.0;
+constexpr double kMaxRecoveryHold = 160.0;
+// "Well under": this fraction of the load that the headroom allows
+constexpr double kRecoveryLoad = 0.75;
+// An overrun this soon after a recovery doubles the hold
+constexpr double kRelapseTime = 30.0;
+
+class Monitor
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  enum class Action
+  {
+    None = 0,
+    Degrade,
+    Recover
+  };
+
+  // Reads NAM_DEGRADE and NAM_DEGRADE_HEADROOM.
+  Monitor();
+
+  bool IsEnabled() const { return mEnabled; };
+  // Fraction of the deadline to keep free
+  double GetHeadroom() const { return mHeadroom; };
+
+  // Audio thread, after every block
+  void AddBlock(const double elapsedSeconds, const int numFrames, const double sampleRate)
+  {
+    if (numFrames <= 0 || sampleRate <= 0.0)
+      return;
+    const double load = elapsedSeconds * sampleRate / (double)numFrames;
+    mBlocks.fetch_add(1, std::memory_order_relaxed);
+    mLoadSum.fetch_add((uint64_t)(std::min(load, 100.0) * kLoadScale), std::memory_order_relaxed);
+    if (load > 1.0 - mHeadroom)
+      mBlocksOverHeadroom.fetch_add(1, std::memory_order_relaxed);
+    if (load > 1.0)
+    {
+      mIntervalOverruns.fetch_add(1, std::memory_order_relaxed);
+      mOverruns.fetch_add(1, std::memory_order_relaxed);
+    }
+  };
+
+  // Any one other thread. Returns what to do, if anything; the caller is expected to do it. `canDegrade` and
+  // `canRecover` say whether there's a step left to give up or to take back.
+  Action Evaluate(const Clock::time_point now, const bool canDegrade, const bool canRecover);
+
+  // Blocks that overran their deadline since the monitor was made
+  uint64_t GetOverruns() const { return mOverruns.load(std::memory_order_relaxed); };
+
+private:
+  static constexpr double kLoadScale = 1.0e6;
+
+  bool mEnabled = true;
+  double mHeadroom = 0.2;
+
+  // Audio thread, since the last evaluation
+  std::atomic<uint64_t> mBlocks{0};
+  std::atomic<uint64_t> mBlocksOverHeadroom{0};
+  std::atomic<uint64_t> mIntervalOverruns{0};
+  // Fixed point, kLoadScale to 1.0
+  std::atomic<uint64_t> mLoadSum{0};
+  std::atomic<uint64_t> mOverruns{0};
+
+  // Evaluate()
+  Clock::time_point mLastEvaluation;
+  Clock::time_point mLastChange;
+  Clock::time_point mLastRecovery;
+  Clock::time_point mRelaxedSince;
+  bool mRelaxed = false;
+  double mRecoveryHold = kRecoveryHold;
+};
+
+// A capture of the same rig as `modelPath` that's cheaper to run, from the same folder, or an empty path if there
+// isn't one. Captures go together if their file names match once the size names (Standard, Lite, Feather, Nano, ...)
+// are taken out. Of those that need fewer operations per second than the model (see model_profile::ProfileConfig()),
+// the heaviest. Reads each candidate's config (nam_file::ReadConfig(), which skips the weights), so not for the audio
+// thread.
+std::filesystem::path FindLighterSibling(const std::filesystem::path& modelPath);
+}; // namespace deadline
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm> // std::max
+#include <chrono>
+
+// What drawing the editor costs, for comparing rendering changes (published as telemetry, see Telemetry.h).
+//
+// IGraphics redraws the dirty parts of the UI once per frame by drawing every control that overlaps them, in the order
+// that they were attached. So a frame is timed from the background (the first control, see NAMBackgroundControl) to
+// NAMDrawStatsControl (the last). Only the drawing calls are timed, not the backend presenting the frame. Opening the
+// editor is timed too, since that's when everything gets loaded.
+//
+// Everything here happens on the UI thread.
+class DrawStats
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  void BeginFrame()
+  {
+    mFrameStart = Clock::now();
+    mInFrame = true;
+  };
+
+  void EndFrame()
+  {
+    // E.g. a control drawn on its own to a layer
+    if (!mInFrame)
+      return;
+    mInFrame = false;
+    const auto now = Clock::now();
+    const double elapsed = std::chrono::duration<double>(now - mFrameStart).count();
+    mNumFrames++;
+    mTotalTime += elapsed;
+    mMaxTime = std::max(mMaxTime, elapsed);
+    if (mOpening && mLayoutEnd > mOpenStart)
+    {
+      mOpening = false;
+      mHaveOpenTimes = true;
+      mOpenTimes.firstFrame = std::chrono::duration<double>(now - mOpenStart).count();
+    }
+  };
+
+  // Opening the editor, in seconds from when it started: creating the graphics, laying out the controls and drawing
+  // the first frame, which is when it appears to be open.
+  struct OpenTimes
+  {
+    double graphics = 0.0;
+    double layout = 0.0;
+    double firstFrame = 0.0;
+  };
+
+  // Call these in order as the editor opens
+  void BeginOpen()
+  {
+    mOpenStart = Clock::now();
+    mLayoutStart = mLayoutEnd = mOpenStart;
+    mOpening = true;
+    mHaveOpenTimes = false;
+  };
+  void BeginLayout() { mLayoutStart = Clock::now(); };
+  void EndLayout()
+  {
+    mLayoutEnd = Clock::now();
+    mOpenTimes.graphics = std::chrono::duration<double>(mLayoutStart - mOpenStart).count();
+    mOpenTimes.layout = std::chrono::duration<double>(mLayoutEnd - mLayoutStart).count();
+  };
+
+  // Once per opening, after its first frame
+  bool ConsumeOpenTimes(OpenTimes& openTimes)
+  {
+    if (!mHaveOpenTimes)
+      return false;
+    mHaveOpenTimes = false;
+    openTimes = mOpenTimes;
+    return true;
+  };
+
+  // A level that reached a meter, and whether it moved the meter by at least a pixel (see NAMMeterControl)
+  void CountMeterUpdate(const bool drawn) { (drawn ? mMeterUpdatesDrawn : mMeterUpdatesSkipped)++; };
+
+  int GetNumFrames() const { return mNumFrames; };
+  // Seconds
+  double GetAverageFrameTime() const { return mNumFrames > 0 ? mTotalTime / mNumFrames : 0.0; };
+  double GetMaxFrameTime() const { return mMaxTime; };
+  int GetMeterUpdatesDrawn() const { return mMeterUpdatesDrawn; };
+  int GetMeterUpdatesSkipped() const { return mMeterUpdatesSkipped; };
+
+  // Start a new window
+  void Reset()
+  {
+    mNumFrames = 0;
+    mTotalTime = 0.0;
+    mMaxTime = 0.0;
+    mMeterUpdatesDrawn = 0;
+    mMeterUpdatesSkipped = 0;
+  };
+
+private:
+  Clock::time_point mFrameStart;
+  bool mInFrame = false;
+  int mNumFrames = 0;
+  double mTotalTime = 0.0;
+  double mMaxTime = 0.0;
+  int mMeterUpdatesDrawn = 0;
+  int mMeterUpdatesSkipped = 0;
+
+  Clock::time_point mOpenStart, mLayoutStart, mLayoutEnd;
+  bool mOpening = false;
+  bool mHaveOpenTimes = false;
+  OpenTimes mOpenTimes;
+};
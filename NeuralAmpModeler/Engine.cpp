@@ -0,0 +1,1054 @@
+#include <algorithm> // std::any_of, std::copy, std::fill, std::max, std::min
+#include <cfenv>
+#include <cmath> // pow
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include "architecture.hpp"
+
+#include "Engine.h"
+#include "RemoteInference.h"
+#include "WavIO.h"
+
+namespace
+{
+// Silence bypass (see Engine::_ShouldBypass()). Below -120 dBFS is digital silence as far as any interface goes.
+const double kSilenceThresholdDB = -120.0;
+// With the gate on, input this far under its threshold counts too: the gate takes the model's output down by well over
+// 100 dB there.
+const double kGatedSilenceMarginDB = 40.0;
+// For recurrent models (and remote ones, whose config we don't have). Trained LSTMs' states die away well within it.
+const double kRecurrentModelSettleTime = 1.0;
+// For the tone stack and the DC blocker, which is the slow one: 5 Hz takes about 0.37 s to fall by 100 dB.
+const double kFilterSettleTime = 0.5;
+// Crossfade from one IR to the next. Long enough for the new one's history to fill with the bulk of a cab's response.
+const double kIRCrossfadeTime = 0.02;
+// And from one model to the next, so that a swap (for a lighter capture, say; see DeadlineMonitor.h) doesn't click
+const double kModelCrossfadeTime = 0.02;
+// Channels that a block that's too big can be split over (see Engine::Process()). Any more outputs are copies.
+const size_t kMaxSplitChannels = 64;
+// More than one ApplyStaging() can retire: two models on their way out, two per branch and two convolutions
+const size_t kMaxRetiredPerSwap = 16;
+
+double DBToAmp(const double db) { return pow(10.0, db / 20.0); }
+
+// From `from` to `to`, in place, `position` frames into a fade that takes `length`
+void Crossfade(const DSP_SAMPLE* from, DSP_SAMPLE* to, const size_t numFrames, const size_t position,
+               const size_t length)
+{
+  const double fadeLength = (double)std::max<size_t>(1, length);
+  for (size_t s = 0; s < numFrames; s++)
+  {
+    const double t = std::min(1.0, (double)(position + s) / fadeLength);
+    to[s] = (DSP_SAMPLE)((1.0 - t) * from[s] + t * to[s]);
+  }
+}
+}; // namespace
+
+engine::Engine::Engine(const Options& options)
+: mOptions(options)
+{
+  // If you want to customize the tone stack, then put it here!
+  mToneStack = std::make_unique<dsp::tone_stack::BasicNamToneStack>();
+  mToneStackRight = std::make_unique<dsp::tone_stack::BasicNamToneStack>();
+  // Pick the kernels for this CPU now so that the audio thread doesn't have to.
+  mKernels = &dsp::kernels::GetKernels();
+  mNoiseGateTrigger.AddListener(&mNoiseGateGain);
+}
+
+engine::Engine::~Engine()
+{
+  // The workers use the DSP modules, so they have to go first.
+  mPipeline.Stop();
+  mBranchPool = nullptr;
+  delete mStagedBranchPool.exchange(nullptr);
+  mRetired.Release();
+  delete mStagedConvolver.exchange(nullptr);
+}
+
+void engine::Engine::Reset(const double sampleRate, const int maxBlockSize)
+{
+  mRetired.Release();
+  // Models that have been sitting in silence are already where prewarming would put them (see tools/Prewarm.h), so if
+  // nothing that they're sized for has changed either, they're left as they are. Some hosts reset on every transport
+  // start, and prewarming a big model takes a while.
+  const bool modelsSettled = mBypassingSilence && sampleRate == mSampleRate && maxBlockSize == mMaxBlockSize;
+  mSampleRate = sampleRate;
+  mMaxBlockSize = maxBlockSize;
+  // Exactly what the host asked for, so give back anything left over from a bigger block size.
+  mInputArray.assign(maxBlockSize, 0.0);
+  mInputArray.shrink_to_fit();
+  mProcessedInputFrames = 0;
+  mOutputArray.assign(maxBlockSize, 0.0);
+  mOutputArray.shrink_to_fit();
+  mOutputArrayRight.assign(maxBlockSize, 0.0);
+  mOutputArrayRight.shrink_to_fit();
+  mFadingOutput.assign(maxBlockSize, 0.0);
+  mFadingOutput.shrink_to_fit();
+  mFadingModelOutput.assign(maxBlockSize, 0.0);
+  mFadingModelOutput.shrink_to_fit();
+  for (BranchMix& mix : mBranchMix)
+  {
+    mix.output.assign(maxBlockSize, 0.0);
+    mix.output.shrink_to_fit();
+    mix.alignment.Reset();
+  }
+  // If there is a model or IR loaded, they need to be checked for resampling.
+  _ResetModelAndIR(sampleRate, maxBlockSize, modelsSettled);
+  mToneStack->Reset(sampleRate, maxBlockSize);
+  mToneStackRight->Reset(sampleRate, maxBlockSize);
+  _ResetPipeline(sampleRate, maxBlockSize);
+  // The block size may be too big for the branches' workers now, so they're started again if they're still wanted.
+  // Nothing's processing, so they go live straight away.
+  mBranchPool = nullptr;
+  delete mStagedBranchPool.exchange(nullptr);
+  _UpdateRig();
+  if (mNumLiveBranches > 1)
+    mBranchPool = _MakeBranchPool();
+  mHasBranchPool = mBranchPool != nullptr;
+  mBranchPoolWanted = false;
+  mSilentFrames = 0;
+  mBypassingSilence = false;
+  _UpdateSilenceHold();
+}
+
+void engine::Engine::Process(DSP_SAMPLE* const* inputs, const size_t numInputChannels, DSP_SAMPLE* const* outputs,
+                             const size_t numOutputChannels, const size_t numFrames)
+{
+  if ((int)numFrames <= mMaxBlockSize)
+  {
+    _ProcessBlock(inputs, numInputChannels, outputs, numOutputChannels, numFrames);
+    return;
+  }
+  // Hosts aren't supposed to send more than they said they would in Reset(), but some do. Everything (the models
+  // included) is sized for what they said, and resizing here would allocate and prewarm on the audio thread, so the
+  // block goes through in pieces that fit instead.
+  if (mMaxBlockSize <= 0)
+    return;
+  const size_t numInputs = std::min(numInputChannels, kMaxSplitChannels);
+  const size_t numOutputs = std::min(numOutputChannels, kMaxSplitChannels);
+  std::array<DSP_SAMPLE*, kMaxSplitChannels> inputPieces, outputPieces;
+  for (size_t offset = 0; offset < numFrames; offset += (size_t)mMaxBlockSize)
+  {
+    for (size_t c = 0; c < numInputs; c++)
+      inputPieces[c] = inputs[c] + offset;
+    for (size_t c = 0; c < numOutputs; c++)
+      outputPieces[c] = outputs[c] + offset;
+    _ProcessBlock(inputPieces.data(), numInputs, outputPieces.data(), numOutputs,
+                  std::min((size_t)mMaxBlockSize, numFrames - offset));
+  }
+  for (size_t c = numOutputs; c < numOutputChannels; c++)
+    std::copy(outputs[numOutputs - 1], outputs[numOutputs - 1] + numFrames, outputs[c]);
+}
+
+void engine::Engine::_ProcessBlock(DSP_SAMPLE* const* inputs, const size_t numInputChannels,
+                                   DSP_SAMPLE* const* outputs, const size_t numOutputChannels, const size_t numFrames)
+{
+  // Disable floating point denormals
+  std::fenv_t fe_state;
+  std::feholdexcept(&fe_state);
+  disable_denormals();
+
+  ApplyStaging();
+  DSP_SAMPLE* inputPointers[kNumChannelsInternal] = {mInputArray.data()};
+  DSP_SAMPLE* outputPointers[kMaxChannelsInternal] = {mOutputArray.data(), mOutputArrayRight.data()};
+  // Input is collapsed to mono in preparation for the NAM.
+  _ProcessInput(inputs, numInputChannels, numFrames);
+
+  // An idle track: everything has settled, so the chain would output (next to) nothing. Its state is left where it
+  // is, which is where silence keeps it, so it carries on from there as soon as there's input again.
+  if (_ShouldBypass(numFrames))
+  {
+    std::feupdateenv(&fe_state);
+    for (size_t c = 0; c < numOutputChannels; c++)
+      std::fill(outputs[c], outputs[c] + numFrames, (DSP_SAMPLE)0);
+    return;
+  }
+
+  // Noise gate trigger
+  mNoiseGateActiveThisBlock = mNoiseGateActive;
+  if (mNoiseGateActiveThisBlock)
+  {
+    const double time = 0.01;
+    const double threshold = mNoiseGateThreshold;
+    const double ratio = 0.1; // Quadratic...
+    const double openTime = 0.005;
+    const double holdTime = 0.01;
+    const double closeTime = 0.05;
+    const dsp::noise_gate::TriggerParams triggerParams(time, threshold, ratio, openTime, holdTime, closeTime);
+    mNoiseGateTrigger.SetParams(triggerParams);
+    mNoiseGateTrigger.SetSampleRate(mSampleRate);
+  }
+
+  // A rig goes stereo from the mix on if it's panned and there's somewhere to put it.
+  mStereoThisBlock = false;
+  if (mIsRig && numOutputChannels >= kMaxChannelsInternal)
+    for (int i = 0; i < mNumLiveBranches; i++)
+      mStereoThisBlock = mStereoThisBlock || mBranchMix[mLiveBranches[i]].pan != 0.0;
+  const size_t numChannelsInternal = mStereoThisBlock ? kMaxChannelsInternal : kNumChannelsInternal;
+
+  // Gate & NAM. If we're pipelined, then the worker starts on this block and we get the one before it back.
+  const bool pipelined = !mIsRig && mPipeline.CanProcess((int)numFrames);
+  DSP_SAMPLE** gateGainOutput = outputPointers;
+  if (pipelined)
+    mPipeline.Launch(inputPointers[0], outputPointers[0], (int)numFrames);
+  else
+    gateGainOutput = _ProcessFirstStage(inputPointers, outputPointers, numFrames);
+
+  // Tone stack, IR and HPF. The modules are mono, so each side has its own.
+  dsp::tone_stack::AbstractToneStack* toneStacks[kMaxChannelsInternal] = {mToneStack.get(), mToneStackRight.get()};
+  const bool irActive = mConvolver != nullptr && mIRActive;
+  if (irActive)
+  {
+    mConvolver->BeginBlock();
+    if (mFadingConvolver != nullptr)
+      mFadingConvolver->BeginBlock();
+  }
+  recursive_linear_filter::HighPass* highPasses[kMaxChannelsInternal] = {&mHighPass, &mHighPassRight};
+  const recursive_linear_filter::HighPassParams highPassParams(mSampleRate, kDCBlockerFrequency);
+  DSP_SAMPLE* hpfPointers[kMaxChannelsInternal] = {};
+  for (size_t c = 0; c < numChannelsInternal; c++)
+  {
+    DSP_SAMPLE** pointers = &gateGainOutput[c];
+    if (mToneStackActive && toneStacks[c] != nullptr)
+      pointers = toneStacks[c]->Process(pointers, 1, numFrames);
+    if (irActive)
+    {
+      // In place, so the fading one goes first.
+      if (mFadingConvolver != nullptr)
+        mFadingConvolver->Process((int)c, pointers[0], mFadingOutput.data(), numFrames);
+      mConvolver->Process((int)c, pointers[0], pointers[0], numFrames);
+      if (mFadingConvolver != nullptr)
+        Crossfade(mFadingOutput.data(), pointers[0], numFrames, mIRFadePosition, mIRFadeLength);
+    }
+    // And the HPF for DC offset (Issue 271)
+    highPasses[c]->SetParams(highPassParams);
+    hpfPointers[c] = highPasses[c]->Process(pointers, 1, numFrames)[0];
+  }
+  if (mFadingConvolver != nullptr)
+  {
+    mIRFadePosition += numFrames;
+    // If there's no room to retire it yet, it keeps running, silently, until there is.
+    if (mIRFadePosition >= mIRFadeLength)
+      mRetired.Push(mFadingConvolver);
+  }
+
+  if (pipelined)
+    mPipeline.Wait();
+
+  // restore previous floating point state
+  std::feupdateenv(&fe_state);
+
+  // This is where we exit mono (or stereo) for whatever the output requires.
+  _ProcessOutput(hpfPointers, numChannelsInternal, outputs, numOutputChannels, numFrames);
+}
+
+void engine::Engine::ApplyStaging()
+{
+  // Whatever's swapped out goes to mRetired. If it's too full to take a whole round of swaps, they wait for a block
+  // after ReleaseRetired() has caught up.
+  if (mRetired.HasRoom(kMaxRetiredPerSwap) && _SwapStaged())
+  {
+    _UpdateRig();
+    _UpdateSilenceHold();
+  }
+  _UpdateBranchPool();
+  // The first stage (which may be on the pipeline's worker, but that's done with the last block by now) fades the model
+  // out. Rigs don't run it at all. If there's no room to retire it yet, it keeps running, silently, until there is.
+  if (mFadingModel != nullptr && (mIsRig || mModelFadePosition >= mModelFadeLength))
+    mRetired.Push(mFadingModel);
+  // Loudness from the background analysis, if it's for this model
+  uint64_t analyzedModelID = mModelID;
+  if (mModel != nullptr && mModelID != 0 && mAnalyzedModelID.compare_exchange_strong(analyzedModelID, 0))
+  {
+    mModel->SetLoudness(mAnalyzedLoudness.load());
+    mLoudnessAnalyzed = true;
+    _SetOutputGain();
+    _SetBranchGains();
+  }
+}
+
+engine::MemoryReport engine::Engine::GetMemoryReport() const
+{
+  MemoryReport report;
+  report.scratch =
+    sizeof(DSP_SAMPLE)
+      * (mInputArray.capacity() + mOutputArray.capacity() + mOutputArrayRight.capacity() + mFadingOutput.capacity()
+         + mFadingModelOutput.capacity())
+    + mPipeline.GetMemoryBytes();
+  for (const BranchMix& mix : mBranchMix)
+    report.scratch += sizeof(DSP_SAMPLE) * mix.output.capacity();
+  for (int branch = 0; branch < kMaxModelBranches; branch++)
+  {
+    const ResamplingNAM* model = _GetBranchModel(branch);
+    if (model == nullptr)
+      continue;
+    const ModelMemory& memory = branch == 0 ? mModelMemory : mBranches[branch - 1].memory;
+    report.weights += memory.weights;
+    report.state += memory.state;
+    report.scratch += memory.scratchPerFrame * (size_t)model->GetMaxEncapsulatedBlockSize();
+    report.resampler += model->GetResamplerBytes();
+  }
+  for (const ModelSource& source : mModelSources)
+    report.weights += sizeof(float) * source.data.weights.capacity();
+  if (mConvolver != nullptr)
+    report.ir += mConvolver->GetMemoryBytes();
+  if (mFadingConvolver != nullptr)
+    report.ir += mFadingConvolver->GetMemoryBytes();
+  return report;
+}
+
+int engine::Engine::GetLatency() const
+{
+  int latency = _GetModelLatency();
+  // The second stage runs one block behind the first. Rigs aren't pipelined.
+  if (!mIsRig)
+    latency += mPipeline.GetLatency();
+  // Other things that add latency here...
+  return latency;
+}
+
+std::string engine::Engine::StageModel(const std::filesystem::path& modelPath, nam::dspData* modelData)
+{
+  return _StageModel(0, modelPath, nullptr, modelData);
+}
+
+std::string engine::Engine::RebuildModels()
+{
+  std::string firstError;
+  for (int branch = 0; branch < kMaxModelBranches; branch++)
+  {
+    const ModelSource& source = mModelSources[branch];
+    if (source.path.empty())
+      continue;
+    // Staging from the path replaces the source.
+    const std::filesystem::path modelPath = source.path;
+    const nam::dspData* fromData = source.data.architecture.empty() ? nullptr : &source.data;
+    const std::string error = _StageModel(branch, modelPath, fromData, nullptr);
+    if (firstError.empty())
+      firstError = error;
+  }
+  return firstError;
+}
+
+std::string engine::Engine::_StageModel(const int branch, const std::filesystem::path& modelPath,
+                                        const nam::dspData* fromData, nam::dspData* modelData)
+{
+  mRetired.Release();
+  std::unique_ptr<ResamplingNAM>& staged = branch == 0 ? mStagedModel : mBranches[branch - 1].stagedModel;
+  try
+  {
+    ModelMemory& memory = branch == 0 ? mStagedModelMemory : mBranches[branch - 1].stagedMemory;
+    double& settleTime = branch == 0 ? mStagedModelSettleTime : mBranches[branch - 1].stagedSettleTime;
+    nam::dspData loaded;
+    std::unique_ptr<ResamplingNAM> temp = fromData != nullptr ? _BuildModel(*fromData, memory, settleTime)
+                                                              : _LoadModel(modelPath, loaded, memory, settleTime);
+    const nam::dspData& data = fromData != nullptr ? *fromData : loaded;
+    if (branch == 0)
+    {
+      mStagedModelID = mNextModelID++;
+      if (mOptions.analyzeLoudness && !temp->HasLoudness() && !data.architecture.empty())
+      {
+        const uint64_t modelID = mStagedModelID;
+        mLoudnessAnalyzer.Start(data, [this, modelID](const double loudness) {
+          mAnalyzedLoudness = loudness;
+          mAnalyzedModelID.store(modelID, std::memory_order_release);
+        });
+      }
+      // What the analysis is calibrated against (see loudness::Calibration)
+      else if (mOptions.analyzeLoudness && !data.architecture.empty())
+        mLoudnessAnalyzer.Learn(data, temp->GetLoudness());
+    }
+    staged = std::move(temp);
+    if (branch > 0)
+      _StageBranchPool();
+    if (modelData != nullptr)
+      *modelData = data;
+    if (fromData == nullptr)
+      mModelSources[branch] = {modelPath, std::move(loaded)};
+  }
+  catch (std::runtime_error& e)
+  {
+    staged = nullptr;
+    std::cerr << "Failed to read DSP module" << std::endl;
+    std::cerr << e.what() << std::endl;
+    return e.what();
+  }
+  return "";
+}
+
+dsp::wav::LoadReturnCode engine::Engine::StageIR(const std::filesystem::path& irPath, const int slot)
+{
+  if (slot < 0 || slot >= ir_blend::kMaxIRs)
+    return dsp::wav::LoadReturnCode::ERROR_OTHER;
+  dsp::wav::LoadReturnCode wavState = dsp::wav::LoadReturnCode::ERROR_OTHER;
+  try
+  {
+    // Decoded straight from the mapped file (see WavIO.h)
+    dsp::ImpulseResponse::IRData irData;
+    wavState = wav_io::Load(irPath, irData.mRawAudio, irData.mRawAudioSampleRate);
+    if (wavState == dsp::wav::LoadReturnCode::SUCCESS)
+      StageIR(irData, slot);
+  }
+  catch (std::runtime_error& e)
+  {
+    wavState = dsp::wav::LoadReturnCode::ERROR_OTHER;
+    std::cerr << "Caught unhandled exception while attempting to load IR:" << std::endl;
+    std::cerr << e.what() << std::endl;
+  }
+  // A failed load leaves the blend as it was.
+  return wavState;
+}
+
+void engine::Engine::StageIR(const dsp::ImpulseResponse::IRData& irData, const int slot)
+{
+  if (slot < 0 || slot >= ir_blend::kMaxIRs)
+    return;
+  mIRSlots[slot].data = irData;
+  mIRSlots[slot].loaded = true;
+  _StageIRBlend();
+}
+
+void engine::Engine::ClearIR(const int slot)
+{
+  if (slot < 0 || slot >= ir_blend::kMaxIRs)
+    return;
+  // Its gain and delay stay for whatever's loaded next.
+  mIRSlots[slot].loaded = false;
+  mIRSlots[slot].data = dsp::ImpulseResponse::IRData();
+  _StageIRBlend();
+}
+
+void engine::Engine::SetIRGain(const int slot, const double db)
+{
+  if (slot < 0 || slot >= ir_blend::kMaxIRs || mIRSlots[slot].gainDB == db)
+    return;
+  mIRSlots[slot].gainDB = db;
+  if (mIRSlots[slot].loaded)
+    _StageIRBlend();
+}
+
+void engine::Engine::SetIRDelay(const int slot, const double ms)
+{
+  const double delayMs = std::max(0.0, std::min(ir_blend::kMaxDelayMs, ms));
+  if (slot < 0 || slot >= ir_blend::kMaxIRs || mIRSlots[slot].delayMs == delayMs)
+    return;
+  mIRSlots[slot].delayMs = delayMs;
+  if (mIRSlots[slot].loaded)
+    _StageIRBlend();
+}
+
+void engine::Engine::SetIRMaxLength(const double seconds)
+{
+  const double maxLength = std::max(0.0, seconds);
+  if (mIRMaxLength == maxLength)
+    return;
+  mIRMaxLength = maxLength;
+  if (std::any_of(mIRSlots.begin(), mIRSlots.end(), [](const IRSlot& slot) { return slot.loaded; }))
+    _StageIRBlend();
+}
+
+std::string engine::Engine::StageBranchModel(const int branch, const std::filesystem::path& modelPath)
+{
+  if (branch == 0)
+    return StageModel(modelPath);
+  if (branch < 0 || branch >= kMaxModelBranches)
+    return "There's no model branch " + std::to_string(branch);
+  return _StageModel(branch, modelPath, nullptr, nullptr);
+}
+
+void engine::Engine::ClearBranchModel(const int branch)
+{
+  if (branch == 0)
+    ClearModel();
+  else if (branch > 0 && branch < kMaxModelBranches)
+  {
+    mBranches[branch - 1].shouldRemove = true;
+    mModelSources[branch] = ModelSource();
+  }
+}
+
+bool engine::Engine::HasBranchModel(const int branch) const
+{
+  if (branch == 0)
+    return HasModelOrStagedModel();
+  if (branch < 0 || branch >= kMaxModelBranches)
+    return false;
+  return mBranches[branch - 1].model != nullptr || mBranches[branch - 1].stagedModel != nullptr;
+}
+
+void engine::Engine::SetBranchLevel(const int branch, const double db)
+{
+  if (branch < 0 || branch >= kMaxModelBranches)
+    return;
+  mBranchMix[branch].levelDB = db;
+  _SetBranchGains();
+}
+
+void engine::Engine::SetBranchPan(const int branch, const double pan)
+{
+  if (branch < 0 || branch >= kMaxModelBranches)
+    return;
+  mBranchMix[branch].pan = std::max(-1.0, std::min(1.0, pan));
+  _SetBranchGains();
+}
+
+void engine::Engine::SetInputLevel(const double db)
+{
+  mInputLevel = db;
+  _SetInputGain();
+}
+
+void engine::Engine::SetCalibrateInput(const bool active)
+{
+  mCalibrateInput = active;
+  _SetInputGain();
+}
+
+void engine::Engine::SetInputCalibrationLevel(const double dbu)
+{
+  mInputCalibrationLevel = dbu;
+  _SetInputGain();
+  // Calibrated output depends on it too
+  _SetOutputGain();
+}
+
+void engine::Engine::SetOutputLevel(const double db)
+{
+  mOutputLevel = db;
+  _SetOutputGain();
+}
+
+void engine::Engine::SetOutputMode(const OutputMode mode)
+{
+  mOutputMode = mode;
+  _SetOutputGain();
+  // Loudness matching between branches depends on it too
+  _SetBranchGains();
+}
+
+// Private methods ============================================================
+
+void engine::Engine::_FallbackDSP(DSP_SAMPLE** inputs, DSP_SAMPLE** outputs, const size_t numChannels,
+                                  const size_t numFrames)
+{
+  for (auto c = 0; c < numChannels; c++)
+    for (auto s = 0; s < numFrames; s++)
+      outputs[c][s] = inputs[c][s];
+}
+
+DSP_SAMPLE** engine::Engine::_ProcessFirstStage(DSP_SAMPLE** inputs, DSP_SAMPLE** outputs, const size_t numFrames)
+{
+  const size_t numChannels = kNumChannelsInternal;
+  DSP_SAMPLE** triggerOutput =
+    mNoiseGateActiveThisBlock ? mNoiseGateTrigger.Process(inputs, numChannels, numFrames) : inputs;
+
+  if (mIsRig)
+  {
+    mBranchInput = triggerOutput[0];
+    _ProcessRig(outputs, numFrames);
+  }
+  else if (mModel != nullptr)
+  {
+    if (mFadingModel != nullptr)
+      mFadingModel->process(triggerOutput[0], mFadingModelOutput.data(), (int)numFrames);
+    mModel->process(triggerOutput[0], outputs[0], (int)numFrames);
+    if (mFadingModel != nullptr)
+    {
+      Crossfade(mFadingModelOutput.data(), outputs[0], numFrames, mModelFadePosition, mModelFadeLength);
+      mModelFadePosition += numFrames;
+    }
+  }
+  else
+  {
+    _FallbackDSP(triggerOutput, outputs, numChannels, numFrames);
+  }
+  // Apply the noise gate after the NAM
+  if (!mNoiseGateActiveThisBlock)
+    return outputs;
+  if (!mStereoThisBlock)
+    return mNoiseGateGain.Process(outputs, numChannels, numFrames);
+  // The trigger saw the mono input, so its gain goes on one side at a time.
+  for (size_t c = 0; c < kMaxChannelsInternal; c++)
+  {
+    DSP_SAMPLE** gated = mNoiseGateGain.Process(&outputs[c], 1, numFrames);
+    std::copy(gated[0], gated[0] + numFrames, outputs[c]);
+  }
+  return outputs;
+}
+
+void engine::Engine::_ProcessRig(DSP_SAMPLE** outputs, const size_t numFrames)
+{
+  mBranchNumFrames = numFrames;
+  if (mNumLiveBranches > 1 && mBranchPool != nullptr && (int)numFrames <= pipeline::kMaxParallelBlockSize)
+    mBranchPool->Run(mNumLiveBranches);
+  else
+    for (int job = 0; job < mNumLiveBranches; job++)
+      _ProcessBranch(job);
+
+  const size_t numChannels = mStereoThisBlock ? kMaxChannelsInternal : kNumChannelsInternal;
+  for (size_t c = 0; c < numChannels; c++)
+    std::fill(outputs[c], outputs[c] + numFrames, (DSP_SAMPLE)0);
+  for (int job = 0; job < mNumLiveBranches; job++)
+  {
+    BranchMix& mix = mBranchMix[mLiveBranches[job]];
+    if (mix.delay > 0)
+      mix.alignment.Process(mix.output.data(), numFrames, mix.delay);
+    const DSP_SAMPLE* branchOutput = mix.output.data();
+    if (mStereoThisBlock)
+    {
+      for (size_t s = 0; s < numFrames; s++)
+      {
+        outputs[0][s] += (DSP_SAMPLE)mix.gainLeft * branchOutput[s];
+        outputs[1][s] += (DSP_SAMPLE)mix.gainRight * branchOutput[s];
+      }
+    }
+    else
+    {
+      for (size_t s = 0; s < numFrames; s++)
+        outputs[0][s] += (DSP_SAMPLE)mix.gain * branchOutput[s];
+    }
+  }
+}
+
+void engine::Engine::_ProcessBranch(const int job)
+{
+  const int branch = mLiveBranches[job];
+  _GetBranchModel(branch)->process(mBranchInput, mBranchMix[branch].output.data(), (int)mBranchNumFrames);
+}
+
+void engine::Engine::_ProcessInput(DSP_SAMPLE* const* inputs, const size_t numChannels, const size_t numFrames)
+{
+  // A standalone app can probably assume that the user has plugged into only one input and they expect it to be
+  // carried straight through, so it doesn't divide over the channels because it's just "catching anything out there."
+  // However, in a DAW, it's probably something providing stereo, and we want to take the average in order to avoid
+  // doubling the loudness. (This would change w/ double mono processing)
+  double gain = mInputGain;
+  if (mOptions.averageInputChannels && numChannels > 0)
+    gain /= (double)numChannels;
+  mKernels->mixdown(inputs, numChannels, numFrames, gain, mInputArray.data());
+  mProcessedInputFrames = numFrames;
+}
+
+void engine::Engine::_ProcessOutput(DSP_SAMPLE* const* input, const size_t numInputChannels,
+                                    DSP_SAMPLE* const* outputs, const size_t numChannels, const size_t numFrames)
+{
+  // A lone model's level is applied here; a rig's branches have theirs in the mix.
+  const double gain = mIsRig ? mOutputGain : mOutputGain * mBranchMix[0].gain;
+  // Broadcast the internal mono stream to all output channels (or left, then right to the rest).
+  for (size_t c = 0; c < numChannels; c++)
+  {
+    const DSP_SAMPLE* channel = input[std::min(c, numInputChannels - 1)];
+    if (mOptions.clampOutput) // Ensure valid output to interface
+      mKernels->gainClamped(channel, numFrames, gain, -1.0, 1.0, outputs[c]);
+    else // In a DAW, other things may come next and should be able to handle large values.
+      mKernels->gain(channel, numFrames, gain, outputs[c]);
+  }
+}
+
+size_t engine::Engine::ReleaseRetired()
+{
+  const size_t numReleased = mRetired.Release();
+  if (mBranchPoolWanted.load(std::memory_order_relaxed))
+    _StageBranchPool();
+  return numReleased;
+}
+
+void engine::Engine::_StageIRBlend()
+{
+  mRetired.Release();
+  std::vector<ir_blend::Layer> layers;
+  for (const IRSlot& slot : mIRSlots)
+    if (slot.loaded)
+      layers.push_back({&slot.data, slot.gainDB, slot.delayMs});
+  if (layers.empty())
+  {
+    // Anything staged and not yet live goes with it.
+    mLatestConvolver = nullptr;
+    delete mStagedConvolver.exchange(nullptr);
+    mShouldRemoveIR = true;
+    mIRBlendDuration = 0.0;
+    return;
+  }
+  std::vector<float> ir = ir_blend::Blend(layers, mSampleRate);
+  mIRBlendDuration = (double)ir.size() / mSampleRate;
+  if (mIRMaxLength > 0.0)
+    ir_blend::Trim(ir, (size_t)(mIRMaxLength * mSampleRate));
+  // New taps for the convolution that's there, if the blend fits it and doesn't leave most of it unused
+  const size_t maxLength = ir_blend::GetMaxBlendLength(layers, mSampleRate);
+  if (mLatestConvolver != nullptr && mLatestConvolver->GetSampleRate() == mSampleRate
+      && maxLength <= mLatestConvolver->GetMaxLength() && 2 * maxLength > mLatestConvolver->GetMaxLength())
+  {
+    mLatestConvolver->SetIR(ir);
+    return;
+  }
+  auto convolver =
+    std::make_unique<ir_blend::Convolver>(ir, mSampleRate, maxLength, mMaxBlockSize, (int)kMaxChannelsInternal);
+  mLatestConvolver = convolver.get();
+  // One that was staged before and never went live is ours to delete.
+  delete mStagedConvolver.exchange(convolver.release());
+}
+
+bool engine::Engine::_SwapStaged()
+{
+  bool chainChanged = false;
+  // Remove marked modules
+  if (mShouldRemoveModel)
+  {
+    mRetired.Push(mModel);
+    mRetired.Push(mFadingModel);
+    mModelID = 0;
+    mModelMemory = ModelMemory();
+    mModelSettleTime = 0.0;
+    chainChanged = true;
+    mShouldRemoveModel = false;
+    mModelCleared = true;
+    _SetInputGain();
+    _SetOutputGain();
+  }
+  for (Branch& branch : mBranches)
+  {
+    if (branch.shouldRemove)
+    {
+      mRetired.Push(branch.model);
+      branch.memory = ModelMemory();
+      branch.settleTime = 0.0;
+      branch.shouldRemove = false;
+      chainChanged = true;
+    }
+    if (branch.stagedModel != nullptr)
+    {
+      mRetired.Push(branch.model);
+      branch.model = std::move(branch.stagedModel);
+      branch.memory = branch.stagedMemory;
+      branch.settleTime = branch.stagedSettleTime;
+      branch.stagedModel = nullptr;
+      chainChanged = true;
+    }
+  }
+  if (mShouldRemoveIR)
+  {
+    mRetired.Push(mConvolver);
+    mRetired.Push(mFadingConvolver);
+    mShouldRemoveIR = false;
+    chainChanged = true;
+  }
+  // Move things from staged to live
+  if (mStagedModel != nullptr)
+  {
+    // The outgoing model fades out over the new one. If it replaces one that was still fading, that one goes now. The
+    // two may not have the same latency (see GetLatency()), but over a fade this short that's no worse than a smear.
+    mRetired.Push(mFadingModel);
+    if (mModel != nullptr && !mIsRig && !mModelStale)
+    {
+      mFadingModel = std::move(mModel);
+      mModelFadePosition = 0;
+      mModelFadeLength = (size_t)(kModelCrossfadeTime * mSampleRate);
+    }
+    mRetired.Push(mModel);
+    mModel = std::move(mStagedModel);
+    mModelStale = false;
+    mModelID = mStagedModelID;
+    mModelMemory = mStagedModelMemory;
+    mModelSettleTime = mStagedModelSettleTime;
+    mStagedModel = nullptr;
+    chainChanged = true;
+    mNewModelLoaded = true;
+    _SetInputGain();
+    _SetOutputGain();
+  }
+  // A new convolution waits for the last one's crossfade to finish. Only loads that outgrow it make new ones, so that's
+  // rarely long.
+  if (mFadingConvolver == nullptr && mStagedConvolver.load(std::memory_order_relaxed) != nullptr)
+  {
+    std::unique_ptr<ir_blend::Convolver> staged(mStagedConvolver.exchange(nullptr));
+    if (mConvolver != nullptr && mIRActive)
+    {
+      mFadingConvolver = std::move(mConvolver);
+      mIRFadePosition = 0;
+      mIRFadeLength = (size_t)(kIRCrossfadeTime * mSampleRate);
+    }
+    mRetired.Push(mConvolver);
+    mConvolver = std::move(staged);
+    chainChanged = true;
+  }
+  return chainChanged;
+}
+
+std::unique_ptr<ResamplingNAM> engine::Engine::_LoadModel(const std::filesystem::path& modelPath, nam::dspData& data,
+                                                          ModelMemory& memory, double& settleTime)
+{
+  std::unique_ptr<nam::DSP> model;
+  // Once the daemon has let us down, it's not asked again.
+  if (remote::IsRequested() && !mRemoteModelLost.load())
+  {
+    // The daemon has the config, so there's no profile and no memory to report here.
+    std::string error;
+    std::unique_ptr<remote::RemoteDSP> remoteModel =
+      remote::LoadModel(modelPath, mActivationAccuracy, remote::GetSocketPath(), error);
+    if (remoteModel == nullptr)
+      std::cerr << "Remote engine unavailable, loading the model here: " << error << std::endl;
+    else
+      remoteModel->SetLostFlag(&mRemoteModelLost);
+    model = std::move(remoteModel);
+  }
+  if (model == nullptr)
+  {
+    dsp::activations::ScopedActivationAccuracy activationAccuracy(mActivationAccuracy);
+    model = nam_file::GetDSP(modelPath, data);
+  }
+  return _WrapModel(std::move(model), data, memory, settleTime);
+}
+
+std::unique_ptr<ResamplingNAM> engine::Engine::_BuildModel(const nam::dspData& data, ModelMemory& memory,
+                                                           double& settleTime)
+{
+  std::unique_ptr<nam::DSP> model;
+  {
+    dsp::activations::ScopedActivationAccuracy activationAccuracy(mActivationAccuracy);
+    model = nam_file::BuildDSP(data);
+  }
+  return _WrapModel(std::move(model), data, memory, settleTime);
+}
+
+std::unique_ptr<ResamplingNAM> engine::Engine::_WrapModel(std::unique_ptr<nam::DSP> model, const nam::dspData& data,
+                                                          ModelMemory& memory, double& settleTime)
+{
+  // Before Reset(), there's no block size to size it for yet, so it's left for Reset() to prewarm.
+  std::unique_ptr<ResamplingNAM> temp =
+    std::make_unique<ResamplingNAM>(std::move(model), mSampleRate, mMaxBlockSize, mResamplerQuality);
+  const model_profile::ModelProfile profile = model_profile::ProfileConfig(data);
+  memory.weights = sizeof(float) * profile.numParameters;
+  memory.state = profile.stateBytes;
+  memory.scratchPerFrame = profile.scratchBytesPerFrame;
+  // How long it takes to forget its input
+  const double modelRate = data.expected_sample_rate > 0.0 ? data.expected_sample_rate : 48000.0;
+  settleTime = profile.recurrent || data.architecture.empty() ? kRecurrentModelSettleTime
+                                                              : (double)profile.receptiveField / modelRate;
+  return temp;
+}
+
+void engine::Engine::_ResetModelAndIR(const double sampleRate, const int maxBlockSize, const bool modelsSettled)
+{
+  // Model. Staged ones haven't played anything since they were prewarmed, so they're as settled as the live ones. A
+  // live one that's about to be replaced is left as it is, and so can't fade out. Nor can the one that was fading.
+  mFadingModel = nullptr;
+  mModelStale = !modelsSettled && mStagedModel != nullptr;
+  if (!modelsSettled)
+  {
+    if (mStagedModel != nullptr)
+      mStagedModel->Reset(sampleRate, maxBlockSize);
+    else if (mModel != nullptr)
+      mModel->Reset(sampleRate, maxBlockSize);
+    for (Branch& branch : mBranches)
+    {
+      if (branch.stagedModel != nullptr)
+        branch.stagedModel->Reset(sampleRate, maxBlockSize);
+      else if (branch.model != nullptr)
+        branch.model->Reset(sampleRate, maxBlockSize);
+    }
+  }
+
+  // IR. Its taps are at the sample rate and its history is sized for the block size, so it's blended again. Nothing's
+  // processing, so there's nothing to fade from, and it goes live straight away.
+  mConvolver = nullptr;
+  mFadingConvolver = nullptr;
+  mLatestConvolver = nullptr;
+  delete mStagedConvolver.exchange(nullptr);
+  if (std::any_of(mIRSlots.begin(), mIRSlots.end(), [](const IRSlot& slot) { return slot.loaded; }))
+  {
+    _StageIRBlend();
+    mConvolver.reset(mStagedConvolver.exchange(nullptr));
+  }
+}
+
+void engine::Engine::_ResetPipeline(const double sampleRate, const int maxBlockSize)
+{
+  if (pipeline::IsRequested() && maxBlockSize <= pipeline::kMaxPipelinedBlockSize)
+  {
+    auto firstStage = [&](const DSP_SAMPLE* input, DSP_SAMPLE* output, int numFrames) {
+      // The worker has its own floating point state.
+      disable_denormals();
+      DSP_SAMPLE* inputPointers[kNumChannelsInternal] = {const_cast<DSP_SAMPLE*>(input)};
+      DSP_SAMPLE* outputPointers[kNumChannelsInternal] = {output};
+      DSP_SAMPLE** gateGainOutput = _ProcessFirstStage(inputPointers, outputPointers, (size_t)numFrames);
+      if (gateGainOutput[0] != output)
+        std::copy(gateGainOutput[0], gateGainOutput[0] + numFrames, output);
+    };
+    mPipeline.Start(firstStage, maxBlockSize, sampleRate);
+  }
+  else
+  {
+    mPipeline.Stop();
+  }
+}
+
+std::unique_ptr<pipeline::WorkerPool> engine::Engine::_MakeBranchPool()
+{
+  if (!mOptions.parallelBranches || mMaxBlockSize <= 0 || mMaxBlockSize > pipeline::kMaxParallelBlockSize)
+    return nullptr;
+  // A worker per core that the audio thread isn't on. With none, spinning workers would only take time from it.
+  const int numWorkers = std::min(kMaxModelBranches - 1, (int)std::thread::hardware_concurrency() - 1);
+  if (numWorkers <= 0)
+    return nullptr;
+  auto pool = std::make_unique<pipeline::WorkerPool>();
+  pool->Start(
+    [&](const int job) {
+      // The workers have their own floating point state.
+      disable_denormals();
+      _ProcessBranch(job);
+    },
+    numWorkers);
+  return pool;
+}
+
+void engine::Engine::_StageBranchPool()
+{
+  if (mHasBranchPool.load() || mStagedBranchPool.load() != nullptr)
+    return;
+  // Null if they aren't wanted, and then there's nothing to stage.
+  delete mStagedBranchPool.exchange(_MakeBranchPool().release());
+}
+
+void engine::Engine::_UpdateBranchPool()
+{
+  const bool wanted = mNumLiveBranches > 1;
+  if (mBranchPool == nullptr && wanted && mStagedBranchPool.load(std::memory_order_relaxed) != nullptr)
+    mBranchPool.reset(mStagedBranchPool.exchange(nullptr));
+  else if (mBranchPool != nullptr && !wanted)
+    mRetired.Push(mBranchPool);
+  mHasBranchPool.store(mBranchPool != nullptr);
+  mBranchPoolWanted.store(wanted && mBranchPool == nullptr, std::memory_order_relaxed);
+}
+
+ResamplingNAM* engine::Engine::_GetBranchModel(const int branch) const
+{
+  return branch == 0 ? mModel.get() : mBranches[branch - 1].model.get();
+}
+
+void engine::Engine::_UpdateRig()
+{
+  mNumLiveBranches = 0;
+  mIsRig = false;
+  for (int branch = 0; branch < kMaxModelBranches; branch++)
+  {
+    if (_GetBranchModel(branch) == nullptr)
+      continue;
+    mLiveBranches[mNumLiveBranches++] = branch;
+    mIsRig = mIsRig || branch > 0;
+  }
+  // Branches that resample add latency; the others wait for them, as far as the alignment delay goes.
+  const int latency = _GetModelLatency();
+  int misalignment = 0;
+  for (int i = 0; i < mNumLiveBranches; i++)
+  {
+    BranchMix& mix = mBranchMix[mLiveBranches[i]];
+    const int delay = latency - _GetBranchModel(mLiveBranches[i])->GetLatency();
+    mix.delay = std::min(delay, AlignmentDelay::kMaxDelay);
+    misalignment = std::max(misalignment, delay - mix.delay);
+  }
+  mRigMisalignment.store(mIsRig ? misalignment : 0, std::memory_order_relaxed);
+  _SetBranchGains();
+}
+
+int engine::Engine::_GetModelLatency() const
+{
+  int latency = 0;
+  for (int branch = 0; branch < kMaxModelBranches; branch++)
+    if (const ResamplingNAM* model = _GetBranchModel(branch))
+      latency = std::max(latency, model->GetLatency());
+  return latency;
+}
+
+bool engine::Engine::_ShouldBypass(const size_t numFrames)
+{
+  if (!mOptions.bypassSilence)
+    return false;
+  // The model's input. The gate works on the same signal; it only applies its gain after the model.
+  double thresholdDB = kSilenceThresholdDB;
+  if (mNoiseGateActive)
+    thresholdDB = std::max(thresholdDB, mNoiseGateThreshold - kGatedSilenceMarginDB);
+  if (mKernels->peak(mInputArray.data(), numFrames) > DBToAmp(thresholdDB))
+  {
+    mSilentFrames = 0;
+    mBypassingSilence = false;
+    return false;
+  }
+  mSilentFrames += numFrames;
+  // Every sample of this block has to be at least the hold time past the last sound.
+  const bool bypass = mSilentFrames >= mSilenceHoldFrames + numFrames;
+  mBypassingSilence = bypass;
+  return bypass;
+}
+
+void engine::Engine::_UpdateSilenceHold()
+{
+  double settleTime = kFilterSettleTime + (mConvolver != nullptr ? mConvolver->GetMaxDuration() : 0.0);
+  // The slowest branch of a rig
+  double modelSettleTime = mModel != nullptr ? mModelSettleTime : 0.0;
+  for (const Branch& branch : mBranches)
+    if (branch.model != nullptr)
+      modelSettleTime = std::max(modelSettleTime, branch.settleTime);
+  settleTime += modelSettleTime + (double)_GetModelLatency() / mSampleRate;
+  mSilenceHoldFrames = (size_t)(settleTime * mSampleRate);
+}
+
+void engine::Engine::_SetInputGain()
+{
+  double inputGainDB = mInputLevel;
+  // Input calibration
+  if ((mModel != nullptr) && (mModel->HasInputLevel()) && mCalibrateInput)
+  {
+    inputGainDB += mInputCalibrationLevel - mModel->GetInputLevel();
+  }
+  mInputGain = DBToAmp(inputGainDB);
+}
+
+void engine::Engine::_SetOutputGain()
+{
+  double gainDB = mOutputLevel;
+  if (mModel != nullptr)
+  {
+    switch (mOutputMode)
+    {
+      case OutputMode::Normalized:
+        if (mModel->HasLoudness())
+        {
+          const double loudness = mModel->GetLoudness();
+          const double targetLoudness = -18.0;
+          gainDB += (targetLoudness - loudness);
+        }
+        break;
+      case OutputMode::Calibrated:
+        if (mModel->HasOutputLevel())
+        {
+          const double inputLevel = mInputCalibrationLevel;
+          const double outputLevel = mModel->GetOutputLevel();
+          gainDB += (outputLevel - inputLevel);
+        }
+        break;
+      case OutputMode::Raw:
+      default: break;
+    }
+  }
+  mOutputGain = DBToAmp(gainDB);
+}
+
+void engine::Engine::_SetBranchGains()
+{
+  for (int branch = 0; branch < kMaxModelBranches; branch++)
+  {
+    BranchMix& mix = mBranchMix[branch];
+    double gainDB = mix.levelDB;
+    // Normalized is relative to branch 0, whose loudness the output gain already takes care of.
+    const ResamplingNAM* model = _GetBranchModel(branch);
+    if (branch > 0 && mOutputMode == OutputMode::Normalized && model != nullptr && model->HasLoudness()
+        && mModel != nullptr && mModel->HasLoudness())
+      gainDB += mModel->GetLoudness() - model->GetLoudness();
+    mix.gain = DBToAmp(gainDB);
+    // Balance: panning to one side turns the other side down. The middle is unity on both, like the mono mix.
+    mix.gainLeft = mix.gain * std::min(1.0, 1.0 - mix.pan);
+    mix.gainRight = mix.gain * std::min(1.0, 1.0 + mix.pan);
+  }
+}
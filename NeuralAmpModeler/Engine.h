@@ -0,0 +1,531 @@
+#pragma once
+
+// The plugin's signal chain, without the plugin.
+//
+// Input level, noise gate, model (or a rig of up to four), tone stack, IR, DC blocker and output level, plus the
+// staging that lets models and IRs be swapped while audio is running. No iPlug2 or GUI in here, so it can be built on
+// its own (the nam_engine target in tools/CMakeLists.txt) and used by anything that has audio buffers: the plugin is an
+// adapter over it, and the headless tools run exactly the same code.
+//
+// Threads:
+// * Process() is the audio thread.
+// * Reset() must not run concurrently with Process().
+// * Staging (StageModel(), StageIR(), Clear...()) and the parameter setters may be called from one other thread while
+//   Process() runs. Staged models and IRs go live at the start of the next Process().
+// * What Process() swaps out is deleted by ReleaseRetired(), which staging calls too, never on the audio thread.
+
+#include <algorithm> // std::fill
+#include <array>
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "AudioDSPTools/dsp/ImpulseResponse.h"
+#include "AudioDSPTools/dsp/NoiseGate.h"
+#include "AudioDSPTools/dsp/RecursiveLinearFilter.h"
+#include "AudioDSPTools/dsp/dsp.h"
+#include "AudioDSPTools/dsp/wav.h"
+#include "NeuralAmpModelerCore/NAM/get_dsp.h"
+
+#include "Activations.h"
+#include "DSPKernels.h"
+#include "IRBlend.h"
+#include "NamFile.h"
+#include "LoudnessAnalysis.h"
+#include "ModelProfile.h"
+#include "Pipeline.h"
+#include "ResamplingNAM.h"
+#include "RetireQueue.h"
+#include "ToneStack.h"
+
+namespace engine
+{
+// The chain is mono inside, except after a rig whose branches are panned.
+constexpr size_t kNumChannelsInternal = 1;
+constexpr size_t kMaxChannelsInternal = 2;
+// Models in a rig, counting the main one
+constexpr int kMaxModelBranches = 4;
+// Cutoff of the high-pass at the end of the chain, in Hz. Also sets the plugin's tail.
+constexpr double kDCBlockerFrequency = 5.0;
+
+enum class OutputMode
+{
+  Raw = 0,
+  // Towards a common loudness, if the model knows its loudness
+  Normalized,
+  // Matches the model's output level to the input calibration, if it knows its output level
+  Calibrated
+};
+
+struct Options
+{
+  // Divide the input by the number of input channels when mixing down, so that stereo isn't twice as loud. A
+  // standalone app where the user plugs into one input of many probably doesn't want this.
+  bool averageInputChannels = true;
+  // Clamp the output to [-1, 1], e.g. when going straight to an interface
+  bool clampOutput = false;
+  // Work out the loudness of models that don't have it, in the background, and calibrate that against the models that
+  // do (see LoudnessAnalysis.h)
+  bool analyzeLoudness = true;
+  // Skip the model, tone stack and IR while the input is silent, once they've settled (see Engine::Process())
+  bool bypassSilence = true;
+  // Run a rig's branches side by side on worker threads at small block sizes, while it has two or more (see
+  // pipeline::WorkerPool)
+  bool parallelBranches = true;
+};
+
+// Approximately what one engine holds on the heap, in bytes. The model and resampler buffers belong to NAM core and
+// AudioDSPTools, so their sizes are worked out from the model's config rather than measured.
+struct MemoryReport
+{
+  // Model weights, and the copy of them that's kept for Engine::RebuildModels()
+  size_t weights = 0;
+  // Model histories and hidden states
+  size_t state = 0;
+  // Per-block buffers: the engine's, the model's and the pipeline's
+  size_t scratch = 0;
+  // IR taps and the histories that they're convolved with (see ir_blend::Convolver)
+  size_t ir = 0;
+  // The models' resamplers
+  size_t resampler = 0;
+
+  size_t Total() const { return weights + state + scratch + ir + resampler; };
+};
+
+class Engine
+{
+public:
+  Engine(const Options& options = Options());
+  ~Engine();
+  Engine(const Engine&) = delete;
+  Engine& operator=(const Engine&) = delete;
+
+  // Processing ======================================================================================================
+
+  // Not real-time safe. Call before the first Process() and whenever the sample rate or max block size changes.
+  // Everything is sized for maxBlockSize; if the host sends a bigger block anyway, Process() takes it in pieces.
+  void Reset(const double sampleRate, const int maxBlockSize);
+
+  // Processes caller-owned buffers. The inputs are mixed down to mono and the result is written to every output
+  // channel (or, for a panned rig, left and right to the first two and right to the rest). `inputs` and `outputs` may
+  // be the same buffers. Call Reset() first.
+  void Process(DSP_SAMPLE* const* inputs, const size_t numInputChannels, DSP_SAMPLE* const* outputs,
+               const size_t numOutputChannels, const size_t numFrames);
+
+  // Moves staged models & IRs in and removes cleared ones. Process() does this at the start of every block; call it
+  // directly to make a newly staged model live before the first block (e.g. to ask for its latency).
+  void ApplyStaging();
+
+  // Deletes the models and IRs that Process() has swapped out since the last call, and returns how many there were.
+  // Not real-time safe. Call it every so often from a thread other than the audio thread (the plugin does on idle).
+  // Also stages the branches' workers if a rig that's live is going without them.
+  size_t ReleaseRetired();
+
+  // Samples of latency from input to output
+  int GetLatency() const;
+
+  // The mono input after the input level, from the last Process(). For metering. A block bigger than the max block
+  // size goes through in pieces, and this only holds the last one, so it's GetProcessedInputFrames() long.
+  const DSP_SAMPLE* GetProcessedInput() const { return mInputArray.data(); };
+  size_t GetProcessedInputFrames() const { return mProcessedInputFrames; };
+
+  double GetSampleRate() const { return mSampleRate; };
+  int GetMaxBlockSize() const { return mMaxBlockSize; };
+
+  // Not real-time safe
+  MemoryReport GetMemoryReport() const;
+
+  // Whether the last Process() skipped the chain because the input has been silent (see Options::bypassSilence)
+  bool IsBypassingSilence() const { return mBypassingSilence; };
+
+  // Two-core pipelining (see Pipeline.h); opt-in with NAM_PIPELINE=1
+  bool IsPipelined() const { return mPipeline.IsRunning(); };
+  const DSPLoadMeter& GetPipelineWorkerLoad() const { return mPipeline.GetWorkerLoad(); };
+  // Whether a rig's branches run on worker threads (see Options::parallelBranches)
+  bool IsRunningBranchesInParallel() const { return mHasBranchPool.load(std::memory_order_relaxed); };
+
+  // Models and IRs ==================================================================================================
+
+  // Accuracy of the activations in models staged from now on (see Activations.h). Models that are already loaded keep
+  // what they were built with, so RebuildModels() to switch. Rational unless set.
+  void SetActivationAccuracy(const dsp::activations::Accuracy accuracy) { mActivationAccuracy = accuracy; };
+  dsp::activations::Accuracy GetActivationAccuracy() const { return mActivationAccuracy; };
+  // Same for the resampler, for models that aren't at the host's sample rate (see ResamplingNAM.h). High unless set.
+  void SetResamplerQuality(const ResamplerQuality quality) { mResamplerQuality = quality; };
+  ResamplerQuality GetResamplerQuality() const { return mResamplerQuality; };
+  // Loads a model (.nam or legacy directory) and stages it.
+  // Returns an empty string on success, or an error message on failure. If `modelData` is given, it receives the
+  // model's config and weights.
+  std::string StageModel(const std::filesystem::path& modelPath, nam::dspData* modelData = nullptr);
+  // Builds the models that were staged last (the one above and a rig's branches) again, with the activation accuracy
+  // and resampler quality that are set now, and stages them. They're built from the config and weights that they were
+  // loaded with, not from their files, except for models in the remote engine, which are loaded again.
+  // Returns an empty string on success, or the first error.
+  std::string RebuildModels();
+  // Loads an IR into a slot of the IR blend (see below) and stages the result. Slot 0 is the plugin's IR.
+  dsp::wav::LoadReturnCode StageIR(const std::filesystem::path& irPath, const int slot = 0);
+  // Same, from data that's already in memory
+  void StageIR(const dsp::ImpulseResponse::IRData& irData, const int slot = 0);
+  // Gives the most recently staged model a loudness, as if it had come with one (e.g. from loudness::Measure()). Takes
+  // effect at the start of the next Process().
+  void SetModelLoudness(const double loudness)
+  {
+    mAnalyzedLoudness = loudness;
+    mAnalyzedModelID = mStagedModelID;
+  };
+  // Take away the model/IR at the start of the next Process()
+  void ClearModel()
+  {
+    mShouldRemoveModel = true;
+    mModelSources[0] = ModelSource();
+  };
+  void ClearIR(const int slot = 0);
+
+  // The model that's live, if any. Not real-time safe to hold on to across a Process() that swaps it.
+  const ResamplingNAM* GetModel() const { return mModel.get(); };
+  bool HasModel() const { return mModel != nullptr; };
+  bool HasModelOrStagedModel() const { return mModel != nullptr || mStagedModel != nullptr; };
+  // Staging thread
+  bool HasIROrStagedIR() const { return mLatestConvolver != nullptr; };
+
+  // Each returns true once after the corresponding change went live in Process().
+  bool ConsumeNewModelLoaded() { return mNewModelLoaded.exchange(false); };
+  bool ConsumeModelCleared() { return mModelCleared.exchange(false); };
+  // The live model got its loudness from the background analysis
+  bool ConsumeLoudnessAnalyzed() { return mLoudnessAnalyzed.exchange(false); };
+  // A model in the remote engine gave up on its daemon (see RemoteInference.h) and is playing silence. Models staged
+  // from then on are loaded here, so restage what's loaded to get it back.
+  bool ConsumeRemoteModelLost() { return mRemoteModelLost.load() && !mRemoteModelLossConsumed.exchange(true); };
+
+  // Parameters ======================================================================================================
+
+  void SetInputLevel(const double db);
+  // Use the model's input level to match the interface's calibration
+  void SetCalibrateInput(const bool active);
+  // dBu for 0 dBFS at the interface's input
+  void SetInputCalibrationLevel(const double dbu);
+  void SetNoiseGateActive(const bool active) { mNoiseGateActive = active; };
+  void SetNoiseGateThreshold(const double db) { mNoiseGateThreshold = db; };
+  void SetToneStackActive(const bool active) { mToneStackActive = active; };
+  // 0 to 10, 5 is "noon"
+  void SetBass(const double value)
+  {
+    mToneStack->SetParam("bass", value);
+    mToneStackRight->SetParam("bass", value);
+  };
+  void SetMiddle(const double value)
+  {
+    mToneStack->SetParam("middle", value);
+    mToneStackRight->SetParam("middle", value);
+  };
+  void SetTreble(const double value)
+  {
+    mToneStack->SetParam("treble", value);
+    mToneStackRight->SetParam("treble", value);
+  };
+  void SetIRActive(const bool active) { mIRActive = active; };
+  void SetOutputLevel(const double db);
+  void SetOutputMode(const OutputMode mode);
+
+  // Rig =============================================================================================================
+  //
+  // Up to kMaxModelBranches models play the same gated input side by side, each at its own level and pan, and are mixed
+  // before the tone stack. Branch 0 is the model above (its level applies without a rig too); the others are staged and
+  // cleared the same way. Branches whose resampling adds less latency are delayed to line up with the rest. In the
+  // Normalized output mode, branches are matched to branch 0's loudness if both know theirs. A panned rig with two or
+  // more outputs makes the rest of the chain stereo; otherwise pan is ignored. Rigs don't use the two-core pipeline:
+  // their branches run in parallel instead.
+
+  // As StageModel(), for branch 1 to kMaxModelBranches - 1 (0 is StageModel() itself)
+  std::string StageBranchModel(const int branch, const std::filesystem::path& modelPath);
+  void ClearBranchModel(const int branch);
+  bool HasBranchModel(const int branch) const;
+  // Whether a branch after the first is live
+  bool IsRig() const { return mIsRig; };
+  // Samples by which the live branches are still out of line, because one adds more latency than the alignment delay
+  // can make up for. 0 unless resampling from a very different rate.
+  int GetRigMisalignment() const { return mRigMisalignment.load(std::memory_order_relaxed); };
+  void SetBranchLevel(const int branch, const double db);
+  // -1 (left) to 1 (right)
+  void SetBranchPan(const int branch, const double pan);
+
+  // IR blend ========================================================================================================
+  //
+  // Up to ir_blend::kMaxIRs IRs, each with a gain and a delay, are blended into the one IR that the chain convolves
+  // with (see IRBlend.h). Changing a gain, delay or max length re-blends on the calling thread, from the IRs that are
+  // already loaded, and rewrites the convolution's taps in place; the audio thread crossfades to them over its next
+  // block, so nothing is allocated there and knob moves aren't held up. Loading or clearing an IR does the same unless
+  // the blend no longer fits (or would fit in far less), in which case a new convolution is staged and the chain
+  // crossfades to it over a few milliseconds.
+
+  void SetIRGain(const int slot, const double db);
+  // 0 to ir_blend::kMaxDelayMs
+  void SetIRDelay(const int slot, const double ms);
+  // Trims the blend to this many seconds, which makes the convolution cheaper (see ir_blend::Trim()). 0 for all of it.
+  // Re-blends like a gain change.
+  void SetIRMaxLength(const double seconds);
+  double GetIRMaxLength() const { return mIRMaxLength; };
+  // Seconds in the last blend that was staged, before trimming. Staging thread.
+  double GetIRBlendDuration() const { return mIRBlendDuration; };
+
+private:
+  // What a model's weights and state take, worked out from its config when it's staged
+  struct ModelMemory
+  {
+    size_t weights = 0;
+    size_t state = 0;
+    size_t scratchPerFrame = 0;
+  };
+
+  // Fallback that just copies inputs to outputs if there's no model.
+  void _FallbackDSP(DSP_SAMPLE** inputs, DSP_SAMPLE** outputs, const size_t numChannels, const size_t numFrames);
+  // Process(), for a block that's no bigger than mMaxBlockSize
+  void _ProcessBlock(DSP_SAMPLE* const* inputs, const size_t numInputChannels, DSP_SAMPLE* const* outputs,
+                     const size_t numOutputChannels, const size_t numFrames);
+  // Noise gate trigger, NAM (or the rig), and noise gate gain. This is the part that the pipeline runs on its worker
+  // thread. Returns the pointers to the gated output, which has two channels if mStereoThisBlock.
+  DSP_SAMPLE** _ProcessFirstStage(DSP_SAMPLE** inputs, DSP_SAMPLE** outputs, const size_t numFrames);
+  // Runs the live branches on mBranchInput and mixes them into `outputs`
+  void _ProcessRig(DSP_SAMPLE** outputs, const size_t numFrames);
+  // One branch's model, into its own buffer. Job `job` of the worker pool.
+  void _ProcessBranch(const int job);
+  // Mix the input buffers down into the internal buffer, applying input level.
+  void _ProcessInput(DSP_SAMPLE* const* inputs, const size_t numChannels, const size_t numFrames);
+  // Broadcast the internal buffers to the output buffers, applying output level.
+  void _ProcessOutput(DSP_SAMPLE* const* input, const size_t numInputChannels, DSP_SAMPLE* const* outputs,
+                      const size_t numChannels, const size_t numFrames);
+  // Blends the loaded IRs and stages the result, or clears the IR if there are none
+  void _StageIRBlend();
+  // Loads a model for staging and works out what it takes. Throws std::runtime_error.
+  std::unique_ptr<ResamplingNAM> _LoadModel(const std::filesystem::path& modelPath, nam::dspData& data,
+                                            ModelMemory& memory, double& settleTime);
+  // The same from its config and weights
+  std::unique_ptr<ResamplingNAM> _BuildModel(const nam::dspData& data, ModelMemory& memory, double& settleTime);
+  std::unique_ptr<ResamplingNAM> _WrapModel(std::unique_ptr<nam::DSP> model, const nam::dspData& data,
+                                            ModelMemory& memory, double& settleTime);
+  // StageModel() and StageBranchModel(). Builds from `fromData` if it's given, and loads `modelPath` if not.
+  std::string _StageModel(const int branch, const std::filesystem::path& modelPath, const nam::dspData* fromData,
+                          nam::dspData* modelData);
+  // The swaps in ApplyStaging(), when there's room to retire what they replace. Returns whether anything changed.
+  bool _SwapStaged();
+  // Resetting for models and IRs, called by Reset(). Settled models are left as they are.
+  void _ResetModelAndIR(const double sampleRate, const int maxBlockSize, const bool modelsSettled);
+  // Start or stop the pipelined mode, called by Reset()
+  void _ResetPipeline(const double sampleRate, const int maxBlockSize);
+  // Workers for a rig's branches, if they're wanted and the block size is small enough; otherwise null
+  std::unique_ptr<pipeline::WorkerPool> _MakeBranchPool();
+  // Staging thread. Stages workers for the branches, unless some are live or staged already.
+  void _StageBranchPool();
+  // Audio thread, after the branches change. Takes staged workers if there's a rig of two or more branches for them,
+  // and retires them when there isn't.
+  void _UpdateBranchPool();
+  // The model branch's model, or null
+  ResamplingNAM* _GetBranchModel(const int branch) const;
+  // After the live branches change: which ones to mix, and how much to delay each one
+  void _UpdateRig();
+  // Latency of the model, or of the slowest branch of a rig
+  int _GetModelLatency() const;
+  // Counts silent input and returns whether this block can be skipped
+  bool _ShouldBypass(const size_t numFrames);
+  // How much silence the chain needs to settle, for what's live now
+  void _UpdateSilenceHold();
+
+  void _SetInputGain();
+  void _SetOutputGain();
+  void _SetBranchGains();
+
+  Options mOptions;
+  double mSampleRate = 48000.0;
+  int mMaxBlockSize = 0;
+
+  // Internal mono buffers
+  std::vector<DSP_SAMPLE> mInputArray;
+  // How much of mInputArray the last Process() filled
+  size_t mProcessedInputFrames = 0;
+  std::vector<DSP_SAMPLE> mOutputArray;
+  // The right side of a panned rig
+  std::vector<DSP_SAMPLE> mOutputArrayRight;
+
+  // Vectorized loops for the CPU we're running on
+  const dsp::kernels::KernelTable* mKernels = nullptr;
+
+  // Parameters
+  double mInputLevel = 0.0;
+  bool mCalibrateInput = false;
+  double mInputCalibrationLevel = 12.0;
+  bool mNoiseGateActive = true;
+  double mNoiseGateThreshold = -80.0;
+  bool mToneStackActive = true;
+  bool mIRActive = true;
+  double mOutputLevel = 0.0;
+  OutputMode mOutputMode = OutputMode::Normalized;
+  dsp::activations::Accuracy mActivationAccuracy = dsp::activations::Accuracy::Rational;
+  ResamplerQuality mResamplerQuality = ResamplerQuality::High;
+
+  // Input and output gain, from the parameters and the model
+  double mInputGain = 1.0;
+  double mOutputGain = 1.0;
+
+  // Noise gates
+  dsp::noise_gate::Trigger mNoiseGateTrigger;
+  dsp::noise_gate::Gain mNoiseGateGain;
+  // Read by the first stage, which may be on the pipeline's worker
+  bool mNoiseGateActiveThisBlock = true;
+
+  // What the model staged last on each branch was loaded from, for RebuildModels(). Staging thread.
+  struct ModelSource
+  {
+    std::filesystem::path path;
+    // No architecture for models in the remote engine
+    nam::dspData data;
+  };
+  std::array<ModelSource, kMaxModelBranches> mModelSources;
+
+  // The model actually being used:
+  std::unique_ptr<ResamplingNAM> mModel;
+  ModelMemory mModelMemory;
+  // The one that it replaced, on its way out, and its output. Only the first stage touches these, apart from swaps.
+  std::unique_ptr<ResamplingNAM> mFadingModel;
+  std::vector<DSP_SAMPLE> mFadingModelOutput;
+  size_t mModelFadePosition = 0;
+  size_t mModelFadeLength = 0;
+  // Whether the last Reset() skipped mModel for the staged model that's replacing it
+  bool mModelStale = false;
+  // And the IR. Both sides of a panned rig share it.
+  std::unique_ptr<ir_blend::Convolver> mConvolver;
+  // Manages switching what DSP is being used.
+  std::unique_ptr<ResamplingNAM> mStagedModel;
+  ModelMemory mStagedModelMemory;
+  // Handed over whole, with one atomic exchange each way. Whoever takes it out owns it.
+  std::atomic<ir_blend::Convolver*> mStagedConvolver = nullptr;
+  // Flags to take away the modules at a safe time.
+  std::atomic<bool> mShouldRemoveModel = false;
+  std::atomic<bool> mShouldRemoveIR = false;
+  // What the IR is blended from. Staging thread only.
+  struct IRSlot
+  {
+    bool loaded = false;
+    dsp::ImpulseResponse::IRData data;
+    double gainDB = 0.0;
+    double delayMs = 0.0;
+  };
+  std::array<IRSlot, ir_blend::kMaxIRs> mIRSlots;
+  double mIRMaxLength = 0.0;
+  double mIRBlendDuration = 0.0;
+  // The convolution that was staged last, live or not, whose taps a re-blend rewrites. It's only retired after a newer
+  // one has been staged or the IR cleared, which is this thread too, so it's never freed under us.
+  ir_blend::Convolver* mLatestConvolver = nullptr;
+  // The one that was live before the last swap, on its way out, and its output
+  std::unique_ptr<ir_blend::Convolver> mFadingConvolver;
+  std::vector<DSP_SAMPLE> mFadingOutput;
+  size_t mIRFadePosition = 0;
+  size_t mIRFadeLength = 0;
+
+  std::atomic<bool> mNewModelLoaded = false;
+  std::atomic<bool> mModelCleared = false;
+  // Set by a remote model when it loses its daemon, and never unset
+  std::atomic<bool> mRemoteModelLost = false;
+  std::atomic<bool> mRemoteModelLossConsumed = false;
+  // Where the audio thread puts what it swaps out
+  retire::RetireQueue mRetired;
+
+  // Tone stack modules
+  std::unique_ptr<dsp::tone_stack::AbstractToneStack> mToneStack;
+
+  // Post-IR filters
+  recursive_linear_filter::HighPass mHighPass;
+
+  // The right side's modules, for a panned rig
+  std::unique_ptr<dsp::tone_stack::AbstractToneStack> mToneStackRight;
+  recursive_linear_filter::HighPass mHighPassRight;
+
+  // Rig branches after the first (which is mModel), at [branch - 1]
+  struct Branch
+  {
+    std::unique_ptr<ResamplingNAM> model;
+    std::unique_ptr<ResamplingNAM> stagedModel;
+    std::atomic<bool> shouldRemove = false;
+    ModelMemory memory;
+    ModelMemory stagedMemory;
+    double settleTime = 0.0;
+    double stagedSettleTime = 0.0;
+  };
+  std::array<Branch, kMaxModelBranches - 1> mBranches;
+
+  // Delays a branch by up to kMaxDelay samples, in place
+  class AlignmentDelay
+  {
+  public:
+    static constexpr int kMaxDelay = 1023;
+    void Reset() { std::fill(mBuffer.begin(), mBuffer.end(), (DSP_SAMPLE)0); };
+    void Process(DSP_SAMPLE* samples, const size_t numFrames, const int delay)
+    {
+      for (size_t s = 0; s < numFrames; s++)
+      {
+        mBuffer[mWrite] = samples[s];
+        samples[s] = mBuffer[(mWrite - delay) & kMaxDelay];
+        mWrite = (mWrite + 1) & kMaxDelay;
+      }
+    };
+
+  private:
+    std::array<DSP_SAMPLE, kMaxDelay + 1> mBuffer = {};
+    int mWrite = 0;
+  };
+
+  // How each branch, including the first, goes into the mix
+  struct BranchMix
+  {
+    double levelDB = 0.0;
+    double pan = 0.0;
+    // From the level, the pan and loudness matching
+    double gain = 1.0;
+    double gainLeft = 1.0;
+    double gainRight = 1.0;
+    // To line up with the branch with the most latency
+    int delay = 0;
+    AlignmentDelay alignment;
+    std::vector<DSP_SAMPLE> output;
+  };
+  std::array<BranchMix, kMaxModelBranches> mBranchMix;
+  // The branches with a model, in order. Audio thread.
+  std::array<int, kMaxModelBranches> mLiveBranches = {};
+  int mNumLiveBranches = 0;
+  bool mIsRig = false;
+  std::atomic<int> mRigMisalignment = 0;
+  // For the branches' jobs, set for each block
+  DSP_SAMPLE* mBranchInput = nullptr;
+  size_t mBranchNumFrames = 0;
+  bool mStereoThisBlock = false;
+  // Only there while a rig has two or more branches. Staged and retired like the models, since starting and stopping
+  // threads isn't for the audio thread.
+  std::unique_ptr<pipeline::WorkerPool> mBranchPool;
+  std::atomic<pipeline::WorkerPool*> mStagedBranchPool = nullptr;
+  // Set by the audio thread: whether mBranchPool is there, and whether a rig is going without it
+  std::atomic<bool> mHasBranchPool = false;
+  std::atomic<bool> mBranchPoolWanted = false;
+
+  // Silence bypass: how long the live and staged model take to settle once their input stops, how many frames of
+  // silence that adds up to for the whole chain (with the IR's), and how many there have been
+  double mModelSettleTime = 0.0;
+  double mStagedModelSettleTime = 0.0;
+  size_t mSilenceHoldFrames = 0;
+  size_t mSilentFrames = 0;
+  std::atomic<bool> mBypassingSilence = false;
+
+  // Opt-in two-core mode for heavy chains at small buffer sizes (set NAM_PIPELINE=1)
+  pipeline::TwoStagePipeline<DSP_SAMPLE> mPipeline;
+
+  // Loudness for models without it. Each staged model gets an ID so that a late result can't land on a newer model.
+  uint64_t mNextModelID = 1;
+  uint64_t mStagedModelID = 0;
+  uint64_t mModelID = 0;
+  std::atomic<uint64_t> mAnalyzedModelID = 0;
+  std::atomic<double> mAnalyzedLoudness = 0.0;
+  std::atomic<bool> mLoudnessAnalyzed = false;
+  // Last, so that its thread is stopped before anything it writes to goes away
+  loudness::BackgroundAnalyzer mLoudnessAnalyzer;
+};
+}; // namespace engine
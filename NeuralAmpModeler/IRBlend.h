@@ -0,0 +1,254 @@
+#pragma once
+
+// Blending up to four IRs (two mics, two cabs, ...) into the one that the chain convolves with.
+//
+// Convolution is linear, so convolving the input with each IR at its own gain and delay and adding up the results is
+// the same as convolving it once with the gained, delayed IRs added up. The blend is worked out off the audio thread
+// whenever an IR, gain or delay changes, so four IRs cost one convolution as long as the longest of them (plus its
+// delay) instead of four, and a gain change costs a re-blend rather than a reload (see Engine::SetIRGain()).
+//
+// The IRs can be at different sample rates; they're blended straight at the host's. A gain, delay or length change only
+// rewrites the Convolver's taps in place, which the audio thread crossfades to over one block.
+
+#include <algorithm> // std::copy, std::max, std::min
+#include <array>
+#include <atomic>
+#include <cmath> // std::acos, std::ceil, std::cos, std::floor, std::pow
+#include <vector>
+
+#include "AudioDSPTools/dsp/ImpulseResponse.h"
+#include "DSPKernels.h"
+
+namespace ir_blend
+{
+constexpr int kMaxIRs = 4;
+// Enough to line up mics at different distances (50 ms is 17 m)
+constexpr double kMaxDelayMs = 50.0;
+
+struct Layer
+{
+  const dsp::ImpulseResponse::IRData* data = nullptr;
+  double gainDB = 0.0;
+  double delayMs = 0.0;
+};
+
+// Adds `audio` at `fromRate`, scaled by `gain` and delayed by `delay` seconds, to `mix` at `toRate`. Cubic
+// (Catmull-Rom) interpolation, which is exact where the positions land on samples, i.e. at the same rate and a
+// whole-sample delay.
+inline void AddLayer(const std::vector<float>& audio, const double fromRate, const double gain, const double delay,
+                     const double toRate, std::vector<float>& mix)
+{
+  if (audio.empty() || fromRate <= 0.0 || toRate <= 0.0)
+    return;
+  const double step = fromRate / toRate;
+  const double delaySamples = delay * toRate;
+  const size_t length = (size_t)std::ceil(delaySamples + (double)audio.size() / step);
+  if (mix.size() < length)
+    mix.resize(length, 0.0f);
+  const long last = (long)audio.size() - 1;
+  auto sample = [&](const long i) { return i < 0 || i > last ? 0.0f : audio[i]; };
+  for (size_t i = (size_t)std::max(0.0, std::floor(delaySamples)); i < length; i++)
+  {
+    const double position = ((double)i - delaySamples) * step;
+    const long k = (long)std::floor(position);
+    const float t = (float)(position - (double)k);
+    const float y0 = sample(k - 1), y1 = sample(k), y2 = sample(k + 1), y3 = sample(k + 2);
+    const float value =
+      y1 + 0.5f * t * (y2 - y0 + t * (2.0f * y0 - 5.0f * y1 + 4.0f * y2 - y3 + t * (3.0f * (y1 - y2) + y3 - y0)));
+    mix[i] += (float)gain * value;
+  }
+}
+
+// Like AudioDSPTools' ImpulseResponse, the chain convolves with no more taps than this.
+constexpr size_t kMaxTaps = 8192;
+
+// The blend of `layers` (which mustn't be empty), at `sampleRate`, with no more than kMaxTaps taps
+inline std::vector<float> Blend(const std::vector<Layer>& layers, const double sampleRate)
+{
+  std::vector<float> blend;
+  for (const Layer& layer : layers)
+  {
+    const double gain = std::pow(10.0, layer.gainDB / 20.0);
+    const double delay = std::max(0.0, std::min(kMaxDelayMs, layer.delayMs)) / 1000.0;
+    AddLayer(layer.data->mRawAudio, layer.data->mRawAudioSampleRate, gain, delay, sampleRate, blend);
+  }
+  if (blend.size() > kMaxTaps)
+    blend.resize(kMaxTaps);
+  return blend;
+}
+
+// The most taps that a blend of `layers` at `sampleRate` can have, whatever their gains and delays
+inline size_t GetMaxBlendLength(const std::vector<Layer>& layers, const double sampleRate)
+{
+  size_t length = 0;
+  for (const Layer& layer : layers)
+    if (layer.data->mRawAudioSampleRate > 0.0)
+      length = std::max(length, (size_t)std::ceil((kMaxDelayMs / 1000.0) * sampleRate
+                                                  + (double)layer.data->mRawAudio.size() * sampleRate
+                                                      / layer.data->mRawAudioSampleRate));
+  return std::min(length, kMaxTaps);
+}
+
+// Cuts `ir` down to `length` samples, fading out over the last quarter of what's left so that the cut doesn't click.
+// Does nothing if it's that short already.
+inline void Trim(std::vector<float>& ir, const size_t length)
+{
+  if (length == 0 || ir.size() <= length)
+    return;
+  ir.resize(length);
+  const size_t fadeLength = std::max<size_t>(1, length / 4);
+  const double pi = std::acos(-1.0);
+  for (size_t i = 0; i < fadeLength; i++)
+  {
+    const double t = (double)(i + 1) / (double)fadeLength;
+    ir[length - fadeLength + i] *= (float)(0.5 * (1.0 + std::cos(pi * t)));
+  }
+}
+
+// The chain's convolution with the blend: the same time-domain convolution as AudioDSPTools' ImpulseResponse (and at
+// the same gain), but with taps that can be replaced while it runs, without allocating or starting over.
+//
+// There's room for up to a fixed number of taps, set when it's made. SetIR() writes new taps into a spare buffer on
+// the staging thread and hands it over with an atomic exchange; the audio thread picks it up at the start of its next
+// block and crossfades from the old taps to the new ones over that block. The input history doesn't depend on the taps,
+// so the new ones are heard straight away. Four buffers go round: the audio thread's current and fading ones, the one
+// being handed over, and the one that SetIR() is writing.
+class Convolver
+{
+public:
+  // For IRs of up to `maxLength` taps at `sampleRate`, and a history for each of `numChannels` channels. Convolves
+  // with `ir` (at `sampleRate`) from the start, with `kernels` (or the ones for this CPU). Allocates.
+  Convolver(const std::vector<float>& ir, const double sampleRate, const size_t maxLength, const int maxBlockSize,
+            const int numChannels, const dsp::kernels::KernelTable* kernels = nullptr)
+  : mKernels(kernels != nullptr ? kernels : &dsp::kernels::GetKernels())
+  , mSampleRate(sampleRate)
+  , mMaxLength(std::max<size_t>(1, std::min(maxLength, kMaxTaps)))
+  , mMaxBlockSize((size_t)std::max(1, maxBlockSize))
+  {
+    for (std::vector<float>& taps : mTaps)
+      taps.assign(mMaxLength, 0.0f);
+    mHistory.resize(numChannels);
+    for (std::vector<float>& history : mHistory)
+      history.assign(mMaxLength - 1 + kHistoryBlocks * mMaxBlockSize, 0.0f);
+    mHistoryIndex.assign(numChannels, mMaxLength - 1);
+    _WriteTaps(ir, mFront);
+  };
+
+  // Staging thread. Convolves with `ir` (at the sample rate that this was made for, cut to GetMaxLength()) from the
+  // audio thread's next block on. Doesn't allocate.
+  void SetIR(const std::vector<float>& ir)
+  {
+    _WriteTaps(ir, mBack);
+    mBack = mHandover.exchange(mBack | kFresh, std::memory_order_acq_rel) & kIndexMask;
+  };
+
+  // Audio thread, once per block before Process()
+  void BeginBlock()
+  {
+    mFadingThisBlock = (mHandover.load(std::memory_order_acquire) & kFresh) != 0;
+    if (!mFadingThisBlock)
+      return;
+    // SetIR() only ever gets back the spare, so the fading taps are ours until the next block.
+    const int fresh = mHandover.exchange(mSpare, std::memory_order_acq_rel) & kIndexMask;
+    mFading = mFront;
+    mFront = fresh;
+    mSpare = mFading;
+  };
+
+  // Audio thread. Convolves a block of `channel`. `output` may be `input`.
+  void Process(const int channel, const DSP_SAMPLE* input, DSP_SAMPLE* output, const size_t numFrames)
+  {
+    // A block that's bigger than we were made for goes through in pieces that fit the history.
+    for (size_t offset = 0; offset < numFrames; offset += mMaxBlockSize)
+      _ProcessChunk(channel, input + offset, output + offset, std::min(mMaxBlockSize, numFrames - offset), offset,
+                    numFrames);
+  };
+
+  double GetSampleRate() const { return mSampleRate; };
+  size_t GetMaxLength() const { return mMaxLength; };
+  // Seconds of the longest IR that it can take, which is as long as its output can take to die away
+  double GetMaxDuration() const { return (double)mMaxLength / mSampleRate; };
+  size_t GetMemoryBytes() const
+  {
+    size_t bytes = 0;
+    for (const std::vector<float>& taps : mTaps)
+      bytes += sizeof(float) * taps.capacity();
+    for (const std::vector<float>& history : mHistory)
+      bytes += sizeof(float) * history.capacity();
+    return bytes;
+  };
+
+private:
+  static constexpr int kNumBuffers = 4;
+  static constexpr int kIndexMask = 3;
+  // Set in the handover index when it's new taps
+  static constexpr int kFresh = 4;
+  // The history holds this many blocks before it has to go back to the start
+  static constexpr size_t kHistoryBlocks = 8;
+
+  // Reversed and scaled, the way that AudioDSPTools' ImpulseResponse does it
+  void _WriteTaps(const std::vector<float>& ir, const int buffer)
+  {
+    const size_t length = std::min(ir.size(), mMaxLength);
+    const float gain = (float)(std::pow(10.0, -18.0 * 0.05) * 48000.0 / mSampleRate);
+    std::vector<float>& taps = mTaps[buffer];
+    for (size_t i = 0, j = length - 1; i < length; i++, j--)
+      taps[j] = gain * ir[i];
+    mNumTaps[buffer] = length;
+  };
+
+  void _ProcessChunk(const int channel, const DSP_SAMPLE* input, DSP_SAMPLE* output, const size_t numFrames,
+                     const size_t fadeOffset, const size_t fadeLength)
+  {
+    std::vector<float>& history = mHistory[channel];
+    size_t& index = mHistoryIndex[channel];
+    if (index + numFrames > history.size())
+    {
+      std::copy(history.begin() + (index - (mMaxLength - 1)), history.begin() + index, history.begin());
+      index = mMaxLength - 1;
+    }
+    for (size_t s = 0; s < numFrames; s++)
+      history[index + s] = (float)input[s];
+    for (size_t s = 0; s < numFrames; s++)
+    {
+      const size_t last = index + s;
+      float y = _Dot(mFront, history, last);
+      if (mFadingThisBlock)
+      {
+        const float t = (float)(fadeOffset + s + 1) / (float)fadeLength;
+        y = t * y + (1.0f - t) * _Dot(mFading, history, last);
+      }
+      output[s] = (DSP_SAMPLE)y;
+    }
+    index += numFrames;
+  };
+
+  // The output for the sample at `last` in `history`, with taps `buffer`
+  float _Dot(const int buffer, const std::vector<float>& history, const size_t last) const
+  {
+    const size_t numTaps = mNumTaps[buffer];
+    if (numTaps == 0)
+      return 0.0f;
+    return mKernels->dot(mTaps[buffer].data(), &history[last + 1 - numTaps], numTaps);
+  };
+
+  const dsp::kernels::KernelTable* mKernels;
+  const double mSampleRate;
+  const size_t mMaxLength;
+  const size_t mMaxBlockSize;
+  std::array<std::vector<float>, kNumBuffers> mTaps;
+  std::array<size_t, kNumBuffers> mNumTaps = {};
+  // Audio thread
+  int mFront = 0;
+  int mFading = 1;
+  int mSpare = 1;
+  bool mFadingThisBlock = false;
+  // Between the two
+  std::atomic<int> mHandover = 2;
+  // Staging thread
+  int mBack = 3;
+  // Per channel, each of which sees a block at a time
+  std::vector<std::vector<float>> mHistory;
+  std::vector<size_t> mHistoryIndex;
+};
+}; // namespace ir_blend
@@ -0,0 +1,151 @@
+#pragma once
+
+// Loading models in the legacy directory format (config.json + weights.npy, like the captures in Models/).
+//
+// NAM core reads the .npy through a general-purpose reader. Here the file is memory-mapped, its header is checked
+// against the one layout that the exporter ever wrote (a flat little-endian float32 array), and the payload is taken
+// straight from the mapping. The only copy is into dspData's weight vector, which is what NAM core builds models from.
+//
+// Used through nam_file::GetDSP() (see NamFile.h). Errors are std::runtime_errors, like NAM core's.
+
+#include <cstdint>
+#include <cstring> // memcmp, memcpy
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include "NeuralAmpModelerCore/NAM/dsp.h"
+#include "NeuralAmpModelerCore/NAM/get_dsp.h"
+
+#include "MappedFile.h"
+
+namespace legacy_model
+{
+// A 1-D (or C-ordered N-D) little-endian float32 .npy file, mapped
+class NpyFile
+{
+public:
+  explicit NpyFile(const std::filesystem::path& path)
+  {
+    if (!mFile.Open(path))
+      throw std::runtime_error("Can't open " + path.u8string());
+    const uint8_t* bytes = mFile.GetData();
+    const size_t size = mFile.GetSize();
+
+    // Magic, version, header length, header
+    if (size < 10 || memcmp(bytes, "\x93NUMPY", 6) != 0)
+      throw std::runtime_error(path.u8string() + " isn't a .npy file");
+    const uint8_t majorVersion = bytes[6];
+    size_t headerStart = 0, headerLength = 0;
+    if (majorVersion == 1)
+    {
+      headerStart = 10;
+      headerLength = (size_t)bytes[8] | ((size_t)bytes[9] << 8);
+    }
+    else if ((majorVersion == 2 || majorVersion == 3) && size >= 12)
+    {
+      headerStart = 12;
+      headerLength = (size_t)bytes[8] | ((size_t)bytes[9] << 8) | ((size_t)bytes[10] << 16) | ((size_t)bytes[11] << 24);
+    }
+    else
+      throw std::runtime_error(path.u8string() + ": unsupported .npy version " + std::to_string(majorVersion));
+    if (headerStart + headerLength > size)
+      throw std::runtime_error(path.u8string() + ": truncated .npy header");
+    const std::string header(reinterpret_cast<const char*>(bytes) + headerStart, headerLength);
+
+    if (_GetValue(header, "descr") != "'<f4'")
+      throw std::runtime_error(path.u8string() + ": weights must be little-endian float32");
+    if (_GetValue(header, "fortran_order") != "False")
+      throw std::runtime_error(path.u8string() + ": weights must be in C order");
+    const std::string shape = _GetValue(header, "shape");
+    if (shape.size() < 2 || shape.front() != '(' || shape.back() != ')')
+      throw std::runtime_error(path.u8string() + ": can't read the shape " + shape);
+    mSize = 1;
+    for (size_t i = 1; i + 1 < shape.size();)
+    {
+      size_t length = 0;
+      unsigned long long dimension = 0;
+      try
+      {
+        dimension = std::stoull(shape.substr(i), &length);
+      }
+      catch (const std::logic_error&)
+      {
+        throw std::runtime_error(path.u8string() + ": can't read the shape " + shape);
+      }
+      mSize *= (size_t)dimension;
+      i += length;
+      while (i + 1 < shape.size() && (shape[i] == ',' || shape[i] == ' '))
+        i++;
+    }
+
+    const size_t payloadStart = headerStart + headerLength;
+    if (size - payloadStart < sizeof(float) * mSize)
+      throw std::runtime_error(path.u8string() + ": truncated .npy payload");
+    mData = bytes + payloadStart;
+  };
+
+  size_t GetSize() const { return mSize; };
+  // Copies the payload. NumPy pads the header so that the payload is 16- (or 64-) byte aligned in the file, and so in
+  // the mapping, but this doesn't rely on it.
+  void CopyTo(float* output) const { memcpy(output, mData, sizeof(float) * mSize); };
+
+private:
+  // The value for `key` in the header's Python dict literal, e.g. "'<f4'", "False" or "(12073,)"
+  static std::string _GetValue(const std::string& header, const std::string& key)
+  {
+    const size_t keyPosition = header.find("'" + key + "'");
+    if (keyPosition == std::string::npos)
+      return "";
+    size_t start = header.find(':', keyPosition);
+    if (start == std::string::npos)
+      return "";
+    start = header.find_first_not_of(' ', start + 1);
+    if (start == std::string::npos)
+      return "";
+    const size_t end = header[start] == '(' ? header.find(')', start) + 1 : header.find_first_of(",}", start);
+    if (end == std::string::npos || end == 0)
+      return "";
+    return header.substr(start, end - start);
+  };
+
+  io::MappedFile mFile;
+  const uint8_t* mData = nullptr;
+  size_t mSize = 0;
+};
+
+inline bool IsLegacyDirectory(const std::filesystem::path& path)
+{
+  return std::filesystem::is_directory(path) && std::filesystem::exists(path / "config.json");
+}
+
+// Reads a legacy directory into the form that nam::get_dsp(dspData&) takes.
+inline void LoadDirectory(const std::filesystem::path& directory, nam::dspData& data)
+{
+  std::ifstream configFile(directory / "config.json");
+  if (!configFile)
+    throw std::runtime_error("Can't open " + (directory / "config.json").u8string());
+  nlohmann::json j;
+  try
+  {
+    configFile >> j;
+  }
+  catch (const nlohmann::json::exception& e)
+  {
+    throw std::runtime_error((directory / "config.json").u8string() + ": " + e.what());
+  }
+  // The same as NAM core, down to a missing "metadata" being null
+  nam::verify_config_version(j["version"]);
+  data.version = j["version"];
+  data.architecture = j["architecture"];
+  data.config = j["config"];
+  data.metadata = j["metadata"];
+  // Legacy exports predate the sample rate field; NAM core takes -1 as "unknown".
+  data.expected_sample_rate = j.find("sample_rate") != j.end() ? j["sample_rate"].get<double>() : -1.0;
+
+  const NpyFile weights(directory / "weights.npy");
+  data.weights.resize(weights.GetSize());
+  weights.CopyTo(data.weights.data());
+}
+}; // namespace legacy_model
@@ -0,0 +1,403 @@
+#pragma once
+
+// Loudness for models that don't come with it.
+//
+// The "Normalized" output mode needs the model's loudness, which the trainer measures at export time: it renders its
+// standard input through the model and takes the RMS of the output in dB. Older exports (e.g. the legacy directories
+// in Models/) don't have it. For those, the engine does the same thing on a background thread with its own copy of the
+// model and applies the result when it's done (see Engine::StageModel()).
+//
+// The trainer's input file doesn't ship with the plugin, so the test signal here is a synthesized stand-in: plucked
+// strings (single notes and chords across the neck) at the RMS level of a typical DI. Numbers come out close to the
+// trainer's but not identical, and how far off they are depends on the model. So models that do come with a loudness
+// are measured here too, once each, and the typical difference is added to what's measured for the ones that don't
+// (see Calibration). There's no built-in offset; it's learned from the models that each user loads.
+//
+// Expected error: for a model analyzed here, it's how far that model's own offset would be from the median offset.
+// Calibration::GetSpread() (the median absolute deviation of the learned offsets; nam-render prints it) is the typical
+// size of that. Until kMinModels models have been learned from, there's no correction at all, and the error is the
+// whole offset.
+//
+// Results are cached on disk, keyed by a hash of the model's config and weights, so that a model is only ever analyzed
+// once per machine. The offset that was applied is cached along with the measurement, so once a model has a loudness
+// it keeps it, however many more models are learned from afterwards. Another machine that learned from other models
+// may have given it a different one, though. Set NAM_CACHE_DIR to put the cache somewhere else.
+
+#include <algorithm> // std::copy, std::max, std::min, std::nth_element
+#include <atomic>
+#include <cmath> // std::fabs, std::sqrt, std::log10, std::pow
+#include <cstdint>
+#include <cstdlib> // std::getenv
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "NeuralAmpModelerCore/NAM/dsp.h"
+#include "BackgroundJobs.h"
+#include "NamFile.h"
+
+namespace loudness
+{
+// Bump when the test signal, the measurement or what's cached changes so that old cache entries aren't used.
+constexpr int kAnalysisVersion = 2;
+// Seconds of test signal
+constexpr double kTestSignalDuration = 6.0;
+// RMS of the test signal in dBFS. About what the DI in REAPER/ measures.
+constexpr double kTestSignalLevel = -36.0;
+
+// The stand-in for the trainer's input at `sampleRate`. The same every time.
+inline std::vector<NAM_SAMPLE> MakeTestSignal(const double sampleRate)
+{
+  // Open strings and a few chords, each left to ring for half a second
+  const std::vector<std::vector<double>> notes = {
+    {82.41}, {110.0}, {146.83}, {196.0}, {246.94}, {329.63}, // E A D G B E
+    {82.41, 123.47, 164.81, 207.65, 246.94, 329.63}, // E major
+    {110.0, 164.81, 220.0, 277.18, 329.63}, // A major
+    {146.83, 220.0, 293.66, 369.99}, // D major
+    {98.0, 146.83, 196.0, 246.94, 293.66, 392.0}, // G major
+    {164.81}, {220.0}};
+  const size_t length = (size_t)(kTestSignalDuration * sampleRate);
+  const size_t noteLength = std::max<size_t>(1, length / notes.size());
+  std::vector<double> signal(length, 0.0);
+  std::minstd_rand rng(1);
+  std::uniform_real_distribution<double> noise(-1.0, 1.0);
+  for (size_t n = 0; n < notes.size(); n++)
+  {
+    const size_t noteStart = n * noteLength;
+    for (size_t string = 0; string < notes[n].size(); string++)
+    {
+      // Karplus-Strong: a burst of noise recirculating through a damped delay line
+      const size_t period = std::max<size_t>(2, (size_t)(sampleRate / notes[n][string]));
+      std::vector<double> delayLine(period);
+      for (auto& x : delayLine)
+        x = noise(rng);
+      // Strummed, not struck all at once
+      const size_t strumOffset = string * (size_t)(0.012 * sampleRate);
+      for (size_t i = noteStart + strumOffset, j = 0; i < std::min(length, noteStart + noteLength); i++, j++)
+      {
+        const size_t k = j % period;
+        const double y = delayLine[k];
+        delayLine[k] = 0.4985 * (y + delayLine[(k + 1) % period]);
+        signal[i] += y;
+      }
+    }
+  }
+  double sumSquares = 0.0;
+  for (const double x : signal)
+    sumSquares += x * x;
+  const double rms = std::sqrt(sumSquares / std::max<size_t>(1, length));
+  const double gain = rms > 0.0 ? std::pow(10.0, kTestSignalLevel / 20.0) / rms : 0.0;
+  std::vector<NAM_SAMPLE> output(length);
+  for (size_t i = 0; i < length; i++)
+    output[i] = (NAM_SAMPLE)(gain * signal[i]);
+  return output;
+}
+
+// Renders the test signal through `model` at its own sample rate and returns the output's RMS in dB, like the
+// trainer. Resets the model. Returns false if cancelled.
+inline bool Measure(nam::DSP& model, double& loudness, const std::atomic<bool>* cancel = nullptr)
+{
+  const double sampleRate = model.GetExpectedSampleRate() > 0.0 ? model.GetExpectedSampleRate() : 48000.0;
+  const std::vector<NAM_SAMPLE> signal = MakeTestSignal(sampleRate);
+  const int blockSize = 4096;
+  model.ResetAndPrewarm(sampleRate, blockSize);
+  std::vector<NAM_SAMPLE> input(blockSize), output(blockSize);
+  double sumSquares = 0.0;
+  for (size_t start = 0; start < signal.size(); start += blockSize)
+  {
+    if (cancel != nullptr && cancel->load())
+      return false;
+    const int numFrames = (int)std::min<size_t>(blockSize, signal.size() - start);
+    std::copy(signal.begin() + start, signal.begin() + start + numFrames, input.begin());
+    model.process(input.data(), output.data(), numFrames);
+    for (int i = 0; i < numFrames; i++)
+      sumSquares += (double)output[i] * (double)output[i];
+  }
+  const double rms = std::sqrt(sumSquares / std::max<size_t>(1, signal.size()));
+  loudness = 20.0 * std::log10(std::max(rms, 1.0e-10));
+  return true;
+}
+
+// Identifies a model by what it computes, not where it's stored (FNV-1a of the config and weights)
+inline std::string HashModel(const nam::dspData& data)
+{
+  uint64_t hash = 0xcbf29ce484222325ull;
+  auto add = [&hash](const void* bytes, const size_t size) {
+    const uint8_t* p = static_cast<const uint8_t*>(bytes);
+    for (size_t i = 0; i < size; i++)
+      hash = (hash ^ p[i]) * 0x100000001b3ull;
+  };
+  add(&kAnalysisVersion, sizeof(kAnalysisVersion));
+  add(data.architecture.data(), data.architecture.size());
+  const std::string config = data.config.dump();
+  add(config.data(), config.size());
+  add(data.weights.data(), sizeof(float) * data.weights.size());
+  add(&data.expected_sample_rate, sizeof(data.expected_sample_rate));
+  std::ostringstream hex;
+  hex << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return hex.str();
+}
+
+// Where per-user caches go on this platform (empty if there's nowhere)
+inline std::filesystem::path GetCacheDirectory()
+{
+  const char* cacheDir = std::getenv("NAM_CACHE_DIR");
+  if (cacheDir != nullptr && cacheDir[0] != '\0')
+    return std::filesystem::u8path(cacheDir);
+#if defined(_WIN32)
+  const wchar_t* localAppData = _wgetenv(L"LOCALAPPDATA");
+  if (localAppData != nullptr && localAppData[0] != L'\0')
+    return std::filesystem::path(localAppData) / "NeuralAmpModeler";
+#elif defined(__APPLE__)
+  const char* home = std::getenv("HOME");
+  if (home != nullptr && home[0] != '\0')
+    return std::filesystem::u8path(home) / "Library" / "Caches" / "NeuralAmpModeler";
+#else
+  const char* xdgCache = std::getenv("XDG_CACHE_HOME");
+  if (xdgCache != nullptr && xdgCache[0] != '\0')
+    return std::filesystem::u8path(xdgCache) / "NeuralAmpModeler";
+  const char* home = std::getenv("HOME");
+  if (home != nullptr && home[0] != '\0')
+    return std::filesystem::u8path(home) / ".cache" / "NeuralAmpModeler";
+#endif
+  return {};
+}
+
+// One small file per model, in `subdirectory` of `directory`, with a line of numbers in it. Safe to share between
+// processes: entries are written to a temporary file and renamed into place.
+class Cache
+{
+public:
+  explicit Cache(const std::filesystem::path& directory, const char* subdirectory = "loudness")
+  : mDirectory(directory.empty() ? directory : directory / subdirectory) {};
+
+  const std::filesystem::path& GetDirectory() const { return mDirectory; };
+
+  // False unless the entry has (at least) `numValues` numbers
+  bool Lookup(const std::string& key, double* values, const size_t numValues) const
+  {
+    if (mDirectory.empty())
+      return false;
+    std::ifstream file(mDirectory / key);
+    for (size_t i = 0; i < numValues; i++)
+      if (!(file >> values[i]))
+        return false;
+    return true;
+  };
+  bool Lookup(const std::string& key, double& value) const { return Lookup(key, &value, 1); };
+
+  void Store(const std::string& key, const double* values, const size_t numValues) const
+  {
+    if (mDirectory.empty())
+      return;
+    std::error_code error;
+    std::filesystem::create_directories(mDirectory, error);
+    std::ostringstream tempName;
+    tempName << key << ".tmp" << std::random_device()();
+    const std::filesystem::path tempPath = mDirectory / tempName.str();
+    {
+      std::ofstream file(tempPath);
+      file << std::setprecision(17);
+      for (size_t i = 0; i < numValues; i++)
+        file << (i > 0 ? " " : "") << values[i];
+      file << std::endl;
+      if (!file)
+        return;
+    }
+    std::filesystem::rename(tempPath, mDirectory / key, error);
+    if (error)
+      std::filesystem::remove(tempPath, error);
+  };
+  void Store(const std::string& key, const double value) const { Store(key, &value, 1); };
+
+private:
+  std::filesystem::path mDirectory;
+};
+
+// How much louder the trainer says models are than Measure() does, learned from models that come with a loudness (see
+// BackgroundAnalyzer::Learn()). Kept per model next to the cache, so that a model only counts once. The directory is
+// read the first time that it's needed; after that, only what's learned here is added. Thread-safe.
+class Calibration
+{
+public:
+  // Models to learn from before there's an offset
+  static constexpr size_t kMinModels = 3;
+
+  explicit Calibration(const std::filesystem::path& cacheDirectory)
+  : mOffsets(cacheDirectory, "loudness-offsets") {};
+
+  bool Has(const std::string& key) const
+  {
+    double offset = 0.0;
+    return mOffsets.Lookup(key, offset);
+  };
+  void Store(const std::string& key, const double offset)
+  {
+    mOffsets.Store(key, offset);
+    std::lock_guard<std::mutex> lock(mMutex);
+    _Load();
+    mLearned.push_back(offset);
+  };
+
+  // Models learned from so far
+  size_t GetNumModels()
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    _Load();
+    return mLearned.size();
+  };
+
+  // In dB, to add to Measure(): the median over the models learned from, so that one odd model doesn't skew it. 0 until
+  // there are kMinModels of them.
+  double GetOffset()
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    _Load();
+    return mLearned.size() < kMinModels ? 0.0 : _Median(mLearned);
+  };
+
+  // In dB: the median absolute deviation of the offsets from GetOffset(), which is about how far off a model that's
+  // analyzed with it will be. 0 until there are kMinModels.
+  double GetSpread()
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    _Load();
+    if (mLearned.size() < kMinModels)
+      return 0.0;
+    const double median = _Median(mLearned);
+    std::vector<double> deviations;
+    for (const double offset : mLearned)
+      deviations.push_back(std::fabs(offset - median));
+    return _Median(deviations);
+  };
+
+private:
+  static double _Median(std::vector<double> values)
+  {
+    auto middle = values.begin() + values.size() / 2;
+    std::nth_element(values.begin(), middle, values.end());
+    return *middle;
+  };
+
+  void _Load()
+  {
+    if (mLoaded)
+      return;
+    mLoaded = true;
+    if (mOffsets.GetDirectory().empty())
+      return;
+    std::error_code error;
+    for (std::filesystem::directory_iterator it(mOffsets.GetDirectory(), error), end; !error && it != end;
+         it.increment(error))
+    {
+      double offset = 0.0;
+      // Skipping entries that are still being written
+      const std::string key = it->path().filename().u8string();
+      if (key.find(".tmp") == std::string::npos && mOffsets.Lookup(key, offset))
+        mLearned.push_back(offset);
+    }
+  };
+
+  Cache mOffsets;
+  std::mutex mMutex;
+  bool mLoaded = false;
+  std::vector<double> mLearned;
+};
+
+// Works out a model's loudness on a background thread (or finds it in the cache) and calls back with it from that
+// thread. What's cached for each model is Measure()'s number and the Calibration's offset at the time, so that a model
+// keeps the loudness that it was first given.
+class BackgroundAnalyzer
+{
+public:
+  using Callback = std::function<void(double loudness)>;
+
+  BackgroundAnalyzer(const std::filesystem::path& cacheDirectory = GetCacheDirectory())
+  : mCache(cacheDirectory)
+  , mCalibration(cacheDirectory) {};
+  BackgroundAnalyzer(const BackgroundAnalyzer&) = delete;
+  BackgroundAnalyzer& operator=(const BackgroundAnalyzer&) = delete;
+
+  // Replaces any analysis that's in progress (without waiting for it); its callback won't be called.
+  void Start(const nam::dspData& data, Callback onDone)
+  {
+    std::lock_guard<std::mutex> lock(mCallbackMutex);
+    mJobs.Start([this, data, onDone](const std::atomic<bool>& cancel) {
+      double loudness = 0.0;
+      if (!Analyze(data, loudness, &cancel))
+        return;
+      std::lock_guard<std::mutex> lock(mCallbackMutex);
+      if (!cancel)
+        onDone(loudness);
+    });
+  };
+
+  // The same on this thread, for the tools. Returns false if cancelled or if the model can't be built.
+  bool Analyze(const nam::dspData& data, double& loudness, const std::atomic<bool>* cancel = nullptr)
+  {
+    const std::string key = HashModel(data);
+    // Measured, offset
+    double entry[2] = {};
+    if (!mCache.Lookup(key, entry, 2))
+    {
+      if (!_Measure(data, cancel, entry[0]))
+        return false;
+      entry[1] = mCalibration.GetOffset();
+      mCache.Store(key, entry, 2);
+    }
+    loudness = entry[0] + entry[1];
+    return true;
+  };
+
+  // For a model that came with the trainer's loudness: measures it too (if it hasn't been already), for the
+  // Calibration. Replaces any analysis that's in progress, like Start().
+  void Learn(const nam::dspData& data, const double trainerLoudness)
+  {
+    std::lock_guard<std::mutex> lock(mCallbackMutex);
+    mJobs.Start([this, data, trainerLoudness](const std::atomic<bool>& cancel) {
+      const std::string key = HashModel(data);
+      double loudness = 0.0;
+      if (!mCalibration.Has(key) && _Measure(data, &cancel, loudness))
+        mCalibration.Store(key, trainerLoudness - loudness);
+    });
+  };
+
+  // Stops whatever's in progress without waiting for it to finish
+  void Cancel()
+  {
+    std::lock_guard<std::mutex> lock(mCallbackMutex);
+    mJobs.CancelAll();
+  };
+
+  Calibration& GetCalibration() { return mCalibration; };
+
+private:
+  // Renders the model for Measure(). Returns false if cancelled or if the model can't be built.
+  static bool _Measure(const nam::dspData& data, const std::atomic<bool>* cancel, double& loudness)
+  {
+    try
+    {
+      std::unique_ptr<nam::DSP> model = nam_file::BuildDSP(data);
+      return Measure(*model, loudness, cancel);
+    }
+    catch (const std::exception&)
+    {
+      return false;
+    }
+  };
+
+  Cache mCache;
+  Calibration mCalibration;
+  // Held while a callback is made, so that once Cancel() returns there won't be one
+  std::mutex mCallbackMutex;
+  background::Jobs mJobs;
+};
+}; // namespace loudness
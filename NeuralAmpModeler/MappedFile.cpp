@@ -0,0 +1,92 @@
+#if defined(_WIN32)
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#include "MappedFile.h"
+
+bool io::MappedFile::Open(const std::filesystem::path& path)
+{
+  Close();
+#if defined(_WIN32)
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+  {
+    CloseHandle(file);
+    return false;
+  }
+  HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  const void* data = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+  if (data == nullptr)
+  {
+    if (mapping != nullptr)
+      CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  mFile = file;
+  mMapping = mapping;
+  mData = static_cast<const uint8_t*>(data);
+  mSize = (size_t)size.QuadPart;
+#else
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  struct stat info;
+  void* data = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && info.st_size > 0)
+    data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps the file.
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+  madvise(data, (size_t)info.st_size, MADV_SEQUENTIAL);
+  mData = static_cast<const uint8_t*>(data);
+  mSize = (size_t)info.st_size;
+#endif
+  mReleased = 0;
+  return true;
+}
+
+void io::MappedFile::Close()
+{
+  if (mData == nullptr)
+    return;
+#if defined(_WIN32)
+  UnmapViewOfFile(mData);
+  CloseHandle(mMapping);
+  CloseHandle(mFile);
+  mMapping = nullptr;
+  mFile = nullptr;
+#else
+  munmap(const_cast<uint8_t*>(mData), mSize);
+#endif
+  mData = nullptr;
+  mSize = 0;
+}
+
+void io::MappedFile::Release(const size_t offset)
+{
+#if !defined(_WIN32)
+  static const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+  const size_t end = (offset < mSize ? offset : mSize) / pageSize * pageSize;
+  if (mData == nullptr || end <= mReleased)
+    return;
+  madvise(const_cast<uint8_t*>(mData) + mReleased, end - mReleased, MADV_DONTNEED);
+  mReleased = end;
+#else
+  // Windows trims the working set of a read-only view by itself.
+  (void)offset;
+#endif
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+// A read-only, memory-mapped view of a whole file. Used for audio (see WavIO.h) and models (see NamFile.h and
+// LegacyModel.h) so that they're decoded straight from the page cache instead of being read into a buffer first.
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+namespace io
+{
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  ~MappedFile() { Close(); };
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool Open(const std::filesystem::path& path);
+  void Close();
+  bool IsOpen() const { return mData != nullptr; };
+  const uint8_t* GetData() const { return mData; };
+  size_t GetSize() const { return mSize; };
+  // Tells the OS that [0, offset) won't be needed again. The mapping stays valid; the pages just get read again if
+  // they're touched.
+  void Release(const size_t offset);
+
+private:
+  const uint8_t* mData = nullptr;
+  size_t mSize = 0;
+  size_t mReleased = 0;
+#if defined(_WIN32)
+  void* mFile = nullptr;
+  void* mMapping = nullptr;
+#endif
+};
+}; // namespace io
@@ -0,0 +1,281 @@
+#pragma once
+
+// What a model costs to run.
+//
+// The static part (parameters, MACs per sample, receptive field, state memory) is worked out from the model's config
+// when it's loaded. The dynamic part is a short microbenchmark on a separate copy of the model, run on a background
+// thread so that neither loading nor the audio thread waits on it.
+//
+// This doesn't depend on the plugin or the GUI so that the headless tools can use it too (see tools/nam-profile.cpp).
+
+#include <algorithm> // std::max
+#include <atomic>
+#include <chrono>
+#include <cmath> // std::ceil
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "NeuralAmpModelerCore/NAM/dsp.h"
+#include "BackgroundJobs.h"
+#include "NamFile.h"
+
+namespace model_profile
+{
+// Mirrors LAYER_ARRAY_BUFFER_SIZE in NeuralAmpModelerCore/NAM/wavenet.h: each WaveNet layer keeps this many samples
+// of history on top of its layer array's receptive field.
+constexpr long kWaveNetLayerBufferSize = 65536;
+
+// Above this fraction of one core, we tell the user that the model probably won't keep up.
+constexpr double kRealtimeWarningLoad = 0.7;
+
+struct ModelProfile
+{
+  std::string architecture;
+  // Number of weights in the model file
+  size_t numParameters = 0;
+  // Multiply-accumulates per sample at the model's own sample rate
+  double macsPerSample = 0.0;
+  // In samples. Recurrent models don't have one.
+  long receptiveField = 0;
+  bool recurrent = false;
+  // Bytes of internal state (histories, hidden states), not counting the weights
+  size_t stateBytes = 0;
+  // Bytes of per-block buffers for each sample of the block (at the model's sample rate)
+  size_t scratchBytesPerFrame = 0;
+
+  // Filled in by the benchmark
+  bool benchmarked = false;
+  // Fraction of one core needed to run in real time at the host settings below
+  double estimatedLoad = 0.0;
+  double hostSampleRate = 0.0;
+  int hostBlockSize = 0;
+
+  bool IsLikelyTooHeavy() const { return benchmarked && estimatedLoad > kRealtimeWarningLoad; };
+};
+
+namespace detail
+{
+inline void ProfileWaveNet(const nlohmann::json& config, ModelProfile& profile)
+{
+  long receptiveField = 1;
+  for (const auto& layerArray : config["layers"])
+  {
+    const long inputSize = layerArray["input_size"];
+    const long conditionSize = layerArray["condition_size"];
+    const long headSize = layerArray["head_size"];
+    const long channels = layerArray["channels"];
+    const long kernelSize = layerArray["kernel_size"];
+    const bool gated = layerArray["gated"];
+    const long convOutChannels = gated ? 2 * channels : channels;
+
+    // Rechannel in, then the layers, then rechannel to the head
+    profile.macsPerSample += (double)(inputSize * channels + channels * headSize);
+    long arrayReceptiveField = 0;
+    for (const auto& dilation : layerArray["dilations"])
+    {
+      const long d = dilation;
+      // Dilated conv, condition mix-in, 1x1
+      profile.macsPerSample +=
+        (double)(kernelSize * channels * convOutChannels + conditionSize * convOutChannels + channels * channels);
+      arrayReceptiveField += (kernelSize - 1) * d;
+    }
+    // Every layer's buffer is sized for the whole array's receptive field.
+    const size_t numLayers = layerArray["dilations"].size();
+    profile.stateBytes += sizeof(float) * numLayers * channels * (kWaveNetLayerBufferSize + arrayReceptiveField);
+    // Rechannel output, each layer's conv output and residual, and the head's accumulator
+    profile.scratchBytesPerFrame += sizeof(float) * (channels + numLayers * (convOutChannels + channels) + headSize);
+    receptiveField += arrayReceptiveField;
+  }
+  profile.receptiveField = receptiveField;
+}
+
+inline void ProfileLSTM(const nlohmann::json& config, ModelProfile& profile)
+{
+  const long numLayers = config["num_layers"];
+  const long inputSize = config["input_size"];
+  const long hiddenSize = config["hidden_size"];
+  for (long i = 0; i < numLayers; i++)
+  {
+    const long layerInputSize = i == 0 ? inputSize : hiddenSize;
+    // Gates, plus the elementwise products for the cell and hidden state
+    profile.macsPerSample += (double)(4 * hiddenSize * (layerInputSize + hiddenSize) + 3 * hiddenSize);
+    // [x, h], the gates, and c
+    profile.stateBytes += sizeof(float) * ((layerInputSize + hiddenSize) + 4 * hiddenSize + hiddenSize);
+  }
+  // Head
+  profile.macsPerSample += (double)hiddenSize;
+  profile.recurrent = true;
+  profile.receptiveField = 0;
+}
+
+inline void ProfileConvNet(const nlohmann::json& config, ModelProfile& profile)
+{
+  const long channels = config["channels"];
+  const bool batchnorm = config["batchnorm"];
+  const long kernelSize = 2;
+  long receptiveField = 1;
+  long inChannels = 1;
+  for (const auto& dilation : config["dilations"])
+  {
+    const long d = dilation;
+    profile.macsPerSample += (double)(kernelSize * inChannels * channels + (batchnorm ? channels : 0));
+    receptiveField += (kernelSize - 1) * d;
+    inChannels = channels;
+  }
+  profile.macsPerSample += (double)channels; // Head
+  profile.receptiveField = receptiveField;
+  profile.stateBytes += sizeof(float) * channels * receptiveField;
+  // Each block's output
+  profile.scratchBytesPerFrame += sizeof(float) * channels * config["dilations"].size();
+}
+
+inline void ProfileLinear(const nlohmann::json& config, ModelProfile& profile)
+{
+  const long receptiveField = config["receptive_field"];
+  profile.macsPerSample += (double)receptiveField;
+  profile.receptiveField = receptiveField;
+  profile.stateBytes += sizeof(float) * receptiveField;
+}
+}; // namespace detail
+
+// The parts that we can get from the config and weights without running anything
+inline ModelProfile ProfileConfig(const nam::dspData& data)
+{
+  ModelProfile profile;
+  profile.architecture = data.architecture;
+  profile.numParameters = data.weights.size();
+  try
+  {
+    if (data.architecture == "WaveNet")
+      detail::ProfileWaveNet(data.config, profile);
+    else if (data.architecture == "LSTM")
+      detail::ProfileLSTM(data.config, profile);
+    else if (data.architecture == "ConvNet")
+      detail::ProfileConvNet(data.config, profile);
+    else if (data.architecture == "Linear")
+      detail::ProfileLinear(data.config, profile);
+  }
+  catch (const nlohmann::json::exception&)
+  {
+    // Unexpected config; leave what we don't know as zero rather than failing the load.
+  }
+  return profile;
+}
+
+// Seconds of CPU time per sample that the model needs when run in blocks of `blockSize` at its own sample rate.
+// Runs for about `durationSeconds` of wall-clock time.
+inline double BenchmarkSecondsPerSample(nam::DSP& model, const int blockSize, const double durationSeconds,
+                                        const std::atomic<bool>* cancel = nullptr)
+{
+  using Clock = std::chrono::steady_clock;
+  std::vector<NAM_SAMPLE> input(blockSize), output(blockSize);
+  std::minstd_rand rng(0);
+  std::uniform_real_distribution<double> noise(-0.1, 0.1);
+  for (auto& x : input)
+    x = (NAM_SAMPLE)noise(rng);
+
+  // Warm up caches and the branch predictor before timing
+  for (int i = 0; i < 8; i++)
+    model.process(input.data(), output.data(), blockSize);
+
+  long numSamples = 0;
+  const auto start = Clock::now();
+  double elapsed = 0.0;
+  while (elapsed < durationSeconds && !(cancel != nullptr && cancel->load()))
+  {
+    model.process(input.data(), output.data(), blockSize);
+    numSamples += blockSize;
+    elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  }
+  return numSamples > 0 ? elapsed / (double)numSamples : 0.0;
+}
+
+// Fills in the benchmark part of the profile with `model`, which should be an instance of its own (not the one that's
+// processing audio).
+inline void Benchmark(nam::DSP& model, const double hostSampleRate, const int hostBlockSize, ModelProfile& profile,
+                      const double durationSeconds = 0.25, const std::atomic<bool>* cancel = nullptr)
+{
+  const double modelSampleRate = model.GetExpectedSampleRate() > 0.0 ? model.GetExpectedSampleRate() : 48000.0;
+  // If the host's at a different rate, the model sees proportionally bigger or smaller blocks.
+  const int modelBlockSize =
+    std::max(1, (int)std::ceil((double)hostBlockSize * modelSampleRate / std::max(1.0, hostSampleRate)));
+  model.ResetAndPrewarm(modelSampleRate, modelBlockSize);
+  const double secondsPerSample = BenchmarkSecondsPerSample(model, modelBlockSize, durationSeconds, cancel);
+  profile.estimatedLoad = secondsPerSample * modelSampleRate;
+  profile.hostSampleRate = hostSampleRate;
+  profile.hostBlockSize = hostBlockSize;
+  profile.benchmarked = secondsPerSample > 0.0;
+}
+
+// Same, building the instance from `data`
+inline void Benchmark(const nam::dspData& data, const double hostSampleRate, const int hostBlockSize,
+                      ModelProfile& profile, const double durationSeconds = 0.25,
+                      const std::atomic<bool>* cancel = nullptr)
+{
+  std::unique_ptr<nam::DSP> model = nam_file::BuildDSP(data);
+  Benchmark(*model, hostSampleRate, hostBlockSize, profile, durationSeconds, cancel);
+}
+
+// Runs the benchmark on a background thread and hands the result back to whoever polls for it. The model is loaded
+// again from its file for the benchmark and freed afterwards, so nobody has to keep a copy of its weights around.
+class BackgroundProfiler
+{
+public:
+  // Replaces any profile that's in progress, without waiting for it.
+  void Start(const std::filesystem::path& modelPath, const ModelProfile& staticProfile, const double hostSampleRate,
+             const int hostBlockSize)
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mHaveResult = false;
+    mJobs.Start([this, modelPath, staticProfile, hostSampleRate, hostBlockSize](const std::atomic<bool>& cancel) {
+      ModelProfile profile = staticProfile;
+      try
+      {
+        nam::dspData data;
+        std::unique_ptr<nam::DSP> model = nam_file::GetDSP(modelPath, data);
+        data = nam::dspData();
+        Benchmark(*model, hostSampleRate, hostBlockSize, profile, 0.25, &cancel);
+      }
+      catch (const std::exception&)
+      {
+        // Leave it un-benchmarked
+      }
+      std::lock_guard<std::mutex> lock(mMutex);
+      if (cancel)
+        return;
+      mResult = profile;
+      mHaveResult = true;
+    });
+  };
+
+  // Doesn't wait for the benchmark to stop
+  void Cancel()
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mJobs.CancelAll();
+    mHaveResult = false;
+  };
+
+  // Returns true (once) when a finished profile is available.
+  // Not for the audio thread.
+  bool Poll(ModelProfile& profile)
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mHaveResult)
+      return false;
+    profile = mResult;
+    mHaveResult = false;
+    return true;
+  };
+
+private:
+  std::mutex mMutex;
+  ModelProfile mResult;
+  bool mHaveResult = false;
+  background::Jobs mJobs;
+};
+}; // namespace model_profile
@@ -0,0 +1,416 @@
+#include <cmath> // std::fabs, std::ldexp
+#include <cstdint>
+#include <cstring> // memchr, memcmp, memcpy
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+#include "NamFile.h"
+
+namespace
+{
+// Exact in a double up to 10^22
+constexpr int kMaxExactPowerOfTen = 22;
+constexpr double kPowersOfTen[kMaxExactPowerOfTen + 1] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                                          1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                                          1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+// Significant digits that always fit in a uint64
+constexpr int kMaxDigits = 19;
+
+bool IsDigit(const char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+bool IsWhitespace(const char c)
+{
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+const char* SkipWhitespace(const char* p, const char* end)
+{
+  while (p < end && IsWhitespace(*p))
+    p++;
+  return p;
+}
+
+// Structure ===========================================================================================================
+
+// Just past the closing quote of the string that starts at `p`; nullptr if it doesn't end
+const char* SkipString(const char* p, const char* end)
+{
+  for (p++; p < end; p++)
+  {
+    if (*p == '\\')
+      p++;
+    else if (*p == '"')
+      return p + 1;
+  }
+  return nullptr;
+}
+
+// Just past the value that starts at `p`; nullptr if it doesn't end. This only finds where the value ends; nlohmann
+// checks that it's valid.
+const char* SkipValue(const char* p, const char* end)
+{
+  if (p >= end)
+    return nullptr;
+  if (*p == '"')
+    return SkipString(p, end);
+  if (*p == '{' || *p == '[')
+  {
+    int depth = 0;
+    while (p < end)
+    {
+      if (*p == '"')
+      {
+        p = SkipString(p, end);
+        if (p == nullptr)
+          return nullptr;
+        continue;
+      }
+      if (*p == '{' || *p == '[')
+        depth++;
+      else if ((*p == '}' || *p == ']') && --depth == 0)
+        return p + 1;
+      p++;
+    }
+    return nullptr;
+  }
+  // A number, true, false or null
+  while (p < end && *p != ',' && *p != '}' && *p != ']' && !IsWhitespace(*p))
+    p++;
+  return p;
+}
+
+// Numbers =============================================================================================================
+
+// Eight ASCII digits at once, as a 64-bit word. The files are little-endian, as is everything that we build for.
+bool IsEightDigits(const uint64_t word)
+{
+  return (((word + 0x4646464646464646ull) | (word - 0x3030303030303030ull)) & 0x8080808080808080ull) == 0;
+}
+
+uint32_t ParseEightDigits(uint64_t word)
+{
+  word -= 0x3030303030303030ull;
+  // Pairs of digits, then pairs of pairs, then the two halves
+  word = (word * 10) + (word >> 8);
+  word = (((word & 0x000000FF000000FFull) * 0x000F424000000064ull)
+          + (((word >> 16) & 0x000000FF000000FFull) * 0x0000271000000001ull))
+         >> 32;
+  return (uint32_t)word;
+}
+
+// Commas in [p, end), eight bytes at a time
+size_t CountCommas(const char* p, const char* end)
+{
+  size_t count = 0;
+  uint64_t word;
+  for (; end - p >= 8; p += 8)
+  {
+    memcpy(&word, p, sizeof(word));
+    // 0x80 in each byte that's a comma, and nothing else
+    const uint64_t x = word ^ 0x2C2C2C2C2C2C2C2Cull;
+    const uint64_t commas = ~(((x & 0x7F7F7F7F7F7F7F7Full) + 0x7F7F7F7F7F7F7F7Full) | x | 0x7F7F7F7F7F7F7F7Full);
+    count += (size_t)(((commas >> 7) * 0x0101010101010101ull) >> 56);
+  }
+  for (; p < end; p++)
+    count += *p == ',';
+  return count;
+}
+
+// Reads the digits at `p` into `mantissa` and counts the significant ones. Leading zeros are skipped while the
+// mantissa is still 0. Returns how many digits there were, zeros included.
+size_t ReadDigits(const char*& p, const char* end, uint64_t& mantissa, int& numSignificant)
+{
+  const char* start = p;
+  if (mantissa == 0)
+    while (p < end && *p == '0')
+      p++;
+  uint64_t word;
+  while (end - p >= 8 && (memcpy(&word, p, sizeof(word)), IsEightDigits(word)))
+  {
+    // Wraps if there are too many digits, but then the caller won't use it.
+    mantissa = mantissa * 100000000ull + ParseEightDigits(word);
+    numSignificant += 8;
+    p += 8;
+  }
+  while (p < end && IsDigit(*p))
+  {
+    mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+    numSignificant++;
+    p++;
+  }
+  return (size_t)(p - start);
+}
+
+// Decodes the number at `p` to exactly what nlohmann's get<float>() gives for it and moves `p` past it. Returns false,
+// without moving `p`, if it can't be sure of that: too many digits, an exponent too large, a result too close to
+// halfway between two floats, or not a valid number at all.
+bool ParseNumberFast(const char*& p, const char* end, float& value)
+{
+  const char* q = p;
+  const bool negative = q < end && *q == '-';
+  if (negative)
+    q++;
+  // No leading zeros in JSON
+  if (q >= end || !IsDigit(*q) || (*q == '0' && q + 1 < end && IsDigit(q[1])))
+    return false;
+  uint64_t mantissa = 0;
+  int numSignificant = 0, exponent = 0;
+  bool isInteger = true;
+  ReadDigits(q, end, mantissa, numSignificant);
+  if (q < end && *q == '.')
+  {
+    q++;
+    const size_t numFractional = ReadDigits(q, end, mantissa, numSignificant);
+    if (numFractional == 0)
+      return false;
+    exponent -= (int)numFractional;
+    isInteger = false;
+  }
+  if (q < end && (*q == 'e' || *q == 'E'))
+  {
+    q++;
+    const bool negativeExponent = q < end && *q == '-';
+    if (q < end && (*q == '+' || *q == '-'))
+      q++;
+    if (q >= end || !IsDigit(*q))
+      return false;
+    int explicitExponent = 0;
+    for (; q < end && IsDigit(*q); q++)
+      if (explicitExponent < 10000)
+        explicitExponent = 10 * explicitExponent + (*q - '0');
+    exponent += negativeExponent ? -explicitExponent : explicitExponent;
+    isInteger = false;
+  }
+  if (numSignificant > kMaxDigits)
+    return false;
+
+  if (isInteger)
+  {
+    // nlohmann keeps these as integers and converts from that.
+    if (numSignificant == kMaxDigits)
+      return false;
+    value = negative ? (float)(-(int64_t)mantissa) : (float)mantissa;
+  }
+  else if (mantissa == 0)
+    value = negative ? -0.0f : 0.0f;
+  else
+  {
+    // nlohmann parses to the nearest double and converts that to float. Here, the double is approximated with at most
+    // three roundings, so it's within 2^-50 (relative) of the nearest. If it's also within 2^-26 of a float, which is
+    // less than halfway to the next one, then the nearest double rounds to that float too. Weights are floats written
+    // out in full, so this is practically always the case.
+    if (exponent < -2 * kMaxExactPowerOfTen || exponent > 2 * kMaxExactPowerOfTen)
+      return false;
+    double approximation = (double)mantissa;
+    if (exponent < 0)
+    {
+      for (; exponent < -kMaxExactPowerOfTen; exponent += kMaxExactPowerOfTen)
+        approximation /= kPowersOfTen[kMaxExactPowerOfTen];
+      approximation /= kPowersOfTen[-exponent];
+    }
+    else
+    {
+      for (; exponent > kMaxExactPowerOfTen; exponent -= kMaxExactPowerOfTen)
+        approximation *= kPowersOfTen[kMaxExactPowerOfTen];
+      approximation *= kPowersOfTen[exponent];
+    }
+    const float rounded = (float)approximation;
+    const double magnitude = std::fabs((double)rounded);
+    // Not subnormal or out of range, where the bound above doesn't hold
+    if (!(magnitude >= (double)std::numeric_limits<float>::min() && magnitude <= std::numeric_limits<float>::max()))
+      return false;
+    if (std::fabs(approximation - (double)rounded) > std::ldexp(magnitude, -26))
+      return false;
+    value = negative ? -rounded : rounded;
+  }
+  p = q;
+  return true;
+}
+
+// As above, but numbers that the fast path can't be sure of are handed to nlohmann.
+bool ParseNumber(const char*& p, const char* end, float& value)
+{
+  if (ParseNumberFast(p, end, value))
+    return true;
+  const char* numberEnd = SkipValue(p, end);
+  if (numberEnd == nullptr)
+    return false;
+  const nlohmann::json number = nlohmann::json::parse(p, numberEnd, nullptr, false);
+  if (!number.is_number())
+    return false;
+  value = number.get<float>();
+  p = numberEnd;
+  return true;
+}
+
+// The weights array that starts at `p`, straight into `weights`
+bool ParseWeights(const char*& p, const char* end, std::vector<float>& weights)
+{
+  // A flat array of numbers has no ']' before its own, and one more number than it has commas.
+  const char* close = static_cast<const char*>(memchr(p, ']', (size_t)(end - p)));
+  if (close == nullptr)
+    return false;
+  const char* q = SkipWhitespace(p + 1, close);
+  weights.resize(q == close ? 0 : CountCommas(q, close) + 1);
+  for (float& weight : weights)
+  {
+    // Anything else (e.g. a nested array) leaves this false.
+    if (!ParseNumber(q, close, weight))
+      return false;
+    q = SkipWhitespace(q, close);
+    if (q < close)
+    {
+      if (*q != ',')
+        return false;
+      q = SkipWhitespace(q + 1, close);
+    }
+  }
+  if (q != close)
+    return false;
+  p = close + 1;
+  return true;
+}
+
+// Counts the weights in the array that starts at `p` instead of decoding them
+bool CountWeights(const char*& p, const char* end, size_t& numWeights)
+{
+  const char* close = static_cast<const char*>(memchr(p, ']', (size_t)(end - p)));
+  if (close == nullptr)
+    return false;
+  const char* q = SkipWhitespace(p + 1, close);
+  numWeights = q == close ? 0 : CountCommas(q, close) + 1;
+  p = close + 1;
+  return true;
+}
+
+// Parse(), with the weights decoded into `data` or, if `countOnly`, just counted
+bool ParseFile(const char* text, const size_t size, nam::dspData& data, const bool countOnly, size_t& numWeights)
+{
+  const char* end = text + size;
+  const char* p = text;
+  // nlohmann skips a UTF-8 byte order mark too.
+  if (size >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0)
+    p += 3;
+  p = SkipWhitespace(p, end);
+  if (p == end || *p != '{')
+    return false;
+  p = SkipWhitespace(p + 1, end);
+
+  // Everything but the weights
+  nlohmann::json members = nlohmann::json::object();
+  bool hasWeights = false;
+  while (true)
+  {
+    if (p == end || *p != '"')
+      return false;
+    const char* keyEnd = SkipString(p, end);
+    if (keyEnd == nullptr)
+      return false;
+    std::string key(p + 1, keyEnd - 1);
+    if (key.find('\\') != std::string::npos)
+    {
+      const nlohmann::json unescaped = nlohmann::json::parse(p, keyEnd, nullptr, false);
+      if (!unescaped.is_string())
+        return false;
+      key = unescaped.get<std::string>();
+    }
+    p = SkipWhitespace(keyEnd, end);
+    if (p == end || *p != ':')
+      return false;
+    p = SkipWhitespace(p + 1, end);
+
+    if (key == "weights")
+    {
+      if (p == end || *p != '[')
+        return false;
+      if (countOnly ? !CountWeights(p, end, numWeights) : !ParseWeights(p, end, data.weights))
+        return false;
+      if (!countOnly)
+        numWeights = data.weights.size();
+      hasWeights = true;
+    }
+    else
+    {
+      const char* valueEnd = SkipValue(p, end);
+      if (valueEnd == nullptr)
+        return false;
+      nlohmann::json value = nlohmann::json::parse(p, valueEnd, nullptr, false);
+      if (value.is_discarded())
+        return false;
+      members[key] = std::move(value);
+      p = valueEnd;
+    }
+
+    p = SkipWhitespace(p, end);
+    if (p < end && *p == ',')
+      p = SkipWhitespace(p + 1, end);
+    else if (p < end && *p == '}')
+      break;
+    else
+      return false;
+  }
+  if (!hasWeights || SkipWhitespace(p + 1, end) != end)
+    return false;
+
+  // The same as NAM core's get_dsp(path, data)
+  nam::verify_config_version(members["version"]);
+  data.version = members["version"];
+  data.architecture = members["architecture"];
+  data.config = members["config"];
+  data.metadata = members["metadata"];
+  if (members.find("sample_rate") != members.end())
+    data.expected_sample_rate = members["sample_rate"];
+  else
+    data.expected_sample_rate = -1.0;
+  return true;
+}
+}; // namespace
+
+bool nam_file::Parse(const char* text, const size_t size, nam::dspData& data)
+{
+  size_t numWeights = 0;
+  return ParseFile(text, size, data, false, numWeights);
+}
+
+bool nam_file::ReadConfig(const std::filesystem::path& modelPath, nam::dspData& data, size_t& numWeights)
+{
+  if (legacy_model::IsLegacyDirectory(modelPath))
+  {
+    legacy_model::LoadDirectory(modelPath, data);
+    numWeights = data.weights.size();
+    data.weights = std::vector<float>();
+    return true;
+  }
+  io::MappedFile file;
+  return file.Open(modelPath)
+         && ParseFile(reinterpret_cast<const char*>(file.GetData()), file.GetSize(), data, true, numWeights);
+}
+
+std::unique_ptr<nam::DSP> nam_file::GetDSP(const std::filesystem::path& modelPath, nam::dspData& data)
+{
+  if (legacy_model::IsLegacyDirectory(modelPath))
+    legacy_model::LoadDirectory(modelPath, data);
+  else
+  {
+    io::MappedFile file;
+    if (!file.Open(modelPath) || !Parse(reinterpret_cast<const char*>(file.GetData()), file.GetSize(), data))
+    {
+      auto lock = dsp::activations::LockModelBuilding();
+      return nam::get_dsp(modelPath, data);
+    }
+  }
+  return BuildDSP(data);
+}
+
+std::unique_ptr<nam::DSP> nam_file::BuildDSP(const nam::dspData& data)
+{
+  // NAM core builds from a copy too.
+  nam::dspData copy = data;
+  auto lock = dsp::activations::LockModelBuilding();
+  return nam::get_dsp(copy);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+// Loading .nam files without building a JSON document for the whole file.
+//
+// NAM core parses a .nam into an nlohmann DOM, which turns the weights array into one heap-allocated node per weight
+// before copying them out. Here the file is memory-mapped and scanned once: the weights are decoded straight into
+// dspData's (preallocated) weight vector, and only the small members (version, architecture, config, metadata,
+// sample_rate) go through nlohmann, each on its own slice of the file.
+//
+// The result is exactly what nam::get_dsp(path, data) gives, weight for weight. Anything that the fast path doesn't
+// handle (a malformed file, weights that aren't a flat array of numbers, ...) goes to NAM core's loader instead, so
+// errors are also the same.
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+
+#include "NeuralAmpModelerCore/NAM/dsp.h"
+#include "NeuralAmpModelerCore/NAM/get_dsp.h"
+
+#include "Activations.h"
+#include "LegacyModel.h"
+
+namespace nam_file
+{
+// Parses the contents of a .nam file into `data`. Returns false if the file needs NAM core's loader. Throws like NAM
+// core if the version isn't supported.
+bool Parse(const char* text, const size_t size, nam::dspData& data);
+
+// Everything but the weights of a model (.nam or legacy directory), which are only counted, for working out what it
+// costs (see model_profile::ProfileConfig()) without loading it. A .nam is mapped and skimmed, so it's much quicker
+// than Parse(). Returns false if the file can't be read or needs NAM core's loader; throws if the version isn't
+// supported.
+bool ReadConfig(const std::filesystem::path& modelPath, nam::dspData& data, size_t& numWeights);
+
+// nam::get_dsp(path, data), with .nam files parsed as above and legacy directories loaded by LegacyModel.h
+std::unique_ptr<nam::DSP> GetDSP(const std::filesystem::path& modelPath, nam::dspData& data);
+
+// nam::get_dsp(data) on a copy of `data` (the models may modify what they're given). Use this (or GetDSP()) rather
+// than NAM core directly: it holds dsp::activations::LockModelBuilding().
+std::unique_ptr<nam::DSP> BuildDSP(const nam::dspData& data);
+}; // namespace nam_file
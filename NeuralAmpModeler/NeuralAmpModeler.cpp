@@ -1,4 +1,4 @@
-#include <algorithm> // std::clamp, std::min
+#include <algorithm> // std::clamp, std::max, std::min
 #include <cmath> // pow
 #include <filesystem>
 #include <iostream>
@@ -20,8 +20,6 @@
 using namespace iplug;
 using namespace igraphics;
 
-const double kDCBlockerFrequency = 5.0;
-
 // Styles
 const IVColorSpec colorSpec{
   DEFAULT_BGCOLOR, // Background
@@ -73,12 +71,29 @@ const std::string kCalibrateInputParamName = "CalibrateInput";
 const bool kDefaultCalibrateInput = false;
 const std::string kInputCalibrationLevelParamName = "InputCalibrationLevel";
 const double kDefaultInputCalibrationLevel = 12.0;
+// What SerializeState() puts after the params (see _GetExtras())
+const char* const kStateExtrasMarker = "###NeuralAmpModelerExtras###";
+
 
+engine::Options MakeEngineOptions()
+{
+  engine::Options options;
+#ifdef APP_API
+  // On the standalone, we can probably assume that the user has plugged into only one input and they expect it to be
+  // carried straight through.
+  options.averageInputChannels = false;
+  // Ensure valid output to interface
+  options.clampOutput = true;
+#endif
+  return options;
+}
 
 NeuralAmpModeler::NeuralAmpModeler(const InstanceInfo& info)
 : Plugin(info, MakeConfig(kNumParams, kNumPresets))
+, mEngine(MakeEngineOptions())
 {
-  _InitToneStack();
+  // WaveNet and ConvNet models get their activations from the engine (see Activations.h); this is for LSTMs, which
+  // check NAM's global switch as they run.
   nam::activations::Activation::enable_fast_tanh();
   GetParam(kInputLevel)->InitGain("Input", 0.0, -20.0, 20.0, 0.1);
   GetParam(kToneBass)->InitDouble("Bass", 5.0, 0.0, 10.0, 0.1);
@@ -93,10 +108,26 @@ NeuralAmpModeler::NeuralAmpModeler(const InstanceInfo& info)
   GetParam(kCalibrateInput)->InitBool(kCalibrateInputParamName.c_str(), kDefaultCalibrateInput);
   GetParam(kInputCalibrationLevel)
     ->InitDouble(kInputCalibrationLevelParamName.c_str(), kDefaultInputCalibrationLevel, -60.0, 60.0, 0.1, "dBu");
+  for (int branch = 0; branch < engine::kMaxModelBranches; branch++)
+  {
+    const std::string name = "Branch" + std::to_string(branch + 1);
+    GetParam(kBranchLevel + branch)->InitGain((name + "Level").c_str(), 0.0, -40.0, 40.0, 0.1);
+    GetParam(kBranchPan + branch)->InitDouble((name + "Pan").c_str(), 0.0, -1.0, 1.0, 0.01);
+  }
+  for (int slot = 0; slot < ir_blend::kMaxIRs; slot++)
+  {
+    const std::string name = "IR" + std::to_string(slot + 1);
+    GetParam(kIRGain + slot)->InitGain((name + "Gain").c_str(), 0.0, -40.0, 12.0, 0.1);
+    GetParam(kIRDelay + slot)->InitDouble((name + "Delay").c_str(), 0.0, 0.0, ir_blend::kMaxDelayMs, 0.01, "ms");
+  }
+  GetParam(kActivations)->InitEnum("Activations", kActivationsAuto, {"Exact", "Polynomial", "Rational", "Auto"});
 
-  mNoiseGateTrigger.AddListener(&mNoiseGateGain);
+  // Start the engine off with the parameters' defaults
+  for (int i = 0; i < kNumParams; i++)
+    OnParamChange(i);
 
   mMakeGraphicsFunc = [&]() {
+    mDrawStats.BeginOpen();
 
 #ifdef OS_IOS
     auto scaleFactor = GetScaleForScreen(PLUG_WIDTH, PLUG_HEIGHT) * 0.85f;
@@ -108,11 +139,18 @@ NeuralAmpModeler::NeuralAmpModeler(const InstanceInfo& info)
   };
 
   mLayoutFunc = [&](IGraphics* pGraphics) {
+    mDrawStats.BeginLayout();
     pGraphics->AttachCornerResizer(EUIResizerMode::Scale, false);
     pGraphics->AttachTextEntryControl();
     pGraphics->EnableMouseOver(true);
     pGraphics->EnableTooltips(true);
     pGraphics->EnableMultiTouch(true);
+    pGraphics->SetKeyHandlerFunc([&](const IKeyPress& key, const bool isUp) {
+      if (isUp || key.VK != kVK_D || !key.C || !key.S || !mBlackBox.IsEnabled())
+        return false;
+      _DumpBlackBox();
+      return true;
+    });
 
     pGraphics->LoadFont("Roboto-Regular", ROBOTO_FN);
     pGraphics->LoadFont("Michroma-Regular", MICHROMA_FN);
@@ -128,7 +166,6 @@ NeuralAmpModeler::NeuralAmpModeler(const InstanceInfo& info)
 
     const auto backgroundBitmap = pGraphics->LoadBitmap(BACKGROUND_FN);
     const auto fileBackgroundBitmap = pGraphics->LoadBitmap(FILEBACKGROUND_FN);
-    const auto inputLevelBackgroundBitmap = pGraphics->LoadBitmap(INPUTLEVELBACKGROUND_FN);
     const auto linesBitmap = pGraphics->LoadBitmap(LINES_FN);
     const auto knobBackgroundBitmap = pGraphics->LoadBitmap(KNOBBACKGROUND_FN);
     const auto switchHandleBitmap = pGraphics->LoadBitmap(SLIDESWITCHHANDLE_FN);
@@ -177,12 +214,14 @@ NeuralAmpModeler::NeuralAmpModeler(const InstanceInfo& info)
 
     // Misc Areas
     const auto settingsButtonArea = CornerButtonArea(b);
+    const auto rigButtonArea = settingsButtonArea.GetHShifted(-30.0f);
+    const auto degradationArea = titleArea.GetFromBottom(18.0f).GetVShifted(22.0f);
 
     // Model loader button
     auto loadModelCompletionHandler = [&](const WDL_String& fileName, const WDL_String& path) {
       if (fileName.GetLength())
       {
-        // Sets mNAMPath and mStagedNAM
+        // Sets mNAMPath and stages the model in the engine
         const std::string msg = _StageModel(fileName);
         // TODO error messages like the IR loader.
         if (msg.size())
@@ -195,6 +234,28 @@ NeuralAmpModeler::NeuralAmpModeler(const InstanceInfo& info)
       }
     };
 
+    // Model loaders on the rig page
+    auto loadBranchModelFunc = [&](const int branch, const WDL_String& fileName) {
+      const std::string msg = _StageBranchModel(branch, fileName);
+      if (msg.size())
+      {
+        std::stringstream ss;
+        ss << "Failed to load NAM model. Message:\n\n" << msg;
+        _ShowMessageBox(GetUI(), ss.str().c_str(), "Failed to load model!", kMB_OK);
+      }
+    };
+    // And IR loaders
+    auto loadIRSlotFunc = [&](const int slot, const WDL_String& fileName) {
+      const dsp::wav::LoadReturnCode retCode = _StageIRSlot(slot, fileName);
+      if (retCode != dsp::wav::LoadReturnCode::SUCCESS)
+      {
+        std::stringstream message;
+        message << "Failed to load IR file " << fileName.Get() << ":\n";
+        message << dsp::wav::GetMsgForLoadReturnCode(retCode);
+        _ShowMessageBox(GetUI(), message.str().c_str(), "Failed to load IR!", kMB_OK);
+      }
+    };
+
     // IR loader button
     auto loadIRCompletionHandler = [&](const WDL_String& fileName, const WDL_String& path) {
       if (fileName.GetLength())
@@ -212,9 +273,15 @@ NeuralAmpModeler::NeuralAmpModeler(const InstanceInfo& info)
       }
     };
 
-    pGraphics->AttachBackground(BACKGROUND_FN);
+    // Like AttachBackground(), but timed (see DrawStats)
+    pGraphics->AttachControl(new NAMBackgroundControl(backgroundBitmap, mDrawStats));
     pGraphics->AttachControl(new IBitmapControl(b, linesBitmap));
     pGraphics->AttachControl(new IVLabelControl(titleArea, "NEURAL AMP MODELER", titleStyle));
+    pGraphics
+      ->AttachControl(new NAMDegradationControl(
+                        degradationArea, IText(DEFAULT_TEXT_SIZE, EAlign::Center, PluginColors::HELP_TEXT)),
+                      kCtrlTagDegradation)
+      ->Hide(true);
     pGraphics->AttachControl(new ISVGControl(modelIconArea, modelIconSVG));
 
 #ifdef NAM_PICK_DIRECTORY
@@ -249,23 +316,35 @@ NeuralAmpModeler::NeuralAmpModeler(const InstanceInfo& info)
     pGraphics->AttachControl(new NAMKnobControl(outputKnobArea, kOutputLevel, "", style, knobBackgroundBitmap));
 
     // The meters
-    pGraphics->AttachControl(new NAMMeterControl(inputMeterArea, meterBackgroundBitmap, style), kCtrlTagInputMeter);
-    pGraphics->AttachControl(new NAMMeterControl(outputMeterArea, meterBackgroundBitmap, style), kCtrlTagOutputMeter);
+    pGraphics->AttachControl(
+      new NAMMeterControl(inputMeterArea, meterBackgroundBitmap, style, mDrawStats), kCtrlTagInputMeter);
+    pGraphics->AttachControl(
+      new NAMMeterControl(outputMeterArea, meterBackgroundBitmap, style, mDrawStats), kCtrlTagOutputMeter);
 
     // Settings/help/about box
     pGraphics->AttachControl(new NAMCircleButtonControl(
-      settingsButtonArea,
-      [pGraphics](IControl* pCaller) {
-        pGraphics->GetControlWithTag(kCtrlTagSettingsBox)->As<NAMSettingsPageControl>()->HideAnimated(false);
-      },
-      gearSVG));
+      settingsButtonArea, [this](IControl* pCaller) { _ShowSettingsPage(); }, gearSVG));
 
     pGraphics
-      ->AttachControl(new NAMSettingsPageControl(b, backgroundBitmap, inputLevelBackgroundBitmap, switchHandleBitmap,
+      ->AttachControl(new NAMSettingsPageControl(b, backgroundBitmap, INPUTLEVELBACKGROUND_FN, switchHandleBitmap,
                                                  crossSVG, style, radioButtonStyle),
                       kCtrlTagSettingsBox)
       ->Hide(true);
 
+    // The rig's other models and IRs
+    pGraphics
+      ->AttachControl(new NAMCircleButtonControl(
+        rigButtonArea, [this](IControl* pCaller) { _ShowRigPage(); }, modelIconSVG))
+      ->SetTooltip("Rig: more models to play alongside this one, and more IRs to blend with this one");
+    pGraphics
+      ->AttachControl(new NAMRigPageControl(b, backgroundBitmap, fileBackgroundBitmap, fileSVG, crossSVG, leftArrowSVG,
+                                            rightArrowSVG, style, loadBranchModelFunc, loadIRSlotFunc),
+                      kCtrlTagRigPage)
+      ->Hide(true);
+
+    // Keep this last.
+    pGraphics->AttachControl(new NAMDrawStatsControl(b, mDrawStats));
+
     pGraphics->ForAllControlsFunc([](IControl* pControl) {
       pControl->SetMouseEventsWhenDisabled(true);
       pControl->SetMouseOverWhenDisabled(true);
@@ -273,13 +352,11 @@ NeuralAmpModeler::NeuralAmpModeler(const InstanceInfo& info)
 
     // pGraphics->GetControlWithTag(kCtrlTagOutNorm)->SetMouseEventsWhenDisabled(false);
     // pGraphics->GetControlWithTag(kCtrlTagCalibrateInput)->SetMouseEventsWhenDisabled(false);
+    mDrawStats.EndLayout();
   };
 }
 
-NeuralAmpModeler::~NeuralAmpModeler()
-{
-  _DeallocateIOPointers();
-}
+NeuralAmpModeler::~NeuralAmpModeler() {}
 
 void NeuralAmpModeler::ProcessBlock(iplug::sample** inputs, iplug::sample** outputs, int nFrames)
 {
@@ -288,75 +365,33 @@ void NeuralAmpModeler::ProcessBlock(iplug::sample** inputs, iplug::sample** outp
   const size_t numChannelsInternal = kNumChannelsInternal;
   const size_t numFrames = (size_t)nFrames;
   const double sampleRate = GetSampleRate();
+  // Debug builds with NAM_RT_SANITIZER report anything in here that isn't real-time safe.
+  NAM_RT_SANITIZER_SCOPE("NeuralAmpModeler::ProcessBlock");
 
-  // Disable floating point denormals
-  std::fenv_t fe_state;
-  std::feholdexcept(&fe_state);
-  disable_denormals();
-
-  _PrepareBuffers(numChannelsInternal, numFrames);
-  // Input is collapsed to mono in preparation for the NAM.
-  _ProcessInput(inputs, numFrames, numChannelsExternalIn, numChannelsInternal);
-  _ApplyDSPStaging();
-  const bool noiseGateActive = GetParam(kNoiseGateActive)->Value();
-  const bool toneStackActive = GetParam(kEQActive)->Value();
-
-  // Noise gate trigger
-  sample** triggerOutput = mInputPointers;
-  if (noiseGateActive)
-  {
-    const double time = 0.01;
-    const double threshold = GetParam(kNoiseGateThreshold)->Value(); // GetParam...
-    const double ratio = 0.1; // Quadratic...
-    const double openTime = 0.005;
-    const double holdTime = 0.01;
-    const double closeTime = 0.05;
-    const dsp::noise_gate::TriggerParams triggerParams(time, threshold, ratio, openTime, holdTime, closeTime);
-    mNoiseGateTrigger.SetParams(triggerParams);
-    mNoiseGateTrigger.SetSampleRate(sampleRate);
-    triggerOutput = mNoiseGateTrigger.Process(mInputPointers, numChannelsInternal, numFrames);
-  }
-
-  if (mModel != nullptr)
+  const bool recording = mBlackBox.IsEnabled();
+  if (recording)
   {
-    mModel->process(triggerOutput[0], mOutputPointers[0], nFrames);
+    mBlackBox.BeginBlock(inputs, numChannelsExternalIn, numFrames);
+    _RecordSettings();
   }
-  else
-  {
-    _FallbackDSP(triggerOutput, mOutputPointers, numChannelsInternal, numFrames);
-  }
-  // Apply the noise gate after the NAM
-  sample** gateGainOutput =
-    noiseGateActive ? mNoiseGateGain.Process(mOutputPointers, numChannelsInternal, numFrames) : mOutputPointers;
-
-  sample** toneStackOutPointers = (toneStackActive && mToneStack != nullptr)
-                                    ? mToneStack->Process(gateGainOutput, numChannelsInternal, numFrames)
-                                    : gateGainOutput;
-
-  sample** irPointers = toneStackOutPointers;
-  if (mIR != nullptr && GetParam(kIRToggle)->Value())
-    irPointers = mIR->Process(toneStackOutPointers, numChannelsInternal, numFrames);
-
-  // And the HPF for DC offset (Issue 271)
-  const double highPassCutoffFreq = kDCBlockerFrequency;
-  // const double lowPassCutoffFreq = 20000.0;
-  const recursive_linear_filter::HighPassParams highPassParams(sampleRate, highPassCutoffFreq);
-  // const recursive_linear_filter::LowPassParams lowPassParams(sampleRate, lowPassCutoffFreq);
-  mHighPass.SetParams(highPassParams);
-  // mLowPass.SetParams(lowPassParams);
-  sample** hpfPointers = mHighPass.Process(irPointers, numChannelsInternal, numFrames);
-  // sample** lpfPointers = mLowPass.Process(hpfPointers, numChannelsInternal, numFrames);
-
-  // restore previous floating point state
-  std::feupdateenv(&fe_state);
+  mProcessLoad.Begin();
+  mEngine.Process(inputs, numChannelsExternalIn, outputs, numChannelsExternalOut, numFrames);
+  mProcessLoad.End(nFrames, sampleRate);
+  if (recording)
+    mBlackBox.EndBlock(mProcessLoad.GetLastElapsed());
+  // Offline renders don't have a deadline, and blocks that skipped the chain for silence would pass for headroom that
+  // isn't there.
+  if (!GetRenderingOffline() && !mEngine.IsBypassingSilence())
+    mDeadlineMonitor.AddBlock(mProcessLoad.GetLastElapsed(), nFrames, sampleRate);
+  // A model may have been swapped in.
+  _UpdateLatency();
 
-  // Let's get outta here
-  // This is where we exit mono for whatever the output requires.
-  _ProcessOutput(hpfPointers, outputs, numFrames, numChannelsInternal, numChannelsExternalOut);
-  // _ProcessOutput(lpfPointers, outputs, numFrames, numChannelsInternal, numChannelsExternalOut);
-  // * Output of input leveling (inputs -> mInputPointers),
-  // * Output of output leveling (mOutputPointers -> outputs)
-  _UpdateMeters(mInputPointers, outputs, numFrames, numChannelsInternal, numChannelsExternalOut);
+  // * Output of input leveling (inputs -> engine's input),
+  // * Output of output leveling (engine -> outputs)
+  // A block that was too big for the engine went through in pieces, and only the last piece's input is left.
+  sample* inputPointers[kNumChannelsInternal] = {const_cast<sample*>(mEngine.GetProcessedInput())};
+  _UpdateMeters(inputPointers, mEngine.GetProcessedInputFrames(), outputs, numFrames, numChannelsInternal,
+                numChannelsExternalOut);
 }
 
 void NeuralAmpModeler::OnReset()
@@ -368,12 +403,12 @@ void NeuralAmpModeler::OnReset()
   // 10 cycles should be enough to pass the VST3 tests checking tail behavior.
   // I'm ignoring the model & IR, but it's not the end of the world.
   const int tailCycles = 10;
-  SetTailSize(tailCycles * (int)(sampleRate / kDCBlockerFrequency));
+  SetTailSize(tailCycles * (int)(sampleRate / engine::kDCBlockerFrequency));
   mInputSender.Reset(sampleRate);
   mOutputSender.Reset(sampleRate);
-  // If there is a model or IR loaded, they need to be checked for resampling.
-  _ResetModelAndIR(sampleRate, GetBlockSize());
-  mToneStack->Reset(sampleRate, maxBlockSize);
+  mEngine.Reset(sampleRate, maxBlockSize);
+  mBlackBox.Reset(sampleRate, maxBlockSize);
+  _UpdateActivationAccuracy();
   _UpdateLatency();
 }
 
@@ -381,23 +416,55 @@ void NeuralAmpModeler::OnIdle()
 {
   mInputSender.TransmitData(*this);
   mOutputSender.TransmitData(*this);
-
-  if (mNewModelLoadedInDSP)
+  // Models and IRs that the audio thread has swapped out
+  mEngine.ReleaseRetired();
+  _UpdateIRBlend();
+  _UpdateActivationAccuracy();
+  _UpdateModelProfile();
+
+  // Consumed with or without a UI so that the telemetry keeps up; opening the UI catches it up (see OnUIOpen()).
+  const bool modelLoaded = mEngine.ConsumeNewModelLoaded();
+  const bool loudnessAnalyzed = mEngine.ConsumeLoudnessAnalyzed();
+  const bool modelCleared = mEngine.ConsumeModelCleared();
+  if (modelLoaded || modelCleared)
+    _UpdateModelStats();
+  // The remote engine's daemon went away, so what's playing is loaded here instead.
+  if (mEngine.ConsumeRemoteModelLost())
   {
-    if (auto* pGraphics = GetUI())
+    if (!mSubstituteModel.empty())
+      mEngine.StageModel(mSubstituteModel);
+    else if (mNAMPath.GetLength() > 0)
     {
-      _UpdateControlsFromModel();
-      mNewModelLoadedInDSP = false;
+      const WDL_String modelPath(mNAMPath);
+      _StageModel(modelPath);
+    }
+    for (int branch = 1; branch < engine::kMaxModelBranches; branch++)
+    {
+      const WDL_String modelPath(mBranchPaths[branch - 1]);
+      if (modelPath.GetLength() > 0)
+        _StageBranchModel(branch, modelPath);
     }
   }
-  if (mModelCleared)
+  _PublishTelemetry();
+  _CheckBlackBox();
+  _UpdateDegradation();
+
+  if (auto* pGraphics = GetUI())
   {
-    if (auto* pGraphics = GetUI())
+    if (modelLoaded || loudnessAnalyzed)
+    {
+      _UpdateControlsFromModel();
+    }
+    // What can be given up depends on the model.
+    if (modelLoaded || modelCleared)
+      _UpdateDegradationControl();
+    if (NAMRigPageControl* rigPage = _GetRigPage())
+      rigPage->SetRigMisalignment(mEngine.GetRigMisalignment());
+    if (modelCleared)
     {
       // FIXME -- need to disable only the "normalized" model
       // pGraphics->GetControlWithTag(kCtrlTagOutputMode)->SetDisabled(false);
       static_cast<NAMSettingsPageControl*>(pGraphics->GetControlWithTag(kCtrlTagSettingsBox))->ClearModelInfo();
-      mModelCleared = false;
     }
   }
 }
@@ -414,7 +481,22 @@ bool NeuralAmpModeler::SerializeState(IByteChunk& chunk) const
   // when we unserialize)
   chunk.PutStr(mNAMPath.Get());
   chunk.PutStr(mIRPath.Get());
-  return SerializeParams(chunk);
+  if (!SerializeParams(chunk))
+    return false;
+  // Anything else goes after the params, so that 0.7.13 and earlier can still read everything up to here. The params
+  // that they don't know go in by name too, so that where they are in the params doesn't matter (see _GetExtras()).
+  chunk.PutStr(kStateExtrasMarker);
+  nlohmann::json extras;
+  for (int i = kBranchLevel; i < kNumParams; i++)
+    extras[GetParam(i)->GetName()] = GetParam(i)->Value();
+  extras["BranchPaths"] = nlohmann::json::array();
+  for (const WDL_String& path : mBranchPaths)
+    extras["BranchPaths"].push_back(std::string(path.Get()));
+  extras["IRPaths"] = nlohmann::json::array();
+  for (const WDL_String& path : mIRSlotPaths)
+    extras["IRPaths"].push_back(std::string(path.Get()));
+  chunk.PutStr(extras.dump().c_str());
+  return true;
 }
 
 int NeuralAmpModeler::UnserializeState(const IByteChunk& chunk, int startPos)
@@ -444,39 +526,55 @@ void NeuralAmpModeler::OnUIOpen()
     SendControlMsgFromDelegate(kCtrlTagModelFileBrowser, kMsgTagLoadedModel, mNAMPath.GetLength(), mNAMPath.Get());
     // If it's not loaded yet, then mark as failed.
     // If it's yet to be loaded, then the completion handler will set us straight once it runs.
-    if (mModel == nullptr && mStagedModel == nullptr)
+    if (!mEngine.HasModelOrStagedModel())
       SendControlMsgFromDelegate(kCtrlTagModelFileBrowser, kMsgTagLoadFailed);
   }
 
   if (mIRPath.GetLength())
   {
     SendControlMsgFromDelegate(kCtrlTagIRFileBrowser, kMsgTagLoadedIR, mIRPath.GetLength(), mIRPath.Get());
-    if (mIR == nullptr && mStagedIR == nullptr)
+    if (!mEngine.HasIROrStagedIR())
       SendControlMsgFromDelegate(kCtrlTagIRFileBrowser, kMsgTagLoadFailed);
   }
 
-  if (mModel != nullptr)
+  if (_HaveModel())
   {
     _UpdateControlsFromModel();
   }
+  _UpdateDegradationControl();
+  _UpdateRigControls();
 }
 
 void NeuralAmpModeler::OnParamChange(int paramIdx)
 {
   switch (paramIdx)
   {
-    // Changes to the input gain
-    case kCalibrateInput:
-    case kInputCalibrationLevel:
-    case kInputLevel: _SetInputGain(); break;
-    // Changes to the output gain
-    case kOutputLevel:
-    case kOutputMode: _SetOutputGain(); break;
+    // Input
+    case kInputLevel: mEngine.SetInputLevel(GetParam(paramIdx)->Value()); break;
+    case kCalibrateInput: mEngine.SetCalibrateInput(GetParam(paramIdx)->Bool()); break;
+    case kInputCalibrationLevel: mEngine.SetInputCalibrationLevel(GetParam(paramIdx)->Value()); break;
+    // Noise gate
+    case kNoiseGateActive: mEngine.SetNoiseGateActive(GetParam(paramIdx)->Bool()); break;
+    case kNoiseGateThreshold: mEngine.SetNoiseGateThreshold(GetParam(paramIdx)->Value()); break;
     // Tone stack:
-    case kToneBass: mToneStack->SetParam("bass", GetParam(paramIdx)->Value()); break;
-    case kToneMid: mToneStack->SetParam("middle", GetParam(paramIdx)->Value()); break;
-    case kToneTreble: mToneStack->SetParam("treble", GetParam(paramIdx)->Value()); break;
-    default: break;
+    case kEQActive: mEngine.SetToneStackActive(GetParam(paramIdx)->Bool()); break;
+    case kToneBass: mEngine.SetBass(GetParam(paramIdx)->Value()); break;
+    case kToneMid: mEngine.SetMiddle(GetParam(paramIdx)->Value()); break;
+    case kToneTreble: mEngine.SetTreble(GetParam(paramIdx)->Value()); break;
+    // IR
+    case kIRToggle: mEngine.SetIRActive(GetParam(paramIdx)->Bool()); break;
+    // Output
+    case kOutputLevel: mEngine.SetOutputLevel(GetParam(paramIdx)->Value()); break;
+    case kOutputMode: mEngine.SetOutputMode((engine::OutputMode)GetParam(paramIdx)->Int()); break;
+    // Rig
+    default:
+      if (paramIdx >= kBranchLevel && paramIdx < kBranchPan)
+        mEngine.SetBranchLevel(paramIdx - kBranchLevel, GetParam(paramIdx)->Value());
+      else if (paramIdx >= kBranchPan && paramIdx < kBranchPan + engine::kMaxModelBranches)
+        mEngine.SetBranchPan(paramIdx - kBranchPan, GetParam(paramIdx)->Value());
+      else if (paramIdx >= kIRGain && paramIdx < kIRDelay + ir_blend::kMaxIRs)
+        mIRBlendChanged = true;
+      break;
   }
 }
 
@@ -502,8 +600,34 @@ bool NeuralAmpModeler::OnMessage(int msgTag, int ctrlTag, int dataSize, const vo
 {
   switch (msgTag)
   {
-    case kMsgTagClearModel: mShouldRemoveModel = true; return true;
-    case kMsgTagClearIR: mShouldRemoveIR = true; return true;
+    case kMsgTagClearModel:
+      mEngine.ClearModel();
+      mBlackBox.NoteStaging(black_box::Staging::Type::ClearModel);
+      mNAMPath.Set("");
+      return true;
+    case kMsgTagClearIR:
+      mEngine.ClearIR();
+      mBlackBox.NoteStaging(black_box::Staging::Type::ClearIR);
+      mIRPath.Set("");
+      return true;
+    case kMsgTagClearBranchModel:
+    {
+      const int branch = ctrlTag - kCtrlTagBranchFileBrowser + 1;
+      if (branch < 1 || branch >= engine::kMaxModelBranches)
+        return false;
+      mEngine.ClearBranchModel(branch);
+      mBranchPaths[branch - 1].Set("");
+      return true;
+    }
+    case kMsgTagClearIRSlot:
+    {
+      const int slot = ctrlTag - kCtrlTagIRSlotFileBrowser + 1;
+      if (slot < 1 || slot >= ir_blend::kMaxIRs)
+        return false;
+      mEngine.ClearIR(slot);
+      mIRSlotPaths[slot - 1].Set("");
+      return true;
+    }
     case kMsgTagHighlightColor:
     {
       mHighLightColor.Set((const char*)pData);
@@ -532,365 +656,464 @@ bool NeuralAmpModeler::OnMessage(int msgTag, int ctrlTag, int dataSize, const vo
 
 // Private methods ============================================================
 
-void NeuralAmpModeler::_AllocateIOPointers(const size_t nChans)
+void NeuralAmpModeler::_ShowSettingsPage()
 {
-  if (mInputPointers != nullptr)
-    throw std::runtime_error("Tried to re-allocate mInputPointers without freeing");
-  mInputPointers = new sample*[nChans];
-  if (mInputPointers == nullptr)
-    throw std::runtime_error("Failed to allocate pointer to input buffer!\n");
-  if (mOutputPointers != nullptr)
-    throw std::runtime_error("Tried to re-allocate mOutputPointers without freeing");
-  mOutputPointers = new sample*[nChans];
-  if (mOutputPointers == nullptr)
-    throw std::runtime_error("Failed to allocate pointer to output buffer!\n");
+  auto* settingsPage = GetUI()->GetControlWithTag(kCtrlTagSettingsBox)->As<NAMSettingsPageControl>();
+  if (!settingsPage->IsBuilt())
+  {
+    const auto start = std::chrono::steady_clock::now();
+    settingsPage->Build();
+    if (_HaveModel())
+      _UpdateControlsFromModel();
+    mSettingsBuildTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+  settingsPage->HideAnimated(false);
 }
 
-void NeuralAmpModeler::_ApplyDSPStaging()
+void NeuralAmpModeler::_ShowRigPage()
 {
-  // Remove marked modules
-  if (mShouldRemoveModel)
+  auto* rigPage = GetUI()->GetControlWithTag(kCtrlTagRigPage)->As<NAMRigPageControl>();
+  if (!rigPage->IsBuilt())
   {
-    mModel = nullptr;
-    mNAMPath.Set("");
-    mShouldRemoveModel = false;
-    mModelCleared = true;
-    _UpdateLatency();
-    _SetInputGain();
-    _SetOutputGain();
+    rigPage->Build();
+    _UpdateRigControls();
   }
-  if (mShouldRemoveIR)
-  {
-    mIR = nullptr;
-    mIRPath.Set("");
-    mShouldRemoveIR = false;
-  }
-  // Move things from staged to live
-  if (mStagedModel != nullptr)
+  rigPage->HideAnimated(false);
+}
+
+NAMRigPageControl* NeuralAmpModeler::_GetRigPage()
+{
+  auto* pGraphics = GetUI();
+  if (pGraphics == nullptr)
+    return nullptr;
+  auto* rigPage = pGraphics->GetControlWithTag(kCtrlTagRigPage)->As<NAMRigPageControl>();
+  return rigPage->IsBuilt() ? rigPage : nullptr;
+}
+
+void NeuralAmpModeler::_UpdateRigControls()
+{
+  NAMRigPageControl* rigPage = _GetRigPage();
+  if (rigPage == nullptr)
+    return;
+  for (int branch = 1; branch < engine::kMaxModelBranches; branch++)
   {
-    mModel = std::move(mStagedModel);
-    mStagedModel = nullptr;
-    mNewModelLoadedInDSP = true;
-    _UpdateLatency();
-    _SetInputGain();
-    _SetOutputGain();
+    const WDL_String& path = mBranchPaths[branch - 1];
+    if (path.GetLength() == 0)
+      continue;
+    const int ctrlTag = kCtrlTagBranchFileBrowser + branch - 1;
+    SendControlMsgFromDelegate(ctrlTag, kMsgTagLoadedModel, path.GetLength(), path.Get());
+    if (!mEngine.HasBranchModel(branch))
+      SendControlMsgFromDelegate(ctrlTag, kMsgTagLoadFailed);
   }
-  if (mStagedIR != nullptr)
+  // Only IRs that loaded have paths.
+  for (int slot = 1; slot < ir_blend::kMaxIRs; slot++)
   {
-    mIR = std::move(mStagedIR);
-    mStagedIR = nullptr;
+    const WDL_String& path = mIRSlotPaths[slot - 1];
+    if (path.GetLength() > 0)
+      SendControlMsgFromDelegate(kCtrlTagIRSlotFileBrowser + slot - 1, kMsgTagLoadedIR, path.GetLength(), path.Get());
   }
+  rigPage->SetRigMisalignment(mEngine.GetRigMisalignment());
 }
 
-void NeuralAmpModeler::_DeallocateIOPointers()
+std::string NeuralAmpModeler::_StageModel(const WDL_String& modelPath)
 {
-  if (mInputPointers != nullptr)
+  // A state that's being restored may have changed kActivations, and there's no point building it twice.
+  _UpdateActivationAccuracy();
+  auto dspPath = std::filesystem::u8path(modelPath.Get());
+  nam::dspData modelData;
+  const auto loadStart = std::chrono::steady_clock::now();
+  const std::string error = mEngine.StageModel(dspPath, &modelData);
+  mModelLoadTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count();
+  if (!error.empty())
   {
-    delete[] mInputPointers;
-    mInputPointers = nullptr;
+    SendControlMsgFromDelegate(kCtrlTagModelFileBrowser, kMsgTagLoadFailed);
+    return error;
   }
-  if (mInputPointers != nullptr)
-    throw std::runtime_error("Failed to deallocate pointer to input buffer!\n");
-  if (mOutputPointers != nullptr)
+  mBlackBox.NoteStaging(black_box::Staging::Type::Model, dspPath, (uint32_t)mEngine.GetActivationAccuracy());
+  mNAMPath = modelPath;
+  // The model itself, whatever it was standing in for
+  mSubstituteModel.clear();
+  if (mDegradation == deadline::Degradation::LighterModel)
   {
-    delete[] mOutputPointers;
-    mOutputPointers = nullptr;
+    mDegradation = deadline::Degradation::TrimmedIR;
+    _UpdateDegradationControl();
   }
-  if (mOutputPointers != nullptr)
-    throw std::runtime_error("Failed to deallocate pointer to output buffer!\n");
+  // What's it going to cost? The static part is instant; the benchmark reports back in OnIdle().
+  mModelProfile = model_profile::ProfileConfig(modelData);
+  // A model in the remote engine leaves us nothing to profile.
+  if (!mModelProfile.architecture.empty())
+    mProfiler.Start(dspPath, mModelProfile, GetSampleRate(), GetBlockSize());
+  SendControlMsgFromDelegate(kCtrlTagModelFileBrowser, kMsgTagLoadedModel, mNAMPath.GetLength(), mNAMPath.Get());
+  return "";
 }
 
-void NeuralAmpModeler::_FallbackDSP(iplug::sample** inputs, iplug::sample** outputs, const size_t numChannels,
-                                    const size_t numFrames)
+std::string NeuralAmpModeler::_StageBranchModel(const int branch, const WDL_String& modelPath)
 {
-  for (auto c = 0; c < numChannels; c++)
-    for (auto s = 0; s < numFrames; s++)
-      mOutputArray[c][s] = mInputArray[c][s];
+  _UpdateActivationAccuracy();
+  const std::string error = mEngine.StageBranchModel(branch, std::filesystem::u8path(modelPath.Get()));
+  const int ctrlTag = kCtrlTagBranchFileBrowser + branch - 1;
+  if (!error.empty())
+  {
+    if (_GetRigPage() != nullptr)
+      SendControlMsgFromDelegate(ctrlTag, kMsgTagLoadFailed);
+    return error;
+  }
+  mBranchPaths[branch - 1] = modelPath;
+  if (_GetRigPage() != nullptr)
+    SendControlMsgFromDelegate(ctrlTag, kMsgTagLoadedModel, modelPath.GetLength(), modelPath.Get());
+  return "";
 }
 
-void NeuralAmpModeler::_ResetModelAndIR(const double sampleRate, const int maxBlockSize)
+dsp::wav::LoadReturnCode NeuralAmpModeler::_StageIR(const WDL_String& irPath)
 {
-  // Model
-  if (mStagedModel != nullptr)
+  // FIXME it'd be better for the path to be "staged" as well. Just in case the
+  // path and the model got caught on opposite sides of the fence...
+  const dsp::wav::LoadReturnCode wavState = mEngine.StageIR(std::filesystem::u8path(irPath.Get()));
+  if (wavState == dsp::wav::LoadReturnCode::SUCCESS)
   {
-    mStagedModel->Reset(sampleRate, maxBlockSize);
+    mBlackBox.NoteStaging(black_box::Staging::Type::IR, std::filesystem::u8path(irPath.Get()));
+    mIRPath = irPath;
+    SendControlMsgFromDelegate(kCtrlTagIRFileBrowser, kMsgTagLoadedIR, mIRPath.GetLength(), mIRPath.Get());
   }
-  else if (mModel != nullptr)
+  else
   {
-    mModel->Reset(sampleRate, maxBlockSize);
+    SendControlMsgFromDelegate(kCtrlTagIRFileBrowser, kMsgTagLoadFailed);
   }
 
-  // IR
-  if (mStagedIR != nullptr)
+  return wavState;
+}
+
+dsp::wav::LoadReturnCode NeuralAmpModeler::_StageIRSlot(const int slot, const WDL_String& irPath)
+{
+  const dsp::wav::LoadReturnCode wavState = mEngine.StageIR(std::filesystem::u8path(irPath.Get()), slot);
+  const int ctrlTag = kCtrlTagIRSlotFileBrowser + slot - 1;
+  if (wavState == dsp::wav::LoadReturnCode::SUCCESS)
   {
-    const double irSampleRate = mStagedIR->GetSampleRate();
-    if (irSampleRate != sampleRate)
-    {
-      const auto irData = mStagedIR->GetData();
-      mStagedIR = std::make_unique<dsp::ImpulseResponse>(irData, sampleRate);
-    }
+    mIRSlotPaths[slot - 1] = irPath;
+    if (_GetRigPage() != nullptr)
+      SendControlMsgFromDelegate(ctrlTag, kMsgTagLoadedIR, irPath.GetLength(), irPath.Get());
   }
-  else if (mIR != nullptr)
+  else if (_GetRigPage() != nullptr)
   {
-    const double irSampleRate = mIR->GetSampleRate();
-    if (irSampleRate != sampleRate)
-    {
-      const auto irData = mIR->GetData();
-      mStagedIR = std::make_unique<dsp::ImpulseResponse>(irData, sampleRate);
-    }
+    SendControlMsgFromDelegate(ctrlTag, kMsgTagLoadFailed);
   }
+  return wavState;
 }
 
-void NeuralAmpModeler::_SetInputGain()
+void NeuralAmpModeler::_UpdateIRBlend()
 {
-  iplug::sample inputGainDB = GetParam(kInputLevel)->Value();
-  // Input calibration
-  if ((mModel != nullptr) && (mModel->HasInputLevel()) && GetParam(kCalibrateInput)->Bool())
+  if (!mIRBlendChanged.exchange(false))
+    return;
+  // The engine only re-blends for the ones that changed.
+  for (int slot = 0; slot < ir_blend::kMaxIRs; slot++)
   {
-    inputGainDB += GetParam(kInputCalibrationLevel)->Value() - mModel->GetInputLevel();
+    mEngine.SetIRGain(slot, GetParam(kIRGain + slot)->Value());
+    mEngine.SetIRDelay(slot, GetParam(kIRDelay + slot)->Value());
   }
-  mInputGain = DBToAmp(inputGainDB);
 }
 
-void NeuralAmpModeler::_SetOutputGain()
+void NeuralAmpModeler::_UpdateActivationAccuracy()
 {
-  double gainDB = GetParam(kOutputLevel)->Value();
-  if (mModel != nullptr)
+  using dsp::activations::Accuracy;
+  const int choice = GetParam(kActivations)->Int();
+  // Auto: offline renders get exact math; live playing gets the fast approximation.
+  const Accuracy accuracy =
+    choice != kActivationsAuto ? (Accuracy)choice : GetRenderingOffline() ? Accuracy::Exact : Accuracy::Rational;
+  if (accuracy == mEngine.GetActivationAccuracy())
+    return;
+  mEngine.SetActivationAccuracy(accuracy);
+  // The loaded models keep the activations that they were built with, so build them again. The engine has their
+  // weights, so this doesn't depend on their files still being there.
+  if (mEngine.HasModelOrStagedModel())
   {
-    const int outputMode = GetParam(kOutputMode)->Int();
-    switch (outputMode)
-    {
-      case 1: // Normalized
-        if (mModel->HasLoudness())
-        {
-          const double loudness = mModel->GetLoudness();
-          const double targetLoudness = -18.0;
-          gainDB += (targetLoudness - loudness);
-        }
-        break;
-      case 2: // Calibrated
-        if (mModel->HasOutputLevel())
-        {
-          const double inputLevel = GetParam(kInputCalibrationLevel)->Value();
-          const double outputLevel = mModel->GetOutputLevel();
-          gainDB += (outputLevel - inputLevel);
-        }
-        break;
-      case 0: // Raw
-      default: break;
-    }
+    mEngine.RebuildModels();
+    const std::filesystem::path& modelPath =
+      mSubstituteModel.empty() ? std::filesystem::u8path(mNAMPath.Get()) : mSubstituteModel;
+    mBlackBox.NoteStaging(black_box::Staging::Type::Model, modelPath, (uint32_t)accuracy);
   }
-  mOutputGain = DBToAmp(gainDB);
 }
 
-std::string NeuralAmpModeler::_StageModel(const WDL_String& modelPath)
+void NeuralAmpModeler::_UpdateModelProfile()
 {
-  WDL_String previousNAMPath = mNAMPath;
-  try
+  if (mProfiler.Poll(mModelProfile))
   {
-    auto dspPath = std::filesystem::u8path(modelPath.Get());
-    std::unique_ptr<nam::DSP> model = nam::get_dsp(dspPath);
-    std::unique_ptr<ResamplingNAM> temp = std::make_unique<ResamplingNAM>(std::move(model), GetSampleRate());
-    temp->Reset(GetSampleRate(), GetBlockSize());
-    mStagedModel = std::move(temp);
-    mNAMPath = modelPath;
-    SendControlMsgFromDelegate(kCtrlTagModelFileBrowser, kMsgTagLoadedModel, mNAMPath.GetLength(), mNAMPath.Get());
+    _UpdateControlsFromModel();
+    return;
   }
-  catch (std::runtime_error& e)
+  // Host settings changed since the last benchmark?
+  if (mModelProfile.benchmarked && mNAMPath.GetLength()
+      && (mModelProfile.hostSampleRate != GetSampleRate() || mModelProfile.hostBlockSize != GetBlockSize()))
   {
-    SendControlMsgFromDelegate(kCtrlTagModelFileBrowser, kMsgTagLoadFailed);
+    mModelProfile.benchmarked = false;
+    mProfiler.Start(std::filesystem::u8path(mNAMPath.Get()), mModelProfile, GetSampleRate(), GetBlockSize());
+  }
+}
 
-    if (mStagedModel != nullptr)
+void NeuralAmpModeler::_UpdateControlsFromModel()
+{
+  const ResamplingNAM* model = mEngine.GetModel();
+  if (model == nullptr)
+  {
+    return;
+  }
+  if (auto* pGraphics = GetUI())
+  {
+    ModelInfo modelInfo;
+    modelInfo.sampleRate.known = true;
+    modelInfo.sampleRate.value = model->GetEncapsulatedSampleRate();
+    modelInfo.inputCalibrationLevel.known = model->HasInputLevel();
+    modelInfo.inputCalibrationLevel.value = model->HasInputLevel() ? model->GetInputLevel() : 0.0;
+    modelInfo.outputCalibrationLevel.known = model->HasOutputLevel();
+    modelInfo.outputCalibrationLevel.value = model->HasOutputLevel() ? model->GetOutputLevel() : 0.0;
+    modelInfo.profile = mModelProfile;
+    _UpdateModelStats();
+    const engine::MemoryReport& memory = mMemoryReport;
+    modelInfo.instanceMemoryBytes = memory.Total();
+
+    auto* settingsPage = pGraphics->GetControlWithTag(kCtrlTagSettingsBox)->As<NAMSettingsPageControl>();
+    // It catches up when it's built.
+    if (!settingsPage->IsBuilt())
+      return;
+    settingsPage->SetModelInfo(modelInfo);
+
+    const bool disableInputCalibrationControls = !model->HasInputLevel();
+    pGraphics->GetControlWithTag(kCtrlTagCalibrateInput)->SetDisabled(disableInputCalibrationControls);
+    pGraphics->GetControlWithTag(kCtrlTagInputCalibrationLevel)->SetDisabled(disableInputCalibrationControls);
     {
-      mStagedModel = nullptr;
+      auto* c = static_cast<OutputModeControl*>(pGraphics->GetControlWithTag(kCtrlTagOutputMode));
+      c->SetNormalizedDisable(!model->HasLoudness());
+      c->SetCalibratedDisable(!model->HasOutputLevel());
     }
-    mNAMPath = previousNAMPath;
-    std::cerr << "Failed to read DSP module" << std::endl;
-    std::cerr << e.what() << std::endl;
-    return e.what();
   }
-  return "";
 }
 
-dsp::wav::LoadReturnCode NeuralAmpModeler::_StageIR(const WDL_String& irPath)
+void NeuralAmpModeler::_UpdateModelStats()
 {
-  // FIXME it'd be better for the path to be "staged" as well. Just in case the
-  // path and the model got caught on opposite sides of the fence...
-  WDL_String previousIRPath = mIRPath;
+  mMemoryReport = mEngine.GetMemoryReport();
+  const ResamplingNAM* model = mEngine.GetModel();
+  mModelSampleRate = model != nullptr ? model->GetEncapsulatedSampleRate() : 0.0;
+}
+
+void NeuralAmpModeler::_PublishTelemetry()
+{
+  const auto now = std::chrono::steady_clock::now();
+  if (now - mLastTelemetry < std::chrono::milliseconds(500))
+    return;
+  mLastTelemetry = now;
+
+  telemetry::Stats stats;
   const double sampleRate = GetSampleRate();
-  dsp::wav::LoadReturnCode wavState = dsp::wav::LoadReturnCode::ERROR_OTHER;
-  try
+  if (mModelSampleRate > 0.0)
   {
-    auto irPathU8 = std::filesystem::u8path(irPath.Get());
-    mStagedIR = std::make_unique<dsp::ImpulseResponse>(irPathU8.string().c_str(), sampleRate);
-    wavState = mStagedIR->GetWavState();
+    stats.modelHash = telemetry::HashPath(mNAMPath.Get());
+    // A model in the remote engine leaves us no config.
+    telemetry::SetArchitecture(stats, mModelProfile.architecture.empty() ? "remote" : mModelProfile.architecture);
+    if (mModelSampleRate != sampleRate)
+      stats.flags |= telemetry::kResampling;
   }
-  catch (std::runtime_error& e)
+  stats.sampleRate = sampleRate;
+  stats.blockSize = GetBlockSize();
+  if (mEngine.IsBypassingSilence())
+    stats.flags |= telemetry::kIdle;
+  if (mEngine.IsPipelined())
   {
-    wavState = dsp::wav::LoadReturnCode::ERROR_OTHER;
-    std::cerr << "Caught unhandled exception while attempting to load IR:" << std::endl;
-    std::cerr << e.what() << std::endl;
+    stats.flags |= telemetry::kPipelined;
+    const DSPLoadMeter& workerLoad = mEngine.GetPipelineWorkerLoad();
+    stats.workerAverageLoad = (float)workerLoad.GetAverageLoad();
+    stats.workerMaxLoad = (float)workerLoad.GetMaxLoad();
   }
-
-  if (wavState == dsp::wav::LoadReturnCode::SUCCESS)
+  if (mEngine.IsRig())
+    stats.flags |= telemetry::kRig;
+  stats.averageLoad = (float)mProcessLoad.GetAverageLoad();
+  stats.maxLoad = (float)mProcessLoad.GetMaxLoad();
+  stats.averageProcessMs = (float)(1000.0 * mProcessLoad.GetAverageElapsed());
+  stats.maxProcessMs = (float)(1000.0 * mProcessLoad.GetMaxElapsed());
+  stats.modelLoadMs = (float)(1000.0 * mModelLoadTime);
+  stats.memoryBytes = mMemoryReport.Total();
+  stats.degradation = (uint32_t)mDegradation.load();
+  stats.overruns = mDeadlineMonitor.GetOverruns();
+  stats.blackBoxDumps = mBlackBoxDumps;
+  stats.blackBoxDumpFailures = mBlackBoxDumpFailures;
+  // OnIdle() is on the UI thread, so the draw stats can be read here.
+  const double windowSeconds = std::chrono::duration<double>(now - mTelemetryWindowStart).count();
+  if (GetUI() != nullptr && windowSeconds > 0.0)
   {
-    mIRPath = irPath;
-    SendControlMsgFromDelegate(kCtrlTagIRFileBrowser, kMsgTagLoadedIR, mIRPath.GetLength(), mIRPath.Get());
+    stats.framesPerSecond = (float)(mDrawStats.GetNumFrames() / windowSeconds);
+    stats.averageFrameMs = (float)(1000.0 * mDrawStats.GetAverageFrameTime());
+    stats.maxFrameMs = (float)(1000.0 * mDrawStats.GetMaxFrameTime());
+    stats.meterUpdatesDrawn = (uint32_t)mDrawStats.GetMeterUpdatesDrawn();
+    stats.meterUpdatesSkipped = (uint32_t)mDrawStats.GetMeterUpdatesSkipped();
   }
-  else
+  mDrawStats.ConsumeOpenTimes(mUIOpenTimes);
+  stats.uiOpenMs = (float)(1000.0 * mUIOpenTimes.firstFrame);
+  stats.uiGraphicsMs = (float)(1000.0 * mUIOpenTimes.graphics);
+  stats.uiLayoutMs = (float)(1000.0 * mUIOpenTimes.layout);
+  stats.settingsBuildMs = (float)(1000.0 * mSettingsBuildTime);
+  mTelemetry.Publish(stats);
+  // The maximums and the draw stats cover a couple of seconds, so that a reader polling every second or so doesn't
+  // miss a spike.
+  if (now - mTelemetryWindowStart >= std::chrono::seconds(2))
   {
-    if (mStagedIR != nullptr)
-    {
-      mStagedIR = nullptr;
-    }
-    mIRPath = previousIRPath;
-    SendControlMsgFromDelegate(kCtrlTagIRFileBrowser, kMsgTagLoadFailed);
+    mTelemetryWindowStart = now;
+    mProcessLoad.ResetMax();
+    mDrawStats.Reset();
   }
-
-  return wavState;
 }
 
-size_t NeuralAmpModeler::_GetBufferNumChannels() const
+void NeuralAmpModeler::_RecordSettings()
 {
-  // Assumes input=output (no mono->stereo effects)
-  return mInputArray.size();
+  // The parameters that OnParamChange() passes on to the engine
+  using black_box::Setting;
+  static constexpr std::pair<int, Setting> kSettings[] = {
+    {kInputLevel, Setting::InputLevel},
+    {kCalibrateInput, Setting::CalibrateInput},
+    {kInputCalibrationLevel, Setting::InputCalibrationLevel},
+    {kNoiseGateActive, Setting::NoiseGateActive},
+    {kNoiseGateThreshold, Setting::NoiseGateThreshold},
+    {kEQActive, Setting::ToneStackActive},
+    {kToneBass, Setting::Bass},
+    {kToneMid, Setting::Middle},
+    {kToneTreble, Setting::Treble},
+    {kIRToggle, Setting::IRActive},
+    {kOutputLevel, Setting::OutputLevel},
+    {kOutputMode, Setting::OutputMode}};
+  for (const auto& [paramIdx, setting] : kSettings)
+    mBlackBox.RecordSetting(setting, GetParam(paramIdx)->Value());
+  // And what the deadline monitor gave up (see _SetDegradation())
+  const deadline::Degradation degradation = mDegradation.load(std::memory_order_relaxed);
+  mBlackBox.RecordSetting(
+    Setting::ResamplerQuality,
+    (double)(degradation >= deadline::Degradation::DraftResampling ? ResamplerQuality::Draft : ResamplerQuality::High));
+  mBlackBox.RecordSetting(Setting::IRMaxLength,
+                          degradation >= deadline::Degradation::TrimmedIR ? deadline::kTrimmedIRLength : 0.0);
 }
 
-size_t NeuralAmpModeler::_GetBufferNumFrames() const
+void NeuralAmpModeler::_CheckBlackBox()
 {
-  if (_GetBufferNumChannels() == 0)
-    return 0;
-  return mInputArray[0].size();
+  if (!mBlackBox.ConsumeDeadlineMiss())
+    return;
+  // One overrun tends to bring more with it; the first dump has what led up to them.
+  const auto now = std::chrono::steady_clock::now();
+  if (now - mLastBlackBoxDump < std::chrono::seconds(10))
+    return;
+  mLastBlackBoxDump = now;
+  _DumpBlackBox();
 }
 
-void NeuralAmpModeler::_InitToneStack()
+void NeuralAmpModeler::_DumpBlackBox()
 {
-  // If you want to customize the tone stack, then put it here!
-  mToneStack = std::make_unique<dsp::tone_stack::BasicNamToneStack>();
+  std::string error;
+  if (mBlackBox.Dump(error).empty())
+    mBlackBoxDumpFailures++;
+  else
+    mBlackBoxDumps++;
 }
-void NeuralAmpModeler::_PrepareBuffers(const size_t numChannels, const size_t numFrames)
+
+void NeuralAmpModeler::_UpdateDegradation()
 {
-  const bool updateChannels = numChannels != _GetBufferNumChannels();
-  const bool updateFrames = updateChannels || (_GetBufferNumFrames() != numFrames);
-  //  if (!updateChannels && !updateFrames)  // Could we do this?
-  //    return;
+  using deadline::Degradation;
+  // Offline renders have all the time that they need.
+  if (GetRenderingOffline())
+  {
+    if (mDegradation != Degradation::None)
+      _SetDegradation(Degradation::None);
+    return;
+  }
+  const Degradation current = mDegradation;
+  // The next step that would help, and the one to go back to
+  Degradation next = current, previous = Degradation::None;
+  for (int d = (int)current + 1; d < (int)Degradation::Count && next == current; d++)
+    if (_CanDegrade((Degradation)d))
+      next = (Degradation)d;
+  for (int d = (int)current - 1; d > 0 && previous == Degradation::None; d--)
+    if (_CanDegrade((Degradation)d))
+      previous = (Degradation)d;
+
+  const auto action =
+    mDeadlineMonitor.Evaluate(std::chrono::steady_clock::now(), next != current, current != Degradation::None);
+  if (action == deadline::Monitor::Action::Degrade)
+    _SetDegradation(next);
+  else if (action == deadline::Monitor::Action::Recover)
+    _SetDegradation(previous);
+}
 
-  if (updateChannels)
+bool NeuralAmpModeler::_CanDegrade(const deadline::Degradation degradation)
+{
+  switch (degradation)
   {
-    _PrepareIOPointers(numChannels);
-    mInputArray.resize(numChannels);
-    mOutputArray.resize(numChannels);
+    case deadline::Degradation::DraftResampling: return mModelSampleRate > 0.0 && mModelSampleRate != GetSampleRate();
+    case deadline::Degradation::TrimmedIR:
+      return GetParam(kIRToggle)->Bool() && mEngine.GetIRBlendDuration() > deadline::kTrimmedIRLength;
+    case deadline::Degradation::LighterModel: return !_GetLighterModel().empty();
+    default: return false;
   }
-  if (updateFrames)
+}
+
+void NeuralAmpModeler::_SetDegradation(const deadline::Degradation degradation)
+{
+  using deadline::Degradation;
+  const Degradation previous = mDegradation;
+  if (degradation == previous)
+    return;
+  // Before anything is staged, so that the black box has it first
+  mDegradation = degradation;
+
+  mEngine.SetIRMaxLength(degradation >= Degradation::TrimmedIR ? deadline::kTrimmedIRLength : 0.0);
+  const ResamplerQuality quality =
+    degradation >= Degradation::DraftResampling ? ResamplerQuality::Draft : ResamplerQuality::High;
+  const bool restage = quality != mEngine.GetResamplerQuality();
+  mEngine.SetResamplerQuality(quality);
+  const std::filesystem::path substitute =
+    degradation >= Degradation::LighterModel ? _GetLighterModel() : std::filesystem::path();
+  if (mNAMPath.GetLength() > 0 && mEngine.HasModelOrStagedModel() && (restage || substitute != mSubstituteModel))
   {
-    for (auto c = 0; c < mInputArray.size(); c++)
+    if (substitute.empty())
     {
-      mInputArray[c].resize(numFrames);
-      std::fill(mInputArray[c].begin(), mInputArray[c].end(), 0.0);
+      const WDL_String modelPath(mNAMPath);
+      _StageModel(modelPath);
     }
-    for (auto c = 0; c < mOutputArray.size(); c++)
+    else if (mEngine.StageModel(substitute).empty())
     {
-      mOutputArray[c].resize(numFrames);
-      std::fill(mOutputArray[c].begin(), mOutputArray[c].end(), 0.0);
+      // Stands in for mNAMPath, which is still what's saved and shown
+      mSubstituteModel = substitute;
+      mBlackBox.NoteStaging(black_box::Staging::Type::Model, substitute, (uint32_t)mEngine.GetActivationAccuracy());
     }
   }
-  // Would these ever get changed by something?
-  for (auto c = 0; c < mInputArray.size(); c++)
-    mInputPointers[c] = mInputArray[c].data();
-  for (auto c = 0; c < mOutputArray.size(); c++)
-    mOutputPointers[c] = mOutputArray[c].data();
+  _UpdateDegradationControl();
 }
 
-void NeuralAmpModeler::_PrepareIOPointers(const size_t numChannels)
+const std::filesystem::path& NeuralAmpModeler::_GetLighterModel()
 {
-  _DeallocateIOPointers();
-  _AllocateIOPointers(numChannels);
-}
-
-void NeuralAmpModeler::_ProcessInput(iplug::sample** inputs, const size_t nFrames, const size_t nChansIn,
-                                     const size_t nChansOut)
-{
-  // We'll assume that the main processing is mono for now. We'll handle dual amps later.
-  if (nChansOut != 1)
+  if (mLighterModelFor != mNAMPath.Get())
   {
-    std::stringstream ss;
-    ss << "Expected mono output, but " << nChansOut << " output channels are requested!";
-    throw std::runtime_error(ss.str());
+    mLighterModelFor = mNAMPath.Get();
+    mLighterModel = mLighterModelFor.empty() ? std::filesystem::path()
+                                             : deadline::FindLighterSibling(std::filesystem::u8path(mLighterModelFor));
   }
-
-  // On the standalone, we can probably assume that the user has plugged into only one input and they expect it to be
-  // carried straight through. Don't apply any division over nChansIn because we're just "catching anything out there."
-  // However, in a DAW, it's probably something providing stereo, and we want to take the average in order to avoid
-  // doubling the loudness. (This would change w/ double mono processing)
-  double gain = mInputGain;
-#ifndef APP_API
-  gain /= (float)nChansIn;
-#endif
-  // Assume _PrepareBuffers() was already called
-  for (size_t c = 0; c < nChansIn; c++)
-    for (size_t s = 0; s < nFrames; s++)
-      if (c == 0)
-        mInputArray[0][s] = gain * inputs[c][s];
-      else
-        mInputArray[0][s] += gain * inputs[c][s];
-}
-
-void NeuralAmpModeler::_ProcessOutput(iplug::sample** inputs, iplug::sample** outputs, const size_t nFrames,
-                                      const size_t nChansIn, const size_t nChansOut)
-{
-  const double gain = mOutputGain;
-  // Assume _PrepareBuffers() was already called
-  if (nChansIn != 1)
-    throw std::runtime_error("Plugin is supposed to process in mono.");
-  // Broadcast the internal mono stream to all output channels.
-  const size_t cin = 0;
-  for (auto cout = 0; cout < nChansOut; cout++)
-    for (auto s = 0; s < nFrames; s++)
-#ifdef APP_API // Ensure valid output to interface
-      outputs[cout][s] = std::clamp(gain * inputs[cin][s], -1.0, 1.0);
-#else // In a DAW, other things may come next and should be able to handle large
-      // values.
-      outputs[cout][s] = gain * inputs[cin][s];
-#endif
+  return mLighterModel;
 }
 
-void NeuralAmpModeler::_UpdateControlsFromModel()
+void NeuralAmpModeler::_UpdateDegradationControl()
 {
-  if (mModel == nullptr)
-  {
+  auto* pGraphics = GetUI();
+  if (pGraphics == nullptr)
     return;
-  }
-  if (auto* pGraphics = GetUI())
+  using deadline::Degradation;
+  std::string description;
+  for (int d = 1; d <= (int)mDegradation.load(); d++)
   {
-    ModelInfo modelInfo;
-    modelInfo.sampleRate.known = true;
-    modelInfo.sampleRate.value = mModel->GetEncapsulatedSampleRate();
-    modelInfo.inputCalibrationLevel.known = mModel->HasInputLevel();
-    modelInfo.inputCalibrationLevel.value = mModel->HasInputLevel() ? mModel->GetInputLevel() : 0.0;
-    modelInfo.outputCalibrationLevel.known = mModel->HasOutputLevel();
-    modelInfo.outputCalibrationLevel.value = mModel->HasOutputLevel() ? mModel->GetOutputLevel() : 0.0;
-
-    static_cast<NAMSettingsPageControl*>(pGraphics->GetControlWithTag(kCtrlTagSettingsBox))->SetModelInfo(modelInfo);
-
-    const bool disableInputCalibrationControls = !mModel->HasInputLevel();
-    pGraphics->GetControlWithTag(kCtrlTagCalibrateInput)->SetDisabled(disableInputCalibrationControls);
-    pGraphics->GetControlWithTag(kCtrlTagInputCalibrationLevel)->SetDisabled(disableInputCalibrationControls);
-    {
-      auto* c = static_cast<OutputModeControl*>(pGraphics->GetControlWithTag(kCtrlTagOutputMode));
-      c->SetNormalizedDisable(!mModel->HasLoudness());
-      c->SetCalibratedDisable(!mModel->HasOutputLevel());
-    }
+    if (!_CanDegrade((Degradation)d))
+      continue;
+    description += description.empty() ? "Saving CPU: " : ", ";
+    description += deadline::GetDegradationName((Degradation)d);
   }
+  if (auto* pControl = pGraphics->GetControlWithTag(kCtrlTagDegradation))
+    static_cast<NAMDegradationControl*>(pControl)->SetDescription(description.c_str());
 }
 
 void NeuralAmpModeler::_UpdateLatency()
 {
-  int latency = 0;
-  if (mModel)
-  {
-    latency += mModel->GetLatency();
-  }
-  // Other things that add latency here...
+  const int latency = mEngine.GetLatency();
 
   // Feels weird to have to do this.
   if (GetLatency() != latency)
@@ -899,12 +1122,12 @@ void NeuralAmpModeler::_UpdateLatency()
   }
 }
 
-void NeuralAmpModeler::_UpdateMeters(sample** inputPointer, sample** outputPointer, const size_t nFrames,
-                                     const size_t nChansIn, const size_t nChansOut)
+void NeuralAmpModeler::_UpdateMeters(sample** inputPointer, const size_t nInputFrames, sample** outputPointer,
+                                     const size_t nFrames, const size_t nChansIn, const size_t nChansOut)
 {
   // Right now, we didn't specify MAXNC when we initialized these, so it's 1.
   const int nChansHack = 1;
-  mInputSender.ProcessBlock(inputPointer, (int)nFrames, kCtrlTagInputMeter, nChansHack);
+  mInputSender.ProcessBlock(inputPointer, (int)nInputFrames, kCtrlTagInputMeter, nChansHack);
   mOutputSender.ProcessBlock(outputPointer, (int)nFrames, kCtrlTagOutputMeter, nChansHack);
 }
 
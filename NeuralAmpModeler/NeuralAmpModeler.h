@@ -1,14 +1,19 @@
 #pragma once
 
+#include <array>
+
 #include "NeuralAmpModelerCore/NAM/dsp.h"
-#include "AudioDSPTools/dsp/ImpulseResponse.h"
-#include "AudioDSPTools/dsp/NoiseGate.h"
-#include "AudioDSPTools/dsp/dsp.h"
 #include "AudioDSPTools/dsp/wav.h"
-#include "AudioDSPTools/dsp/ResamplingContainer/ResamplingContainer.h"
 
+#include "BlackBox.h"
 #include "Colors.h"
-#include "ToneStack.h"
+#include "DSPLoadMeter.h"
+#include "DeadlineMonitor.h"
+#include "DrawStats.h"
+#include "Engine.h"
+#include "ModelProfile.h"
+#include "RealtimeSanitizer.h"
+#include "Telemetry.h"
 
 #include "IPlug_include_in_plug_hdr.h"
 #include "ISender.h"
@@ -16,7 +21,7 @@
 
 const int kNumPresets = 1;
 // The plugin is mono inside
-constexpr size_t kNumChannelsInternal = 1;
+constexpr size_t kNumChannelsInternal = engine::kNumChannelsInternal;
 
 class NAMSender : public iplug::IPeakAvgSender<>
 {
@@ -45,9 +50,21 @@ enum EParams
   kCalibrateInput,
   kInputCalibrationLevel,
   kOutputMode,
+  // A rig's branches (see engine::Engine::StageBranchModel()), 0 being the model above: a level each, then a pan each
+  kBranchLevel,
+  kBranchPan = kBranchLevel + engine::kMaxModelBranches,
+  // The IR blend's slots (see engine::Engine::SetIRGain()), 0 being the IR above: a gain each, then a delay each
+  kIRGain = kBranchPan + engine::kMaxModelBranches,
+  kIRDelay = kIRGain + ir_blend::kMaxIRs,
+  // How the models' activations are computed (see Activations.h): dsp::activations::Accuracy's values, or
+  // kActivationsAuto
+  kActivations = kIRDelay + ir_blend::kMaxIRs,
   kNumParams
 };
 
+// Exact for offline renders, Rational otherwise
+constexpr int kActivationsAuto = 3;
+
 const int numKnobs = 6;
 
 enum ECtrlTags
@@ -60,7 +77,13 @@ enum ECtrlTags
   kCtrlTagOutputMode,
   kCtrlTagCalibrateInput,
   kCtrlTagInputCalibrationLevel,
-  kNumCtrlTags
+  kCtrlTagDegradation,
+  kCtrlTagRigPage,
+  // Branch 1's, then the rest's
+  kCtrlTagBranchFileBrowser,
+  // IR slot 1's, then the rest's
+  kCtrlTagIRSlotFileBrowser = kCtrlTagBranchFileBrowser + engine::kMaxModelBranches - 1,
+  kNumCtrlTags = kCtrlTagIRSlotFileBrowser + ir_blend::kMaxIRs - 1
 };
 
 enum EMsgTags
@@ -69,6 +92,9 @@ enum EMsgTags
   kMsgTagClearModel = 0,
   kMsgTagClearIR,
   kMsgTagHighlightColor,
+  // With the file browser's tag
+  kMsgTagClearBranchModel,
+  kMsgTagClearIRSlot,
   // The following tags are from DSP -> UI
   kMsgTagLoadFailed,
   kMsgTagLoadedModel,
@@ -76,111 +102,8 @@ enum EMsgTags
   kNumMsgTags
 };
 
-// Get the sample rate of a NAM model.
-// Sometimes, the model doesn't know its own sample rate; this wrapper guesses 48k based on the way that most
-// people have used NAM in the past.
-double GetNAMSampleRate(const std::unique_ptr<nam::DSP>& model)
-{
-  // Some models are from when we didn't have sample rate in the model.
-  // For those, this wraps with the assumption that they're 48k models, which is probably true.
-  const double assumedSampleRate = 48000.0;
-  const double reportedEncapsulatedSampleRate = model->GetExpectedSampleRate();
-  const double encapsulatedSampleRate =
-    reportedEncapsulatedSampleRate <= 0.0 ? assumedSampleRate : reportedEncapsulatedSampleRate;
-  return encapsulatedSampleRate;
-};
-
-class ResamplingNAM : public nam::DSP
-{
-public:
-  // Resampling wrapper around the NAM models
-  ResamplingNAM(std::unique_ptr<nam::DSP> encapsulated, const double expected_sample_rate)
-  : nam::DSP(expected_sample_rate)
-  , mEncapsulated(std::move(encapsulated))
-  , mResampler(GetNAMSampleRate(mEncapsulated))
-  {
-    // Assign the encapsulated object's processing function  to this object's member so that the resampler can use it:
-    auto ProcessBlockFunc = [&](NAM_SAMPLE** input, NAM_SAMPLE** output, int numFrames) {
-      mEncapsulated->process(input[0], output[0], numFrames);
-    };
-    mBlockProcessFunc = ProcessBlockFunc;
-
-    // Get the other information from the encapsulated NAM so that we can tell the outside world about what we're
-    // holding.
-    if (mEncapsulated->HasLoudness())
-    {
-      SetLoudness(mEncapsulated->GetLoudness());
-    }
-    if (mEncapsulated->HasInputLevel())
-    {
-      SetInputLevel(mEncapsulated->GetInputLevel());
-    }
-    if (mEncapsulated->HasOutputLevel())
-    {
-      SetOutputLevel(mEncapsulated->GetOutputLevel());
-    }
-
-    // NOTE: prewarm samples doesn't mean anything--we can prewarm the encapsulated model as it likes and be good to
-    // go.
-    // _prewarm_samples = 0;
-
-    // And be ready
-    int maxBlockSize = 2048; // Conservative
-    Reset(expected_sample_rate, maxBlockSize);
-  };
-
-  ~ResamplingNAM() = default;
-
-  void prewarm() override { mEncapsulated->prewarm(); };
-
-  void process(NAM_SAMPLE* input, NAM_SAMPLE* output, const int num_frames) override
-  {
-    if (num_frames > mMaxExternalBlockSize)
-      // We can afford to be careful
-      throw std::runtime_error("More frames were provided than the max expected!");
-
-    if (!NeedToResample())
-    {
-      mEncapsulated->process(input, output, num_frames);
-    }
-    else
-    {
-      mResampler.ProcessBlock(&input, &output, num_frames, mBlockProcessFunc);
-    }
-  };
-
-  int GetLatency() const { return NeedToResample() ? mResampler.GetLatency() : 0; };
-
-  void Reset(const double sampleRate, const int maxBlockSize) override
-  {
-    mExpectedSampleRate = sampleRate;
-    mMaxExternalBlockSize = maxBlockSize;
-    mResampler.Reset(sampleRate, maxBlockSize);
-
-    // Allocations in the encapsulated model (HACK)
-    // Stolen some code from the resampler; it'd be nice to have these exposed as methods? :)
-    const double mUpRatio = sampleRate / GetEncapsulatedSampleRate();
-    const auto maxEncapsulatedBlockSize = static_cast<int>(std::ceil(static_cast<double>(maxBlockSize) / mUpRatio));
-    mEncapsulated->ResetAndPrewarm(sampleRate, maxEncapsulatedBlockSize);
-  };
-
-  // So that we can let the world know if we're resampling (useful for debugging)
-  double GetEncapsulatedSampleRate() const { return GetNAMSampleRate(mEncapsulated); };
-
-private:
-  bool NeedToResample() const { return GetExpectedSampleRate() != GetEncapsulatedSampleRate(); };
-  // The encapsulated NAM
-  std::unique_ptr<nam::DSP> mEncapsulated;
-
-  // The resampling wrapper
-  dsp::ResamplingContainer<NAM_SAMPLE, 1, 12> mResampler;
-
-  // Used to check that we don't get too large a block to process.
-  int mMaxExternalBlockSize = 0;
-
-  // This function is defined to conform to the interface expected by the iPlug2 resampler.
-  std::function<void(NAM_SAMPLE**, NAM_SAMPLE**, int)> mBlockProcessFunc;
-};
+// See NeuralAmpModelerControls.h
+class NAMRigPageControl;
 
 class NeuralAmpModeler final : public iplug::Plugin
 {
@@ -202,48 +125,32 @@ public:
   bool OnMessage(int msgTag, int ctrlTag, int dataSize, const void* pData) override;
 
 private:
-  // Allocates mInputPointers and mOutputPointers
-  void _AllocateIOPointers(const size_t nChans);
-  // Moves DSP modules from staging area to the main area.
-  // Also deletes DSP modules that are flagged for removal.
-  // Exists so that we don't try to use a DSP module that's only
-  // partially-instantiated.
-  void _ApplyDSPStaging();
-  // Deallocates mInputPointers and mOutputPointers
-  void _DeallocateIOPointers();
-  // Fallback that just copies inputs to outputs if mDSP doesn't hold a model.
-  void _FallbackDSP(iplug::sample** inputs, iplug::sample** outputs, const size_t numChannels, const size_t numFrames);
-  // Sizes based on mInputArray
-  size_t _GetBufferNumChannels() const;
-  size_t _GetBufferNumFrames() const;
-  void _InitToneStack();
-  // Loads a NAM model and stores it to mStagedNAM
+  // Loads a NAM model and stages it in the engine
   // Returns an empty string on success, or an error message on failure.
   std::string _StageModel(const WDL_String& dspFile);
-  // Loads an IR and stores it to mStagedIR.
+  // The same for one of a rig's other branches (1 and up)
+  std::string _StageBranchModel(const int branch, const WDL_String& modelPath);
+  // Loads an IR and stages it in the engine.
   // Return status code so that error messages can be relayed if
   // it wasn't successful.
   dsp::wav::LoadReturnCode _StageIR(const WDL_String& irPath);
-
-  bool _HaveModel() const { return this->mModel != nullptr; };
-  // Prepare the input & output buffers
-  void _PrepareBuffers(const size_t numChannels, const size_t numFrames);
-  // Manage pointers
-  void _PrepareIOPointers(const size_t nChans);
-  // Copy the input buffer to the object, applying input level.
-  // :param nChansIn: In from external
-  // :param nChansOut: Out to the internal of the DSP routine
-  void _ProcessInput(iplug::sample** inputs, const size_t nFrames, const size_t nChansIn, const size_t nChansOut);
-  // Copy the output to the output buffer, applying output level.
-  // :param nChansIn: In from internal
-  // :param nChansOut: Out to external
-  void _ProcessOutput(iplug::sample** inputs, iplug::sample** outputs, const size_t nFrames, const size_t nChansIn,
-                      const size_t nChansOut);
-  // Resetting for models and IRs, called by OnReset
-  void _ResetModelAndIR(const double sampleRate, const int maxBlockSize);
-
-  void _SetInputGain();
-  void _SetOutputGain();
+  // The same for one of the IR blend's other slots (1 and up)
+  dsp::wav::LoadReturnCode _StageIRSlot(const int slot, const WDL_String& irPath);
+  // Passes the IR slots' gains and delays on to the engine if they've changed (see OnParamChange())
+  void _UpdateIRBlend();
+  // Uses the activations that kActivations asks for (exact for offline renders, if it's on Auto). Rebuilds the models
+  // if that changed.
+  void _UpdateActivationAccuracy();
+
+  bool _HaveModel() const { return mEngine.HasModel(); };
+  // Builds the settings page the first time
+  void _ShowSettingsPage();
+  // Likewise for the rig page
+  void _ShowRigPage();
+  // The rig page, if it's been built, or null
+  NAMRigPageControl* _GetRigPage();
+  // Tells the rig page's file browsers what's loaded (models and IRs)
+  void _UpdateRigControls();
 
   // See: Unserialization.cpp
   void _UnserializeApplyConfig(nlohmann::json& config);
@@ -252,64 +159,97 @@ private:
   // Hopefully 0.7.3-0.7.8, but no gurantees
   int _UnserializeStateWithUnknownVersion(const iplug::IByteChunk& chunk, int startPos);
 
+  // Re-run the model's benchmark if the host settings changed since the last one
+  void _UpdateModelProfile();
   // Update all controls that depend on a model
   void _UpdateControlsFromModel();
+  // Caches what the live model holds in memory and its sample rate, so that they're only read from the engine when it
+  // changes
+  void _UpdateModelStats();
+  // Every half second or so (see Telemetry.h)
+  void _PublishTelemetry();
+  // Audio thread, for the black box (see BlackBox.h)
+  void _RecordSettings();
+  // Writes out the black box after a block overran (at most every so often) or when asked to (Ctrl+Shift+D)
+  void _CheckBlackBox();
+  void _DumpBlackBox();
+  // Gives up or takes back a step of quality if the deadline monitor says so (see DeadlineMonitor.h)
+  void _UpdateDegradation();
+  // Whether `degradation` would change anything for what's loaded now
+  bool _CanDegrade(const deadline::Degradation degradation);
+  // Applies every step up to and including `degradation`, and takes back the rest
+  void _SetDegradation(const deadline::Degradation degradation);
+  // The lighter capture for the model, searched for the first time that it's asked for
+  const std::filesystem::path& _GetLighterModel();
+  void _UpdateDegradationControl();
 
   // Make sure that the latency is reported correctly.
   void _UpdateLatency();
 
   // Update level meters
-  // Called within ProcessBlock().
-  // Assume _ProcessInput() and _ProcessOutput() were run immediately before.
-  void _UpdateMeters(iplug::sample** inputPointer, iplug::sample** outputPointer, const size_t nFrames,
-                     const size_t nChansIn, const size_t nChansOut);
+  // Called within ProcessBlock(). The input can be shorter than the output (see engine::Engine::GetProcessedInput()).
+  void _UpdateMeters(iplug::sample** inputPointer, const size_t nInputFrames, iplug::sample** outputPointer,
+                     const size_t nFrames, const size_t nChansIn, const size_t nChansOut);
 
   // Member data
 
-  // Input arrays to NAM
-  std::vector<std::vector<iplug::sample>> mInputArray;
-  // Output from NAM
-  std::vector<std::vector<iplug::sample>> mOutputArray;
-  // Pointer versions
-  iplug::sample** mInputPointers = nullptr;
-  iplug::sample** mOutputPointers = nullptr;
-
-  // Input and output gain
-  double mInputGain = 1.0;
-  double mOutputGain = 1.0;
-
-  // Noise gates
-  dsp::noise_gate::Trigger mNoiseGateTrigger;
-  dsp::noise_gate::Gain mNoiseGateGain;
-  // The model actually being used:
-  std::unique_ptr<ResamplingNAM> mModel;
-  // And the IR
-  std::unique_ptr<dsp::ImpulseResponse> mIR;
-  // Manages switching what DSP is being used.
-  std::unique_ptr<ResamplingNAM> mStagedModel;
-  std::unique_ptr<dsp::ImpulseResponse> mStagedIR;
-  // Flags to take away the modules at a safe time.
-  std::atomic<bool> mShouldRemoveModel = false;
-  std::atomic<bool> mShouldRemoveIR = false;
-
-  std::atomic<bool> mNewModelLoadedInDSP = false;
-  std::atomic<bool> mModelCleared = false;
-
-  // Tone stack modules
-  std::unique_ptr<dsp::tone_stack::AbstractToneStack> mToneStack;
-
-  // Post-IR filters
-  recursive_linear_filter::HighPass mHighPass;
-  //  recursive_linear_filter::LowPass mLowPass;
+  // The signal chain. Everything else here is about talking to the host and the GUI.
+  engine::Engine mEngine;
+
+  // What the loaded model costs. The benchmark part is filled in by mProfiler in the background.
+  model_profile::ModelProfile mModelProfile;
+  model_profile::BackgroundProfiler mProfiler;
 
   // Path to model's config.json or model.nam
   WDL_String mNAMPath;
   // Path to IR (.wav file)
   WDL_String mIRPath;
+  // Paths to the models of a rig's other branches, at [branch - 1]
+  std::array<WDL_String, engine::kMaxModelBranches - 1> mBranchPaths;
+  // And to the IR blend's other IRs, at [slot - 1]
+  std::array<WDL_String, ir_blend::kMaxIRs - 1> mIRSlotPaths;
+  // The IR slots' params changed. Re-blending allocates, and hosts may change params on the audio thread, so it waits
+  // for OnIdle().
+  std::atomic<bool> mIRBlendChanged = false;
 
   WDL_String mHighLightColor{PluginColors::NAM_THEMECOLOR.ToColorCode()};
 
   std::unordered_map<std::string, double> mNAMParams = {{"Input", 0.0}, {"Output", 0.0}};
 
   NAMSender mInputSender, mOutputSender;
+
+  // How much of the deadline ProcessBlock() uses on the audio thread
+  DSPLoadMeter mProcessLoad;
+  // What drawing the UI costs; UI thread only
+  DrawStats mDrawStats;
+  // When _PublishTelemetry() last started a new window for the maximum load and mDrawStats
+  std::chrono::steady_clock::time_point mTelemetryWindowStart;
+  // The last time the UI opened, and seconds that building the settings page took (0 until it's been built)
+  DrawStats::OpenTimes mUIOpenTimes;
+  double mSettingsBuildTime = 0.0;
+
+  // For telemetry::Publisher (see _UpdateModelStats())
+  engine::MemoryReport mMemoryReport;
+  double mModelSampleRate = 0.0;
+  // Seconds that the last _StageModel() took
+  double mModelLoadTime = 0.0;
+  telemetry::Publisher mTelemetry;
+  std::chrono::steady_clock::time_point mLastTelemetry;
+
+  // Trading quality for time when the CPU can't keep up
+  deadline::Monitor mDeadlineMonitor;
+  // Also read by the audio thread, for the black box
+  std::atomic<deadline::Degradation> mDegradation{deadline::Degradation::None};
+  // The model that's live in place of mNAMPath, if the lighter model step is taken
+  std::filesystem::path mSubstituteModel;
+  // FindLighterSibling() for mLighterModelFor
+  std::filesystem::path mLighterModel;
+  std::string mLighterModelFor;
+
+  // The last few seconds of what the audio thread did, if NAM_BLACKBOX is set
+  black_box::Recorder mBlackBox;
+  std::chrono::steady_clock::time_point mLastBlackBoxDump;
+  // For telemetry
+  uint32_t mBlackBoxDumps = 0;
+  uint32_t mBlackBoxDumpFailures = 0;
 };
@@ -1,9 +1,15 @@
 #pragma once
 
-#include <cmath> // std::round
+#include <algorithm> // std::clamp
+#include <cmath> // std::log10, std::round
+#include <functional> // std::function
+#include <utility> // std::pair
 #include <sstream> // std::stringstream
 #include <unordered_map> // std::unordered_map
 #include "IControls.h"
+#include "CPUFeatures.h"
+#include "DrawStats.h"
+#include "ModelProfile.h"
 
 #define PLUG() static_cast<PLUG_CLASS_NAME*>(GetDelegate())
 #define NAM_KNOB_HEIGHT 120.0f
@@ -302,7 +308,8 @@ public:
     };
 
     auto clearFileFunc = [&](IControl* pCaller) {
-      pCaller->GetDelegate()->SendArbitraryMsgFromUI(mClearMsgTag);
+      // With our tag, so that browsers can share a message (see NAMRigPageControl)
+      pCaller->GetDelegate()->SendArbitraryMsgFromUI(mClearMsgTag, GetTag());
       mFileNameControl->SetLabelAndTooltip(mDefaultLabelStr.Get());
       // FIXME disabling output mode...
       //      pCaller->GetUI()->GetControlWithTag(kCtrlTagOutputMode)->SetDisabled(false);
@@ -413,10 +420,11 @@ class NAMMeterControl : public IVPeakAvgMeterControl<>, public IBitmapBase
   static constexpr float KMeterMax = -0.01f;
 
 public:
-  NAMMeterControl(const IRECT& bounds, const IBitmap& bitmap, const IVStyle& style)
+  NAMMeterControl(const IRECT& bounds, const IBitmap& bitmap, const IVStyle& style, DrawStats& drawStats)
   : IVPeakAvgMeterControl<>(bounds, "", style.WithShowValue(false).WithDrawFrame(false).WithWidgetFrac(0.8),
                             EDirection::Vertical, {}, 0, KMeterMin, KMeterMax, {})
   , IBitmapBase(bitmap)
+  , mDrawStats(drawStats)
   {
     SetPeakSize(1.0f);
   }
@@ -445,6 +453,97 @@ public:
     g.DrawGrid(COLOR_BLACK, mTrackBounds.Get()[chIdx], 10, 2);
     g.FillRect(GetColor(kX3), r, &mBlend);
   }
+
+  // The sender sends levels at the UI's frame rate whether or not they've changed. Redraw only when one of them moves
+  // the meter by at least a pixel, so that a steady (or slowly decaying) level doesn't redraw the meter every frame.
+  void OnMsgFromDelegate(int msgTag, int dataSize, const void* pData) override
+  {
+    if (IsDisabled() || msgTag != ISender<>::kUpdateMessage || mTrackBounds.GetSize() == 0)
+    {
+      IVPeakAvgMeterControl<>::OnMsgFromDelegate(msgTag, dataSize, pData);
+      return;
+    }
+    IByteStream stream(pData, dataSize);
+    ISenderData<1, std::pair<float, float>> data;
+    stream.Get(&data, 0);
+    const float pixels = mTrackBounds.Get()[0].H() * GetUI()->GetTotalScale();
+    const std::pair<int, int> shown = {_ToPixel(data.vals[0].first, pixels), _ToPixel(data.vals[0].second, pixels)};
+    const bool drawn = shown != mShownPixels;
+    mDrawStats.CountMeterUpdate(drawn);
+    if (!drawn)
+      return;
+    mShownPixels = shown;
+    IVPeakAvgMeterControl<>::OnMsgFromDelegate(msgTag, dataSize, pData);
+  }
+
+private:
+  // Where a linear level lands on a track `pixels` tall
+  static int _ToPixel(const float level, const float pixels)
+  {
+    const float db = level > 0.0f ? 20.0f * std::log10(level) : KMeterMin;
+    const float position = std::clamp((db - KMeterMin) / (KMeterMax - KMeterMin), 0.0f, 1.0f);
+    return (int)std::round(position * pixels);
+  }
+
+  // Nothing's been shown yet
+  std::pair<int, int> mShownPixels = {-1, -1};
+  DrawStats& mDrawStats;
+};
+
+// The plugin's background, which is the first thing drawn in every frame (see DrawStats)
+class NAMBackgroundControl : public IBitmapControl
+{
+public:
+  NAMBackgroundControl(const IBitmap& bitmap, DrawStats& drawStats)
+  : IBitmapControl(0, 0, bitmap)
+  , mDrawStats(drawStats)
+  {
+  }
+
+  void Draw(IGraphics& g) override
+  {
+    mDrawStats.BeginFrame();
+    IBitmapControl::Draw(g);
+  }
+
+private:
+  DrawStats& mDrawStats;
+};
+
+// Attached last over the whole UI, so it's the last thing drawn in every frame. Draws nothing.
+class NAMDrawStatsControl : public IControl
+{
+public:
+  NAMDrawStatsControl(const IRECT& bounds, DrawStats& drawStats)
+  : IControl(bounds)
+  , mDrawStats(drawStats)
+  {
+    SetIgnoreMouse(true);
+  }
+
+  void Draw(IGraphics& g) override { mDrawStats.EndFrame(); }
+
+private:
+  DrawStats& mDrawStats;
+};
+
+// A line under the title saying what the plugin has given up to keep up with the CPU (see DeadlineMonitor.h). Hidden
+// while it hasn't given anything up.
+class NAMDegradationControl : public ITextControl
+{
+public:
+  NAMDegradationControl(const IRECT& bounds, const IText& text)
+  : ITextControl(bounds, "", text)
+  {
+    SetIgnoreMouse(true);
+  }
+
+  // Empty to hide it
+  void SetDescription(const char* description)
+  {
+    SetStr(description);
+    Hide(description[0] == '\0');
+  }
 };
 
 // Container where we can refer to children by names instead of indices
@@ -487,6 +586,9 @@ struct ModelInfo
   PossiblyKnownParameter sampleRate;
   PossiblyKnownParameter inputCalibrationLevel;
   PossiblyKnownParameter outputCalibrationLevel;
+  model_profile::ModelProfile profile;
+  // Everything that this plugin instance holds, not just the model (see engine::MemoryReport)
+  size_t instanceMemoryBytes = 0;
 };
 
 class ModelInfoControl : public IContainerBaseWithNamedChildren
@@ -499,6 +601,9 @@ public:
   void ClearModelInfo()
   {
     static_cast<IVLabelControl*>(GetNamedChild(mControlNames.sampleRate))->SetStr("");
+    static_cast<IVLabelControl*>(GetNamedChild(mControlNames.size))->SetStr("");
+    static_cast<IVLabelControl*>(GetNamedChild(mControlNames.memory))->SetStr("");
+    static_cast<IVLabelControl*>(GetNamedChild(mControlNames.cpu))->SetStr("");
     mHasInfo = false;
   };
 
@@ -510,8 +615,11 @@ public:
 
   void OnAttached() override
   {
-    AddChildControl(new IVLabelControl(GetRECT().SubRectVertical(4, 0), "Model information:", mStyle));
-    AddNamedChildControl(new IVLabelControl(GetRECT().SubRectVertical(4, 1), "", mStyle), mControlNames.sampleRate);
+    AddChildControl(new IVLabelControl(GetRECT().SubRectVertical(5, 0), "Model information:", mStyle));
+    AddNamedChildControl(new IVLabelControl(GetRECT().SubRectVertical(5, 1), "", mStyle), mControlNames.sampleRate);
+    AddNamedChildControl(new IVLabelControl(GetRECT().SubRectVertical(5, 2), "", mStyle), mControlNames.size);
+    AddNamedChildControl(new IVLabelControl(GetRECT().SubRectVertical(5, 3), "", mStyle), mControlNames.memory);
+    AddNamedChildControl(new IVLabelControl(GetRECT().SubRectVertical(5, 4), "", mStyle), mControlNames.cpu);
     // AddNamedChildControl(
     //   new IVLabelControl(GetRECT().SubRectVertical(4, 2), "", mStyle), mControlNames.inputCalibrationLevel);
     // AddNamedChildControl(
@@ -536,6 +644,7 @@ public:
     };
 
     SetControlStr("Sample rate", modelInfo.sampleRate, "Hz", mControlNames.sampleRate);
+    _SetProfileStrs(modelInfo.profile, modelInfo.instanceMemoryBytes);
     // SetControlStr(
     //   "Input calibration level", modelInfo.inputCalibrationLevel, "dBu", mControlNames.inputCalibrationLevel);
     // SetControlStr(
@@ -545,10 +654,71 @@ public:
   };
 
 private:
+  void _SetProfileStrs(const model_profile::ModelProfile& profile, const size_t instanceMemoryBytes)
+  {
+    auto SetStr = [&](const std::string& childName, const std::string& str) {
+      static_cast<IVLabelControl*>(GetNamedChild(childName))->SetStr(str.c_str());
+    };
+    // 12345 -> "12.3k"
+    auto Abbreviate = [](const double x) {
+      std::stringstream ss;
+      ss.precision(3);
+      if (x >= 1.0e6)
+        ss << x / 1.0e6 << "M";
+      else if (x >= 1.0e3)
+        ss << x / 1.0e3 << "k";
+      else
+        ss << x;
+      return ss.str();
+    };
+
+    if (profile.numParameters == 0)
+    {
+      SetStr(mControlNames.size, "");
+      SetStr(mControlNames.memory, "");
+      SetStr(mControlNames.cpu, "");
+      return;
+    }
+
+    std::stringstream size;
+    size << profile.architecture << ": " << Abbreviate((double)profile.numParameters) << " params, "
+         << Abbreviate(profile.macsPerSample) << " MAC/sample";
+    SetStr(mControlNames.size, size.str());
+
+    std::stringstream memory;
+    memory << "Receptive field: ";
+    if (profile.recurrent)
+      memory << "recurrent";
+    else
+      memory << profile.receptiveField;
+    memory << ", state: " << Abbreviate((double)profile.stateBytes) << "B";
+    if (instanceMemoryBytes > 0)
+      memory << ", total: " << Abbreviate((double)instanceMemoryBytes) << "B";
+    SetStr(mControlNames.memory, memory.str());
+
+    std::stringstream cpu;
+    cpu << "Est. CPU: ";
+    if (profile.benchmarked)
+    {
+      cpu << std::round(100.0 * profile.estimatedLoad) << "% @ " << profile.hostSampleRate / 1000.0 << " kHz, "
+          << profile.hostBlockSize << " samples";
+      if (profile.IsLikelyTooHeavy())
+        cpu << " [May not run in real time!]";
+    }
+    else
+    {
+      cpu << "(Measuring...)";
+    }
+    SetStr(mControlNames.cpu, cpu.str());
+  };
+
   const IVStyle mStyle;
   struct
   {
     const std::string sampleRate = "sampleRate";
+    const std::string size = "size";
+    const std::string memory = "memory";
+    const std::string cpu = "cpu";
     // const std::string inputCalibrationLevel = "inputCalibrationLevel";
     // const std::string outputCalibrationLevel = "outputCalibrationLevel";
   } mControlNames;
@@ -587,31 +757,17 @@ public:
   };
 };
 
-class NAMSettingsPageControl : public IContainerBaseWithNamedChildren
+// A page over the main one that fades in and out, with controls that aren't made until it's first shown (see Build() in
+// the pages below). Most sessions never open them.
+class NAMPageControl : public IContainerBaseWithNamedChildren
 {
 public:
-  NAMSettingsPageControl(const IRECT& bounds, const IBitmap& bitmap, const IBitmap& inputLevelBackgroundBitmap,
-                         const IBitmap& switchBitmap, ISVG closeSVG, const IVStyle& style,
-                         const IVStyle& radioButtonStyle)
+  NAMPageControl(const IRECT& bounds)
   : IContainerBaseWithNamedChildren(bounds)
-  , mAnimationTime(0)
-  , mBitmap(bitmap)
-  , mInputLevelBackgroundBitmap(inputLevelBackgroundBitmap)
-  , mSwitchBitmap(switchBitmap)
-  , mStyle(style)
-  , mRadioButtonStyle(radioButtonStyle)
-  , mCloseSVG(closeSVG)
   {
     mIgnoreMouse = false;
   }
 
-  void ClearModelInfo()
-  {
-    auto* modelInfoControl = static_cast<ModelInfoControl*>(GetNamedChild(mControlNames.modelInfo));
-    assert(modelInfoControl != nullptr);
-    modelInfoControl->ClearModelInfo();
-  }
-
   bool OnKeyDown(float x, float y, const IKeyPress& key) override
   {
     if (key.VK == kVK_ESCAPE)
@@ -658,8 +814,67 @@ public:
     SetDirty(true);
   }
 
-  void OnAttached() override
+  bool IsBuilt() const { return mIsBuilt; };
+
+protected:
+  // The close button in the corner, and controls in sync with their parameters. The end of every Build().
+  void FinishBuild(const ISVG& closeSVG)
   {
+    auto closeAction = [&](IControl* pCaller) {
+      static_cast<NAMPageControl*>(pCaller->GetParent())->HideAnimated(true);
+    };
+    AddNamedChildControl(new NAMSquareButtonControl(CornerButtonArea(GetRECT()), closeAction, closeSVG), "Close");
+
+    OnResize();
+    ForAllChildrenFunc([](int childIdx, IControl* pChild) {
+      if (pChild->GetParamIdx() > kNoParameter)
+        pChild->SetValueFromDelegate(pChild->GetParam()->GetNormalized());
+    });
+  };
+
+  bool mIsBuilt = false;
+
+private:
+  int mAnimationTime = 0;
+  bool mWillHide = false;
+};
+
+class NAMSettingsPageControl : public NAMPageControl
+{
+public:
+  // The page's controls (and the bitmap that only they use) aren't made until it's first shown; see Build().
+  NAMSettingsPageControl(const IRECT& bounds, const IBitmap& bitmap, const char* inputLevelBackgroundFileName,
+                         const IBitmap& switchBitmap, ISVG closeSVG, const IVStyle& style,
+                         const IVStyle& radioButtonStyle)
+  : NAMPageControl(bounds)
+  , mBitmap(bitmap)
+  , mInputLevelBackgroundFileName(inputLevelBackgroundFileName)
+  , mSwitchBitmap(switchBitmap)
+  , mStyle(style)
+  , mRadioButtonStyle(radioButtonStyle)
+  , mCloseSVG(closeSVG)
+  {
+  }
+
+  void ClearModelInfo()
+  {
+    // A page that's built later starts out clear.
+    if (!mIsBuilt)
+      return;
+    auto* modelInfoControl = static_cast<ModelInfoControl*>(GetNamedChild(mControlNames.modelInfo));
+    assert(modelInfoControl != nullptr);
+    modelInfoControl->ClearModelInfo();
+  }
+
+  // Makes the page's controls, which start out in sync with their parameters. Most sessions never open the settings, so
+  // this is left until they're first shown rather than done every time the editor opens.
+  void Build()
+  {
+    if (mIsBuilt)
+      return;
+    mIsBuilt = true;
+    mInputLevelBackgroundBitmap = GetUI()->LoadBitmap(mInputLevelBackgroundFileName);
+
     const float pad = 20.0f;
     const IVStyle titleStyle = DEFAULT_STYLE.WithValueText(IText(30, COLOR_WHITE, "Michroma-Regular"))
                                  .WithDrawFrame(false)
@@ -711,22 +926,30 @@ public:
     const float halfWidth = PLUG_WIDTH / 2.0f - pad;
     const auto bottomArea = GetRECT().GetPadded(-pad).GetFromBottom(78.0f);
     const float lineHeight = 15.0f;
-    const auto modelInfoArea = bottomArea.GetFromLeft(halfWidth).GetFromTop(4 * lineHeight);
+
+    // Fills the gap between the calibration controls and the model info
+    const auto activationsArea = bottomArea.GetFromTop(2.5f * lineHeight).GetVShifted(-2.5f * lineHeight - 4.0f);
+    auto* activationsControl = AddNamedChildControl(
+      new IVRadioButtonControl(activationsArea, kActivations, {}, "Activations", mRadioButtonStyle, EVShape::Ellipse,
+                               EDirection::Horizontal, 10.0f),
+      mControlNames.activations);
+    activationsControl->SetTooltip(
+      "How the model computes its activations.\nExact=The standard library; slowest.\nPolynomial=Faster, and as "
+      "precise for 32-bit audio.\nRational=Fastest; NAM's fast tanh.\nAuto=Exact when rendering offline, Rational "
+      "while playing.");
+
+    const auto modelInfoArea = bottomArea.GetFromLeft(halfWidth).GetFromTop(5 * lineHeight);
     const auto aboutArea = bottomArea.GetFromRight(halfWidth).GetFromTop(5 * lineHeight);
     AddNamedChildControl(new ModelInfoControl(modelInfoArea, leftStyle), mControlNames.modelInfo);
     AddNamedChildControl(new AboutControl(aboutArea, leftStyle, leftText), mControlNames.about);
 
-    auto closeAction = [&](IControl* pCaller) {
-      static_cast<NAMSettingsPageControl*>(pCaller->GetParent())->HideAnimated(true);
-    };
-    AddNamedChildControl(
-      new NAMSquareButtonControl(CornerButtonArea(GetRECT()), closeAction, mCloseSVG), mControlNames.close);
-
-    OnResize();
+    FinishBuild(mCloseSVG);
   }
 
+  // Call this once the page is built (see NeuralAmpModeler::_UpdateControlsFromModel()).
   void SetModelInfo(const ModelInfo& modelInfo)
   {
+    assert(mIsBuilt);
     auto* modelInfoControl = static_cast<ModelInfoControl*>(GetNamedChild(mControlNames.modelInfo));
     assert(modelInfoControl != nullptr);
     modelInfoControl->SetModelInfo(modelInfo);
@@ -734,22 +957,21 @@ public:
 
 private:
   IBitmap mBitmap;
+  const char* mInputLevelBackgroundFileName;
   IBitmap mInputLevelBackgroundBitmap;
   IBitmap mSwitchBitmap;
   IVStyle mStyle;
   IVStyle mRadioButtonStyle;
   ISVG mCloseSVG;
-  int mAnimationTime = 200;
-  bool mWillHide = false;
 
   // Names for controls
   // Make sure that these are all unique and that you use them with AddNamedChildControl
   struct ControlNames
   {
     const std::string about = "About";
+    const std::string activations = "Activations";
     const std::string bitmap = "Bitmap";
     const std::string calibrateInput = "CalibrateInput";
-    const std::string close = "Close";
     const std::string inputCalibrationLevel = "InputCalibrationLevel";
     const std::string modelInfo = "ModelInfo";
     const std::string outputMode = "OutputMode";
@@ -815,7 +1037,8 @@ private:
       WDL_String verStr, buildInfoStr;
       PLUG()->GetPluginVersionStr(verStr);
 
-      buildInfoStr.SetFormatted(100, "Version %s %s %s", verStr.Get(), PLUG()->GetArchStr(), PLUG()->GetAPIStr());
+      buildInfoStr.SetFormatted(100, "Version %s %s %s %s", verStr.Get(), PLUG()->GetArchStr(), PLUG()->GetAPIStr(),
+                                cpu_features::GetTierName(cpu_features::GetActiveTier()));
 
       AddChildControl(new IVLabelControl(GetRECT().SubRectVertical(5, 0), "NEURAL AMP MODELER", mStyle));
       AddChildControl(new IVLabelControl(GetRECT().SubRectVertical(5, 1), "By Steven Atkinson", mStyle));
@@ -834,3 +1057,154 @@ private:
     IText mText;
   };
 };
+
+// What there's only room for one of on the main page: the other models of a rig (see
+// engine::Engine::StageBranchModel()) and where each one sits in the mix, and the other IRs of the IR blend (see
+// engine::Engine::SetIRGain()) and how each one goes into it
+class NAMRigPageControl : public NAMPageControl
+{
+public:
+  // Called with a branch's model file, or an IR slot's file, when it's picked
+  using LoadFunc = std::function<void(int index, const WDL_String& fileName)>;
+
+  NAMRigPageControl(const IRECT& bounds, const IBitmap& bitmap, const IBitmap& fileBitmap, const ISVG& fileSVG,
+                    const ISVG& closeSVG, const ISVG& leftSVG, const ISVG& rightSVG, const IVStyle& style,
+                    LoadFunc loadBranch, LoadFunc loadIR)
+  : NAMPageControl(bounds)
+  , mBitmap(bitmap)
+  , mFileBitmap(fileBitmap)
+  , mFileSVG(fileSVG)
+  , mCloseSVG(closeSVG)
+  , mLeftSVG(leftSVG)
+  , mRightSVG(rightSVG)
+  , mStyle(style)
+  , mLoadBranch(std::move(loadBranch))
+  , mLoadIR(std::move(loadIR))
+  {
+  }
+
+  // Makes the page's controls. The file browsers have the tags kCtrlTagBranchFileBrowser + branch - 1 and
+  // kCtrlTagIRSlotFileBrowser + slot - 1, so tell them what's loaded once they're here (see
+  // NeuralAmpModeler::_UpdateRigControls()).
+  void Build()
+  {
+    if (mIsBuilt)
+      return;
+    mIsBuilt = true;
+
+    const float pad = 20.0f;
+    const IVStyle titleStyle = DEFAULT_STYLE.WithValueText(IText(30, COLOR_WHITE, "Michroma-Regular"))
+                                 .WithDrawFrame(false)
+                                 .WithShadowOffset(2.f);
+    const auto text = IText(DEFAULT_TEXT_SIZE, EAlign::Center, PluginColors::HELP_TEXT);
+    const IVStyle labelStyle = mStyle.WithDrawFrame(false).WithValueText(text);
+    const IVStyle knobStyle = mStyle.WithShowLabel(false).WithShowValue(false);
+
+    AddNamedChildControl(new IBitmapControl(GetRECT(), mBitmap), mControlNames.bitmap)->SetIgnoreMouse(true);
+    const auto contentArea = GetRECT().GetPadded(-(pad + 10.0f));
+    const auto titleArea = contentArea.GetFromTop(50.0f);
+    AddNamedChildControl(new IVLabelControl(titleArea, "RIG", titleStyle), mControlNames.title);
+
+    // Two columns, models and IRs. Each has a row of headings, then a row for each branch or slot: its file and two
+    // knobs. The first ones are the main page's.
+    const float rowHeight = 40.0f;
+    const float knobWidth = 40.0f;
+    const auto columnsArea = contentArea.GetReducedFromTop(titleArea.H() + 10.0f);
+    const auto branchesArea = columnsArea.GetFromLeft(0.5f * columnsArea.W()).GetHPadded(-5.0f);
+    const auto irsArea = columnsArea.GetFromRight(0.5f * columnsArea.W()).GetHPadded(-5.0f);
+    auto rowArea = [&](const IRECT& column, const int row) {
+      return column.GetFromTop(rowHeight).GetVShifted(row * rowHeight);
+    };
+    auto addColumn = [&](const IRECT& column, const int numRows, const char* heading, const char* firstKnobName,
+                         const char* secondKnobName, auto addRow) {
+      auto fileArea = [&](const IRECT& row) { return row.GetReducedFromRight(2.0f * knobWidth).GetMidVPadded(15.0f); };
+      auto firstKnobArea = [&](const IRECT& row) { return row.GetFromRight(2.0f * knobWidth).GetFromLeft(knobWidth); };
+      auto secondKnobArea = [&](const IRECT& row) { return row.GetFromRight(knobWidth); };
+      const auto headingArea = rowArea(column, 0).GetFromBottom(20.0f);
+      AddChildControl(new IVLabelControl(fileArea(headingArea), heading, labelStyle));
+      AddChildControl(new IVLabelControl(firstKnobArea(headingArea), firstKnobName, labelStyle));
+      AddChildControl(new IVLabelControl(secondKnobArea(headingArea), secondKnobName, labelStyle));
+      for (int i = 0; i < numRows; i++)
+      {
+        const auto row = rowArea(column, i + 1);
+        addRow(i, fileArea(row), firstKnobArea(row), secondKnobArea(row));
+      }
+    };
+
+    addColumn(branchesArea, engine::kMaxModelBranches, "Models", "Level", "Pan",
+              [&](const int branch, const IRECT& fileArea, const IRECT& levelArea, const IRECT& panArea) {
+                if (branch == 0)
+                  AddChildControl(new IVLabelControl(fileArea, "(Main page's model)", labelStyle));
+                else
+                  AddChildControl(_MakeFileBrowser(fileArea, kMsgTagClearBranchModel, "Select model...", "nam",
+                                                   mLoadBranch, branch),
+                                  kCtrlTagBranchFileBrowser + branch - 1);
+                AddChildControl(new IVKnobControl(levelArea, kBranchLevel + branch, "", knobStyle));
+                AddChildControl(new IVKnobControl(panArea, kBranchPan + branch, "", knobStyle));
+              });
+    addColumn(irsArea, ir_blend::kMaxIRs, "IRs", "Gain", "Delay",
+              [&](const int slot, const IRECT& fileArea, const IRECT& gainArea, const IRECT& delayArea) {
+                if (slot == 0)
+                  AddChildControl(new IVLabelControl(fileArea, "(Main page's IR)", labelStyle));
+                else
+                  AddChildControl(
+                    _MakeFileBrowser(fileArea, kMsgTagClearIRSlot, "Select IR...", "wav", mLoadIR, slot),
+                    kCtrlTagIRSlotFileBrowser + slot - 1);
+                AddChildControl(new IVKnobControl(gainArea, kIRGain + slot, "", knobStyle));
+                AddChildControl(new IVKnobControl(delayArea, kIRDelay + slot, "", knobStyle));
+              });
+
+    const auto misalignmentArea = rowArea(branchesArea, engine::kMaxModelBranches + 1).GetFromTop(20.0f);
+    AddNamedChildControl(
+      new ITextControl(misalignmentArea, _GetMisalignmentStr().c_str(), text), mControlNames.misalignment);
+
+    FinishBuild(mCloseSVG);
+  }
+
+  // See engine::Engine::GetRigMisalignment()
+  void SetRigMisalignment(const int samples)
+  {
+    if (samples == mRigMisalignment)
+      return;
+    mRigMisalignment = samples;
+    if (mIsBuilt)
+      static_cast<ITextControl*>(GetNamedChild(mControlNames.misalignment))->SetStr(_GetMisalignmentStr().c_str());
+  };
+
+private:
+  // A file browser that hands what's picked to `loadFunc`, with `index`
+  NAMFileBrowserControl* _MakeFileBrowser(const IRECT& bounds, const int clearMsgTag, const char* labelStr,
+                                          const char* fileExtension, const LoadFunc& loadFunc, const int index)
+  {
+    auto completionHandler = [loadFunc, index](const WDL_String& fileName, const WDL_String& path) {
+      if (fileName.GetLength())
+        loadFunc(index, fileName);
+    };
+    return new NAMFileBrowserControl(bounds, clearMsgTag, labelStr, fileExtension, completionHandler, mStyle, mFileSVG,
+                                     mCloseSVG, mLeftSVG, mRightSVG, mFileBitmap);
+  };
+
+  std::string _GetMisalignmentStr() const
+  {
+    std::stringstream ss;
+    if (mRigMisalignment > 0)
+      ss << "Branches out of line by " << mRigMisalignment << " samples";
+    return ss.str();
+  };
+
+
+  IBitmap mBitmap;
+  IBitmap mFileBitmap;
+  ISVG mFileSVG, mCloseSVG, mLeftSVG, mRightSVG;
+  IVStyle mStyle;
+  LoadFunc mLoadBranch;
+  LoadFunc mLoadIR;
+  int mRigMisalignment = 0;
+
+  struct ControlNames
+  {
+    const std::string bitmap = "Bitmap";
+    const std::string misalignment = "Misalignment";
+    const std::string title = "Title";
+  } mControlNames;
+};
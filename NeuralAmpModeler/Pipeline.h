@@ -0,0 +1,388 @@
+#pragma once
+
+// Two-core pipelined execution of the signal chain.
+//
+// At small buffer sizes, a big model and a long IR may not fit inside one core's deadline even though neither does on
+// its own. The pipeline runs the first stage of the chain (gate, model) for block n on a worker thread while the audio
+// thread runs the second stage (tone stack, IR, ...) on the first stage's output from one block earlier. That costs
+// exactly maxBlockSize samples of latency, regardless of how the host splits its buffers.
+//
+// Handoff is lock-free: the audio thread publishes a block with an atomic counter and the worker publishes its
+// completion the same way. Neither side ever takes a lock or allocates once Start() has been called.
+//
+// WorkerPool is the fork-join counterpart for work that splits within a block (a rig's model branches, see Engine.h):
+// no latency, but the audio thread waits for the slowest job. Its workers park once they've been idle for a while, so
+// a pool that isn't being used costs nothing.
+
+#include <algorithm> // std::copy, std::min
+#include <atomic>
+#include <chrono>
+#include <climits> // LONG_MAX
+#include <cstdint>
+#include <cstdlib> // std::getenv
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+  #include <windows.h>
+#else
+  #include <pthread.h>
+  #include <sched.h>
+  #if defined(__APPLE__)
+    #include <dispatch/dispatch.h>
+  #else
+    #include <semaphore.h>
+  #endif
+#endif
+
+#if defined(__x86_64__) || defined(_M_AMD64) || defined(__i386__) || defined(_M_IX86)
+  #include <immintrin.h>
+  #define NAM_CPU_RELAX() _mm_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+  #define NAM_CPU_RELAX() __asm__ __volatile__("yield")
+#else
+  #define NAM_CPU_RELAX()
+#endif
+
+#include "DSPLoadMeter.h"
+
+namespace pipeline
+{
+// Best effort; if the OS won't let us, we just run at normal priority.
+inline void PromoteCurrentThreadToRealtime()
+{
+#if defined(_WIN32)
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#else
+  sched_param param{};
+  param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 10;
+  pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+#endif
+}
+
+// Whether the user asked for pipelining. It's opt-in because of the extra latency.
+inline bool IsRequested()
+{
+  const char* value = std::getenv("NAM_PIPELINE");
+  return value != nullptr && value[0] != '\0' && value[0] != '0';
+}
+
+// Above this, one core has plenty of time per block and pipelining would only add latency.
+constexpr int kMaxPipelinedBlockSize = 256;
+// Likewise for the worker pool: above this, the handoff isn't worth the cores that it keeps busy.
+constexpr int kMaxParallelBlockSize = 256;
+
+// Spins while we expect more work soon; backs off if the host has stopped calling us.
+inline void IdleWait(const std::chrono::steady_clock::time_point& lastWork)
+{
+  const auto idle = std::chrono::steady_clock::now() - lastWork;
+  if (idle < std::chrono::milliseconds(2))
+    NAM_CPU_RELAX();
+  else if (idle < std::chrono::milliseconds(50))
+    std::this_thread::yield();
+  else
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+// For parking a worker until the audio thread has something for it. Post() doesn't lock or allocate, so the audio
+// thread can call it.
+class Semaphore
+{
+public:
+#if defined(_WIN32)
+  Semaphore() { mHandle = CreateSemaphore(nullptr, 0, LONG_MAX, nullptr); };
+  ~Semaphore() { CloseHandle(mHandle); };
+  void Post() { ReleaseSemaphore(mHandle, 1, nullptr); };
+  void Wait() { WaitForSingleObject(mHandle, INFINITE); };
+#elif defined(__APPLE__)
+  Semaphore() { mHandle = dispatch_semaphore_create(0); };
+  ~Semaphore() { dispatch_release(mHandle); };
+  void Post() { dispatch_semaphore_signal(mHandle); };
+  void Wait() { dispatch_semaphore_wait(mHandle, DISPATCH_TIME_FOREVER); };
+#else
+  Semaphore() { sem_init(&mHandle, 0, 0); };
+  ~Semaphore() { sem_destroy(&mHandle); };
+  void Post() { sem_post(&mHandle); };
+  void Wait()
+  {
+    while (sem_wait(&mHandle) != 0)
+      ; // Interrupted by a signal
+  };
+#endif
+  Semaphore(const Semaphore&) = delete;
+  Semaphore& operator=(const Semaphore&) = delete;
+
+private:
+#if defined(_WIN32)
+  HANDLE mHandle;
+#elif defined(__APPLE__)
+  dispatch_semaphore_t mHandle;
+#else
+  sem_t mHandle;
+#endif
+};
+
+template <typename SampleType>
+class TwoStagePipeline
+{
+public:
+  // Processes `numFrames` samples of `input` into `output` on the worker thread.
+  using Stage = std::function<void(const SampleType* input, SampleType* output, int numFrames)>;
+
+  TwoStagePipeline() = default;
+  TwoStagePipeline(const TwoStagePipeline&) = delete;
+  TwoStagePipeline& operator=(const TwoStagePipeline&) = delete;
+  ~TwoStagePipeline() { Stop(); };
+
+  bool IsRunning() const { return mThread.joinable(); };
+
+  // Latency added by the pipeline, in samples
+  int GetLatency() const { return IsRunning() ? mMaxBlockSize : 0; };
+
+  // Whether a block of this size can go through the pipeline
+  bool CanProcess(const int numFrames) const { return IsRunning() && numFrames <= mMaxBlockSize; };
+
+  // Load of the first stage on the worker core, relative to the block deadline
+  const DSPLoadMeter& GetWorkerLoad() const { return mWorkerLoad; };
+
+  // Bytes of the pipeline's buffers
+  size_t GetMemoryBytes() const
+  {
+    return sizeof(SampleType) * (mInput.capacity() + mStageOutput.capacity() + mRing.capacity());
+  };
+
+  // Not real-time safe. Call while the audio thread is not processing.
+  void Start(Stage firstStage, const int maxBlockSize, const double sampleRate)
+  {
+    Stop();
+    mFirstStage = std::move(firstStage);
+    mMaxBlockSize = maxBlockSize;
+    mSampleRate = sampleRate;
+    mInput.assign(maxBlockSize, (SampleType)0);
+    mStageOutput.assign(maxBlockSize, (SampleType)0);
+    // Room for the delay plus the block being written. Starts silent, which is the "previous" output for the first
+    // block.
+    mRing.assign(2 * maxBlockSize, (SampleType)0);
+    mWritePos = 0;
+    mLaunched.store(0);
+    mCompleted.store(0);
+    mQuit.store(false);
+    mThread = std::thread([this]() { _WorkerLoop(); });
+  };
+
+  void Stop()
+  {
+    if (!IsRunning())
+      return;
+    mQuit.store(true, std::memory_order_release);
+    mThread.join();
+    // Don't hold on to buffers that won't be used
+    std::vector<SampleType>().swap(mInput);
+    std::vector<SampleType>().swap(mStageOutput);
+    std::vector<SampleType>().swap(mRing);
+  };
+
+  // Audio thread. Writes the first stage's output from maxBlockSize samples ago into `delayed`, then starts the first
+  // stage on `input` on the worker and returns immediately.
+  // Wait() must be called before the next Launch().
+  void Launch(const SampleType* input, SampleType* delayed, const int numFrames)
+  {
+    const int ringSize = (int)mRing.size();
+    int readPos = mWritePos - mMaxBlockSize;
+    if (readPos < 0)
+      readPos += ringSize;
+    for (int s = 0; s < numFrames; s++)
+    {
+      delayed[s] = mRing[readPos];
+      if (++readPos == ringSize)
+        readPos = 0;
+    }
+    std::copy(input, input + numFrames, mInput.begin());
+    mNumFrames = numFrames;
+    mLaunched.fetch_add(1, std::memory_order_release);
+  };
+
+  // Audio thread. Returns once the worker has finished the block from the last Launch().
+  void Wait()
+  {
+    const uint64_t target = mLaunched.load(std::memory_order_relaxed);
+    while (mCompleted.load(std::memory_order_acquire) != target)
+      NAM_CPU_RELAX();
+  };
+
+private:
+  void _WorkerLoop()
+  {
+    PromoteCurrentThreadToRealtime();
+    uint64_t done = 0;
+    auto lastWork = std::chrono::steady_clock::now();
+    while (!mQuit.load(std::memory_order_acquire))
+    {
+      if (mLaunched.load(std::memory_order_acquire) == done)
+      {
+        IdleWait(lastWork);
+        continue;
+      }
+      mWorkerLoad.Begin();
+      const int numFrames = mNumFrames;
+      mFirstStage(mInput.data(), mStageOutput.data(), numFrames);
+      const int ringSize = (int)mRing.size();
+      for (int s = 0; s < numFrames; s++)
+      {
+        mRing[mWritePos] = mStageOutput[s];
+        if (++mWritePos == ringSize)
+          mWritePos = 0;
+      }
+      mWorkerLoad.End(numFrames, mSampleRate);
+      done++;
+      mCompleted.store(done, std::memory_order_release);
+      lastWork = std::chrono::steady_clock::now();
+    }
+  };
+
+  Stage mFirstStage;
+  int mMaxBlockSize = 0;
+  double mSampleRate = 0.0;
+  std::vector<SampleType> mInput;
+  std::vector<SampleType> mStageOutput;
+  std::vector<SampleType> mRing;
+  // Only touched by whichever side currently owns the block (ordered by the counters)
+  int mWritePos = 0;
+  int mNumFrames = 0;
+
+  std::atomic<uint64_t> mLaunched = 0;
+  std::atomic<uint64_t> mCompleted = 0;
+  std::atomic<bool> mQuit = false;
+  std::thread mThread;
+  DSPLoadMeter mWorkerLoad;
+};
+
+// Runs jobs 0..n-1 of a block at once: job 0 on the audio thread and job i on worker i. Only the workers that have a
+// job are woken, so idle ones back off to parking no matter how often Run() is called.
+//
+// A worker spins for a little while after each job, since the next block is usually only a few milliseconds away, and
+// then parks on a semaphore until Run() or Stop() posts it.
+class WorkerPool
+{
+public:
+  // Runs job `job` of the current block. Each job should touch only its own data.
+  using Job = std::function<void(int job)>;
+
+  WorkerPool() = default;
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+  ~WorkerPool() { Stop(); };
+
+  // Safe to call from the audio thread while another thread calls Start().
+  bool IsRunning() const { return mNumWorkers.load(std::memory_order_acquire) > 0; };
+
+  // Not real-time safe, and not while Run() or Stop() might be running. Does nothing if it's already running.
+  void Start(Job job, const int numWorkers)
+  {
+    if (IsRunning() || numWorkers <= 0)
+      return;
+    mJob = std::move(job);
+    mQuit.store(false);
+    for (int w = 0; w < numWorkers; w++)
+      mWorkers.push_back(std::make_unique<Worker>());
+    for (int w = 0; w < numWorkers; w++)
+      mWorkers[w]->thread = std::thread([this, w]() { _WorkerLoop(w); });
+    mNumWorkers.store(numWorkers, std::memory_order_release);
+  };
+
+  // Not while Run() might be running
+  void Stop()
+  {
+    if (!IsRunning())
+      return;
+    mNumWorkers.store(0, std::memory_order_release);
+    mQuit.store(true);
+    for (auto& worker : mWorkers)
+    {
+      _Unpark(*worker);
+      worker->thread.join();
+    }
+    mWorkers.clear();
+  };
+
+  // Audio thread, once IsRunning(). Returns when all `numJobs` jobs are done. Jobs that there are no workers for run
+  // here, after job 0.
+  void Run(const int numJobs)
+  {
+    const int numLaunched = std::min(numJobs - 1, mNumWorkers.load(std::memory_order_relaxed));
+    for (int w = 0; w < numLaunched; w++)
+    {
+      mWorkers[w]->launched.fetch_add(1);
+      _Unpark(*mWorkers[w]);
+    }
+    mJob(0);
+    for (int job = numLaunched + 1; job < numJobs; job++)
+      mJob(job);
+    for (int w = 0; w < numLaunched; w++)
+    {
+      const uint64_t target = mWorkers[w]->launched.load(std::memory_order_relaxed);
+      while (mWorkers[w]->completed.load(std::memory_order_acquire) != target)
+        NAM_CPU_RELAX();
+    }
+  };
+
+private:
+  // Each on its own cache line so that the workers' counters don't slow each other down
+  struct alignas(64) Worker
+  {
+    std::atomic<uint64_t> launched = 0;
+    std::atomic<uint64_t> completed = 0;
+    std::atomic<bool> parked = false;
+    Semaphore unpark;
+    std::thread thread;
+  };
+
+  // How long a worker spins after its last job before it parks
+  static constexpr std::chrono::milliseconds kSpinTime{5};
+
+  // Whoever takes `parked` back from true posts, so there's exactly one post for each park that needs one.
+  // Sequentially consistent, as are the worker's store and load, so that either the worker sees the job or we see
+  // that it's parked.
+  void _Unpark(Worker& worker)
+  {
+    if (worker.parked.exchange(false))
+      worker.unpark.Post();
+  };
+
+  void _WorkerLoop(const int w)
+  {
+    PromoteCurrentThreadToRealtime();
+    Worker& worker = *mWorkers[w];
+    uint64_t done = 0;
+    auto lastWork = std::chrono::steady_clock::now();
+    while (!mQuit.load(std::memory_order_acquire))
+    {
+      if (worker.launched.load(std::memory_order_acquire) == done)
+      {
+        if (std::chrono::steady_clock::now() - lastWork < kSpinTime)
+        {
+          NAM_CPU_RELAX();
+          continue;
+        }
+        worker.parked.store(true);
+        // If there's work after all, whatever posted for it has to be taken too.
+        if ((worker.launched.load() == done && !mQuit.load()) || !worker.parked.exchange(false))
+          worker.unpark.Wait();
+        lastWork = std::chrono::steady_clock::now();
+        continue;
+      }
+      mJob(w + 1);
+      done++;
+      worker.completed.store(done, std::memory_order_release);
+      lastWork = std::chrono::steady_clock::now();
+    }
+  };
+
+  Job mJob;
+  std::vector<std::unique_ptr<Worker>> mWorkers;
+  std::atomic<int> mNumWorkers = 0;
+  std::atomic<bool> mQuit = false;
+};
+}; // namespace pipeline
@@ -0,0 +1,389 @@
+#include "RealtimeSanitizer.h"
+
+#ifdef NAM_RT_SANITIZER
+
+  #include <atomic>
+  #include <cerrno>
+  #include <cstdarg>
+  #include <cstdio>
+  #include <cstdlib>
+  #include <new>
+
+  #if defined(_WIN32)
+    #include <malloc.h> // _aligned_malloc
+  #else
+    #include <execinfo.h> // backtrace
+    #include <unistd.h>
+  #endif
+
+  #if defined(__linux__) && defined(__GLIBC__)
+    #define NAM_RT_SANITIZER_INTERCEPT_LIBC
+    #include <dlfcn.h>
+    #include <fcntl.h>
+    #include <pthread.h>
+    #include <time.h>
+  #endif
+
+  // The checks run inside malloc, so the thread-locals must never need malloc themselves (which dynamic TLS can).
+  #if defined(__GNUC__) && !defined(_WIN32) && !defined(__APPLE__)
+    #define NAM_RT_SANITIZER_TLS __thread __attribute__((tls_model("initial-exec")))
+  #else
+    #define NAM_RT_SANITIZER_TLS thread_local
+  #endif
+
+namespace
+{
+NAM_RT_SANITIZER_TLS int tRealtimeDepth = 0;
+NAM_RT_SANITIZER_TLS const char* tScopeName = nullptr;
+// Set while we report a violation or resolve a symbol so that whatever that does doesn't count
+NAM_RT_SANITIZER_TLS bool tSuspended = false;
+
+std::atomic<size_t> gNumViolations{0};
+// Reports after this many are only counted
+constexpr size_t kMaxReports = 100;
+bool gAbortOnViolation = false;
+
+void WriteStderr(const char* str)
+{
+  #if defined(_WIN32)
+  fputs(str, stderr);
+  #else
+  size_t length = 0;
+  while (str[length] != '\0')
+    length++;
+  (void)!write(STDERR_FILENO, str, length);
+  #endif
+}
+
+void Report(const char* what)
+{
+  tSuspended = true;
+  const size_t n = gNumViolations.fetch_add(1) + 1;
+  if (n <= kMaxReports)
+  {
+    char line[256];
+    snprintf(line, sizeof(line), "[rt-sanitizer] %s inside real-time scope \"%s\" (violation %zu)\n", what,
+             tScopeName != nullptr ? tScopeName : "?", n);
+    WriteStderr(line);
+  #if !defined(_WIN32)
+    void* frames[64];
+    const int numFrames = backtrace(frames, 64);
+    // Skip Report() and Check()
+    if (numFrames > 2)
+      backtrace_symbols_fd(frames + 2, numFrames - 2, STDERR_FILENO);
+  #endif
+    if (n == kMaxReports)
+      WriteStderr("[rt-sanitizer] Further violations will be counted but not reported\n");
+  }
+  if (gAbortOnViolation)
+    abort();
+  tSuspended = false;
+}
+
+inline void Check(const char* what)
+{
+  if (tRealtimeDepth > 0 && !tSuspended)
+    Report(what);
+}
+
+struct Init
+{
+  Init()
+  {
+    const char* value = getenv("NAM_RT_SANITIZER_ABORT");
+    gAbortOnViolation = value != nullptr && value[0] != '\0' && value[0] != '0';
+  #if !defined(_WIN32)
+    // The first backtrace() loads the unwinder, which allocates. Get that out of the way now.
+    void* frames[4];
+    backtrace(frames, 4);
+  #endif
+  };
+} gInit;
+
+  #if defined(NAM_RT_SANITIZER_INTERCEPT_LIBC)
+template <typename Fn>
+Fn Next(Fn& cached, const char* name)
+{
+  if (cached == nullptr)
+  {
+    const bool suspended = tSuspended;
+    tSuspended = true;
+    cached = reinterpret_cast<Fn>(dlsym(RTLD_NEXT, name));
+    tSuspended = suspended;
+  }
+  return cached;
+}
+  #endif
+}; // namespace
+
+// Unchecked allocation for operator new and friends, so that one `new` is one report
+  #if defined(NAM_RT_SANITIZER_INTERCEPT_LIBC)
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t num, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+void* __libc_memalign(size_t alignment, size_t size);
+}
+static void* RawMalloc(const size_t size) { return __libc_malloc(size); }
+static void* RawAlignedMalloc(const size_t alignment, const size_t size) { return __libc_memalign(alignment, size); }
+static void RawFree(void* ptr) { __libc_free(ptr); }
+static void RawAlignedFree(void* ptr) { __libc_free(ptr); }
+  #elif defined(_WIN32)
+static void* RawMalloc(const size_t size) { return malloc(size); }
+static void* RawAlignedMalloc(const size_t alignment, const size_t size) { return _aligned_malloc(size, alignment); }
+static void RawFree(void* ptr) { free(ptr); }
+static void RawAlignedFree(void* ptr) { _aligned_free(ptr); }
+  #else
+static void* RawMalloc(const size_t size) { return malloc(size); }
+static void* RawAlignedMalloc(const size_t alignment, const size_t size)
+{
+  void* ptr = nullptr;
+  return posix_memalign(&ptr, alignment, size) == 0 ? ptr : nullptr;
+}
+static void RawFree(void* ptr) { free(ptr); }
+static void RawAlignedFree(void* ptr) { free(ptr); }
+  #endif
+
+extern "C" {
+void nam_rt_sanitizer_enter(const char* scopeName)
+{
+  if (tRealtimeDepth++ == 0)
+    tScopeName = scopeName;
+}
+
+void nam_rt_sanitizer_leave()
+{
+  if (tRealtimeDepth > 0)
+    tRealtimeDepth--;
+}
+
+size_t nam_rt_sanitizer_num_violations() { return gNumViolations.load(); }
+}
+
+// C++ allocation (all platforms) ------------------------------------------------------------------------------------
+
+void* operator new(std::size_t size)
+{
+  Check("operator new");
+  if (void* ptr = RawMalloc(size > 0 ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+  Check("operator new[]");
+  if (void* ptr = RawMalloc(size > 0 ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+  Check("operator new");
+  return RawMalloc(size > 0 ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+  Check("operator new[]");
+  return RawMalloc(size > 0 ? size : 1);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+  Check("operator new");
+  if (void* ptr = RawAlignedMalloc((size_t)alignment, size > 0 ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+  Check("operator new[]");
+  if (void* ptr = RawAlignedMalloc((size_t)alignment, size > 0 ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+  if (ptr == nullptr)
+    return;
+  Check("operator delete");
+  RawFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+  if (ptr == nullptr)
+    return;
+  Check("operator delete[]");
+  RawFree(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept { operator delete(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { operator delete[](ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { operator delete(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { operator delete[](ptr); }
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+  if (ptr == nullptr)
+    return;
+  Check("operator delete");
+  RawAlignedFree(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+  if (ptr == nullptr)
+    return;
+  Check("operator delete[]");
+  RawAlignedFree(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t alignment) noexcept { operator delete(ptr, alignment); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t alignment) noexcept
+{
+  operator delete[](ptr, alignment);
+}
+
+// C library (Linux) -------------------------------------------------------------------------------------------------
+
+  #if defined(NAM_RT_SANITIZER_INTERCEPT_LIBC)
+extern "C" {
+void* malloc(size_t size)
+{
+  Check("malloc");
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t num, size_t size)
+{
+  Check("calloc");
+  return __libc_calloc(num, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+  Check("realloc");
+  return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr)
+{
+  if (ptr == nullptr)
+    return;
+  Check("free");
+  __libc_free(ptr);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+  Check("memalign");
+  return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+  Check("aligned_alloc");
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size)
+{
+  Check("posix_memalign");
+  if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0)
+    return EINVAL;
+  void* ptr = __libc_memalign(alignment, size);
+  if (ptr == nullptr)
+    return ENOMEM;
+  *out = ptr;
+  return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+  static int (*real)(pthread_mutex_t*) = nullptr;
+  Check("pthread_mutex_lock");
+  return Next(real, "pthread_mutex_lock")(mutex);
+}
+
+int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex)
+{
+  static int (*real)(pthread_cond_t*, pthread_mutex_t*) = nullptr;
+  Check("pthread_cond_wait");
+  return Next(real, "pthread_cond_wait")(cond, mutex);
+}
+
+int pthread_cond_timedwait(pthread_cond_t* cond, pthread_mutex_t* mutex, const struct timespec* abstime)
+{
+  static int (*real)(pthread_cond_t*, pthread_mutex_t*, const struct timespec*) = nullptr;
+  Check("pthread_cond_timedwait");
+  return Next(real, "pthread_cond_timedwait")(cond, mutex, abstime);
+}
+
+int nanosleep(const struct timespec* duration, struct timespec* remaining)
+{
+  static int (*real)(const struct timespec*, struct timespec*) = nullptr;
+  Check("nanosleep");
+  return Next(real, "nanosleep")(duration, remaining);
+}
+
+int usleep(useconds_t usec)
+{
+  static int (*real)(useconds_t) = nullptr;
+  Check("usleep");
+  return Next(real, "usleep")(usec);
+}
+
+unsigned int sleep(unsigned int seconds)
+{
+  static unsigned int (*real)(unsigned int) = nullptr;
+  Check("sleep");
+  return Next(real, "sleep")(seconds);
+}
+
+int open(const char* path, int flags, ...)
+{
+  static int (*real)(const char*, int, ...) = nullptr;
+  Check("open");
+  mode_t mode = 0;
+  if ((flags & O_CREAT) != 0)
+  {
+    va_list args;
+    va_start(args, flags);
+    mode = (mode_t)va_arg(args, int);
+    va_end(args);
+  }
+  return Next(real, "open")(path, flags, mode);
+}
+
+ssize_t read(int fd, void* buffer, size_t count)
+{
+  static ssize_t (*real)(int, void*, size_t) = nullptr;
+  Check("read");
+  return Next(real, "read")(fd, buffer, count);
+}
+
+ssize_t write(int fd, const void* buffer, size_t count)
+{
+  static ssize_t (*real)(int, const void*, size_t) = nullptr;
+  Check("write");
+  return Next(real, "write")(fd, buffer, count);
+}
+
+// Every `throw` goes through here.
+[[noreturn]] void __cxa_throw(void* thrownException, void* typeInfo, void (*destructor)(void*))
+{
+  static void (*real)(void*, void*, void (*)(void*)) = nullptr;
+  Check("throw");
+  Next(real, "__cxa_throw")(thrownException, typeInfo, destructor);
+  __builtin_unreachable();
+}
+}
+  #endif // NAM_RT_SANITIZER_INTERCEPT_LIBC
+
+#endif // NAM_RT_SANITIZER
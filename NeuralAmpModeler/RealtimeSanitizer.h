@@ -0,0 +1,53 @@
+#pragma once
+
+// Debug mode that catches real-time safety violations on the audio thread.
+//
+// Build with NAM_RT_SANITIZER defined (e.g. in EXTRA_DEBUG_DEFS) and RealtimeSanitizer.cpp starts checking every
+// thread that is inside a real-time scope (NAM_RT_SANITIZER_SCOPE(), which ProcessBlock() opens) for:
+//
+// * Heap allocation and deallocation (operator new/delete everywhere; malloc & co. on Linux)
+// * Locking a mutex or waiting on a condition variable (Linux)
+// * Sleeping and file I/O (Linux)
+// * Throwing an exception (Linux)
+//
+// Each violation is written to stderr with a stack trace. Set NAM_RT_SANITIZER_ABORT=1 to abort on the first one
+// instead, so that a debugger stops right there.
+//
+// The C library's functions can only be intercepted from the executable (or something that's preloaded), not from a
+// plugin that the host dlopen()s. To check the plugin in a host on Linux, also preload the standalone build of the
+// sanitizer: LD_PRELOAD=libnam-rtsan.so <host> (see tools/CMakeLists.txt). tools/nam-rtcheck.cpp is a headless
+// harness that drives the chain through the things that tend to go wrong.
+//
+// Without NAM_RT_SANITIZER, all of this compiles to nothing.
+
+#include <cstddef>
+
+extern "C" {
+// Enter/leave a real-time scope on the calling thread. Scopes nest.
+void nam_rt_sanitizer_enter(const char* scopeName);
+void nam_rt_sanitizer_leave();
+// Total violations reported so far, on all threads
+size_t nam_rt_sanitizer_num_violations();
+}
+
+namespace rt_sanitizer
+{
+#ifdef NAM_RT_SANITIZER
+class ScopedRealtimeContext
+{
+public:
+  explicit ScopedRealtimeContext(const char* scopeName) { nam_rt_sanitizer_enter(scopeName); };
+  ~ScopedRealtimeContext() { nam_rt_sanitizer_leave(); };
+  ScopedRealtimeContext(const ScopedRealtimeContext&) = delete;
+  ScopedRealtimeContext& operator=(const ScopedRealtimeContext&) = delete;
+};
+
+inline size_t GetNumViolations() { return nam_rt_sanitizer_num_violations(); }
+
+  #define NAM_RT_SANITIZER_SCOPE(name) rt_sanitizer::ScopedRealtimeContext _namRealtimeScope(name)
+#else
+inline size_t GetNumViolations() { return 0; }
+
+  #define NAM_RT_SANITIZER_SCOPE(name)
+#endif
+}; // namespace rt_sanitizer
@@ -0,0 +1,331 @@
+#include <algorithm> // std::min, std::fill
+#include <chrono>
+#include <cstdlib> // std::getenv
+#include <iostream>
+#include <new>
+#include <sstream>
+
+#include "Pipeline.h" // NAM_CPU_RELAX
+#include "RemoteInference.h"
+
+#if defined(__linux__)
+  #include <climits> // INT_MAX
+  #include <fcntl.h>
+  #include <linux/futex.h>
+  #include <poll.h>
+  #include <sys/mman.h>
+  #include <sys/socket.h>
+  #include <sys/stat.h>
+  #include <sys/syscall.h>
+  #include <sys/un.h>
+  #include <time.h>
+  #include <unistd.h>
+#endif
+
+bool remote::IsRequested()
+{
+#if defined(__linux__)
+  const char* value = std::getenv("NAM_REMOTE_ENGINE");
+  return value != nullptr && value[0] != '\0' && !(value[0] == '0' && value[1] == '\0');
+#else
+  return false;
+#endif
+}
+
+std::string remote::GetSocketPath()
+{
+  const char* value = std::getenv("NAM_REMOTE_ENGINE");
+  if (value != nullptr && value[0] == '/')
+    return value;
+  const char* runtimeDir = std::getenv("XDG_RUNTIME_DIR");
+  if (runtimeDir != nullptr && runtimeDir[0] != '\0')
+    return std::string(runtimeDir) + "/nam-engined.sock";
+#if defined(__linux__)
+  return "/tmp/nam-engined-" + std::to_string(getuid()) + ".sock";
+#else
+  return "/tmp/nam-engined.sock";
+#endif
+}
+
+#if defined(__linux__)
+
+namespace
+{
+// Spin this long for the reply before sleeping. Most round trips are shorter, and a futex wake costs more.
+constexpr double kSpinSeconds = 20.0e-6;
+// For control messages
+constexpr size_t kMaxMessageSize = 4096;
+
+bool SendRequest(const int socket, const std::string& message, std::string& reply)
+{
+  reply.clear();
+  if (send(socket, message.data(), message.size(), MSG_NOSIGNAL) != (ssize_t)message.size())
+    return false;
+  char buffer[kMaxMessageSize];
+  const ssize_t received = recv(socket, buffer, sizeof(buffer), 0);
+  if (received <= 0)
+    return false;
+  reply.assign(buffer, (size_t)received);
+  return true;
+}
+}; // namespace
+
+void remote::FutexWait(std::atomic<uint32_t>& word, const uint32_t expected, const double timeoutSeconds)
+{
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "Futexes need a plain 32-bit word");
+  timespec timeout;
+  timespec* timeoutPtr = nullptr;
+  if (timeoutSeconds >= 0.0)
+  {
+    timeout.tv_sec = (time_t)timeoutSeconds;
+    timeout.tv_nsec = (long)((timeoutSeconds - (double)timeout.tv_sec) * 1.0e9);
+    timeoutPtr = &timeout;
+  }
+  // Not FUTEX_PRIVATE: the word is shared between processes.
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, timeoutPtr, nullptr, 0);
+}
+
+void remote::FutexWake(std::atomic<uint32_t>& word)
+{
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+remote::RemoteDSP::RemoteDSP(const double expectedSampleRate, const int socket, SharedBlock* shared)
+: nam::DSP(expectedSampleRate)
+, mSocket(socket)
+, mShared(shared)
+{
+}
+
+remote::RemoteDSP::~RemoteDSP()
+{
+  // The daemon drops the session when the socket closes.
+  if (mShared != nullptr)
+    munmap(mShared, sizeof(SharedBlock));
+  if (mSocket >= 0)
+    close(mSocket);
+}
+
+void remote::RemoteDSP::process(NAM_SAMPLE* input, NAM_SAMPLE* output, const int num_frames)
+{
+  if (IsLost())
+  {
+    std::fill(output, output + num_frames, (NAM_SAMPLE)0);
+    return;
+  }
+  for (int start = 0; start < num_frames; start += kMaxFramesPerRequest)
+    _RoundTrip(input + start, output + start, std::min(kMaxFramesPerRequest, num_frames - start));
+}
+
+void remote::RemoteDSP::Reset(const double sampleRate, const int maxBufferSize)
+{
+  nam::DSP::Reset(sampleRate, maxBufferSize);
+  if (IsLost())
+    return;
+  std::ostringstream message;
+  message << "reset " << sampleRate << " " << std::min(maxBufferSize, kMaxFramesPerRequest);
+  std::string reply;
+  if (!_Request(message.str(), reply) || reply != "ok")
+    std::cerr << "Remote engine failed to reset: " << reply << std::endl;
+}
+
+void remote::RemoteDSP::_RoundTrip(const NAM_SAMPLE* input, NAM_SAMPLE* output, const int numFrames)
+{
+  using Clock = std::chrono::steady_clock;
+  SharedBlock& shared = *mShared;
+  const uint64_t n = (uint64_t)numFrames;
+
+  // Whatever's come back already was for blocks that we gave up on.
+  shared.responseRead.store(shared.responseWrite.load(std::memory_order_acquire), std::memory_order_release);
+  const uint64_t start = shared.requestWrite.load(std::memory_order_relaxed);
+  const uint64_t end = start + n;
+  if (end - shared.responseRead.load(std::memory_order_relaxed) > kRingSize)
+  {
+    // The daemon's too far behind to take this one.
+    _Miss(output, numFrames);
+    return;
+  }
+
+  for (uint64_t i = 0; i < n; i++)
+    shared.request[(start + i) & (kRingSize - 1)] = input[i];
+  shared.requestWrite.store(end, std::memory_order_release);
+  shared.requestSignal.fetch_add(1);
+  if (shared.daemonWaiting.load() != 0)
+    FutexWake(shared.requestSignal);
+
+  // Wait for it to come back
+  const double timeout =
+    mTimeoutSeconds > 0.0 ? mTimeoutSeconds : kTimeoutFraction * (double)numFrames / GetExpectedSampleRate();
+  const auto begin = Clock::now();
+  bool arrived = false;
+  while (true)
+  {
+    const uint32_t signal = shared.responseSignal.load();
+    if (shared.responseWrite.load(std::memory_order_acquire) >= end)
+    {
+      arrived = true;
+      break;
+    }
+    const double elapsed = std::chrono::duration<double>(Clock::now() - begin).count();
+    if (elapsed >= timeout)
+      break;
+    if (elapsed < kSpinSeconds)
+    {
+      NAM_CPU_RELAX();
+      continue;
+    }
+    shared.clientWaiting.store(1);
+    if (shared.responseWrite.load(std::memory_order_acquire) < end)
+      FutexWait(shared.responseSignal, signal, timeout - elapsed);
+    shared.clientWaiting.store(0);
+  }
+
+  if (!arrived)
+  {
+    _Miss(output, numFrames);
+    return;
+  }
+  for (uint64_t i = 0; i < n; i++)
+    output[i] = shared.response[(start + i) & (kRingSize - 1)];
+  shared.responseRead.store(end, std::memory_order_release);
+  mNumConsecutiveMisses = 0;
+}
+
+void remote::RemoteDSP::_Miss(NAM_SAMPLE* output, const int numFrames)
+{
+  std::fill(output, output + numFrames, (NAM_SAMPLE)0);
+  mNumMissedBlocks.fetch_add(1, std::memory_order_relaxed);
+  // Only now that something's wrong is it worth a syscall to ask whether the daemon has hung up.
+  pollfd socketState{mSocket, 0, 0};
+  const bool hungUp = poll(&socketState, 1, 0) > 0 && (socketState.revents & (POLLHUP | POLLERR)) != 0;
+  if (++mNumConsecutiveMisses < kMaxConsecutiveMisses && !hungUp)
+    return;
+  mLost.store(true, std::memory_order_relaxed);
+  if (mLostFlag != nullptr)
+    mLostFlag->store(true, std::memory_order_release);
+}
+
+bool remote::RemoteDSP::_Request(const std::string& message, std::string& reply)
+{
+  return SendRequest(mSocket, message, reply);
+}
+
+std::unique_ptr<remote::RemoteDSP> remote::LoadModel(const std::filesystem::path& modelPath,
+                                                     const dsp::activations::Accuracy accuracy,
+                                                     const std::string& socketPath, std::string& error)
+{
+  const int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (sock < 0)
+  {
+    error = "Couldn't create a socket";
+    return nullptr;
+  }
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(address.sun_path))
+  {
+    close(sock);
+    error = "Socket path is too long: " + socketPath;
+    return nullptr;
+  }
+  socketPath.copy(address.sun_path, socketPath.size());
+  if (connect(sock, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+  {
+    close(sock);
+    error = "No daemon at " + socketPath;
+    return nullptr;
+  }
+
+  // The shared block. Only its name goes to the daemon; it's unlinked as soon as the daemon has it mapped so that
+  // nothing's left behind if either side dies.
+  static std::atomic<int> counter = 0;
+  const std::string shmName = "/nam-" + std::to_string(getpid()) + "-" + std::to_string(counter.fetch_add(1));
+  const int fd = shm_open(shmName.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+  if (fd < 0 || ftruncate(fd, sizeof(SharedBlock)) != 0)
+  {
+    if (fd >= 0)
+    {
+      close(fd);
+      shm_unlink(shmName.c_str());
+    }
+    close(sock);
+    error = "Couldn't create shared memory";
+    return nullptr;
+  }
+  void* memory = mmap(nullptr, sizeof(SharedBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED)
+  {
+    shm_unlink(shmName.c_str());
+    close(sock);
+    error = "Couldn't map shared memory";
+    return nullptr;
+  }
+  SharedBlock* shared = new (memory) SharedBlock();
+  auto fail = [&](const std::string& message) {
+    munmap(memory, sizeof(SharedBlock));
+    close(sock);
+    error = message;
+    return nullptr;
+  };
+
+  std::string reply;
+  const bool helloOK = SendRequest(sock, "hello " + shmName, reply) && reply == "ok";
+  shm_unlink(shmName.c_str());
+  if (!helloOK)
+    return fail("Daemon didn't accept the connection: " + reply);
+  std::ostringstream load;
+  load << "load " << (int)accuracy << " " << modelPath.u8string();
+  if (!SendRequest(sock, load.str(), reply) || reply.compare(0, 3, "ok ") != 0)
+    return fail(reply.empty() ? "Daemon went away while loading the model" : reply);
+
+  // ok <expected sample rate> <has loudness> <loudness> <has input level> <input level> <has output level>
+  // <output level>
+  std::istringstream fields(reply.substr(3));
+  double expectedSampleRate = -1.0, loudness = 0.0, inputLevel = 0.0, outputLevel = 0.0;
+  int hasLoudness = 0, hasInputLevel = 0, hasOutputLevel = 0;
+  if (!(fields >> expectedSampleRate >> hasLoudness >> loudness >> hasInputLevel >> inputLevel >> hasOutputLevel
+        >> outputLevel))
+    return fail("Couldn't understand the daemon's reply: " + reply);
+
+  std::unique_ptr<RemoteDSP> remoteDSP(new RemoteDSP(expectedSampleRate, sock, shared));
+  if (hasLoudness)
+    remoteDSP->SetLoudness(loudness);
+  if (hasInputLevel)
+    remoteDSP->SetInputLevel(inputLevel);
+  if (hasOutputLevel)
+    remoteDSP->SetOutputLevel(outputLevel);
+  return remoteDSP;
+}
+
+#else
+
+void remote::FutexWait(std::atomic<uint32_t>&, const uint32_t, const double) {}
+
+void remote::FutexWake(std::atomic<uint32_t>&) {}
+
+remote::RemoteDSP::RemoteDSP(const double expectedSampleRate, const int socket, SharedBlock* shared)
+: nam::DSP(expectedSampleRate)
+{
+}
+
+remote::RemoteDSP::~RemoteDSP() {}
+
+void remote::RemoteDSP::process(NAM_SAMPLE* input, NAM_SAMPLE* output, const int num_frames)
+{
+  std::fill(output, output + num_frames, (NAM_SAMPLE)0);
+}
+
+void remote::RemoteDSP::Reset(const double sampleRate, const int maxBufferSize)
+{
+  nam::DSP::Reset(sampleRate, maxBufferSize);
+}
+
+std::unique_ptr<remote::RemoteDSP> remote::LoadModel(const std::filesystem::path&, const dsp::activations::Accuracy,
+                                                     const std::string&, std::string& error)
+{
+  error = "The remote engine is only available on Linux";
+  return nullptr;
+}
+
+#endif
@@ -0,0 +1,129 @@
+#pragma once
+
+// Running models in a separate process (Linux only).
+//
+// With NAM_REMOTE_ENGINE set, the engine doesn't build models itself. It asks a local daemon (tools/nam-engined.cpp)
+// to load them and gets a RemoteDSP back. The RemoteDSP sends each block to the daemon and waits for the result
+// within the same callback. A model that crashes or hangs then takes down the daemon instead of the host. Heavy
+// models from many instances also spread across the daemon's threads, and a single daemon serves any number of
+// clients. If the daemon can't be reached, the engine loads the model itself as usual.
+//
+// NAM_REMOTE_ENGINE=1 uses the default socket (see GetSocketPath()); any value starting with '/' is taken as the
+// socket's path instead.
+//
+// Control messages (load, reset) go over a Unix socket. Audio goes through a shared memory block with one
+// single-producer, single-consumer ring in each direction; futexes wake whichever side is asleep. Neither side takes a
+// lock or makes a syscall while the other is awake. The response for request samples [a, b) lands at [a, b) in
+// the response ring, so a late block is simply skipped over. If a block doesn't come back within a fraction of its
+// duration (kTimeoutFraction), the client outputs silence for it and carries on. After kMaxConsecutiveMisses in a
+// row, or as soon as the daemon hangs up, it gives up on the daemon: from then on it outputs silence without waiting,
+// and the engine loads its models itself (see Engine::ConsumeRemoteModelLost()).
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include "NeuralAmpModelerCore/NAM/dsp.h"
+
+#include "Activations.h"
+
+namespace remote
+{
+// "NAM1"
+constexpr uint32_t kMagic = 0x4e414d31;
+constexpr uint32_t kVersion = 1;
+// Samples in each ring. A power of two.
+constexpr uint64_t kRingSize = 16384;
+// Bigger blocks are split into requests of this many samples.
+constexpr int kMaxFramesPerRequest = 4096;
+// How much of a block's duration to wait for it, by default. The rest is for the rest of the chain.
+constexpr double kTimeoutFraction = 0.5;
+// Blocks in a row that can miss before the daemon's taken to be gone
+constexpr int kMaxConsecutiveMisses = 8;
+
+// Laid out in the shared memory. Created by the client, mapped by the daemon.
+struct SharedBlock
+{
+  uint32_t magic = kMagic;
+  uint32_t version = kVersion;
+  uint32_t sampleSize = sizeof(NAM_SAMPLE);
+
+  // Absolute sample positions; the ring index is position % kRingSize.
+  alignas(64) std::atomic<uint64_t> requestWrite{0}; // Client
+  alignas(64) std::atomic<uint64_t> requestRead{0}; // Daemon
+  alignas(64) std::atomic<uint64_t> responseWrite{0}; // Daemon
+  alignas(64) std::atomic<uint64_t> responseRead{0}; // Client
+
+  // Futex words, bumped after each publish, and whether anyone's asleep on them
+  alignas(64) std::atomic<uint32_t> requestSignal{0};
+  std::atomic<uint32_t> daemonWaiting{0};
+  alignas(64) std::atomic<uint32_t> responseSignal{0};
+  std::atomic<uint32_t> clientWaiting{0};
+
+  alignas(64) NAM_SAMPLE request[kRingSize];
+  alignas(64) NAM_SAMPLE response[kRingSize];
+};
+
+static_assert((kRingSize & (kRingSize - 1)) == 0, "Ring size must be a power of two");
+static_assert(kRingSize >= 2 * kMaxFramesPerRequest, "Ring must hold a late request plus the current one");
+
+// Whether NAM_REMOTE_ENGINE asks for it
+bool IsRequested();
+// Where the daemon listens
+std::string GetSocketPath();
+
+// Sleeps on `word` while it's `expected`, for at most `timeoutSeconds` (forever if negative). May wake spuriously.
+void FutexWait(std::atomic<uint32_t>& word, const uint32_t expected, const double timeoutSeconds);
+void FutexWake(std::atomic<uint32_t>& word);
+
+// A model running in the daemon. Reset() forwards to the daemon's model, so it's not real-time safe, but process()
+// is.
+class RemoteDSP : public nam::DSP
+{
+public:
+  ~RemoteDSP();
+  RemoteDSP(const RemoteDSP&) = delete;
+  RemoteDSP& operator=(const RemoteDSP&) = delete;
+
+  void process(NAM_SAMPLE* input, NAM_SAMPLE* output, const int num_frames) override;
+  // The daemon prewarms its model when it's reset.
+  void prewarm() override {};
+  void Reset(const double sampleRate, const int maxBufferSize) override;
+
+  // How long to wait for a block before giving up on it. Zero (the default) waits kTimeoutFraction of the block.
+  void SetTimeout(const double seconds) { mTimeoutSeconds = seconds; };
+  // Blocks that didn't come back in time
+  uint64_t GetNumMissedBlocks() const { return mNumMissedBlocks.load(std::memory_order_relaxed); };
+  // Whether it's given up on the daemon
+  bool IsLost() const { return mLost.load(std::memory_order_relaxed); };
+  // Also set to true when it gives up on the daemon, from the audio thread. Must outlive it.
+  void SetLostFlag(std::atomic<bool>* flag) { mLostFlag = flag; };
+
+private:
+  friend std::unique_ptr<RemoteDSP> LoadModel(const std::filesystem::path&, const dsp::activations::Accuracy,
+                                              const std::string&, std::string&);
+  RemoteDSP(const double expectedSampleRate, const int socket, SharedBlock* shared);
+
+  void _RoundTrip(const NAM_SAMPLE* input, NAM_SAMPLE* output, const int numFrames);
+  // Outputs silence for a block that didn't come back, and gives up on the daemon if it's gone
+  void _Miss(NAM_SAMPLE* output, const int numFrames);
+  // Sends a control message and waits for the reply. Returns false if the daemon has gone away.
+  bool _Request(const std::string& message, std::string& reply);
+
+  int mSocket = -1;
+  SharedBlock* mShared = nullptr;
+  double mTimeoutSeconds = 0.0;
+  std::atomic<uint64_t> mNumMissedBlocks = 0;
+  // Audio thread
+  int mNumConsecutiveMisses = 0;
+  std::atomic<bool> mLost = false;
+  std::atomic<bool>* mLostFlag = nullptr;
+};
+
+// Connects to the daemon and has it load the model ("" for a loopback that returns its input, for benchmarking).
+// Returns nullptr and sets `error` if the daemon isn't there or can't load the model.
+std::unique_ptr<RemoteDSP> LoadModel(const std::filesystem::path& modelPath, const dsp::activations::Accuracy accuracy,
+                                     const std::string& socketPath, std::string& error);
+}; // namespace remote
@@ -0,0 +1,177 @@
+#pragma once
+
+// The model, as the plugin runs it: wrapped so that it can be used at any sample rate.
+// No iPlug2 in here so that the headless tools can run exactly what the plugin runs.
+
+#include <cmath> // std::ceil
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+
+#include "NeuralAmpModelerCore/NAM/dsp.h"
+#include "AudioDSPTools/dsp/ResamplingContainer/ResamplingContainer.h"
+
+// Get the sample rate of a NAM model.
+// Sometimes, the model doesn't know its own sample rate; this wrapper guesses 48k based on the way that most
+// people have used NAM in the past.
+inline double GetNAMSampleRate(const std::unique_ptr<nam::DSP>& model)
+{
+  // Some models are from when we didn't have sample rate in the model.
+  // For those, this wraps with the assumption that they're 48k models, which is probably true.
+  const double assumedSampleRate = 48000.0;
+  const double reportedEncapsulatedSampleRate = model->GetExpectedSampleRate();
+  const double encapsulatedSampleRate =
+    reportedEncapsulatedSampleRate <= 0.0 ? assumedSampleRate : reportedEncapsulatedSampleRate;
+  return encapsulatedSampleRate;
+};
+
+// Mirrors AudioDSPTools' LanczosResampler: each of the container's two resamplers keeps a fixed input buffer of this
+// many samples per channel, whatever the block size.
+constexpr size_t kLanczosResamplerBufferSize = 2 * 4096;
+
+// The resampler's Lanczos kernel size. Draft uses a third of the taps: more aliasing and a less flat top octave, for
+// when the CPU can't keep up with High (see DeadlineMonitor.h).
+enum class ResamplerQuality
+{
+  High = 0,
+  Draft
+};
+
+class ResamplingNAM : public nam::DSP
+{
+public:
+  // Resampling wrapper around the NAM models.
+  // Everything is sized for maxBlockSize, which should be what the host said it'll send; call Reset() if that changes.
+  // Before the host has said (maxBlockSize is 0), the model isn't reset or prewarmed until Reset() is called: for a
+  // big model that's a good part of the load time, and it would only be done again.
+  ResamplingNAM(std::unique_ptr<nam::DSP> encapsulated, const double expected_sample_rate, const int maxBlockSize,
+                const ResamplerQuality quality = ResamplerQuality::High)
+  : nam::DSP(expected_sample_rate)
+  , mEncapsulated(std::move(encapsulated))
+  , mQuality(quality)
+  {
+    const double encapsulatedSampleRate = GetNAMSampleRate(mEncapsulated);
+    if (mQuality == ResamplerQuality::Draft)
+      mDraftResampler = std::make_unique<DraftResampler>(encapsulatedSampleRate);
+    else
+      mResampler = std::make_unique<HighResampler>(encapsulatedSampleRate);
+
+    // Assign the encapsulated object's processing function  to this object's member so that the resampler can use it:
+    auto ProcessBlockFunc = [&](NAM_SAMPLE** input, NAM_SAMPLE** output, int numFrames) {
+      mEncapsulated->process(input[0], output[0], numFrames);
+    };
+    mBlockProcessFunc = ProcessBlockFunc;
+
+    // Get the other information from the encapsulated NAM so that we can tell the outside world about what we're
+    // holding.
+    if (mEncapsulated->HasLoudness())
+    {
+      SetLoudness(mEncapsulated->GetLoudness());
+    }
+    if (mEncapsulated->HasInputLevel())
+    {
+      SetInputLevel(mEncapsulated->GetInputLevel());
+    }
+    if (mEncapsulated->HasOutputLevel())
+    {
+      SetOutputLevel(mEncapsulated->GetOutputLevel());
+    }
+
+    // NOTE: prewarm samples doesn't mean anything--we can prewarm the encapsulated model as it likes and be good to
+    // go.
+    // _prewarm_samples = 0;
+
+    // And be ready, or as ready as we can be
+    if (maxBlockSize > 0)
+      Reset(expected_sample_rate, maxBlockSize);
+    else
+      _ResetResampler(expected_sample_rate, 1);
+  };
+
+  ~ResamplingNAM() = default;
+
+  void prewarm() override { mEncapsulated->prewarm(); };
+
+  void process(NAM_SAMPLE* input, NAM_SAMPLE* output, const int num_frames) override
+  {
+    if (num_frames > mMaxExternalBlockSize)
+      // We can afford to be careful
+      throw std::runtime_error("More frames were provided than the max expected!");
+
+    if (!NeedToResample())
+    {
+      mEncapsulated->process(input, output, num_frames);
+    }
+    else if (mDraftResampler != nullptr)
+    {
+      mDraftResampler->ProcessBlock(&input, &output, num_frames, mBlockProcessFunc);
+    }
+    else
+    {
+      mResampler->ProcessBlock(&input, &output, num_frames, mBlockProcessFunc);
+    }
+  };
+
+  int GetLatency() const
+  {
+    if (!NeedToResample())
+      return 0;
+    return mDraftResampler != nullptr ? mDraftResampler->GetLatency() : mResampler->GetLatency();
+  };
+
+  void Reset(const double sampleRate, const int maxBlockSize) override
+  {
+    _ResetResampler(sampleRate, maxBlockSize);
+    mEncapsulated->ResetAndPrewarm(sampleRate, mMaxEncapsulatedBlockSize);
+  };
+
+  int GetMaxBlockSize() const { return mMaxExternalBlockSize; };
+  // The biggest block that the encapsulated model gets
+  int GetMaxEncapsulatedBlockSize() const { return mMaxEncapsulatedBlockSize; };
+  // Approximate bytes held by the resampler: the Lanczos resamplers' fixed buffers, plus the container's buffers for
+  // the encapsulated model's input and output
+  size_t GetResamplerBytes() const
+  {
+    return sizeof(NAM_SAMPLE) * (2 * kLanczosResamplerBufferSize + 2 * (size_t)mMaxEncapsulatedBlockSize);
+  };
+
+  // So that we can let the world know if we're resampling (useful for debugging)
+  double GetEncapsulatedSampleRate() const { return GetNAMSampleRate(mEncapsulated); };
+  ResamplerQuality GetResamplerQuality() const { return mQuality; };
+
+private:
+  void _ResetResampler(const double sampleRate, const int maxBlockSize)
+  {
+    mExpectedSampleRate = sampleRate;
+    mMaxExternalBlockSize = maxBlockSize;
+    if (mDraftResampler != nullptr)
+      mDraftResampler->Reset(sampleRate, maxBlockSize);
+    else
+      mResampler->Reset(sampleRate, maxBlockSize);
+
+    // Allocations in the encapsulated model (HACK)
+    // Stolen some code from the resampler; it'd be nice to have these exposed as methods? :)
+    const double mUpRatio = sampleRate / GetEncapsulatedSampleRate();
+    mMaxEncapsulatedBlockSize = static_cast<int>(std::ceil(static_cast<double>(maxBlockSize) / mUpRatio));
+  };
+
+  using HighResampler = dsp::ResamplingContainer<NAM_SAMPLE, 1, 12>;
+  using DraftResampler = dsp::ResamplingContainer<NAM_SAMPLE, 1, 4>;
+
+  bool NeedToResample() const { return GetExpectedSampleRate() != GetEncapsulatedSampleRate(); };
+  // The encapsulated NAM
+  std::unique_ptr<nam::DSP> mEncapsulated;
+
+  // The resampling wrapper, one or the other
+  ResamplerQuality mQuality = ResamplerQuality::High;
+  std::unique_ptr<HighResampler> mResampler;
+  std::unique_ptr<DraftResampler> mDraftResampler;
+
+  // Used to check that we don't get too large a block to process.
+  int mMaxExternalBlockSize = 0;
+  int mMaxEncapsulatedBlockSize = 0;
+
+  // This function is defined to conform to the interface expected by the iPlug2 resampler.
+  std::function<void(NAM_SAMPLE**, NAM_SAMPLE**, int)> mBlockProcessFunc;
+};
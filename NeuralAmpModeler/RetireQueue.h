@@ -0,0 +1,79 @@
+#pragma once
+
+// Deleting things without deleting them on the audio thread.
+//
+// When a model or IR is swapped out in Process(), the old one still has to be freed, and freeing a model's buffers
+// takes the allocator's locks. The audio thread hands it to a RetireQueue instead, which another thread empties
+// (Engine::ReleaseRetired(); the plugin calls it from OnIdle()). Pushing is wait-free and never allocates: the queue is
+// a fixed ring of (pointer, deleter) pairs.
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+namespace retire
+{
+class RetireQueue
+{
+public:
+  static constexpr size_t kCapacity = 64;
+
+  RetireQueue() = default;
+  ~RetireQueue() { Release(); };
+  RetireQueue(const RetireQueue&) = delete;
+  RetireQueue& operator=(const RetireQueue&) = delete;
+
+  // Audio thread. Takes `object` (if there is one) to be deleted later. Returns false, and leaves `object` alone, if
+  // the queue is full.
+  template <typename T>
+  bool Push(std::unique_ptr<T>& object)
+  {
+    if (object == nullptr)
+      return true;
+    const size_t write = mWrite.load(std::memory_order_relaxed);
+    if (write - mRead.load(std::memory_order_acquire) >= kCapacity)
+      return false;
+    mEntries[write % kCapacity] = {object.release(), [](void* p) { delete static_cast<T*>(p); }};
+    mWrite.store(write + 1, std::memory_order_release);
+    return true;
+  };
+
+  // Audio thread. Whether there's room for `count` more, so that a swap that retires several things can be put off
+  // until all of them fit.
+  bool HasRoom(const size_t count) const
+  {
+    return mWrite.load(std::memory_order_relaxed) - mRead.load(std::memory_order_acquire) + count <= kCapacity;
+  };
+
+  // Any thread but the audio thread. Deletes everything that's been pushed so far and returns how many there were.
+  size_t Release()
+  {
+    std::lock_guard<std::mutex> lock(mReleaseMutex);
+    const size_t write = mWrite.load(std::memory_order_acquire);
+    size_t read = mRead.load(std::memory_order_relaxed);
+    const size_t count = write - read;
+    for (; read != write; read++)
+    {
+      Entry& entry = mEntries[read % kCapacity];
+      entry.deleter(entry.object);
+      entry = Entry();
+      mRead.store(read + 1, std::memory_order_release);
+    }
+    return count;
+  };
+
+private:
+  struct Entry
+  {
+    void* object = nullptr;
+    void (*deleter)(void*) = nullptr;
+  };
+  std::array<Entry, kCapacity> mEntries;
+  // Counts of pushes and releases. Only the audio thread writes mWrite; only Release() (one at a time) writes mRead.
+  std::atomic<size_t> mWrite = 0;
+  std::atomic<size_t> mRead = 0;
+  std::mutex mReleaseMutex;
+};
+}; // namespace retire
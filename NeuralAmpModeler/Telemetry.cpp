@@ -0,0 +1,410 @@
+#include <algorithm> // std::min
+#include <chrono>
+#include <cstdlib> // std::getenv
+#include <cstring> // memcpy
+#include <mutex>
+#include <new>
+
+#if defined(_WIN32)
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #include <windows.h>
+#else
+  #include <cerrno>
+  #include <fcntl.h>
+  #include <signal.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#include "Telemetry.h"
+
+namespace
+{
+int64_t NowMs()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch())
+    .count();
+}
+
+uint32_t GetProcessID()
+{
+#if defined(_WIN32)
+  return (uint32_t)GetCurrentProcessId();
+#else
+  return (uint32_t)getpid();
+#endif
+}
+
+bool IsProcessAlive(const uint32_t processID)
+{
+#if defined(_WIN32)
+  HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD)processID);
+  if (process == nullptr)
+    return GetLastError() == ERROR_ACCESS_DENIED;
+  DWORD exitCode = 0;
+  const bool alive = GetExitCodeProcess(process, &exitCode) && exitCode == STILL_ACTIVE;
+  CloseHandle(process);
+  return alive;
+#else
+  // EPERM means that it's there but not ours.
+  return kill((pid_t)processID, 0) == 0 || errno != ESRCH;
+#endif
+}
+
+bool IsEnabled()
+{
+  const char* value = std::getenv("NAM_TELEMETRY");
+  return value == nullptr || !(value[0] == '0' && value[1] == '\0');
+}
+
+#if defined(_WIN32)
+std::wstring GetWideSegmentName()
+{
+  const std::string name = telemetry::GetSegmentName();
+  return std::wstring(name.begin(), name.end());
+}
+#endif
+
+// The process's mapping of the segment, shared by all of its publishers
+std::mutex sSegmentMutex;
+telemetry::Segment* sSegment = nullptr;
+int sNumUsers = 0;
+#if defined(_WIN32)
+HANDLE sMapping = nullptr;
+#else
+// Whether the last MapSegment() found a segment that its creator hadn't finished setting up. If the next one (a retry
+// interval later, see Publisher) still does, the creator is taken to have died halfway.
+bool sSawUnfinished = false;
+#endif
+
+enum class SegmentState
+{
+  Usable,
+  // Still being created
+  Unfinished,
+  // From another version
+  Stale
+};
+
+SegmentState GetSegmentState(const telemetry::Segment* segment)
+{
+  const uint32_t magic = segment->magic.load(std::memory_order_acquire);
+  if (magic == 0)
+    return SegmentState::Unfinished;
+  if (magic != telemetry::kMagic || segment->version != telemetry::kVersion
+      || segment->recordSize != sizeof(telemetry::Record) || segment->numRecords != telemetry::kMaxRecords)
+    return SegmentState::Stale;
+  return SegmentState::Usable;
+}
+
+telemetry::Segment* MapSegment(const bool mayReplace = true);
+
+#if !defined(_WIN32)
+// POSIX shared memory outlives the processes that use it, so a segment left behind by another version (or by a process
+// that died while creating it) would otherwise keep telemetry off until the machine restarts. It's unlinked and
+// created afresh; processes that still have the old one mapped keep writing to it, unseen.
+telemetry::Segment* ReplaceSegment(const SegmentState state, const bool mayReplace)
+{
+  if (state == SegmentState::Unfinished && !sSawUnfinished)
+  {
+    sSawUnfinished = true;
+    return nullptr;
+  }
+  sSawUnfinished = false;
+  if (!mayReplace)
+    return nullptr;
+  shm_unlink(telemetry::GetSegmentName().c_str());
+  return MapSegment(false);
+}
+#endif
+
+// Maps (creating if need be) the segment. Returns nullptr if it isn't there or isn't ready yet. `mayReplace` is whether
+// a stale one may be replaced (see ReplaceSegment()).
+telemetry::Segment* MapSegment(const bool mayReplace)
+{
+  using telemetry::Segment;
+  bool created = false;
+  void* memory = nullptr;
+#if defined(_WIN32)
+  HANDLE mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, (DWORD)sizeof(Segment),
+                                      GetWideSegmentName().c_str());
+  if (mapping == nullptr)
+    return nullptr;
+  created = GetLastError() != ERROR_ALREADY_EXISTS;
+  memory = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(Segment));
+  if (memory == nullptr)
+  {
+    CloseHandle(mapping);
+    return nullptr;
+  }
+#else
+  const std::string name = telemetry::GetSegmentName();
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd >= 0)
+  {
+    created = true;
+    if (ftruncate(fd, sizeof(Segment)) != 0)
+    {
+      close(fd);
+      shm_unlink(name.c_str());
+      return nullptr;
+    }
+  }
+  else if (errno == EEXIST)
+    fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0)
+    return nullptr;
+  // Touching a mapping past the end of the object is a SIGBUS, so don't map one that's still being sized (or is from a
+  // different version).
+  struct stat status;
+  if (fstat(fd, &status) != 0)
+  {
+    close(fd);
+    return nullptr;
+  }
+  if ((size_t)status.st_size != sizeof(Segment))
+  {
+    close(fd);
+    return ReplaceSegment(status.st_size == 0 ? SegmentState::Unfinished : SegmentState::Stale, mayReplace);
+  }
+  memory = mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED)
+    return nullptr;
+#endif
+
+  // New mappings are zeroed, which is a valid (free) state for every record.
+  Segment* segment = static_cast<Segment*>(memory);
+  if (created)
+  {
+    segment->version = telemetry::kVersion;
+    segment->recordSize = sizeof(telemetry::Record);
+    segment->numRecords = telemetry::kMaxRecords;
+    segment->magic.store(telemetry::kMagic, std::memory_order_release);
+  }
+  else if (const SegmentState state = GetSegmentState(segment); state != SegmentState::Usable)
+  {
+#if defined(_WIN32)
+    // Only while another process is creating it; other versions use other names.
+    UnmapViewOfFile(memory);
+    CloseHandle(mapping);
+    return nullptr;
+#else
+    munmap(memory, sizeof(Segment));
+    return ReplaceSegment(state, mayReplace);
+#endif
+  }
+#if defined(_WIN32)
+  sMapping = mapping;
+#else
+  sSawUnfinished = false;
+#endif
+  return segment;
+}
+
+telemetry::Segment* AcquireSegment()
+{
+  std::lock_guard<std::mutex> lock(sSegmentMutex);
+  if (sSegment == nullptr)
+    sSegment = MapSegment();
+  if (sSegment != nullptr)
+    sNumUsers++;
+  return sSegment;
+}
+
+void ReleaseSegment()
+{
+  std::lock_guard<std::mutex> lock(sSegmentMutex);
+  if (--sNumUsers > 0 || sSegment == nullptr)
+    return;
+#if defined(_WIN32)
+  UnmapViewOfFile(sSegment);
+  CloseHandle(sMapping);
+  sMapping = nullptr;
+#else
+  // The segment itself stays for the next instance (and for nam-top).
+  munmap(sSegment, sizeof(telemetry::Segment));
+#endif
+  sSegment = nullptr;
+}
+}; // namespace
+
+std::string telemetry::GetSegmentName()
+{
+#if defined(_WIN32)
+  // A mapping goes away with the last process that has it open, but until then it can't be replaced, so each version
+  // has its own.
+  return "Local\\nam-telemetry-" + std::to_string(kVersion);
+#else
+  return "/nam-telemetry-" + std::to_string(getuid());
+#endif
+}
+
+uint64_t telemetry::HashPath(const std::string& path)
+{
+  if (path.empty())
+    return 0;
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (const char c : path)
+  {
+    hash ^= (uint8_t)c;
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+void telemetry::SetArchitecture(Stats& stats, const std::string& architecture)
+{
+  const size_t length = std::min(architecture.size(), sizeof(stats.architecture) - 1);
+  memcpy(stats.architecture, architecture.data(), length);
+  stats.architecture[length] = '\0';
+}
+
+telemetry::Publisher::~Publisher()
+{
+  if (mRecord == nullptr)
+    return;
+  mRecord->owner.store(0, std::memory_order_release);
+  ReleaseSegment();
+}
+
+void telemetry::Publisher::Publish(const Stats& stats)
+{
+  if (mRecord == nullptr)
+  {
+    const auto now = std::chrono::steady_clock::now();
+    if (now < mNextAttempt || !IsEnabled())
+      return;
+    mNextAttempt = now + std::chrono::seconds(kRetrySeconds);
+    Segment* segment = AcquireSegment();
+    // Another process may be creating it.
+    if (segment == nullptr)
+      return;
+    static std::atomic<uint32_t> instanceCounter = 0;
+    const uint64_t owner = ((uint64_t)GetProcessID() << 32) | (uint64_t)(instanceCounter.fetch_add(1) + 1);
+    for (Record& record : segment->records)
+    {
+      uint64_t previous = record.owner.load(std::memory_order_acquire);
+      // Free, or left behind by a process that's gone
+      if (previous != 0 && IsProcessAlive((uint32_t)(previous >> 32)))
+        continue;
+      if (record.owner.compare_exchange_strong(previous, owner, std::memory_order_acq_rel))
+      {
+        mRecord = &record;
+        break;
+      }
+    }
+    if (mRecord == nullptr)
+    {
+      ReleaseSegment();
+      return;
+    }
+  }
+
+  // Readers that see an odd sequence, or a different one after copying, try again.
+  const uint32_t sequence = mRecord->sequence.load(std::memory_order_relaxed);
+  mRecord->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(&mRecord->stats, &stats, sizeof(Stats));
+  mRecord->updated.store(NowMs(), std::memory_order_relaxed);
+  mRecord->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+telemetry::Reader::~Reader()
+{
+  if (mSegment == nullptr)
+    return;
+#if defined(_WIN32)
+  UnmapViewOfFile(mSegment);
+  CloseHandle(mMapping);
+#else
+  munmap(const_cast<Segment*>(mSegment), sizeof(Segment));
+#endif
+}
+
+bool telemetry::Reader::Open()
+{
+  if (mSegment != nullptr)
+    return true;
+  void* memory = nullptr;
+#if defined(_WIN32)
+  HANDLE mapping = OpenFileMappingW(FILE_MAP_READ, FALSE, GetWideSegmentName().c_str());
+  if (mapping == nullptr)
+    return false;
+  memory = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, sizeof(Segment));
+  if (memory == nullptr)
+  {
+    CloseHandle(mapping);
+    return false;
+  }
+#else
+  const int fd = shm_open(GetSegmentName().c_str(), O_RDONLY, 0);
+  if (fd < 0)
+    return false;
+  struct stat status;
+  if (fstat(fd, &status) != 0 || (size_t)status.st_size != sizeof(Segment))
+  {
+    close(fd);
+    return false;
+  }
+  memory = mmap(nullptr, sizeof(Segment), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED)
+    return false;
+#endif
+  const Segment* segment = static_cast<const Segment*>(memory);
+  if (GetSegmentState(segment) != SegmentState::Usable)
+  {
+#if defined(_WIN32)
+    UnmapViewOfFile(memory);
+    CloseHandle(mapping);
+#else
+    munmap(memory, sizeof(Segment));
+#endif
+    return false;
+  }
+  mSegment = segment;
+#if defined(_WIN32)
+  mMapping = mapping;
+#endif
+  return true;
+}
+
+std::vector<telemetry::Snapshot> telemetry::Reader::Read() const
+{
+  std::vector<Snapshot> snapshots;
+  if (mSegment == nullptr)
+    return snapshots;
+  const int64_t now = NowMs();
+  for (int slot = 0; slot < kMaxRecords; slot++)
+  {
+    const Record& record = mSegment->records[slot];
+    const uint64_t owner = record.owner.load(std::memory_order_acquire);
+    if (owner == 0)
+      continue;
+    Snapshot snapshot;
+    snapshot.slot = slot;
+    snapshot.processID = (uint32_t)(owner >> 32);
+    // A writer that's always mid-update has a problem of its own; skip it rather than wait.
+    bool consistent = false;
+    for (int attempt = 0; attempt < 4 && !consistent; attempt++)
+    {
+      const uint32_t before = record.sequence.load(std::memory_order_acquire);
+      if (before & 1)
+        continue;
+      memcpy(&snapshot.stats, &record.stats, sizeof(Stats));
+      snapshot.age = now - record.updated.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      consistent = record.sequence.load(std::memory_order_relaxed) == before;
+    }
+    // Claimed but not written yet
+    if (!consistent || record.updated.load(std::memory_order_relaxed) == 0)
+      continue;
+    snapshot.alive = IsProcessAlive(snapshot.processID);
+    snapshots.push_back(snapshot);
+  }
+  return snapshots;
+}
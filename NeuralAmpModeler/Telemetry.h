@@ -0,0 +1,166 @@
+#pragma once
+
+// Per-instance CPU and health figures, published where other processes can see them.
+//
+// Every instance on the machine (for the same user) gets a record in one shared memory segment, so a host with dozens
+// of instances, or several hosts, can be watched from outside with tools/nam-top.cpp. Records are written from the
+// plugin's idle timer, never from the audio thread: the audio thread only keeps its DSPLoadMeter up to date, as it
+// already does. Neither writers nor readers take a lock. Each record has a sequence number that's odd while it's being
+// written, and readers retry (or skip) a record that changed under them.
+//
+// The segment is mapped once per process. A record is claimed by writing the instance's owner ID into a free one, and
+// freed when the instance goes away. Records left behind by a process that crashed are taken over once that process
+// is gone. A segment from another version (or one whose creator died halfway) is replaced on POSIX, where segments
+// outlive their processes; on Windows each version has its own.
+//
+// Set NAM_TELEMETRY=0 to turn publishing off.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace telemetry
+{
+// "NAMT"
+constexpr uint32_t kMagic = 0x4e414d54;
+constexpr uint32_t kVersion = 3;
+constexpr int kMaxRecords = 256;
+
+// Stats::flags
+enum Flags : uint32_t
+{
+  kResampling = 1 << 0,
+  // The chain is skipped while the input is silent.
+  kIdle = 1 << 1,
+  kPipelined = 1 << 2,
+  kRig = 1 << 3,
+};
+
+// What an instance publishes. Plain data, copied in and out whole.
+struct Stats
+{
+  // Of the model's path (see HashPath()), so that instances can be told apart without publishing paths. 0 is no model.
+  uint64_t modelHash = 0;
+  char architecture[16] = {};
+  double sampleRate = 0.0;
+  int32_t blockSize = 0;
+  uint32_t flags = 0;
+  // Of the buffer's duration, and in milliseconds per ProcessBlock() call. The maximums are over the last couple of
+  // seconds.
+  float averageLoad = 0.0f;
+  float maxLoad = 0.0f;
+  float averageProcessMs = 0.0f;
+  float maxProcessMs = 0.0f;
+  // The last model load, in milliseconds
+  float modelLoadMs = 0.0f;
+  // Steps of quality given up to keep up (see DeadlineMonitor.h)
+  uint32_t degradation = 0;
+  uint64_t memoryBytes = 0;
+  // Blocks that overran their deadline since the instance started
+  uint64_t overruns = 0;
+  // The pipeline's worker thread (see engine::Options::pipeline), like averageLoad; its maximum is since it started.
+  // 0 unless kPipelined.
+  float workerAverageLoad = 0.0f;
+  float workerMaxLoad = 0.0f;
+  // Drawing the UI (see DrawStats.h) over the last couple of seconds: frames drawn per second and milliseconds per
+  // frame, and the levels that reached a meter, drawn or skipped for moving it less than a pixel. 0 while it's closed.
+  float framesPerSecond = 0.0f;
+  float averageFrameMs = 0.0f;
+  float maxFrameMs = 0.0f;
+  uint32_t meterUpdatesDrawn = 0;
+  uint32_t meterUpdatesSkipped = 0;
+  // The last time the UI opened, in milliseconds: until its first frame was drawn, and how much of that went to
+  // creating the graphics and to laying out the controls. 0 if it hasn't opened.
+  float uiOpenMs = 0.0f;
+  float uiGraphicsMs = 0.0f;
+  float uiLayoutMs = 0.0f;
+  // Building the settings page, which happens the first time it's shown. 0 until then.
+  float settingsBuildMs = 0.0f;
+  // Black box recordings written (to NAM_BLACKBOX_DIR or the temp directory, see BlackBox.h), and ones that couldn't
+  // be, since the instance started
+  uint32_t blackBoxDumps = 0;
+  uint32_t blackBoxDumpFailures = 0;
+};
+
+struct Record
+{
+  // 0 if free, otherwise the process ID in the high 32 bits and an instance number in the low ones
+  alignas(64) std::atomic<uint64_t> owner{0};
+  // Odd while `stats` is being written
+  std::atomic<uint32_t> sequence{0};
+  // Milliseconds since the epoch, when `stats` was last written
+  std::atomic<int64_t> updated{0};
+  Stats stats;
+};
+
+// Laid out in the shared memory. Created zeroed by whichever process gets there first.
+struct Segment
+{
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  uint32_t recordSize;
+  uint32_t numRecords;
+  Record records[kMaxRecords];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Records need lock-free atomics to be shared");
+
+// The segment's name
+std::string GetSegmentName();
+// FNV-1a
+uint64_t HashPath(const std::string& path);
+// Sets `stats.architecture` (truncating)
+void SetArchitecture(Stats& stats, const std::string& architecture);
+
+// An instance's record. Not real-time safe; use it from the idle timer.
+class Publisher
+{
+public:
+  Publisher() = default;
+  ~Publisher();
+  Publisher(const Publisher&) = delete;
+  Publisher& operator=(const Publisher&) = delete;
+
+  // Claims a record the first time. Does nothing if there's no segment or every record's taken, and tries again
+  // kRetrySeconds later.
+  void Publish(const Stats& stats);
+
+  static constexpr int kRetrySeconds = 5;
+
+private:
+  Record* mRecord = nullptr;
+  // So that a full or unusable segment isn't searched on every call
+  std::chrono::steady_clock::time_point mNextAttempt;
+};
+
+// A copy of one record
+struct Snapshot
+{
+  int slot = 0;
+  uint32_t processID = 0;
+  // Milliseconds since the record was last written
+  int64_t age = 0;
+  // Whether its process is still running
+  bool alive = true;
+  Stats stats;
+};
+
+// Reads the segment from another process
+class Reader
+{
+public:
+  ~Reader();
+
+  // Returns false if no instance has created the segment yet (or it's from a different version).
+  bool Open();
+  std::vector<Snapshot> Read() const;
+
+private:
+  const Segment* mSegment = nullptr;
+#if defined(_WIN32)
+  void* mMapping = nullptr;
+#endif
+};
+}; // namespace telemetry
@@ -37,6 +37,10 @@ void NeuralAmpModeler::_UnserializeApplyConfig(nlohmann::json& config)
   };
   TRACE
   ENTER_PARAMS_MUTEX
+  // Params that are newer than the state start from their defaults.
+  for (int i = 0; i < kNumParams; i++)
+    if (!config.contains(GetParam(i)->GetName()))
+      GetParam(i)->SetToDefault();
   for (auto it = config.begin(); it != config.end(); ++it)
   {
     std::string name = it.key();
@@ -65,6 +69,37 @@ void NeuralAmpModeler::_UnserializeApplyConfig(nlohmann::json& config)
   {
     _StageIR(mIRPath);
   }
+  // A rig's other branches. States without them (or the other IRs below) clear any that are loaded.
+  const nlohmann::json branchPaths = config.value("BranchPaths", nlohmann::json::array());
+  for (int branch = 1; branch < engine::kMaxModelBranches; branch++)
+  {
+    const size_t i = (size_t)branch - 1;
+    const std::string path =
+      i < branchPaths.size() && branchPaths[i].is_string() ? branchPaths[i].get<std::string>() : std::string();
+    if (path.empty())
+    {
+      mEngine.ClearBranchModel(branch);
+      mBranchPaths[i].Set("");
+    }
+    else
+      _StageBranchModel(branch, WDL_String(path.c_str()));
+  }
+  // And the IR blend's other slots
+  const nlohmann::json irPaths = config.value("IRPaths", nlohmann::json::array());
+  for (int slot = 1; slot < ir_blend::kMaxIRs; slot++)
+  {
+    const size_t i = (size_t)slot - 1;
+    const std::string path =
+      i < irPaths.size() && irPaths[i].is_string() ? irPaths[i].get<std::string>() : std::string();
+    // Only IRs that loaded have paths, and clearing one re-blends the rest, so it's only cleared if it's there.
+    const bool hadIR = mIRSlotPaths[i].GetLength() > 0;
+    mIRSlotPaths[i].Set("");
+    if (!path.empty() && _StageIRSlot(slot, WDL_String(path.c_str())) == dsp::wav::LoadReturnCode::SUCCESS)
+      continue;
+    if (hadIR)
+      mEngine.ClearIR(slot);
+  }
+  _UpdateRigControls();
 }
 
 // Unserialize NAM Path, IR path, then named keys
@@ -87,6 +122,32 @@ int _UnserializePathsAndExpectedKeys(const iplug::IByteChunk& chunk, int startPo
   return pos;
 }
 
+// What SerializeState() puts after the params, if it's there: a marker, then a JSON object that's merged into `config`.
+// Params that are newer than the reader come before the marker, so it's looked for after each one. Returns where the
+// state ends.
+int _GetExtras(const iplug::IByteChunk& chunk, const int startPos, nlohmann::json& config)
+{
+  for (int numNewerParams = 0; numNewerParams <= kNumParams; numNewerParams++)
+  {
+    int pos = startPos + numNewerParams * (int)sizeof(double);
+    WDL_String marker;
+    pos = chunk.GetStr(marker, pos);
+    if (pos < 0 || pos > chunk.Size() || strcmp(marker.Get(), kStateExtrasMarker) != 0)
+      continue;
+    WDL_String extrasStr;
+    pos = chunk.GetStr(extrasStr, pos);
+    if (pos < 0 || pos > chunk.Size())
+      return startPos;
+    const nlohmann::json extras = nlohmann::json::parse(extrasStr.Get(), nullptr, false);
+    if (!extras.is_object())
+      return startPos;
+    for (auto it = extras.begin(); it != extras.end(); ++it)
+      config[it.key()] = it.value();
+    return pos;
+  }
+  return startPos;
+}
+
 void _RenameKeys(nlohmann::json& j, std::unordered_map<std::string, std::string> newNames)
 {
   // Assumes no aliasing!
@@ -120,6 +181,7 @@ int _GetConfigFrom_0_7_12(const iplug::IByteChunk& chunk, int startPos, nlohmann
                                       "OutputMode"};
 
   int pos = _UnserializePathsAndExpectedKeys(chunk, startPos, config, paramNames);
+  pos = _GetExtras(chunk, pos, config);
   // Then update:
   _UpdateConfigFrom_0_7_12(config);
   return pos;
@@ -0,0 +1,450 @@
+#include <cmath> // std::lrint
+#include <cstring> // memcpy
+
+#include "WavIO.h"
+
+namespace
+{
+using LoadReturnCode = dsp::wav::LoadReturnCode;
+
+// Frames decoded or encoded per pass; small enough to stay in L1 and for the decode loops to stay in registers.
+constexpr size_t kChunkFrames = 1024;
+// How much already-read audio the reader keeps mapped behind it before giving the pages back
+constexpr size_t kReleaseLag = 1 << 20;
+
+constexpr uint16_t kFormatPCM = 1;
+constexpr uint16_t kFormatIEEEFloat = 3;
+constexpr uint16_t kFormatALaw = 6;
+constexpr uint16_t kFormatMuLaw = 7;
+constexpr uint16_t kFormatExtensible = 0xFFFE;
+
+uint16_t ReadU16(const uint8_t* p)
+{
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+uint32_t ReadU32(const uint8_t* p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void WriteU16(uint8_t* p, const uint16_t value)
+{
+  p[0] = (uint8_t)value;
+  p[1] = (uint8_t)(value >> 8);
+}
+
+void WriteU32(uint8_t* p, const uint32_t value)
+{
+  WriteU16(p, (uint16_t)value);
+  WriteU16(p + 2, (uint16_t)(value >> 16));
+}
+
+// Decoding ============================================================================================================
+
+// One sample at `p`, scaled to [-1, 1). The files are little-endian, as is everything that we build for.
+template <wav_io::SampleFormat Format, typename T>
+inline T DecodeSample(const uint8_t* p)
+{
+  using wav_io::SampleFormat;
+  if constexpr (Format == SampleFormat::PCM16)
+  {
+    int16_t value;
+    memcpy(&value, p, sizeof(value));
+    return (T)value * (T)(1.0 / 32768.0);
+  }
+  else if constexpr (Format == SampleFormat::PCM24)
+  {
+    // Into the top of an int32 and back down to sign-extend
+    const int32_t value = (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24)) >> 8;
+    return (T)value * (T)(1.0 / 8388608.0);
+  }
+  else if constexpr (Format == SampleFormat::PCM32)
+  {
+    int32_t value;
+    memcpy(&value, p, sizeof(value));
+    return (T)value * (T)(1.0 / 2147483648.0);
+  }
+  else if constexpr (Format == SampleFormat::Float32)
+  {
+    float value;
+    memcpy(&value, p, sizeof(value));
+    return (T)value;
+  }
+  else
+  {
+    double value;
+    memcpy(&value, p, sizeof(value));
+    return (T)value;
+  }
+}
+
+// Plain loops over a constant stride; the compiler vectorizes them for the mono case, which is the common one.
+template <wav_io::SampleFormat Format, typename T>
+void Decode(const uint8_t* input, const size_t stride, T* output, const size_t numFrames)
+{
+  for (size_t i = 0; i < numFrames; i++)
+    output[i] = DecodeSample<Format, T>(input + i * stride);
+}
+
+template <wav_io::SampleFormat Format, typename T>
+void DecodeAccumulate(const uint8_t* input, const size_t stride, T* output, const size_t numFrames)
+{
+  for (size_t i = 0; i < numFrames; i++)
+    output[i] += DecodeSample<Format, T>(input + i * stride);
+}
+
+template <typename T>
+void DecodeChunk(const wav_io::SampleFormat format, const uint8_t* input, const size_t stride, T* output,
+                 const size_t numFrames, const bool accumulate)
+{
+  using wav_io::SampleFormat;
+#define NAM_WAV_DECODE(FORMAT)                                                                                         \
+  case SampleFormat::FORMAT:                                                                                           \
+    if (accumulate)                                                                                                    \
+      DecodeAccumulate<SampleFormat::FORMAT, T>(input, stride, output, numFrames);                                     \
+    else                                                                                                               \
+      Decode<SampleFormat::FORMAT, T>(input, stride, output, numFrames);                                               \
+    break;
+  switch (format)
+  {
+    NAM_WAV_DECODE(PCM16)
+    NAM_WAV_DECODE(PCM24)
+    NAM_WAV_DECODE(PCM32)
+    NAM_WAV_DECODE(Float32)
+    NAM_WAV_DECODE(Float64)
+  }
+#undef NAM_WAV_DECODE
+}
+
+// Encoding ============================================================================================================
+
+template <typename T>
+inline int32_t Quantize(const T sample, const double scale)
+{
+  double value = (double)sample * scale;
+  value = value < -scale ? -scale : (value > scale - 1.0 ? scale - 1.0 : value);
+  return (int32_t)std::lrint(value);
+}
+
+template <typename T>
+void Encode(const wav_io::SampleFormat format, const T* input, const size_t numSamples, uint8_t* output)
+{
+  using wav_io::SampleFormat;
+  switch (format)
+  {
+    case SampleFormat::PCM16:
+      for (size_t i = 0; i < numSamples; i++)
+        WriteU16(output + 2 * i, (uint16_t)(int16_t)Quantize(input[i], 32768.0));
+      break;
+    case SampleFormat::PCM24:
+      for (size_t i = 0; i < numSamples; i++)
+      {
+        const uint32_t value = (uint32_t)Quantize(input[i], 8388608.0);
+        output[3 * i] = (uint8_t)value;
+        output[3 * i + 1] = (uint8_t)(value >> 8);
+        output[3 * i + 2] = (uint8_t)(value >> 16);
+      }
+      break;
+    case SampleFormat::PCM32:
+      for (size_t i = 0; i < numSamples; i++)
+        WriteU32(output + 4 * i, (uint32_t)Quantize(input[i], 2147483648.0));
+      break;
+    case SampleFormat::Float32:
+      for (size_t i = 0; i < numSamples; i++)
+      {
+        const float value = (float)input[i];
+        memcpy(output + 4 * i, &value, sizeof(value));
+      }
+      break;
+    case SampleFormat::Float64:
+      for (size_t i = 0; i < numSamples; i++)
+      {
+        const double value = (double)input[i];
+        memcpy(output + 8 * i, &value, sizeof(value));
+      }
+      break;
+  }
+}
+}; // namespace
+
+const char* wav_io::GetSampleFormatName(const SampleFormat format)
+{
+  switch (format)
+  {
+    case SampleFormat::PCM16: return "PCM16";
+    case SampleFormat::PCM24: return "PCM24";
+    case SampleFormat::PCM32: return "PCM32";
+    case SampleFormat::Float32: return "Float32";
+    case SampleFormat::Float64: return "Float64";
+  }
+  return "?";
+}
+
+size_t wav_io::GetBytesPerSample(const SampleFormat format)
+{
+  switch (format)
+  {
+    case SampleFormat::PCM16: return 2;
+    case SampleFormat::PCM24: return 3;
+    case SampleFormat::PCM32: return 4;
+    case SampleFormat::Float32: return 4;
+    case SampleFormat::Float64: return 8;
+  }
+  return 0;
+}
+
+// WavReader ===========================================================================================================
+
+dsp::wav::LoadReturnCode wav_io::WavReader::Open(const std::filesystem::path& path)
+{
+  mPosition = 0;
+  mNumFrames = 0;
+  if (!mFile.Open(path))
+    return LoadReturnCode::ERROR_OPENING;
+  const uint8_t* data = mFile.GetData();
+  const size_t size = mFile.GetSize();
+  auto fail = [&](const LoadReturnCode code) {
+    mFile.Close();
+    return code;
+  };
+  if (size < 12 || memcmp(data, "RIFF", 4) != 0)
+    return fail(LoadReturnCode::ERROR_NOT_RIFF);
+  if (memcmp(data + 8, "WAVE", 4) != 0)
+    return fail(LoadReturnCode::ERROR_NOT_WAVE);
+
+  bool haveFormat = false, haveData = false;
+  uint16_t formatTag = 0, numChannels = 0, bitsPerSample = 0;
+  uint32_t sampleRate = 0;
+  size_t dataSize = 0;
+  for (size_t position = 12; position + 8 <= size && !(haveFormat && haveData);)
+  {
+    const uint8_t* chunk = data + position;
+    const size_t chunkSize = ReadU32(chunk + 4);
+    const size_t bodyOffset = position + 8;
+    const size_t available = size - bodyOffset;
+    if (memcmp(chunk, "fmt ", 4) == 0)
+    {
+      if (chunkSize < 16 || available < 16)
+        return fail(LoadReturnCode::ERROR_INVALID_FILE);
+      formatTag = ReadU16(chunk + 8);
+      numChannels = ReadU16(chunk + 10);
+      sampleRate = ReadU32(chunk + 12);
+      bitsPerSample = ReadU16(chunk + 22);
+      // The real format is the first two bytes of the sub-format GUID.
+      if (formatTag == kFormatExtensible)
+      {
+        if (chunkSize < 40 || available < 40)
+          return fail(LoadReturnCode::ERROR_INVALID_FILE);
+        formatTag = ReadU16(chunk + 8 + 24);
+        if (formatTag != kFormatPCM && formatTag != kFormatIEEEFloat)
+          return fail(LoadReturnCode::ERROR_UNSUPPORTED_FORMAT_EXTENSIBLE);
+      }
+      haveFormat = true;
+    }
+    else if (memcmp(chunk, "data", 4) == 0)
+    {
+      // Files that were never finalized have 0 or 0xFFFFFFFF here; take what's there.
+      dataSize = (chunkSize == 0 || chunkSize > available) ? available : chunkSize;
+      mDataOffset = bodyOffset;
+      haveData = true;
+    }
+    if (chunkSize > available)
+      break;
+    position = bodyOffset + chunkSize + (chunkSize & 1);
+  }
+  if (!haveFormat)
+    return fail(LoadReturnCode::ERROR_MISSING_FMT);
+  if (!haveData || numChannels == 0 || sampleRate == 0)
+    return fail(LoadReturnCode::ERROR_INVALID_FILE);
+
+  if (formatTag == kFormatALaw)
+    return fail(LoadReturnCode::ERROR_UNSUPPORTED_FORMAT_ALAW);
+  if (formatTag == kFormatMuLaw)
+    return fail(LoadReturnCode::ERROR_UNSUPPORTED_FORMAT_MULAW);
+  if (formatTag == kFormatPCM && bitsPerSample == 16)
+    mFormat = SampleFormat::PCM16;
+  else if (formatTag == kFormatPCM && bitsPerSample == 24)
+    mFormat = SampleFormat::PCM24;
+  else if (formatTag == kFormatPCM && bitsPerSample == 32)
+    mFormat = SampleFormat::PCM32;
+  else if (formatTag == kFormatIEEEFloat && bitsPerSample == 32)
+    mFormat = SampleFormat::Float32;
+  else if (formatTag == kFormatIEEEFloat && bitsPerSample == 64)
+    mFormat = SampleFormat::Float64;
+  else if (formatTag == kFormatPCM || formatTag == kFormatIEEEFloat)
+    return fail(LoadReturnCode::ERROR_UNSUPPORTED_BITS_PER_SAMPLE);
+  else
+    return fail(LoadReturnCode::ERROR_OTHER);
+
+  mNumChannels = numChannels;
+  mSampleRate = (double)sampleRate;
+  mNumFrames = dataSize / (GetBytesPerSample(mFormat) * mNumChannels);
+  return LoadReturnCode::SUCCESS;
+}
+
+template <typename T>
+size_t wav_io::WavReader::Read(T* output, const size_t numFrames)
+{
+  return _Read(output, numFrames, -1);
+}
+
+template <typename T>
+size_t wav_io::WavReader::ReadChannel(T* output, const size_t numFrames, const int channel)
+{
+  return channel >= 0 && channel < mNumChannels ? _Read(output, numFrames, channel) : 0;
+}
+
+template <typename T>
+size_t wav_io::WavReader::_Read(T* output, const size_t numFrames, const int channel)
+{
+  if (!IsOpen())
+    return 0;
+  const size_t bytesPerSample = GetBytesPerSample(mFormat);
+  const size_t frameBytes = bytesPerSample * mNumChannels;
+  const size_t toRead = numFrames < mNumFrames - mPosition ? numFrames : mNumFrames - mPosition;
+  const T gain = (T)1.0 / (T)mNumChannels;
+  for (size_t done = 0; done < toRead;)
+  {
+    const size_t n = toRead - done < kChunkFrames ? toRead - done : kChunkFrames;
+    const uint8_t* frames = mFile.GetData() + mDataOffset + (mPosition + done) * frameBytes;
+    T* chunkOutput = output + done;
+    if (channel >= 0)
+      DecodeChunk(mFormat, frames + channel * bytesPerSample, frameBytes, chunkOutput, n, false);
+    else
+    {
+      for (int c = 0; c < mNumChannels; c++)
+        DecodeChunk(mFormat, frames + c * bytesPerSample, frameBytes, chunkOutput, n, c > 0);
+      if (mNumChannels > 1)
+        for (size_t i = 0; i < n; i++)
+          chunkOutput[i] *= gain;
+    }
+    done += n;
+  }
+  mPosition += toRead;
+  const size_t consumed = mDataOffset + mPosition * frameBytes;
+  if (consumed > kReleaseLag)
+    mFile.Release(consumed - kReleaseLag);
+  return toRead;
+}
+
+template size_t wav_io::WavReader::Read<float>(float*, const size_t);
+template size_t wav_io::WavReader::Read<double>(double*, const size_t);
+template size_t wav_io::WavReader::ReadChannel<float>(float*, const size_t, const int);
+template size_t wav_io::WavReader::ReadChannel<double>(double*, const size_t, const int);
+
+// WavWriter ===========================================================================================================
+
+bool wav_io::WavWriter::Open(const std::filesystem::path& path, const double sampleRate, const int numChannels,
+                             const SampleFormat format)
+{
+  Close();
+  if (numChannels <= 0 || numChannels > 0xFFFF || sampleRate <= 0.0)
+    return false;
+#if defined(_WIN32)
+  mFile = _wfopen(path.c_str(), L"wb");
+#else
+  mFile = std::fopen(path.c_str(), "wb");
+#endif
+  if (mFile == nullptr)
+    return false;
+  mNumChannels = numChannels;
+  mFormat = format;
+  mDataBytes = 0;
+  mFailed = false;
+  mBuffer.resize(kChunkFrames * numChannels * GetBytesPerSample(format));
+  mBufferUsed = 0;
+
+  // The sizes are filled in by Close().
+  const bool isFloat = format == SampleFormat::Float32 || format == SampleFormat::Float64;
+  const uint16_t bytesPerSample = (uint16_t)GetBytesPerSample(format);
+  const uint32_t rate = (uint32_t)std::lrint(sampleRate);
+  uint8_t header[44];
+  memcpy(header, "RIFF", 4);
+  WriteU32(header + 4, 0);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  WriteU32(header + 16, 16);
+  WriteU16(header + 20, isFloat ? kFormatIEEEFloat : kFormatPCM);
+  WriteU16(header + 22, (uint16_t)numChannels);
+  WriteU32(header + 24, rate);
+  WriteU32(header + 28, rate * numChannels * bytesPerSample);
+  WriteU16(header + 32, (uint16_t)(numChannels * bytesPerSample));
+  WriteU16(header + 34, (uint16_t)(8 * bytesPerSample));
+  memcpy(header + 36, "data", 4);
+  WriteU32(header + 40, 0);
+  mFailed = std::fwrite(header, 1, sizeof(header), mFile) != sizeof(header);
+  return !mFailed;
+}
+
+template <typename T>
+bool wav_io::WavWriter::Write(const T* input, const size_t numFrames)
+{
+  if (mFile == nullptr || mFailed)
+    return false;
+  const size_t sampleBytes = GetBytesPerSample(mFormat);
+  const size_t frameBytes = sampleBytes * mNumChannels;
+  for (size_t done = 0; done < numFrames;)
+  {
+    const size_t space = (mBuffer.size() - mBufferUsed) / frameBytes;
+    const size_t n = numFrames - done < space ? numFrames - done : space;
+    Encode(mFormat, input + done * mNumChannels, n * mNumChannels, mBuffer.data() + mBufferUsed);
+    mBufferUsed += n * frameBytes;
+    done += n;
+    if (mBufferUsed == mBuffer.size() && !_Flush())
+      return false;
+  }
+  return true;
+}
+
+template bool wav_io::WavWriter::Write<float>(const float*, const size_t);
+template bool wav_io::WavWriter::Write<double>(const double*, const size_t);
+
+bool wav_io::WavWriter::_Flush()
+{
+  if (mBufferUsed > 0 && std::fwrite(mBuffer.data(), 1, mBufferUsed, mFile) != mBufferUsed)
+    mFailed = true;
+  mDataBytes += mBufferUsed;
+  mBufferUsed = 0;
+  return !mFailed;
+}
+
+bool wav_io::WavWriter::Close()
+{
+  if (mFile == nullptr)
+    return false;
+  _Flush();
+  // Chunks are padded to an even size.
+  if (mDataBytes % 2 == 1)
+    mFailed |= std::fputc(0, mFile) == EOF;
+  const uint64_t riffSize = 36 + mDataBytes + mDataBytes % 2;
+  if (riffSize > 0xFFFFFFFFull)
+    mFailed = true;
+  else
+  {
+    uint8_t size[4];
+    WriteU32(size, (uint32_t)riffSize);
+    mFailed |= std::fseek(mFile, 4, SEEK_SET) != 0 || std::fwrite(size, 1, 4, mFile) != 4;
+    WriteU32(size, (uint32_t)mDataBytes);
+    mFailed |= std::fseek(mFile, 40, SEEK_SET) != 0 || std::fwrite(size, 1, 4, mFile) != 4;
+  }
+  mFailed |= std::fclose(mFile) != 0;
+  mFile = nullptr;
+  mBuffer.clear();
+  mBuffer.shrink_to_fit();
+  return !mFailed;
+}
+
+dsp::wav::LoadReturnCode wav_io::Load(const std::filesystem::path& path, std::vector<float>& audio,
+                                      double& sampleRate)
+{
+  WavReader reader;
+  const LoadReturnCode result = reader.Open(path);
+  if (result != LoadReturnCode::SUCCESS)
+    return result;
+  if (reader.GetNumChannels() != 1)
+    return LoadReturnCode::ERROR_NOT_MONO;
+  audio.resize(reader.GetNumFrames());
+  reader.Read(audio.data(), audio.size());
+  sampleRate = reader.GetSampleRate();
+  return LoadReturnCode::SUCCESS;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+// Streaming WAV reading and writing for IRs and offline renders.
+//
+// WavReader memory-maps the file and decodes straight from the mapping into the caller's buffer, in the caller's
+// sample type, so a file is never copied into an intermediate vector. Reading is sequential (or from wherever Seek()
+// puts it), and pages that have been read are handed back to the OS as it goes, so a render of an hour-long DI uses no
+// more memory than one of a second.
+//
+// WavWriter encodes each Write() through a fixed-size buffer and patches the header's sizes on Close().
+//
+// Supported: PCM 16/24/32-bit and IEEE float 32/64-bit, plain or WAVE_FORMAT_EXTENSIBLE, any number of channels.
+// Errors are reported with AudioDSPTools' codes so that callers can use its messages.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+
+#include "AudioDSPTools/dsp/wav.h"
+
+#include "MappedFile.h"
+
+namespace wav_io
+{
+enum class SampleFormat
+{
+  PCM16 = 0,
+  PCM24,
+  PCM32,
+  Float32,
+  Float64
+};
+
+const char* GetSampleFormatName(const SampleFormat format);
+size_t GetBytesPerSample(const SampleFormat format);
+
+class WavReader
+{
+public:
+  dsp::wav::LoadReturnCode Open(const std::filesystem::path& path);
+  void Close() { mFile.Close(); };
+  bool IsOpen() const { return mFile.IsOpen(); };
+
+  double GetSampleRate() const { return mSampleRate; };
+  int GetNumChannels() const { return mNumChannels; };
+  SampleFormat GetFormat() const { return mFormat; };
+  size_t GetNumFrames() const { return mNumFrames; };
+  size_t GetPosition() const { return mPosition; };
+  void Seek(const size_t frame) { mPosition = frame < mNumFrames ? frame : mNumFrames; };
+
+  // Reads up to `numFrames` frames from the current position, mixed down to mono (channels are averaged).
+  // Returns the number of frames read, which is less than asked for only at the end of the file.
+  template <typename T>
+  size_t Read(T* output, const size_t numFrames);
+  // Same, but one channel only
+  template <typename T>
+  size_t ReadChannel(T* output, const size_t numFrames, const int channel);
+
+private:
+  template <typename T>
+  size_t _Read(T* output, const size_t numFrames, const int channel);
+
+  io::MappedFile mFile;
+  size_t mDataOffset = 0;
+  double mSampleRate = 0.0;
+  int mNumChannels = 0;
+  SampleFormat mFormat = SampleFormat::PCM16;
+  size_t mNumFrames = 0;
+  size_t mPosition = 0;
+};
+
+class WavWriter
+{
+public:
+  WavWriter() = default;
+  ~WavWriter() { Close(); };
+  WavWriter(const WavWriter&) = delete;
+  WavWriter& operator=(const WavWriter&) = delete;
+
+  bool Open(const std::filesystem::path& path, const double sampleRate, const int numChannels,
+            const SampleFormat format);
+  // `input` is interleaved. Out-of-range samples are clipped for the PCM formats.
+  template <typename T>
+  bool Write(const T* input, const size_t numFrames);
+  // Writes the sizes into the header and closes the file. Returns false if anything failed along the way.
+  bool Close();
+  bool IsOpen() const { return mFile != nullptr; };
+
+private:
+  bool _Flush();
+
+  std::FILE* mFile = nullptr;
+  int mNumChannels = 0;
+  SampleFormat mFormat = SampleFormat::PCM16;
+  uint64_t mDataBytes = 0;
+  bool mFailed = false;
+  std::vector<uint8_t> mBuffer;
+  size_t mBufferUsed = 0;
+};
+
+// Whole-file mono load with the same results as dsp::wav::Load(), for IRs
+dsp::wav::LoadReturnCode Load(const std::filesystem::path& path, std::vector<float>& audio, double& sampleRate);
+}; // namespace wav_io
@@ -0,0 +1,86 @@
+#pragma once
+
+// The input history of a dilated convolution, kept in a circular buffer.
+//
+// NAM core's WaveNet layers each keep their input in a linear buffer of kWaveNetLayerBufferSize (see ModelProfile.h)
+// frames plus the layer array's receptive field, write further along it with every block, and copy the tail back to
+// the front when they get to the end. The copy is rare, but the buffers aren't small: with 16 channels, each layer
+// sweeps through about 4 MB, so every block's writes and its dilated taps land on memory that the cache let go of a
+// long time ago, and a model of 20 layers has more history than the last-level cache of most machines.
+//
+// History is the same thing with only as much room as the layer needs: its own lookback ((kernel size - 1) x
+// dilation) plus the largest block, rounded up to a power of two so that wrapping around is a mask rather than a
+// branch or a copy. Frames are channel-interleaved, as in NAM core's Eigen matrices (a column per frame), so a tap over
+// a block is at most two contiguous runs of frames (ForEachRun()), and each frame of it is a cache line at 16
+// channels. With blocks of 64 frames, the layer with a dilation of 512 needs 128 kB and the one with a dilation of 1
+// needs 8 kB.
+//
+// nam-bench's wavenet_history cases compare the two on the memory traffic of a layer array: writing each block and
+// reading every tap back, at every block size. The layers themselves are NAM core's, which doesn't use this yet.
+
+#include <algorithm> // std::copy, std::max, std::min
+#include <cstddef>
+#include <vector>
+
+namespace dilation_history
+{
+class History
+{
+public:
+  // Room for `lookback` frames of `channels` channels before a block of up to `maxBlockSize` frames. Starts silent.
+  void Reset(const long channels, const long lookback, const long maxBlockSize)
+  {
+    size_t capacity = 1;
+    while (capacity < (size_t)std::max(1L, lookback + maxBlockSize))
+      capacity <<= 1;
+    mChannels = std::max(1L, channels);
+    mMask = capacity - 1;
+    mNext = mBlockStart = 0;
+    mData.assign(capacity * mChannels, 0.0f);
+  };
+
+  // Appends a block of frames: `channels` floats for each frame, one frame after another (a column-major Eigen matrix
+  // of channels x numFrames). No more than the maxBlockSize given to Reset().
+  void Write(const float* frames, const long numFrames)
+  {
+    mBlockStart = mNext;
+    const size_t start = mNext & mMask;
+    const size_t first = std::min((size_t)numFrames, mMask + 1 - start);
+    std::copy(frames, frames + first * mChannels, mData.data() + start * mChannels);
+    std::copy(frames + first * mChannels, frames + numFrames * mChannels, mData.data());
+    mNext += numFrames;
+  };
+
+  // Frame `frame` of the last block written, delayed by `delay` frames: channels floats. The delay can reach back as
+  // far as the lookback given to Reset().
+  const float* Get(const long frame, const long delay) const
+  {
+    return mData.data() + ((mBlockStart + frame - delay) & mMask) * mChannels;
+  };
+
+  // Calls f(firstFrame, frames, numFrames) with the frames of the last block written, delayed by `delay`, in no more
+  // than two contiguous runs: numFrames x channels floats from `frames`, for the block's frames from firstFrame on.
+  template <typename F>
+  void ForEachRun(const long delay, const long numFrames, F&& f) const
+  {
+    const size_t start = (mBlockStart - delay) & mMask;
+    const long first = (long)std::min((size_t)numFrames, mMask + 1 - start);
+    f(0L, mData.data() + start * mChannels, first);
+    if (first < numFrames)
+      f(first, mData.data(), numFrames - first);
+  };
+
+  long GetChannels() const { return mChannels; };
+  size_t GetCapacity() const { return mMask + 1; };
+  size_t GetBytes() const { return sizeof(float) * mData.size(); };
+
+private:
+  std::vector<float> mData;
+  long mChannels = 1;
+  size_t mMask = 0;
+  // Frames written, ever. Unsigned so that it wraps around the same way that the mask does.
+  size_t mNext = 0;
+  // Where the last block started
+  size_t mBlockStart = 0;
+};
+}; // namespace dilation_history
@@ -0,0 +1,338 @@
+#pragma once
+
+// The server side of RemoteInference.h (Linux only).
+//
+// One session per connected client, each with two threads: a control thread that answers the client's messages
+// (hello, load, reset) and an inference thread, promoted to real-time priority, that runs the client's model on
+// whatever shows up in the request ring. Models are built and swapped on the control thread; the inference thread
+// only takes the model's lock, which the control thread holds just long enough to swap or reset it.
+//
+// Messages, one per packet:
+//
+//   hello <shared memory name>    -> ok | error <message>
+//   load <accuracy> [<model path>] -> ok <expected sample rate> <has loudness> <loudness> <has input level>
+//                                        <input level> <has output level> <output level> | error <message>
+//   reset <sample rate> <max block size> -> ok | error <message>
+//
+// A load without a path sets up a loopback that returns its input, for measuring the round trip itself.
+
+#include <algorithm> // std::copy, std::min
+#include <atomic>
+#include <cstring> // strerror
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "NeuralAmpModelerCore/NAM/get_dsp.h"
+
+#include "Activations.h"
+#include "NamFile.h"
+#include "Pipeline.h" // PromoteCurrentThreadToRealtime
+#include "RemoteInference.h"
+
+namespace remote
+{
+class Session
+{
+public:
+  explicit Session(const int socket)
+  : mSocket(socket)
+  , mInput(kMaxFramesPerRequest)
+  , mOutput(kMaxFramesPerRequest)
+  {
+    mControlThread = std::thread([this]() { _RunControl(); });
+  };
+  ~Session()
+  {
+    Stop();
+    if (mControlThread.joinable())
+      mControlThread.join();
+    // Not before: the descriptor could be reused by the next client while we still hold it.
+    close(mSocket);
+  };
+  Session(const Session&) = delete;
+  Session& operator=(const Session&) = delete;
+
+  // Makes the control thread hang up. Doesn't wait.
+  void Stop() { shutdown(mSocket, SHUT_RDWR); };
+  // Whether the client has gone and the session can be destroyed
+  bool IsDone() const { return mDone.load(); };
+
+private:
+  void _RunControl()
+  {
+    char buffer[4096];
+    while (true)
+    {
+      const ssize_t received = recv(mSocket, buffer, sizeof(buffer), 0);
+      if (received <= 0)
+        break;
+      const std::string reply = _Handle(std::string(buffer, (size_t)received));
+      if (send(mSocket, reply.data(), reply.size(), MSG_NOSIGNAL) != (ssize_t)reply.size())
+        break;
+    }
+
+    if (mInferenceThread.joinable())
+    {
+      mRunning = false;
+      mShared->requestSignal.fetch_add(1);
+      FutexWake(mShared->requestSignal);
+      mInferenceThread.join();
+    }
+    if (mShared != nullptr)
+      munmap(mShared, sizeof(SharedBlock));
+    mDone = true;
+  };
+
+  std::string _Handle(const std::string& message)
+  {
+    std::istringstream fields(message);
+    std::string command;
+    fields >> command;
+    if (command == "hello")
+    {
+      std::string shmName;
+      fields >> shmName;
+      return _Hello(shmName);
+    }
+    if (mShared == nullptr)
+      return "error hello first";
+    if (command == "load")
+    {
+      int accuracy = 0;
+      fields >> accuracy;
+      std::string modelPath;
+      std::getline(fields >> std::ws, modelPath);
+      return _Load((dsp::activations::Accuracy)accuracy, modelPath);
+    }
+    if (command == "reset")
+    {
+      double sampleRate = 0.0;
+      int maxBlockSize = 0;
+      if (!(fields >> sampleRate >> maxBlockSize) || maxBlockSize <= 0)
+        return "error bad reset";
+      std::lock_guard<std::mutex> lock(mModelMutex);
+      mMaxBlockSize = std::min(maxBlockSize, kMaxFramesPerRequest);
+      if (mModel != nullptr)
+      {
+        mModel->Reset(sampleRate, mMaxBlockSize);
+        mModel->prewarm();
+      }
+      return "ok";
+    }
+    return "error unknown command " + command;
+  };
+
+  std::string _Hello(const std::string& shmName)
+  {
+    if (mShared != nullptr)
+      return "error already connected";
+    const int fd = shm_open(shmName.c_str(), O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0)
+      return std::string("error ") + strerror(errno);
+    struct stat info;
+    void* memory = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(SharedBlock))
+      memory = mmap(nullptr, sizeof(SharedBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+      return "error couldn't map the shared memory";
+    SharedBlock* shared = static_cast<SharedBlock*>(memory);
+    if (shared->magic != kMagic || shared->version != kVersion || shared->sampleSize != sizeof(NAM_SAMPLE))
+    {
+      munmap(memory, sizeof(SharedBlock));
+      return "error the client speaks a different version";
+    }
+    mShared = shared;
+    mRunning = true;
+    mInferenceThread = std::thread([this]() { _RunInference(); });
+    return "ok";
+  };
+
+  std::string _Load(const dsp::activations::Accuracy accuracy, const std::string& modelPath)
+  {
+    std::unique_ptr<nam::DSP> model;
+    if (!modelPath.empty())
+    {
+      try
+      {
+        dsp::activations::ScopedActivationAccuracy activationAccuracy(accuracy);
+        nam::dspData data;
+        model = nam_file::GetDSP(std::filesystem::u8path(modelPath), data);
+      }
+      catch (std::exception& e)
+      {
+        return std::string("error ") + e.what();
+      }
+      // Until the client tells us otherwise
+      model->Reset(model->GetExpectedSampleRate() > 0.0 ? model->GetExpectedSampleRate() : 48000.0,
+                   kMaxFramesPerRequest);
+      model->prewarm();
+    }
+
+    std::ostringstream reply;
+    if (model != nullptr)
+      reply << "ok " << model->GetExpectedSampleRate() << " " << model->HasLoudness() << " " << model->GetLoudness()
+            << " " << model->HasInputLevel() << " " << model->GetInputLevel() << " " << model->HasOutputLevel() << " "
+            << model->GetOutputLevel();
+    else
+      reply << "ok -1 0 0 0 0 0 0";
+    {
+      std::lock_guard<std::mutex> lock(mModelMutex);
+      mModel.swap(model);
+      mLoopback = mModel == nullptr;
+    }
+    // The old model goes here, off the inference thread.
+    model = nullptr;
+    return reply.str();
+  };
+
+  void _RunInference()
+  {
+    pipeline::PromoteCurrentThreadToRealtime();
+    SharedBlock& shared = *mShared;
+    while (mRunning.load())
+    {
+      const uint32_t signal = shared.requestSignal.load();
+      uint64_t position = shared.requestRead.load(std::memory_order_relaxed);
+      const uint64_t end = shared.requestWrite.load(std::memory_order_acquire);
+      if (position == end)
+      {
+        shared.daemonWaiting.store(1);
+        if (shared.requestWrite.load(std::memory_order_acquire) == end)
+          FutexWait(shared.requestSignal, signal, 0.1);
+        shared.daemonWaiting.store(0);
+        continue;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mModelMutex);
+        while (position < end)
+        {
+          const int numFrames = (int)std::min<uint64_t>(end - position, (uint64_t)mMaxBlockSize);
+          for (int i = 0; i < numFrames; i++)
+            mInput[i] = shared.request[(position + i) & (kRingSize - 1)];
+          if (mModel != nullptr)
+            mModel->process(mInput.data(), mOutput.data(), numFrames);
+          else if (mLoopback)
+            std::copy(mInput.begin(), mInput.begin() + numFrames, mOutput.begin());
+          else
+            std::fill(mOutput.begin(), mOutput.begin() + numFrames, (NAM_SAMPLE)0);
+          for (int i = 0; i < numFrames; i++)
+            shared.response[(position + i) & (kRingSize - 1)] = mOutput[i];
+          position += numFrames;
+          shared.responseWrite.store(position, std::memory_order_release);
+        }
+      }
+      shared.requestRead.store(position, std::memory_order_release);
+      shared.responseSignal.fetch_add(1);
+      if (shared.clientWaiting.load() != 0)
+        FutexWake(shared.responseSignal);
+    }
+  };
+
+  const int mSocket;
+  SharedBlock* mShared = nullptr;
+  std::atomic<bool> mRunning = false;
+  std::atomic<bool> mDone = false;
+
+  std::mutex mModelMutex;
+  std::unique_ptr<nam::DSP> mModel;
+  bool mLoopback = false;
+  int mMaxBlockSize = kMaxFramesPerRequest;
+  std::vector<NAM_SAMPLE> mInput, mOutput;
+
+  std::thread mControlThread;
+  std::thread mInferenceThread;
+};
+
+class Daemon
+{
+public:
+  explicit Daemon(const std::string& socketPath)
+  : mSocketPath(socketPath) {};
+  ~Daemon()
+  {
+    mSessions.clear();
+    if (mListenSocket >= 0)
+    {
+      close(mListenSocket);
+      unlink(mSocketPath.c_str());
+    }
+  };
+  Daemon(const Daemon&) = delete;
+  Daemon& operator=(const Daemon&) = delete;
+
+  // Returns false and sets `error` if the socket can't be bound, e.g. because another daemon already has it.
+  bool Listen(std::string& error)
+  {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (mSocketPath.size() >= sizeof(address.sun_path))
+    {
+      error = "Socket path is too long: " + mSocketPath;
+      return false;
+    }
+    mSocketPath.copy(address.sun_path, mSocketPath.size());
+    mListenSocket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (mListenSocket < 0)
+    {
+      error = "Couldn't create a socket";
+      return false;
+    }
+    // Take over a stale socket, but not a live one.
+    if (connect(mListenSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0)
+    {
+      close(mListenSocket);
+      mListenSocket = -1;
+      error = "Another daemon is already listening at " + mSocketPath;
+      return false;
+    }
+    unlink(mSocketPath.c_str());
+    if (bind(mListenSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+        || listen(mListenSocket, 16) != 0)
+    {
+      error = "Couldn't listen at " + mSocketPath + ": " + strerror(errno);
+      close(mListenSocket);
+      mListenSocket = -1;
+      return false;
+    }
+    return true;
+  };
+
+  // Serves clients until `stop` is set.
+  void Run(const std::atomic<bool>& stop)
+  {
+    while (!stop.load())
+    {
+      pollfd listening{mListenSocket, POLLIN, 0};
+      if (poll(&listening, 1, 200) > 0 && (listening.revents & POLLIN))
+      {
+        const int client = accept4(mListenSocket, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client >= 0)
+          mSessions.push_back(std::make_unique<Session>(client));
+      }
+      mSessions.remove_if([](const std::unique_ptr<Session>& session) { return session->IsDone(); });
+    }
+  };
+
+private:
+  std::string mSocketPath;
+  int mListenSocket = -1;
+  std::list<std::unique_ptr<Session>> mSessions;
+};
+}; // namespace remote
@@ -0,0 +1,222 @@
+#pragma once
+
+// The state that a model settles into on silence, worked out from its weights instead of by running it.
+//
+// NAM core prewarms a model by running it on zeros until it has settled: the receptive field for a WaveNet, a fixed
+// stretch for an LSTM. Every Reset() does it, so for a big WaveNet it's a good part of the time that a load or a
+// sample rate change takes. But on silence, nothing in a WaveNet changes from one sample to the next once it has
+// settled, so each layer's input is a constant that can be carried through the layers once, a sample's worth of work
+// instead of a receptive field's. An LSTM's state has to be iterated, but only the recurrence and only until it stops
+// changing.
+//
+// GetSteadyState() gives the output and each layer's settled state, which is what a prewarm fills a WaveNet layer's
+// history with. The layers are NAM core's, so it can't fill them in itself; nam-regress checks the state that NAM
+// core's own prewarm leaves against it, and says how long each one takes.
+//
+// WaveNet and LSTM models (see WeightLayout.h), with the activations that NAM core has.
+
+#include <algorithm> // std::max, std::min
+#include <cmath> // std::exp, std::fabs, std::tanh
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "WeightLayout.h"
+
+namespace prewarm
+{
+// An LSTM has settled when no part of its state moves by more than this (relative to it, or to 1 if it's smaller) in
+// a step...
+constexpr float kLSTMTolerance = 1.0e-6f;
+// ...which had better happen within this many steps.
+constexpr long kMaxLSTMSteps = 480000;
+
+struct SteadyState
+{
+  // False if the architecture or an activation isn't one that we know, or if an LSTM doesn't settle
+  bool known = false;
+  // What the model outputs on silence once it has settled
+  double output = 0.0;
+  // Samples of silence that it takes to settle: a WaveNet's receptive field, or the steps an LSTM took
+  long numSamples = 0;
+  // WaveNet: each layer's input (its whole history, once it has settled). LSTM: each layer's hidden state, then its
+  // cell state.
+  std::vector<Eigen::VectorXf> layerStates;
+};
+
+namespace detail
+{
+using Activation = float (*)(const float);
+
+inline float Sigmoid(const float x)
+{
+  return 1.0f / (1.0f + std::exp(-x));
+}
+
+// As in NAM core's activations.h
+inline Activation GetActivation(const std::string& name)
+{
+  if (name == "Tanh" || name == "Fasttanh")
+    return [](const float x) { return std::tanh(x); };
+  if (name == "Hardtanh")
+    return [](const float x) { return std::max(-1.0f, std::min(1.0f, x)); };
+  if (name == "ReLU")
+    return [](const float x) { return std::max(0.0f, x); };
+  if (name == "LeakyReLU")
+    return [](const float x) { return x > 0.0f ? x : 0.01f * x; };
+  if (name == "Sigmoid")
+    return Sigmoid;
+  if (name == "SiLU")
+    return [](const float x) { return x * Sigmoid(x); };
+  if (name == "Hardswish")
+    return [](const float x) { return x * std::max(0.0f, std::min(1.0f, x / 6.0f + 0.5f)); };
+  return nullptr;
+}
+
+// The matrix's taps summed (all of them see the same constant input), times `x`, plus its bias
+inline Eigen::VectorXf Apply(const std::vector<float>& weights, const weight_layout::Matrix& matrix,
+                             const Eigen::VectorXf& x)
+{
+  Eigen::VectorXf y = Eigen::VectorXf::Zero(matrix.rows);
+  for (long row = 0; row < matrix.rows; row++)
+  {
+    for (long col = 0; col < matrix.cols; col++)
+    {
+      float w = 0.0f;
+      for (long tap = 0; tap < matrix.taps; tap++)
+        w += weights[matrix.GetIndex(row, col, tap)];
+      y(row) += w * x(col);
+    }
+    if (matrix.biasSize > 0)
+      y(row) += weights[matrix.GetBiasOffset() + row];
+  }
+  return y;
+}
+
+inline SteadyState GetWaveNetSteadyState(const nam::dspData& data,
+                                         const std::vector<weight_layout::Matrix>& matrices)
+{
+  SteadyState state;
+  const std::vector<float>& weights = data.weights;
+  auto matrix = matrices.begin();
+  Eigen::VectorXf arrayInput, headInput;
+  long receptiveField = 1;
+  for (const auto& layerArray : data.config["layers"])
+  {
+    const long channels = layerArray["channels"];
+    const long kernelSize = layerArray["kernel_size"];
+    const bool gated = layerArray["gated"];
+    const Activation activation = GetActivation(layerArray["activation"]);
+    if (activation == nullptr)
+      return SteadyState();
+    // The first array's input is the model's, and so is every array's condition: silence.
+    if (arrayInput.size() == 0)
+      arrayInput = Eigen::VectorXf::Zero((long)layerArray["input_size"]);
+    // The first array's head starts at zero; the others start with the one before's.
+    if (headInput.size() == 0)
+      headInput = Eigen::VectorXf::Zero(channels);
+    if (headInput.size() != channels)
+      return SteadyState();
+
+    Eigen::VectorXf x = Apply(weights, *matrix++, arrayInput);
+    for (const auto& dilation : layerArray["dilations"])
+    {
+      const weight_layout::Matrix& conv = *matrix++;
+      matrix++; // The input mix-in, which silence doesn't get past
+      const weight_layout::Matrix& oneByOne = *matrix++;
+      state.layerStates.push_back(x);
+      receptiveField += (kernelSize - 1) * (long)dilation;
+
+      Eigen::VectorXf z = Apply(weights, conv, x);
+      Eigen::VectorXf activated(channels);
+      for (long c = 0; c < channels; c++)
+        activated(c) = gated ? activation(z(c)) * Sigmoid(z(channels + c)) : activation(z(c));
+      headInput += activated;
+      x += Apply(weights, oneByOne, activated);
+    }
+    headInput = Apply(weights, *matrix++, headInput);
+    arrayInput = x;
+  }
+  const float headScale = weights.back();
+  state.output = headScale * headInput(0);
+  state.numSamples = receptiveField;
+  state.known = true;
+  return state;
+}
+
+inline SteadyState GetLSTMSteadyState(const nam::dspData& data, const std::vector<weight_layout::Matrix>& matrices)
+{
+  const std::vector<float>& weights = data.weights;
+  const long hiddenSize = data.config["hidden_size"];
+  const long inputSize = data.config["input_size"];
+  // Each layer's [input, hidden] and cell, starting from the ones in the weights
+  std::vector<Eigen::VectorXf> xh, c;
+  for (const weight_layout::Matrix& matrix : matrices)
+  {
+    const size_t initialState = matrix.GetBiasOffset() + matrix.biasSize;
+    xh.push_back(Eigen::VectorXf::Zero(matrix.cols));
+    c.push_back(Eigen::Map<const Eigen::VectorXf>(weights.data() + initialState + hiddenSize, hiddenSize));
+    xh.back().tail(hiddenSize) = Eigen::Map<const Eigen::VectorXf>(weights.data() + initialState, hiddenSize);
+  }
+
+  SteadyState state;
+  for (long step = 1; step <= kMaxLSTMSteps && !state.known; step++)
+  {
+    float change = 0.0f;
+    Eigen::VectorXf input = Eigen::VectorXf::Zero(inputSize);
+    for (size_t i = 0; i < matrices.size(); i++)
+    {
+      xh[i].head(xh[i].size() - hiddenSize) = input;
+      // Gates in NAM core's (and PyTorch's) order: input, forget, cell, output
+      const Eigen::VectorXf ifgo = Apply(weights, matrices[i], xh[i]);
+      for (long j = 0; j < hiddenSize; j++)
+      {
+        const float forget = Sigmoid(ifgo(hiddenSize + j)) * c[i](j);
+        const float cell = forget + Sigmoid(ifgo(j)) * std::tanh(ifgo(2 * hiddenSize + j));
+        const float hidden = Sigmoid(ifgo(3 * hiddenSize + j)) * std::tanh(cell);
+        const long h = xh[i].size() - hiddenSize + j;
+        change = std::max(change, std::fabs(cell - c[i](j)) / std::max(1.0f, std::fabs(cell)));
+        change = std::max(change, std::fabs(hidden - xh[i](h)) / std::max(1.0f, std::fabs(hidden)));
+        c[i](j) = cell;
+        xh[i](h) = hidden;
+      }
+      input = xh[i].tail(hiddenSize);
+    }
+    state.numSamples = step;
+    state.known = change <= kLSTMTolerance;
+  }
+  if (!state.known)
+    return SteadyState();
+
+  const size_t head = weights.size() - (size_t)hiddenSize - 1;
+  const Eigen::VectorXf hidden = xh.back().tail(hiddenSize);
+  state.output = Eigen::Map<const Eigen::VectorXf>(weights.data() + head, hiddenSize).dot(hidden) + weights.back();
+  for (size_t i = 0; i < matrices.size(); i++)
+  {
+    state.layerStates.push_back(xh[i].tail(hiddenSize));
+    state.layerStates.push_back(c[i]);
+  }
+  return state;
+}
+}; // namespace detail
+
+// Doesn't build the model, so it's quick, and it doesn't touch anything that's running.
+inline SteadyState GetSteadyState(const nam::dspData& data)
+{
+  const std::vector<weight_layout::Matrix> matrices = weight_layout::GetMatrices(data);
+  if (matrices.empty())
+    return SteadyState();
+  try
+  {
+    if (data.architecture == "WaveNet")
+      return detail::GetWaveNetSteadyState(data, matrices);
+    else
+      return detail::GetLSTMSteadyState(data, matrices);
+  }
+  catch (const std::exception&)
+  {
+    return SteadyState();
+  }
+}
+}; // namespace prewarm
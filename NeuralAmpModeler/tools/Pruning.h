@@ -0,0 +1,177 @@
+#pragma once
+
+// Magnitude pruning for NAM models, and block-sparse kernels to run what's left.
+//
+// Many captures have a good share of weights that do next to nothing. Prune() zeroes them in blocks of a few output
+// channels (4 or 8) that share an input channel and kernel tap: either every block whose weights are all under a
+// threshold, or each matrix's smallest blocks up to a target sparsity. Whole blocks rather than single weights so that
+// a kernel can skip them and reuse each input it loads for several outputs (see BlockSparseMatrix). Only the
+// matrices of the dilated convs, the 1x1s and the LSTM gates are pruned; biases and the odds and ends are left alone.
+//
+// Whether pruning is acceptable depends on the capture, so it's never done behind the user's back: nam-prune (see
+// tools/nam-prune.cpp) renders a reference signal through the pruned and the original model, and only writes the
+// pruned one if the error is small enough. The layers themselves are NAM core's and run dense, so a pruned model
+// isn't any faster there yet; nam-prune also times these kernels on the pruned matrices to show what there is to gain.
+//
+// WaveNet and LSTM models (see WeightLayout.h); the others are left alone.
+
+#include <algorithm> // std::min, std::max, std::sort
+#include <cmath> // std::fabs
+#include <numeric> // std::iota
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "WeightLayout.h"
+
+namespace pruning
+{
+struct Options
+{
+  // Blocks whose weights are all smaller than this are pruned...
+  double threshold = 0.0;
+  // ...or, if this is above 0, each matrix's smallest blocks (by their largest weight), up to this fraction of it.
+  double sparsity = 0.0;
+  // Output channels per block
+  int blockRows = 4;
+};
+
+struct Result
+{
+  // In the matrices that can be pruned
+  size_t numWeights = 0;
+  // Of those, how many are zero afterwards
+  size_t numZeros = 0;
+
+  double GetSparsity() const { return numWeights > 0 ? (double)numZeros / (double)numWeights : 0.0; };
+};
+
+// Prunes `data.weights` in place.
+inline Result Prune(nam::dspData& data, const Options& options)
+{
+  Result result;
+  const long blockRows = std::max(1, options.blockRows);
+  std::vector<float>& weights = data.weights;
+  for (const weight_layout::Matrix& matrix : weight_layout::GetMatrices(data))
+  {
+    const long numRowBlocks = (matrix.rows + blockRows - 1) / blockRows;
+    const long numBlocks = numRowBlocks * matrix.cols * matrix.taps;
+    // Block b is row block b / (cols * taps), then column, then tap.
+    auto forEachWeight = [&](const long block, auto&& f) {
+      const long rowBlock = block / (matrix.cols * matrix.taps);
+      const long col = (block / matrix.taps) % matrix.cols;
+      const long tap = block % matrix.taps;
+      for (long row = rowBlock * blockRows; row < std::min(matrix.rows, (rowBlock + 1) * blockRows); row++)
+        f(weights[matrix.GetIndex(row, col, tap)]);
+    };
+    std::vector<float> magnitudes(numBlocks, 0.0f);
+    for (long b = 0; b < numBlocks; b++)
+      forEachWeight(b, [&](const float w) { magnitudes[b] = std::max(magnitudes[b], std::fabs(w)); });
+
+    std::vector<long> pruned;
+    if (options.sparsity > 0.0)
+    {
+      std::vector<long> order(numBlocks);
+      std::iota(order.begin(), order.end(), 0);
+      std::sort(order.begin(), order.end(), [&](const long a, const long b) { return magnitudes[a] < magnitudes[b]; });
+      const long numPruned = std::min(numBlocks, (long)(options.sparsity * (double)numBlocks));
+      pruned.assign(order.begin(), order.begin() + numPruned);
+    }
+    else
+    {
+      for (long b = 0; b < numBlocks; b++)
+        if (magnitudes[b] < options.threshold)
+          pruned.push_back(b);
+    }
+    for (const long b : pruned)
+      forEachWeight(b, [](float& w) { w = 0.0f; });
+
+    result.numWeights += matrix.GetSize();
+    for (long b = 0; b < numBlocks; b++)
+      forEachWeight(b, [&](const float w) { result.numZeros += w == 0.0f ? 1 : 0; });
+  }
+  return result;
+}
+
+// Tap `tap` of `matrix` from the weights, as NAM core would hold it
+inline Eigen::MatrixXf GetDense(const std::vector<float>& weights, const weight_layout::Matrix& matrix, const long tap)
+{
+  Eigen::MatrixXf dense(matrix.rows, matrix.cols);
+  for (long row = 0; row < matrix.rows; row++)
+    for (long col = 0; col < matrix.cols; col++)
+      dense(row, col) = weights[matrix.GetIndex(row, col, tap)];
+  return dense;
+}
+
+// A matrix stored as the blocks of BlockRows x 1 that have anything in them, column by column.
+//
+// It multiplies activations laid out the other way around from NAM core's: frames down the rows and a column per
+// channel, so that each block is BlockRows multiply-adds along the whole block of frames, which vectorize. Laid out
+// NAM core's way (a column per frame), the blocks are too short for that and it doesn't beat Eigen's dense product at
+// the sizes of NAM's layers.
+template <int BlockRows>
+class BlockSparseMatrix
+{
+public:
+  explicit BlockSparseMatrix(const Eigen::MatrixXf& dense)
+  : mRows(dense.rows())
+  , mCols(dense.cols())
+  {
+    mColumnStarts.reserve(mCols + 1);
+    for (long col = 0; col < mCols; col++)
+    {
+      mColumnStarts.push_back(mFirstRows.size());
+      for (long firstRow = 0; firstRow < mRows; firstRow += BlockRows)
+      {
+        float block[BlockRows] = {};
+        bool any = false;
+        for (long i = 0; i < BlockRows && firstRow + i < mRows; i++)
+        {
+          block[i] = dense(firstRow + i, col);
+          any = any || block[i] != 0.0f;
+        }
+        if (!any)
+          continue;
+        mFirstRows.push_back(firstRow);
+        mValues.insert(mValues.end(), block, block + BlockRows);
+      }
+    }
+    mColumnStarts.push_back(mFirstRows.size());
+  };
+
+  long rows() const { return mRows; };
+  long cols() const { return mCols; };
+  size_t GetNumBlocks() const { return mFirstRows.size(); };
+
+  // output += input * this^T, where `input` is frames x cols() and `output` is frames x rows()
+  void MultiplyAdd(const Eigen::MatrixXf& input, Eigen::MatrixXf& output) const
+  {
+    const long numFrames = input.rows();
+    for (long col = 0; col < mCols; col++)
+    {
+      const float* __restrict x = input.col(col).data();
+      for (size_t b = mColumnStarts[col]; b < mColumnStarts[col + 1]; b++)
+      {
+        const long firstRow = mFirstRows[b];
+        const float* v = mValues.data() + b * BlockRows;
+        for (long i = 0; i < BlockRows && firstRow + i < mRows; i++)
+        {
+          float* __restrict y = output.col(firstRow + i).data();
+          const float vi = v[i];
+          for (long frame = 0; frame < numFrames; frame++)
+            y[frame] += vi * x[frame];
+        }
+      }
+    }
+  };
+
+private:
+  long mRows = 0;
+  long mCols = 0;
+  // Into mFirstRows, for each column and one past the last
+  std::vector<size_t> mColumnStarts;
+  // Each block's first row, and its values
+  std::vector<long> mFirstRows;
+  std::vector<float> mValues;
+};
+}; // namespace pruning
@@ -0,0 +1,119 @@
+#pragma once
+
+// Where each matrix is in a model's flat weights.
+//
+// NAM core reads the weights in one pass in the order that its layers are built, so nothing in a .nam file says where
+// a layer's weights are: it's worked out from the config the same way. This is for the tools that work on the weights
+// without building the model (see Pruning.h and Prewarm.h). WaveNet (without a head) and LSTM models only.
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "NeuralAmpModelerCore/NAM/dsp.h"
+#include "NeuralAmpModelerCore/NAM/get_dsp.h"
+
+namespace weight_layout
+{
+// A weight matrix in a model's flat weights. Element (row, col) of tap k is at offset + (row * cols + col) * taps + k,
+// which is how NAM core reads both its convs (out, in, tap) and its dense matrices (taps = 1). Its bias, if it has one,
+// comes right after it.
+struct Matrix
+{
+  std::string name;
+  size_t offset = 0;
+  long rows = 0;
+  long cols = 0;
+  long taps = 1;
+  long biasSize = 0;
+
+  size_t GetSize() const { return (size_t)(rows * cols * taps); };
+  size_t GetIndex(const long row, const long col, const long tap) const
+  {
+    return offset + (size_t)((row * cols + col) * taps + tap);
+  };
+  size_t GetBiasOffset() const { return offset + GetSize(); };
+};
+
+namespace detail
+{
+// In NAM core's order (see wavenet.cpp: _LayerArray::set_weights_() and friends). Returns the number of weights read.
+inline size_t FindWaveNetMatrices(const nlohmann::json& config, std::vector<Matrix>& matrices)
+{
+  if (config.contains("head") && !config["head"].is_null())
+    throw std::runtime_error("WaveNet with a head isn't supported");
+  size_t offset = 0;
+  auto add = [&](const std::string& name, const long rows, const long cols, const long taps, const long biasSize) {
+    matrices.push_back({name, offset, rows, cols, taps, biasSize});
+    offset += (size_t)(rows * cols * taps + biasSize);
+  };
+  int arrayIndex = 0;
+  for (const auto& layerArray : config["layers"])
+  {
+    const long inputSize = layerArray["input_size"];
+    const long conditionSize = layerArray["condition_size"];
+    const long headSize = layerArray["head_size"];
+    const long channels = layerArray["channels"];
+    const long kernelSize = layerArray["kernel_size"];
+    const bool gated = layerArray["gated"];
+    const bool headBias = layerArray["head_bias"];
+    const long convOutChannels = gated ? 2 * channels : channels;
+    const std::string prefix = "layers[" + std::to_string(arrayIndex++) + "].";
+
+    add(prefix + "rechannel", channels, inputSize, 1, 0);
+    int layerIndex = 0;
+    for (size_t i = 0; i < layerArray["dilations"].size(); i++)
+    {
+      const std::string layer = prefix + "layer[" + std::to_string(layerIndex++) + "].";
+      add(layer + "conv", convOutChannels, channels, kernelSize, convOutChannels);
+      add(layer + "input_mixin", convOutChannels, conditionSize, 1, 0);
+      add(layer + "1x1", channels, channels, 1, channels);
+    }
+    add(prefix + "head_rechannel", headSize, channels, 1, headBias ? headSize : 0);
+  }
+  // Head scale
+  return offset + 1;
+}
+
+// See lstm.cpp: LSTMCell::set_weights_() and LSTM::set_weights_()
+inline size_t FindLSTMMatrices(const nlohmann::json& config, std::vector<Matrix>& matrices)
+{
+  const long numLayers = config["num_layers"];
+  const long inputSize = config["input_size"];
+  const long hiddenSize = config["hidden_size"];
+  size_t offset = 0;
+  for (long i = 0; i < numLayers; i++)
+  {
+    const long layerInputSize = i == 0 ? inputSize : hiddenSize;
+    matrices.push_back(
+      {"layer[" + std::to_string(i) + "].w", offset, 4 * hiddenSize, layerInputSize + hiddenSize, 1, 4 * hiddenSize});
+    // The matrix, the bias, and the initial hidden and cell states
+    offset += (size_t)(4 * hiddenSize * (layerInputSize + hiddenSize) + 4 * hiddenSize + 2 * hiddenSize);
+  }
+  // Head weights and bias
+  return offset + (size_t)hiddenSize + 1;
+}
+}; // namespace detail
+
+// The model's weight matrices in the order that NAM core reads them, or none if the architecture isn't supported or
+// the weights don't add up to what the config says (in which case we don't know where anything is).
+inline std::vector<Matrix> GetMatrices(const nam::dspData& data)
+{
+  std::vector<Matrix> matrices;
+  try
+  {
+    size_t numWeights = 0;
+    if (data.architecture == "WaveNet")
+      numWeights = detail::FindWaveNetMatrices(data.config, matrices);
+    else if (data.architecture == "LSTM")
+      numWeights = detail::FindLSTMMatrices(data.config, matrices);
+    if (numWeights != data.weights.size())
+      matrices.clear();
+  }
+  catch (const std::exception&)
+  {
+    matrices.clear();
+  }
+  return matrices;
+}
+}; // namespace weight_layout
@@ -0,0 +1,511 @@
+// Microbenchmarks for each building block of the chain.
+//
+// One case per block (tone stack, noise gate trigger and gain, IR at several lengths, resampler at common ratios, the
+// engine's kernels and activations for every CPU tier the machine supports, WaveNet's dilation history kept both
+// ways (see DilationHistory.h), and every model that ships in the repo at every activation accuracy), each run at
+// block sizes 16 to 4096. Output is CSV on stdout so that runs can be
+// diffed or loaded straight into a spreadsheet:
+//
+//   case,block_size,ns_per_sample,realtime_factor
+//
+// realtime_factor is how many times faster than real time the case runs at 48 kHz.
+//
+// Usage: nam-bench [--root <repo dir>] [--filter <substring>] [--seconds <per measurement (0.1)>]
+
+#include <algorithm> // std::copy, std::sort
+#include <chrono>
+#include <cmath> // sin, exp
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "AudioDSPTools/dsp/NoiseGate.h"
+#include "AudioDSPTools/dsp/ResamplingContainer/ResamplingContainer.h"
+#include "AudioDSPTools/dsp/dsp.h"
+
+#include "architecture.hpp" // disable_denormals
+#include "Activations.h"
+#include "CPUFeatures.h"
+#include "DSPKernels.h"
+#include "DilationHistory.h"
+#include "IRBlend.h"
+#include "ModelProfile.h"
+#include "NamFile.h"
+#include "ToneStack.h"
+
+#ifndef NAM_REPO_DIR
+  #define NAM_REPO_DIR "."
+#endif
+
+namespace
+{
+namespace fs = std::filesystem;
+
+const int kBlockSizes[] = {16, 32, 64, 128, 256, 512, 1024, 2048, 4096};
+const int kMaxBlockSize = 4096;
+const double kSampleRate = 48000.0;
+
+struct Options
+{
+  fs::path root = fs::u8path(NAM_REPO_DIR);
+  std::string filter;
+  double seconds = 0.1;
+};
+
+// Sets a case up for a block size; returns the function to time, which processes one block.
+using Setup = std::function<std::function<void()>(int blockSize)>;
+
+struct Case
+{
+  std::string name;
+  Setup setup;
+};
+
+// A guitar-ish test signal: a decaying tone plus a little noise
+std::vector<DSP_SAMPLE> MakeInput()
+{
+  std::vector<DSP_SAMPLE> input(kMaxBlockSize);
+  std::minstd_rand rng(0);
+  std::uniform_real_distribution<double> noise(-0.01, 0.01);
+  for (int s = 0; s < kMaxBlockSize; s++)
+    input[s] = 0.3 * sin(2.0 * 3.14159265358979 * 110.0 * s / kSampleRate) * exp(-s / kSampleRate) + noise(rng);
+  return input;
+}
+
+// Seconds per sample, after a short warm-up
+double Measure(const std::function<void()>& processBlock, const int blockSize, const double seconds)
+{
+  using Clock = std::chrono::steady_clock;
+  for (int i = 0; i < 8; i++)
+    processBlock();
+  long numSamples = 0;
+  double elapsed = 0.0;
+  const auto start = Clock::now();
+  while (elapsed < seconds)
+  {
+    processBlock();
+    numSamples += blockSize;
+    elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+  }
+  return elapsed / (double)numSamples;
+}
+
+// Each case owns its state through the closures so that nothing leaks between cases.
+struct Buffers
+{
+  std::vector<DSP_SAMPLE> input;
+  std::vector<DSP_SAMPLE> input2;
+  std::vector<DSP_SAMPLE> output;
+  DSP_SAMPLE* inputPointers[2];
+  DSP_SAMPLE* outputPointers[1];
+
+  Buffers()
+  : input(MakeInput())
+  , input2(MakeInput())
+  , output(kMaxBlockSize)
+  {
+    inputPointers[0] = input.data();
+    inputPointers[1] = input2.data();
+    outputPointers[0] = output.data();
+  };
+};
+
+void AddToneStackCase(std::vector<Case>& cases)
+{
+  cases.push_back({"tone_stack", [](const int blockSize) {
+                     auto buffers = std::make_shared<Buffers>();
+                     auto toneStack = std::make_shared<dsp::tone_stack::BasicNamToneStack>();
+                     toneStack->Reset(kSampleRate, blockSize);
+                     // Off-center so that every filter does some work
+                     toneStack->SetParam("bass", 7.0);
+                     toneStack->SetParam("middle", 3.0);
+                     toneStack->SetParam("treble", 6.0);
+                     return [buffers, toneStack, blockSize]() {
+                       toneStack->Process(buffers->inputPointers, 1, blockSize);
+                     };
+                   }});
+}
+
+std::shared_ptr<dsp::noise_gate::Trigger> MakeTrigger()
+{
+  auto trigger = std::make_shared<dsp::noise_gate::Trigger>();
+  trigger->SetSampleRate(kSampleRate);
+  // Same as the plugin, with the threshold where the test signal makes it open and close
+  trigger->SetParams(dsp::noise_gate::TriggerParams(0.01, -30.0, 0.1, 0.005, 0.01, 0.05));
+  return trigger;
+}
+
+void AddNoiseGateCases(std::vector<Case>& cases)
+{
+  cases.push_back({"noise_gate_trigger", [](const int blockSize) {
+                     auto buffers = std::make_shared<Buffers>();
+                     auto trigger = MakeTrigger();
+                     return [buffers, trigger, blockSize]() { trigger->Process(buffers->inputPointers, 1, blockSize); };
+                   }});
+  cases.push_back({"noise_gate_gain", [](const int blockSize) {
+                     auto buffers = std::make_shared<Buffers>();
+                     auto trigger = MakeTrigger();
+                     auto gain = std::make_shared<dsp::noise_gate::Gain>();
+                     trigger->AddListener(gain.get());
+                     // The gain applies whatever the trigger last computed, so one trigger pass sets it up.
+                     trigger->Process(buffers->inputPointers, 1, blockSize);
+                     return [buffers, trigger, gain, blockSize]() {
+                       gain->Process(buffers->inputPointers, 1, blockSize);
+                     };
+                   }});
+}
+
+void AddImpulseResponseCases(std::vector<Case>& cases)
+{
+  for (const int length : {256, 1024, 4096, 8192})
+  {
+    cases.push_back({"impulse_response_" + std::to_string(length), [length](const int blockSize) {
+                       auto buffers = std::make_shared<Buffers>();
+                       // Decaying noise, like a cab IR, in the chain's convolution (see IRBlend.h)
+                       std::vector<float> irData;
+                       std::minstd_rand rng(1);
+                       std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+                       for (int i = 0; i < length; i++)
+                         irData.push_back(noise(rng) * std::exp(-5.0f * i / length));
+                       auto ir = std::make_shared<ir_blend::Convolver>(irData, kSampleRate, length, blockSize, 1);
+                       return [buffers, ir, blockSize]() {
+                         ir->BeginBlock();
+                         ir->Process(0, buffers->input.data(), buffers->output.data(), blockSize);
+                       };
+                     }});
+  }
+}
+
+void AddResamplerCases(std::vector<Case>& cases)
+{
+  // Host rates around a 48k model
+  for (const double hostRate : {44100.0, 88200.0, 96000.0, 192000.0})
+  {
+    cases.push_back({"resampler_" + std::to_string((int)hostRate) + "_to_48000", [hostRate](const int blockSize) {
+                       using Resampler = dsp::ResamplingContainer<DSP_SAMPLE, 1, 12>;
+                       auto buffers = std::make_shared<Buffers>();
+                       auto resampler = std::make_shared<Resampler>(kSampleRate);
+                       resampler->Reset(hostRate, blockSize);
+                       // Just the resampling; the "model" is a copy.
+                       auto passThrough = [](DSP_SAMPLE** in, DSP_SAMPLE** out, int n) {
+                         std::copy(in[0], in[0] + n, out[0]);
+                       };
+                       return [buffers, resampler, passThrough, blockSize]() {
+                         resampler->ProcessBlock(buffers->inputPointers, buffers->outputPointers, blockSize, passThrough);
+                       };
+                     }});
+  }
+}
+
+// The engine's input, output, silence detection and IR kernels, for every tier that this machine can run
+void AddKernelCases(std::vector<Case>& cases)
+{
+  using cpu_features::Tier;
+  for (const Tier tier : {Tier::Generic, Tier::SSE2, Tier::AVX2, Tier::AVX512, Tier::NEON})
+  {
+    if (!cpu_features::detail::IsSupported(tier))
+      continue;
+    const dsp::kernels::KernelTable kernels = dsp::kernels::MakeKernelTable(tier);
+    if (kernels.tier != tier)
+      continue; // Not compiled in
+    const std::string suffix = std::string("[") + cpu_features::GetTierName(tier) + "]";
+    cases.push_back({"process_input_stereo" + suffix, [kernels](const int blockSize) {
+                       auto buffers = std::make_shared<Buffers>();
+                       return [buffers, kernels, blockSize]() {
+                         kernels.mixdown(buffers->inputPointers, 2, blockSize, 0.5, buffers->output.data());
+                       };
+                     }});
+    cases.push_back({"process_output" + suffix, [kernels](const int blockSize) {
+                       auto buffers = std::make_shared<Buffers>();
+                       return [buffers, kernels, blockSize]() {
+                         kernels.gain(buffers->input.data(), blockSize, 0.5, buffers->output.data());
+                       };
+                     }});
+    cases.push_back({"process_output_clamped" + suffix, [kernels](const int blockSize) {
+                       auto buffers = std::make_shared<Buffers>();
+                       return [buffers, kernels, blockSize]() {
+                         kernels.gainClamped(buffers->input.data(), blockSize, 0.5, -1.0, 1.0, buffers->output.data());
+                       };
+                     }});
+    cases.push_back({"detect_silence" + suffix, [kernels](const int blockSize) {
+                       auto buffers = std::make_shared<Buffers>();
+                       return [buffers, kernels, blockSize]() {
+                         buffers->output[0] = kernels.peak(buffers->input.data(), blockSize);
+                       };
+                     }});
+    cases.push_back({"impulse_response_2048" + suffix, [kernels](const int blockSize) {
+                       auto buffers = std::make_shared<Buffers>();
+                       auto table = std::make_shared<dsp::kernels::KernelTable>(kernels);
+                       const std::vector<float> ir(2048, 1.0f / 2048.0f);
+                       auto convolver =
+                         std::make_shared<ir_blend::Convolver>(ir, kSampleRate, ir.size(), blockSize, 1, table.get());
+                       return [buffers, table, convolver, blockSize]() {
+                         convolver->BeginBlock();
+                         convolver->Process(0, buffers->input.data(), buffers->output.data(), blockSize);
+                       };
+                     }});
+  }
+}
+
+// Activations (see Activations.h) for every tier that this machine can run, at every accuracy. Each block copies fresh
+// input in first, like the layer outputs that they're applied to in a model.
+void AddActivationCases(std::vector<Case>& cases)
+{
+  using cpu_features::Tier;
+  using dsp::activations::Accuracy;
+  for (const Tier tier : {Tier::Generic, Tier::SSE2, Tier::AVX2, Tier::AVX512, Tier::NEON})
+  {
+    if (!cpu_features::detail::IsSupported(tier))
+      continue;
+    for (const Accuracy accuracy : {Accuracy::Exact, Accuracy::Polynomial, Accuracy::Rational})
+    {
+      const dsp::activations::ActivationKernels kernels = dsp::activations::MakeActivationKernels(tier, accuracy);
+      if (kernels.tier != tier)
+        continue; // Not compiled in, or Exact (which is the same on every tier)
+      const std::string suffix = std::string("_") + dsp::activations::GetAccuracyName(accuracy) + "["
+                                 + cpu_features::GetTierName(tier) + "]";
+      const struct
+      {
+        const char* name;
+        void (*kernel)(float*, const long);
+      } functions[] = {{"activation_tanh", kernels.tanh},
+                       {"activation_sigmoid", kernels.sigmoid},
+                       {"activation_hardtanh", kernels.hardTanh},
+                       {"activation_relu", kernels.relu}};
+      for (const auto& f : functions)
+      {
+        cases.push_back({f.name + suffix, [kernel = f.kernel](const int blockSize) {
+                           // Model layers see bigger values than the DI
+                           const std::vector<DSP_SAMPLE> input = MakeInput();
+                           auto source = std::make_shared<std::vector<float>>(input.size());
+                           for (size_t s = 0; s < input.size(); s++)
+                             (*source)[s] = (float)(10.0 * input[s]);
+                           auto work = std::make_shared<std::vector<float>>(input.size());
+                           return [source, work, kernel, blockSize]() {
+                             std::copy(source->begin(), source->begin() + blockSize, work->begin());
+                             kernel(work->data(), blockSize);
+                           };
+                         }});
+      }
+    }
+  }
+}
+
+// The memory traffic of a standard WaveNet layer array's dilation history (kernel size 3, dilations 1 to 512): each
+// block is written to every layer's history and every tap of it is read back, with nothing else going on. "linear" is
+// how NAM core keeps it, a long buffer per layer that's rewound when it's used up; "ring" is DilationHistory.h.
+void AddHistoryCases(std::vector<Case>& cases)
+{
+  static constexpr long kKernelSize = 3;
+  const std::vector<long> dilations = {1, 2, 4, 8, 16, 32, 64, 128, 256, 512};
+  long receptiveField = 1;
+  for (const long d : dilations)
+    receptiveField += (kKernelSize - 1) * d;
+
+  struct State
+  {
+    long channels = 0;
+    std::vector<float> input;
+    std::vector<float> output;
+    // Linear
+    std::vector<std::vector<float>> buffers;
+    long bufferStart = 0;
+    // Ring
+    std::vector<dilation_history::History> histories;
+  };
+  auto makeState = [](const long channels, const int blockSize) {
+    auto state = std::make_shared<State>();
+    state->channels = channels;
+    std::minstd_rand rng(0);
+    std::uniform_real_distribution<float> noise(-0.1f, 0.1f);
+    state->input.resize(channels * blockSize);
+    for (auto& x : state->input)
+      x = noise(rng);
+    state->output.assign(channels * blockSize, 0.0f);
+    return state;
+  };
+  // Adds a contiguous run of a tap's frames into the output, from frame `firstFrame` on
+  auto readRun = [](State& state, const long firstFrame, const float* frames, const long numFrames) {
+    float* y = state.output.data() + firstFrame * state.channels;
+    for (long i = 0; i < numFrames * state.channels; i++)
+      y[i] += 0.5f * frames[i];
+  };
+
+  for (const long channels : {8L, 16L})
+  {
+    const std::string suffix = "[" + std::to_string(channels) + "ch]";
+    cases.push_back({"wavenet_history_linear" + suffix, [=](const int blockSize) {
+                       auto state = makeState(channels, blockSize);
+                       // As in NAM core's _LayerArray
+                       const long numColumns = model_profile::kWaveNetLayerBufferSize + receptiveField - 1;
+                       state->buffers.assign(dilations.size(), std::vector<float>(channels * numColumns, 0.0f));
+                       state->bufferStart = receptiveField - 1;
+                       return [state, blockSize, dilations, numColumns, receptiveField, readRun]() {
+                         const long c = state->channels;
+                         if (state->bufferStart + blockSize > numColumns)
+                         {
+                           // Rewind: copy each layer's lookback to the front.
+                           const long start = receptiveField - 1;
+                           for (size_t i = 0; i < dilations.size(); i++)
+                           {
+                             const long lookback = (kKernelSize - 1) * dilations[i];
+                             float* buffer = state->buffers[i].data();
+                             std::copy(buffer + (state->bufferStart - lookback) * c, buffer + state->bufferStart * c,
+                                       buffer + (start - lookback) * c);
+                           }
+                           state->bufferStart = start;
+                         }
+                         for (size_t i = 0; i < dilations.size(); i++)
+                         {
+                           float* buffer = state->buffers[i].data();
+                           std::copy(state->input.begin(), state->input.end(), buffer + state->bufferStart * c);
+                           for (long k = 0; k < kKernelSize; k++)
+                           {
+                             const long delay = (kKernelSize - 1 - k) * dilations[i];
+                             readRun(*state, 0, buffer + (state->bufferStart - delay) * c, blockSize);
+                           }
+                         }
+                         state->bufferStart += blockSize;
+                       };
+                     }});
+    cases.push_back({"wavenet_history_ring" + suffix, [=](const int blockSize) {
+                       auto state = makeState(channels, blockSize);
+                       state->histories.resize(dilations.size());
+                       for (size_t i = 0; i < dilations.size(); i++)
+                         state->histories[i].Reset(channels, (kKernelSize - 1) * dilations[i], blockSize);
+                       return [state, blockSize, dilations, readRun]() {
+                         for (size_t i = 0; i < dilations.size(); i++)
+                         {
+                           dilation_history::History& history = state->histories[i];
+                           history.Write(state->input.data(), blockSize);
+                           for (long k = 0; k < kKernelSize; k++)
+                           {
+                             history.ForEachRun((kKernelSize - 1 - k) * dilations[i], blockSize,
+                                                [&](const long firstFrame, const float* frames, const long numFrames) {
+                                                  readRun(*state, firstFrame, frames, numFrames);
+                                                });
+                           }
+                         }
+                       };
+                     }});
+  }
+}
+
+void AddModelCases(const fs::path& root, std::vector<Case>& cases)
+{
+  std::vector<fs::path> modelPaths;
+  const fs::path modelsDir = root / "Models";
+  if (fs::is_directory(modelsDir))
+    for (const auto& entry : fs::directory_iterator(modelsDir))
+      if (entry.is_directory())
+        modelPaths.push_back(entry.path());
+  if (fs::exists(root / "REAPER" / "model.nam"))
+    modelPaths.push_back(root / "REAPER" / "model.nam");
+  std::sort(modelPaths.begin(), modelPaths.end());
+
+  for (const auto& modelPath : modelPaths)
+  {
+    nam::dspData data;
+    try
+    {
+      nam_file::GetDSP(modelPath, data);
+    }
+    catch (const std::exception& e)
+    {
+      std::cerr << "Skipping " << modelPath.u8string() << ": " << e.what() << std::endl;
+      continue;
+    }
+    const std::string name = modelPath.filename() == "model.nam" ? modelPath.parent_path().filename().u8string()
+                                                                  : modelPath.filename().u8string();
+    using dsp::activations::Accuracy;
+    for (const Accuracy accuracy : {Accuracy::Exact, Accuracy::Polynomial, Accuracy::Rational})
+    {
+      const std::string caseName = "model_" + data.architecture + "_" + name + "["
+                                   + dsp::activations::GetAccuracyName(accuracy) + "]";
+      cases.push_back({caseName, [data, accuracy](const int blockSize) {
+                         auto buffers = std::make_shared<Buffers>();
+                         std::shared_ptr<nam::DSP> model;
+                         {
+                           dsp::activations::ScopedActivationAccuracy activationAccuracy(accuracy);
+                           model = nam_file::BuildDSP(data);
+                         }
+                         // At the model's own rate; resampling is its own case.
+                         const double modelRate =
+                           model->GetExpectedSampleRate() > 0.0 ? model->GetExpectedSampleRate() : kSampleRate;
+                         model->ResetAndPrewarm(modelRate, blockSize);
+                         return [buffers, model, blockSize]() {
+                           model->process(buffers->input.data(), buffers->output.data(), blockSize);
+                         };
+                       }});
+    }
+  }
+}
+
+bool ParseArgs(int argc, char* argv[], Options& options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--root" && hasValue)
+      options.root = fs::u8path(argv[++i]);
+    else if (arg == "--filter" && hasValue)
+      options.filter = argv[++i];
+    else if (arg == "--seconds" && hasValue)
+      options.seconds = std::atof(argv[++i]);
+    else
+    {
+      std::cerr << "Usage: " << argv[0] << " [--root <repo dir>] [--filter <substring>] [--seconds <s>]" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+}; // namespace
+
+int main(int argc, char* argv[])
+{
+  Options options;
+  if (!ParseArgs(argc, argv, options))
+    return 2;
+
+  std::vector<Case> cases;
+  AddToneStackCase(cases);
+  AddNoiseGateCases(cases);
+  AddImpulseResponseCases(cases);
+  AddResamplerCases(cases);
+  AddKernelCases(cases);
+  AddActivationCases(cases);
+  AddHistoryCases(cases);
+  AddModelCases(options.root, cases);
+
+  // Denormals would make the decaying tails in the filters and IRs dominate the timings.
+  disable_denormals();
+
+  std::cout << "case,block_size,ns_per_sample,realtime_factor" << std::endl;
+  for (const Case& c : cases)
+  {
+    if (!options.filter.empty() && c.name.find(options.filter) == std::string::npos)
+      continue;
+    for (const int blockSize : kBlockSizes)
+    {
+      try
+      {
+        const std::function<void()> processBlock = c.setup(blockSize);
+        const double secondsPerSample = Measure(processBlock, blockSize, options.seconds);
+        std::cout << c.name << "," << blockSize << "," << 1.0e9 * secondsPerSample << ","
+                  << 1.0 / (secondsPerSample * kSampleRate) << std::endl;
+      }
+      catch (const std::exception& e)
+      {
+        std::cerr << c.name << " at " << blockSize << ": " << e.what() << std::endl;
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,52 @@
+// Runs models on behalf of plugin instances in other processes (see RemoteInference.h and EngineDaemon.h).
+//
+// Start it, then start the host with NAM_REMOTE_ENGINE=1 (or NAM_REMOTE_ENGINE=<socket path> with --socket).
+//
+// Usage: nam-engined [--socket <path>]
+
+#include <atomic>
+#include <csignal>
+#include <iostream>
+#include <string>
+
+#include "EngineDaemon.h"
+
+namespace
+{
+std::atomic<bool> stopRequested = false;
+
+void RequestStop(int)
+{
+  stopRequested = true;
+}
+}; // namespace
+
+int main(int argc, char* argv[])
+{
+  std::string socketPath = remote::GetSocketPath();
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    if (arg == "--socket" && i + 1 < argc)
+      socketPath = argv[++i];
+    else
+    {
+      std::cerr << "Usage: " << argv[0] << " [--socket <path>]" << std::endl;
+      return 2;
+    }
+  }
+
+  std::signal(SIGINT, RequestStop);
+  std::signal(SIGTERM, RequestStop);
+
+  remote::Daemon daemon(socketPath);
+  std::string error;
+  if (!daemon.Listen(error))
+  {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  std::cout << "Listening at " << socketPath << std::endl;
+  daemon.Run(stopRequested);
+  return 0;
+}
@@ -0,0 +1,133 @@
+// Measures the cost of running a model out of process (see RemoteInference.h): how long a block takes to go to the
+// daemon and back, with a loopback "model" that costs nothing, at block sizes 16 to 1024. Output is CSV on stdout:
+//
+//   block_size,mean_us,p50_us,p99_us,max_us,misses
+//
+// Unless --socket is given, it forks its own daemon on a temporary socket. Exits with 1 if any block came back wrong.
+//
+// Usage: nam-ipc-bench [--socket <path of a running nam-engined>] [--blocks <per block size (2000)>]
+
+#include <algorithm> // std::sort
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "EngineDaemon.h"
+
+namespace
+{
+const int kBlockSizes[] = {16, 32, 64, 128, 256, 512, 1024};
+const double kSampleRate = 48000.0;
+
+// Forks a daemon listening at `socketPath`. Returns its pid.
+pid_t StartDaemon(const std::string& socketPath)
+{
+  const pid_t pid = fork();
+  if (pid != 0)
+    return pid;
+  std::atomic<bool> stop = false;
+  remote::Daemon daemon(socketPath);
+  std::string error;
+  if (!daemon.Listen(error))
+  {
+    std::cerr << error << std::endl;
+    _exit(1);
+  }
+  daemon.Run(stop);
+  _exit(0);
+}
+}; // namespace
+
+int main(int argc, char* argv[])
+{
+  std::string socketPath;
+  int numBlocks = 2000;
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    if (arg == "--socket" && i + 1 < argc)
+      socketPath = argv[++i];
+    else if (arg == "--blocks" && i + 1 < argc)
+      numBlocks = std::atoi(argv[++i]);
+    else
+    {
+      std::cerr << "Usage: " << argv[0] << " [--socket <path>] [--blocks <n>]" << std::endl;
+      return 2;
+    }
+  }
+
+  pid_t daemonPid = 0;
+  if (socketPath.empty())
+  {
+    socketPath = "/tmp/nam-ipc-bench-" + std::to_string(getpid()) + ".sock";
+    daemonPid = StartDaemon(socketPath);
+  }
+
+  // Give a forked daemon a moment to start listening.
+  std::unique_ptr<remote::RemoteDSP> model;
+  std::string error;
+  for (int attempt = 0; attempt < 50 && model == nullptr; attempt++)
+  {
+    model = remote::LoadModel("", dsp::activations::Accuracy::Exact, socketPath, error);
+    if (model == nullptr)
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  int status = 0;
+  if (model == nullptr)
+  {
+    std::cerr << error << std::endl;
+    status = 2;
+  }
+  else
+  {
+    // Measure the whole round trip, not the timeout.
+    model->SetTimeout(1.0);
+    std::cout << "block_size,mean_us,p50_us,p99_us,max_us,misses" << std::endl;
+    for (const int blockSize : kBlockSizes)
+    {
+      model->Reset(kSampleRate, blockSize);
+      std::vector<NAM_SAMPLE> input(blockSize), output(blockSize);
+      std::vector<double> times;
+      times.reserve(numBlocks);
+      const uint64_t missesBefore = model->GetNumMissedBlocks();
+      for (int block = 0; block < numBlocks; block++)
+      {
+        for (int i = 0; i < blockSize; i++)
+          input[i] = (NAM_SAMPLE)(block * blockSize + i);
+        const auto start = std::chrono::steady_clock::now();
+        model->process(input.data(), output.data(), blockSize);
+        times.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        if (output != input)
+          status = 1;
+        // Leave the time between blocks that a host would.
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+      }
+      std::sort(times.begin(), times.end());
+      double mean = 0.0;
+      for (const double t : times)
+        mean += t / times.size();
+      std::cout << blockSize << "," << mean << "," << times[times.size() / 2] << ","
+                << times[(size_t)(0.99 * (times.size() - 1))] << "," << times.back() << ","
+                << model->GetNumMissedBlocks() - missesBefore << std::endl;
+    }
+    if (status != 0)
+      std::cerr << "Output didn't match input" << std::endl;
+    model = nullptr;
+  }
+
+  if (daemonPid > 0)
+  {
+    kill(daemonPid, SIGKILL);
+    waitpid(daemonPid, nullptr, 0);
+    unlink(socketPath.c_str());
+  }
+  return status;
+}
@@ -0,0 +1,208 @@
+// Times model loading, from file to a ready nam::DSP, for every model that ships in the repo:
+//
+// * directory_core: legacy directories (Models/*) through NAM core's loader
+// * directory_fast: the same through LegacyModel.h
+// * nam_core: .nam files (REAPER/model.nam, and the directories converted to .nam in a temporary directory) through
+//   NAM core's loader
+// * nam_fast: the same through NamFile.h
+//
+// Output is CSV on stdout, with the peak heap use (above what's in use before the load) in KiB:
+//
+//   model,loader,mean_us,min_us,peak_kib
+//
+// Exits with 1 if a fast loader doesn't give exactly what NAM core's does.
+//
+// Usage: nam-load-bench [--root <repo dir>] [--repeats <per loader (50)>]
+
+#include <algorithm> // std::max, std::min
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "NeuralAmpModelerCore/NAM/get_dsp.h"
+
+#include "LegacyModel.h"
+#include "NamFile.h"
+
+#ifndef NAM_REPO_DIR
+  #define NAM_REPO_DIR "."
+#endif
+
+// Heap accounting for the peak_kib column. Each block carries its size in front of it.
+namespace
+{
+constexpr size_t kBlockHeader = alignof(std::max_align_t);
+size_t gHeapInUse = 0;
+size_t gHeapPeak = 0;
+}; // namespace
+
+void* operator new(std::size_t size)
+{
+  void* block = std::malloc(size + kBlockHeader);
+  if (block == nullptr)
+    throw std::bad_alloc();
+  *static_cast<size_t*>(block) = size;
+  gHeapInUse += size;
+  gHeapPeak = std::max(gHeapPeak, gHeapInUse);
+  return static_cast<char*>(block) + kBlockHeader;
+}
+
+void operator delete(void* pointer) noexcept
+{
+  if (pointer == nullptr)
+    return;
+  void* block = static_cast<char*>(pointer) - kBlockHeader;
+  gHeapInUse -= *static_cast<size_t*>(block);
+  std::free(block);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+  operator delete(pointer);
+}
+
+namespace
+{
+namespace fs = std::filesystem;
+
+void Time(const std::string& model, const std::string& loader, const int repeats, const std::function<void()>& load)
+{
+  double total = 0.0, best = std::numeric_limits<double>::max();
+  size_t peak = 0;
+  for (int r = 0; r < repeats; r++)
+  {
+    const size_t inUse = gHeapInUse;
+    gHeapPeak = inUse;
+    const auto start = std::chrono::steady_clock::now();
+    load();
+    const double elapsed =
+      std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    total += elapsed;
+    best = std::min(best, elapsed);
+    peak = std::max(peak, gHeapPeak - inUse);
+  }
+  std::cout << model << "," << loader << "," << total / repeats << "," << best << "," << peak / 1024 << std::endl;
+}
+
+bool IsSame(const nam::dspData& a, const nam::dspData& b)
+{
+  return a.version == b.version && a.architecture == b.architecture && a.config == b.config
+         && a.metadata == b.metadata && a.weights == b.weights && a.expected_sample_rate == b.expected_sample_rate;
+}
+
+// NAM core's loader, holding the lock that every model build takes (see Activations.h)
+void CoreGetDSP(const fs::path& path, nam::dspData& data)
+{
+  auto lock = dsp::activations::LockModelBuilding();
+  nam::get_dsp(path, data);
+}
+
+// Loads `path` both ways and times them. Returns false if they disagree or if either fails.
+bool Compare(const std::string& name, const std::string& format, const fs::path& path, const int repeats)
+{
+  nam::dspData coreData, fastData;
+  try
+  {
+    CoreGetDSP(path, coreData);
+    nam_file::GetDSP(path, fastData);
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << name << ": " << e.what() << std::endl;
+    return false;
+  }
+  const bool same = IsSame(coreData, fastData);
+  if (!same)
+    std::cerr << name << ": the " << format << " loaders disagree" << std::endl;
+
+  Time(name, format + "_core", repeats, [&]() {
+    nam::dspData data;
+    CoreGetDSP(path, data);
+  });
+  Time(name, format + "_fast", repeats, [&]() {
+    nam::dspData data;
+    nam_file::GetDSP(path, data);
+  });
+  return same;
+}
+
+// The directory's model in the current format
+void WriteNamFile(const nam::dspData& data, const fs::path& path)
+{
+  nlohmann::json j;
+  j["version"] = data.version;
+  j["architecture"] = data.architecture;
+  j["config"] = data.config;
+  j["metadata"] = data.metadata;
+  j["weights"] = data.weights;
+  if (data.expected_sample_rate > 0.0)
+    j["sample_rate"] = data.expected_sample_rate;
+  std::ofstream(path) << j;
+}
+}; // namespace
+
+int main(int argc, char* argv[])
+{
+  fs::path root = fs::u8path(NAM_REPO_DIR);
+  int repeats = 50;
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    if (arg == "--root" && i + 1 < argc)
+      root = fs::u8path(argv[++i]);
+    else if (arg == "--repeats" && i + 1 < argc)
+      repeats = std::max(1, std::atoi(argv[++i]));
+    else
+    {
+      std::cerr << "Usage: " << argv[0] << " [--root <repo dir>] [--repeats <n>]" << std::endl;
+      return 2;
+    }
+  }
+
+  std::vector<fs::path> directories;
+  if (fs::is_directory(root / "Models"))
+    for (const auto& entry : fs::directory_iterator(root / "Models"))
+      if (legacy_model::IsLegacyDirectory(entry.path()))
+        directories.push_back(entry.path());
+  std::sort(directories.begin(), directories.end());
+  const fs::path namFile = root / "REAPER" / "model.nam";
+  if (directories.empty() && !fs::exists(namFile))
+  {
+    std::cerr << "No models found under " << root.u8string() << std::endl;
+    return 2;
+  }
+
+  const fs::path tempDir = fs::temp_directory_path() / "nam-load-bench";
+  fs::create_directories(tempDir);
+  bool allSame = true;
+  std::cout << "model,loader,mean_us,min_us,peak_kib" << std::endl;
+  if (fs::exists(namFile))
+    allSame &= Compare("REAPER", "nam", namFile, repeats);
+  for (const fs::path& directory : directories)
+  {
+    const std::string name = directory.filename().u8string();
+    allSame &= Compare(name, "directory", directory, repeats);
+    nam::dspData data;
+    try
+    {
+      legacy_model::LoadDirectory(directory, data);
+    }
+    catch (const std::exception&)
+    {
+      continue;
+    }
+    const fs::path converted = tempDir / (name + ".nam");
+    WriteNamFile(data, converted);
+    allSame &= Compare(name, "nam", converted, repeats);
+  }
+  std::error_code error;
+  fs::remove_all(tempDir, error);
+  return allSame ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+// Prints what a model costs to run, the same numbers that the plugin shows in its settings page, plus what one
+// plugin instance running it holds in memory (no IR) at the given host settings.
+//
+// Usage: nam-profile <model.nam or legacy model directory> [sample rate] [block size]
+
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+
+#include "Engine.h"
+#include "NamFile.h"
+#include "ModelProfile.h"
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2 || argc > 4)
+  {
+    std::cerr << "Usage: " << argv[0] << " <model> [sample rate (48000)] [block size (64)]" << std::endl;
+    return 1;
+  }
+  const std::filesystem::path modelPath = std::filesystem::u8path(argv[1]);
+  const double sampleRate = argc > 2 ? std::atof(argv[2]) : 48000.0;
+  const int blockSize = argc > 3 ? std::atoi(argv[3]) : 64;
+
+  nam::dspData data;
+  try
+  {
+    nam_file::GetDSP(modelPath, data);
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << "Failed to load " << modelPath << ": " << e.what() << std::endl;
+    return 1;
+  }
+
+  model_profile::ModelProfile profile = model_profile::ProfileConfig(data);
+  // A bit longer than the plugin's since nobody's waiting on a GUI
+  model_profile::Benchmark(data, sampleRate, blockSize, profile, 1.0);
+
+  // One key per line so that it's easy to grep or parse
+  std::cout << "model: " << modelPath.u8string() << std::endl;
+  std::cout << "architecture: " << profile.architecture << std::endl;
+  std::cout << "parameters: " << profile.numParameters << std::endl;
+  std::cout << "macs_per_sample: " << profile.macsPerSample << std::endl;
+  if (profile.recurrent)
+    std::cout << "receptive_field: recurrent" << std::endl;
+  else
+    std::cout << "receptive_field: " << profile.receptiveField << std::endl;
+  std::cout << "state_bytes: " << profile.stateBytes << std::endl;
+  std::cout << "sample_rate: " << profile.hostSampleRate << std::endl;
+  std::cout << "block_size: " << profile.hostBlockSize << std::endl;
+  std::cout << "estimated_cpu_percent: " << 100.0 * profile.estimatedLoad << std::endl;
+
+  engine::Options instanceOptions;
+  instanceOptions.analyzeLoudness = false;
+  engine::Engine instance(instanceOptions);
+  instance.Reset(sampleRate, blockSize);
+  if (instance.StageModel(modelPath).empty())
+  {
+    instance.ApplyStaging();
+    const engine::MemoryReport memory = instance.GetMemoryReport();
+    std::cout << "memory_weights_bytes: " << memory.weights << std::endl;
+    std::cout << "memory_state_bytes: " << memory.state << std::endl;
+    std::cout << "memory_scratch_bytes: " << memory.scratch << std::endl;
+    std::cout << "memory_resampler_bytes: " << memory.resampler << std::endl;
+    std::cout << "memory_total_bytes: " << memory.Total() << std::endl;
+  }
+  if (profile.IsLikelyTooHeavy())
+    std::cout << "warning: model is unlikely to run in real time on this machine" << std::endl;
+  return 0;
+}
@@ -0,0 +1,315 @@
+// Prunes models (see Pruning.h) and reports what each capture loses in accuracy and would gain in speed.
+//
+// An excerpt of REAPER/Guitar DI.wav is rendered through each model, pruned and not. The error is the error-to-signal
+// ratio (ESR) of the pruned model's output against the original's, the same measure that NAM's trainer reports. The
+// speedup is how much faster the pruned matrices run with the block-sparse kernels than the original ones do dense
+// (Eigen, as NAM core runs them), on blocks of kKernelFrames frames. It's the layers' matrix work only, and NAM core
+// doesn't use the sparse kernels yet (they'd need its activations transposed), so the model as a whole still runs at
+// the same speed pruned or not.
+//
+// With --sparsity or --threshold, each model is pruned that much. Without either, the sparsest of 10%, 20%, ... 90%
+// that's within --max-esr is picked. A pruned model is only written (to --output, as <name>.pruned.nam) if its ESR is
+// within --max-esr.
+//
+// Prints a CSV line per capture:
+//
+//   capture,architecture,sparsity,esr,kernel_speedup,accepted
+//
+// Usage: nam-prune <model.nam or legacy model directory>... [options]
+//   --threshold <x>    Prune blocks whose weights are all under this
+//   --sparsity <f>     Prune this fraction of each matrix's blocks (0 to 1)
+//   --block-rows <n>   Output channels per block, 4 or 8 (default: 4)
+//   --max-esr <x>      Most error allowed against the original model (default: 0.001)
+//   --output <dir>     Write the accepted pruned models here
+//   --root <dir>       Repository root, for the DI (default: where this was built from)
+
+#include <algorithm> // std::max, std::min
+#include <chrono>
+#include <cstdlib> // std::atof, std::atoi
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "AudioDSPTools/dsp/wav.h"
+#include "NamFile.h"
+#include "Pruning.h"
+#include "WavIO.h"
+
+#ifndef NAM_REPO_DIR
+  #define NAM_REPO_DIR "."
+#endif
+
+namespace
+{
+namespace fs = std::filesystem;
+
+// Excerpt of the DI to render, in seconds. The first few seconds are mostly silence.
+const double kExcerptStart = 8.0;
+const double kExcerptDuration = 3.0;
+const int kRenderBlockSize = 256;
+// Frames per block for timing the kernels
+const long kKernelFrames = 64;
+// Sparsities to try, in order, when none is given
+const double kSearchSparsities[] = {0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9};
+
+struct Options
+{
+  std::vector<fs::path> models;
+  fs::path root = fs::u8path(NAM_REPO_DIR);
+  fs::path output;
+  pruning::Options pruning;
+  bool search = true;
+  double maxESR = 0.001;
+};
+
+bool ParseArgs(int argc, char* argv[], Options& options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--threshold" && hasValue)
+    {
+      options.pruning.threshold = std::atof(argv[++i]);
+      options.search = false;
+    }
+    else if (arg == "--sparsity" && hasValue)
+    {
+      options.pruning.sparsity = std::max(0.0, std::min(1.0, std::atof(argv[++i])));
+      options.search = false;
+    }
+    else if (arg == "--block-rows" && hasValue)
+      options.pruning.blockRows = std::atoi(argv[++i]);
+    else if (arg == "--max-esr" && hasValue)
+      options.maxESR = std::atof(argv[++i]);
+    else if (arg == "--output" && hasValue)
+      options.output = fs::u8path(argv[++i]);
+    else if (arg == "--root" && hasValue)
+      options.root = fs::u8path(argv[++i]);
+    else if (arg.compare(0, 2, "--") != 0)
+      options.models.push_back(fs::u8path(arg));
+    else
+    {
+      std::cerr << "Unknown or incomplete option: " << arg << std::endl;
+      return false;
+    }
+  }
+  if (options.pruning.blockRows != 4 && options.pruning.blockRows != 8)
+  {
+    std::cerr << "--block-rows must be 4 or 8" << std::endl;
+    return false;
+  }
+  return !options.models.empty();
+}
+
+std::vector<NAM_SAMPLE> Render(nam::DSP& model, const std::vector<NAM_SAMPLE>& input)
+{
+  const double sampleRate = model.GetExpectedSampleRate() > 0.0 ? model.GetExpectedSampleRate() : 48000.0;
+  model.ResetAndPrewarm(sampleRate, kRenderBlockSize);
+  std::vector<NAM_SAMPLE> in(input), output(input.size());
+  for (size_t s = 0; s < in.size(); s += kRenderBlockSize)
+    model.process(in.data() + s, output.data() + s, (int)std::min<size_t>(kRenderBlockSize, in.size() - s));
+  return output;
+}
+
+// Error-to-signal ratio of `output` against `reference`
+double GetESR(const std::vector<NAM_SAMPLE>& reference, const std::vector<NAM_SAMPLE>& output)
+{
+  double error = 0.0, signal = 0.0;
+  for (size_t i = 0; i < reference.size(); i++)
+  {
+    const double d = (double)output[i] - (double)reference[i];
+    error += d * d;
+    signal += (double)reference[i] * (double)reference[i];
+  }
+  return signal > 0.0 ? error / signal : (error > 0.0 ? std::numeric_limits<double>::infinity() : 0.0);
+}
+
+// Best seconds per call of `f` over a few runs of about 50 ms each
+template <typename F>
+double Time(F&& f)
+{
+  using Clock = std::chrono::steady_clock;
+  f(); // Warm up
+  double best = std::numeric_limits<double>::max();
+  for (int run = 0; run < 5; run++)
+  {
+    long calls = 0;
+    const auto start = Clock::now();
+    double elapsed = 0.0;
+    while (elapsed < 0.05)
+    {
+      f();
+      calls++;
+      elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    best = std::min(best, elapsed / (double)calls);
+  }
+  return best;
+}
+
+// How many times faster the pruned matrices run sparse than the original ones run dense
+template <int BlockRows>
+double MeasureKernelSpeedup(const nam::dspData& original, const nam::dspData& pruned,
+                            const std::vector<weight_layout::Matrix>& matrices)
+{
+  std::vector<Eigen::MatrixXf> dense, inputs, outputs, transposedInputs, transposedOutputs;
+  std::vector<pruning::BlockSparseMatrix<BlockRows>> sparse;
+  std::minstd_rand rng(0);
+  std::uniform_real_distribution<float> noise(-0.1f, 0.1f);
+  for (const weight_layout::Matrix& matrix : matrices)
+  {
+    for (long tap = 0; tap < matrix.taps; tap++)
+    {
+      dense.push_back(pruning::GetDense(original.weights, matrix, tap));
+      sparse.emplace_back(pruning::GetDense(pruned.weights, matrix, tap));
+      inputs.push_back(Eigen::MatrixXf::NullaryExpr(matrix.cols, kKernelFrames, [&]() { return noise(rng); }));
+      outputs.push_back(Eigen::MatrixXf::Zero(matrix.rows, kKernelFrames));
+      // The sparse kernels want them transposed (see BlockSparseMatrix).
+      transposedInputs.push_back(inputs.back().transpose());
+      transposedOutputs.push_back(outputs.back().transpose());
+    }
+  }
+  const double denseSeconds = Time([&]() {
+    for (size_t i = 0; i < dense.size(); i++)
+      outputs[i].noalias() += dense[i] * inputs[i];
+  });
+  const double sparseSeconds = Time([&]() {
+    for (size_t i = 0; i < sparse.size(); i++)
+      sparse[i].MultiplyAdd(transposedInputs[i], transposedOutputs[i]);
+  });
+  return sparseSeconds > 0.0 ? denseSeconds / sparseSeconds : 0.0;
+}
+
+bool WriteModel(const fs::path& path, const nam::dspData& data)
+{
+  nlohmann::json j;
+  j["version"] = data.version;
+  j["architecture"] = data.architecture;
+  j["config"] = data.config;
+  j["metadata"] = data.metadata;
+  j["weights"] = data.weights;
+  if (data.expected_sample_rate > 0.0)
+    j["sample_rate"] = data.expected_sample_rate;
+  std::ofstream file(path, std::ios::binary);
+  file << j.dump();
+  return (bool)file;
+}
+
+struct Trial
+{
+  nam::dspData data;
+  pruning::Result result;
+  double esr = 0.0;
+};
+
+Trial Try(const nam::dspData& original, const pruning::Options& options, const std::vector<NAM_SAMPLE>& input,
+          const std::vector<NAM_SAMPLE>& reference)
+{
+  Trial trial;
+  trial.data = original;
+  trial.result = pruning::Prune(trial.data, options);
+  std::unique_ptr<nam::DSP> model = nam_file::BuildDSP(trial.data);
+  trial.esr = GetESR(reference, Render(*model, input));
+  return trial;
+}
+}; // namespace
+
+int main(int argc, char* argv[])
+{
+  Options options;
+  if (!ParseArgs(argc, argv, options))
+  {
+    std::cerr << "Usage: " << argv[0]
+              << " <model>... [--threshold <x> | --sparsity <f>] [--block-rows 4|8] [--max-esr <x>] [--output <dir>]"
+                 " [--root <dir>]"
+              << std::endl;
+    return 2;
+  }
+
+  const fs::path diPath = options.root / "REAPER" / "Guitar DI.wav";
+  wav_io::WavReader di;
+  const auto loadResult = di.Open(diPath);
+  if (loadResult != dsp::wav::LoadReturnCode::SUCCESS)
+  {
+    std::cerr << "Failed to load " << diPath.u8string() << ": " << dsp::wav::GetMsgForLoadReturnCode(loadResult)
+              << std::endl;
+    return 2;
+  }
+  di.Seek((size_t)(kExcerptStart * di.GetSampleRate()));
+  std::vector<NAM_SAMPLE> input((size_t)(kExcerptDuration * di.GetSampleRate()));
+  input.resize(di.Read(input.data(), input.size()));
+  di.Close();
+
+  if (!options.output.empty())
+    fs::create_directories(options.output);
+
+  int numFailed = 0;
+  std::cout << "capture,architecture,sparsity,esr,kernel_speedup,accepted" << std::endl;
+  for (const fs::path& modelPath : options.models)
+  {
+    const std::string name = (fs::is_directory(modelPath) ? modelPath.filename() : modelPath.stem()).u8string();
+    try
+    {
+      nam::dspData original;
+      std::unique_ptr<nam::DSP> model = nam_file::GetDSP(modelPath, original);
+      const std::vector<weight_layout::Matrix> matrices = weight_layout::GetMatrices(original);
+      if (matrices.empty())
+      {
+        std::cerr << name << ": can't prune " << original.architecture << " models" << std::endl;
+        continue;
+      }
+      const std::vector<NAM_SAMPLE> reference = Render(*model, input);
+
+      Trial trial;
+      if (options.search)
+      {
+        // The error only grows with the sparsity (near enough), so stop at the first one that's too much.
+        pruning::Options searchOptions = options.pruning;
+        bool haveTrial = false;
+        for (const double sparsity : kSearchSparsities)
+        {
+          searchOptions.sparsity = sparsity;
+          Trial next = Try(original, searchOptions, input, reference);
+          if (haveTrial && next.esr > options.maxESR)
+            break;
+          trial = std::move(next);
+          haveTrial = true;
+          // Not even the lightest pruning is within it
+          if (trial.esr > options.maxESR)
+            break;
+        }
+      }
+      else
+        trial = Try(original, options.pruning, input, reference);
+
+      const double speedup = options.pruning.blockRows == 8
+                               ? MeasureKernelSpeedup<8>(original, trial.data, matrices)
+                               : MeasureKernelSpeedup<4>(original, trial.data, matrices);
+      const bool accepted = trial.esr <= options.maxESR;
+      std::cout << name << "," << original.architecture << "," << trial.result.GetSparsity() << "," << trial.esr << ","
+                << speedup << "," << (accepted ? 1 : 0) << std::endl;
+
+      if (accepted && !options.output.empty())
+      {
+        const fs::path outputPath = options.output / fs::u8path(name + ".pruned.nam");
+        if (!WriteModel(outputPath, trial.data))
+        {
+          std::cerr << "Failed to write " << outputPath.u8string() << std::endl;
+          numFailed++;
+        }
+      }
+    }
+    catch (const std::exception& e)
+    {
+      std::cerr << name << ": " << e.what() << std::endl;
+      numFailed++;
+    }
+  }
+  return numFailed > 0 ? 1 : 0;
+}
@@ -0,0 +1,487 @@
+// Golden-output and performance regression suite.
+//
+// Renders an excerpt of REAPER/Guitar DI.wav through the full chain (see Engine.h) with every model that ships
+// in the repo (Models/*, REAPER/model.nam), at several sample rates and block sizes. Then:
+//
+// * The output is compared with the stored golden output for that model and sample rate. It mustn't depend on the
+//   block size, so every block size is checked against the same file.
+// * The throughput (how many times faster than real time) is compared with the stored baseline for that case, and
+//   the run fails if it's dropped by more than --max-regression percent.
+// * Each model's state after NAM core's prewarm is compared with its steady state worked out from the weights (see
+//   Prewarm.h).
+//
+// * The host sends blocks twice as big as it said it would (see Engine::Process()). The output should still match the
+//   golden output, and the processed input left for metering mustn't be longer than the engine's buffers.
+//
+// Other sample rates just play the same samples at that rate; it's the resampling path that we're checking, not the
+// music.
+//
+// Usage: nam-regress [options]
+//   --root <dir>            Repository root (default: where this was built from)
+//   --golden <dir>          Golden outputs (default: tools/regression/golden)
+//   --baseline <file>       Throughput baseline (default: tools/regression/baseline.txt)
+//   --tolerance <x>         Max absolute difference from the golden output (default: 1e-4)
+//   --max-regression <pct>  Max throughput drop against the baseline, in percent (default: 10)
+//   --repeats <n>           Timed passes per case; the best one counts (default: 3)
+//   --update                Write the golden outputs instead of checking them
+//   --update-baseline       Write the throughput baseline instead of checking it
+//
+// Golden outputs should be regenerated (and the diff listened to!) whenever the chain changes on purpose, and
+// committed along with the change. A case without a golden output fails, unless --update is given. The throughput
+// baseline only means something on the machine that made it, so generate it on the machine that runs the suite; cases
+// without one are reported as "skip". A run where every case was skipped fails too, since it checked no throughput.
+//
+// To generate both from the bundled models: cmake --build build-tools --target regress-update
+
+#include <algorithm> // std::max, std::min
+#include <chrono>
+#include <cmath> // fabs
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "AudioDSPTools/dsp/wav.h"
+#include "Activations.h"
+#include "Engine.h"
+#include "NamFile.h"
+#include "Prewarm.h"
+#include "WavIO.h"
+
+#ifndef NAM_REPO_DIR
+  #define NAM_REPO_DIR "."
+#endif
+
+namespace
+{
+namespace fs = std::filesystem;
+
+const double kSampleRates[] = {44100.0, 48000.0, 96000.0};
+const int kBlockSizes[] = {32, 128, 1024};
+// Excerpt of the DI to use, in seconds. The first few seconds are mostly silence.
+const double kExcerptStart = 8.0;
+const double kExcerptDuration = 3.0;
+// Max block size announced in Reset() for the oversize block check; the blocks are twice that.
+const int kOversizeCheckBlockSize = 128;
+
+struct Options
+{
+  fs::path root = fs::u8path(NAM_REPO_DIR);
+  fs::path golden;
+  fs::path baseline;
+  double tolerance = 1.0e-4;
+  double maxRegressionPercent = 10.0;
+  int repeats = 3;
+  bool update = false;
+  bool updateBaseline = false;
+};
+
+struct Case
+{
+  std::string name; // Model name
+  fs::path modelPath;
+};
+
+bool ParseArgs(int argc, char* argv[], Options& options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--root" && hasValue)
+      options.root = fs::u8path(argv[++i]);
+    else if (arg == "--golden" && hasValue)
+      options.golden = fs::u8path(argv[++i]);
+    else if (arg == "--baseline" && hasValue)
+      options.baseline = fs::u8path(argv[++i]);
+    else if (arg == "--tolerance" && hasValue)
+      options.tolerance = std::atof(argv[++i]);
+    else if (arg == "--max-regression" && hasValue)
+      options.maxRegressionPercent = std::atof(argv[++i]);
+    else if (arg == "--repeats" && hasValue)
+      options.repeats = std::max(1, std::atoi(argv[++i]));
+    else if (arg == "--update")
+      options.update = true;
+    else if (arg == "--update-baseline")
+      options.updateBaseline = true;
+    else
+    {
+      std::cerr << "Unknown or incomplete option: " << arg << std::endl;
+      return false;
+    }
+  }
+  const fs::path regressionDir = options.root / "NeuralAmpModeler" / "tools" / "regression";
+  if (options.golden.empty())
+    options.golden = regressionDir / "golden";
+  if (options.baseline.empty())
+    options.baseline = regressionDir / "baseline.txt";
+  return true;
+}
+
+std::vector<Case> FindCases(const fs::path& root)
+{
+  std::vector<Case> cases;
+  const fs::path modelsDir = root / "Models";
+  if (fs::is_directory(modelsDir))
+    for (const auto& entry : fs::directory_iterator(modelsDir))
+      if (entry.is_directory())
+        cases.push_back({entry.path().filename().u8string(), entry.path()});
+  const fs::path reaperModel = root / "REAPER" / "model.nam";
+  if (fs::exists(reaperModel))
+    cases.push_back({"REAPER_model", reaperModel});
+  std::sort(cases.begin(), cases.end(), [](const Case& a, const Case& b) { return a.name < b.name; });
+  return cases;
+}
+
+std::string CaseName(const Case& c, const double sampleRate, const int blockSize)
+{
+  std::ostringstream ss;
+  ss << c.name << "@" << (int)sampleRate << "/" << blockSize;
+  return ss.str();
+}
+
+fs::path GoldenPath(const Options& options, const Case& c, const double sampleRate)
+{
+  return options.golden / (c.name + "_" + std::to_string((int)sampleRate) + ".f32");
+}
+
+// Raw little-endian float32; these are only ever read by this program.
+bool ReadGolden(const fs::path& path, std::vector<float>& samples)
+{
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file)
+    return false;
+  const std::streamsize numBytes = file.tellg();
+  file.seekg(0);
+  samples.resize((size_t)numBytes / sizeof(float));
+  return (bool)file.read(reinterpret_cast<char*>(samples.data()), samples.size() * sizeof(float));
+}
+
+bool WriteGolden(const fs::path& path, const std::vector<DSP_SAMPLE>& samples)
+{
+  fs::create_directories(path.parent_path());
+  std::vector<float> out(samples.begin(), samples.end());
+  std::ofstream file(path, std::ios::binary);
+  return (bool)file.write(reinterpret_cast<const char*>(out.data()), out.size() * sizeof(float));
+}
+
+std::map<std::string, double> ReadBaseline(const fs::path& path)
+{
+  std::map<std::string, double> baseline;
+  std::ifstream file(path);
+  std::string line;
+  while (std::getline(file, line))
+  {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream ss(line);
+    std::string name;
+    double realtimeFactor = 0.0;
+    if (ss >> name >> realtimeFactor)
+      baseline[name] = realtimeFactor;
+  }
+  return baseline;
+}
+
+bool WriteBaseline(const fs::path& path, const std::map<std::string, double>& baseline)
+{
+  fs::create_directories(path.parent_path());
+  std::ofstream file(path);
+  file << "# <model>@<sample rate>/<block size> <times faster than real time>" << std::endl;
+  for (const auto& entry : baseline)
+    file << entry.first << " " << entry.second << std::endl;
+  return (bool)file;
+}
+
+// Renders `input` through the chain in blocks. The output is aligned with the input (the chain's latency is
+// removed) so that cases with different latencies can be compared.
+// Returns the seconds that the processing took.
+double Render(engine::Engine& chain, const std::vector<DSP_SAMPLE>& input, const int blockSize,
+              std::vector<DSP_SAMPLE>& output)
+{
+  const int latency = chain.GetLatency();
+  const size_t numFrames = input.size() + latency;
+  std::vector<DSP_SAMPLE> padded(input);
+  padded.resize(numFrames, 0.0);
+  std::vector<DSP_SAMPLE> rendered(numFrames);
+
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t s = 0; s < numFrames; s += blockSize)
+  {
+    const size_t n = std::min<size_t>(blockSize, numFrames - s);
+    DSP_SAMPLE* inputPointers[] = {padded.data() + s};
+    DSP_SAMPLE* outputPointers[] = {rendered.data() + s};
+    chain.Process(inputPointers, 1, outputPointers, 1, n);
+  }
+  const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  output.assign(rendered.begin() + latency, rendered.end());
+  return elapsed;
+}
+
+// A host that breaks its promise: Reset() with one max block size, then blocks of twice that. Process() should take
+// them in pieces with the same result as blocks that fit.
+// Returns false if it failed.
+bool CheckOversizeBlocks(const Case& c, const double sampleRate, const std::vector<DSP_SAMPLE>& input,
+                         const fs::path& goldenPath, const double tolerance)
+{
+  const std::string name = CaseName(c, sampleRate, 2 * kOversizeCheckBlockSize) + " (max " +
+                           std::to_string(kOversizeCheckBlockSize) + ")";
+  std::vector<float> golden;
+  if (!ReadGolden(goldenPath, golden))
+  {
+    std::cout << "FAIL " << name << ": no golden output at " << goldenPath.u8string() << " (run with --update)"
+              << std::endl;
+    return false;
+  }
+  std::vector<DSP_SAMPLE> output;
+  engine::Options chainOptions;
+  chainOptions.analyzeLoudness = false;
+  engine::Engine chain(chainOptions);
+  chain.Reset(sampleRate, kOversizeCheckBlockSize);
+  const std::string error = chain.StageModel(c.modelPath);
+  if (!error.empty())
+  {
+    std::cout << "FAIL " << name << ": " << error << std::endl;
+    return false;
+  }
+  chain.ApplyStaging();
+  Render(chain, input, 2 * kOversizeCheckBlockSize, output);
+
+  if (chain.GetProcessedInputFrames() > (size_t)chain.GetMaxBlockSize())
+  {
+    std::cout << "FAIL " << name << ": " << chain.GetProcessedInputFrames()
+              << " frames of processed input, more than the max block size" << std::endl;
+    return false;
+  }
+  if (golden.size() != output.size())
+  {
+    std::cout << "FAIL " << name << ": length " << output.size() << " != golden " << golden.size() << std::endl;
+    return false;
+  }
+  double maxError = 0.0;
+  for (size_t s = 0; s < output.size(); s++)
+    maxError = std::max(maxError, fabs(output[s] - (double)golden[s]));
+  const bool failed = maxError > tolerance;
+  std::cout << (failed ? "FAIL " : "ok   ") << name << ": max error " << maxError << std::endl;
+  return !failed;
+}
+
+// What NAM core's prewarm leaves the model in, against the steady state worked out from its weights (see Prewarm.h):
+// right after prewarming, the output on silence should be the steady state's. Also says how long each one took.
+// Returns false if it failed.
+bool CheckPrewarm(const Case& c, const double tolerance)
+{
+  using Clock = std::chrono::steady_clock;
+  const std::string name = c.name + "/prewarm";
+  try
+  {
+    nam::dspData data;
+    std::unique_ptr<nam::DSP> model;
+    {
+      // The steady state is worked out with the exact activations.
+      dsp::activations::ScopedActivationAccuracy accuracy(dsp::activations::Accuracy::Exact);
+      model = nam_file::GetDSP(c.modelPath, data);
+    }
+    auto start = Clock::now();
+    const prewarm::SteadyState steadyState = prewarm::GetSteadyState(data);
+    const double steadyStateSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (!steadyState.known)
+    {
+      std::cout << "skip " << name << ": no steady state for " << data.architecture << " models like this one"
+                << std::endl;
+      return true;
+    }
+
+    const double sampleRate = model->GetExpectedSampleRate() > 0.0 ? model->GetExpectedSampleRate() : 48000.0;
+    const int blockSize = 64;
+    start = Clock::now();
+    model->ResetAndPrewarm(sampleRate, blockSize);
+    const double prewarmSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::vector<NAM_SAMPLE> silence(blockSize, (NAM_SAMPLE)0), output(blockSize);
+    model->process(silence.data(), output.data(), blockSize);
+    double maxError = 0.0;
+    for (const NAM_SAMPLE x : output)
+      maxError = std::max(maxError, fabs((double)x - steadyState.output));
+
+    const bool failed = maxError > tolerance;
+    std::cout << (failed ? "FAIL " : "ok   ") << name << ": max error " << maxError << "; prewarm "
+              << 1000.0 * prewarmSeconds << " ms, steady state " << 1000.0 * steadyStateSeconds << " ms ("
+              << steadyState.numSamples << " samples to settle)" << std::endl;
+    return !failed;
+  }
+  catch (const std::exception& e)
+  {
+    std::cout << "FAIL " << name << ": " << e.what() << std::endl;
+    return false;
+  }
+}
+}; // namespace
+
+int main(int argc, char* argv[])
+{
+  Options options;
+  if (!ParseArgs(argc, argv, options))
+    return 2;
+
+  const fs::path diPath = options.root / "REAPER" / "Guitar DI.wav";
+  // Only the excerpt is decoded.
+  wav_io::WavReader di;
+  const auto loadResult = di.Open(diPath);
+  if (loadResult != dsp::wav::LoadReturnCode::SUCCESS)
+  {
+    std::cerr << "Failed to load " << diPath.u8string() << ": " << dsp::wav::GetMsgForLoadReturnCode(loadResult)
+              << std::endl;
+    return 2;
+  }
+  di.Seek((size_t)(kExcerptStart * di.GetSampleRate()));
+  std::vector<DSP_SAMPLE> input((size_t)(kExcerptDuration * di.GetSampleRate()));
+  input.resize(di.Read(input.data(), input.size()));
+  di.Close();
+
+  const std::vector<Case> cases = FindCases(options.root);
+  if (cases.empty())
+  {
+    std::cerr << "No models found under " << options.root.u8string() << std::endl;
+    return 2;
+  }
+
+  const std::map<std::string, double> baseline = ReadBaseline(options.baseline);
+  std::map<std::string, double> newBaseline;
+  int numFailures = 0, numSkipped = 0, numCases = 0;
+
+  for (const Case& c : cases)
+  {
+    for (const double sampleRate : kSampleRates)
+    {
+      const fs::path goldenPath = GoldenPath(options, c, sampleRate);
+      std::vector<float> golden;
+      const bool haveGolden = !options.update && ReadGolden(goldenPath, golden);
+      bool wroteGolden = false;
+
+      for (const int blockSize : kBlockSizes)
+      {
+        const std::string name = CaseName(c, sampleRate, blockSize);
+        std::vector<DSP_SAMPLE> output;
+        double bestSeconds = 0.0;
+        try
+        {
+          for (int r = 0; r < options.repeats; r++)
+          {
+            // Fresh state each pass so that every pass renders the same thing. A loudness analysis finishing
+            // partway through would change the gain, so the goldens are without it.
+            engine::Options chainOptions;
+            chainOptions.analyzeLoudness = false;
+            engine::Engine chain(chainOptions);
+            chain.Reset(sampleRate, blockSize);
+            const std::string error = chain.StageModel(c.modelPath);
+            if (!error.empty())
+              throw std::runtime_error(error);
+            chain.ApplyStaging();
+            const double seconds = Render(chain, input, blockSize, output);
+            bestSeconds = r == 0 ? seconds : std::min(bestSeconds, seconds);
+          }
+        }
+        catch (const std::exception& e)
+        {
+          std::cout << "FAIL " << name << ": " << e.what() << std::endl;
+          numFailures++;
+          continue;
+        }
+        const double realtimeFactor = ((double)input.size() / sampleRate) / std::max(bestSeconds, 1.0e-9);
+        newBaseline[name] = realtimeFactor;
+
+        // Output
+        std::string outputResult = "ok";
+        bool outputFailed = false;
+        // No baseline to compare with
+        bool skipped = false;
+        if (options.update)
+        {
+          if (!wroteGolden)
+          {
+            wroteGolden = WriteGolden(goldenPath, output);
+            outputResult = wroteGolden ? "updated" : "FAILED TO WRITE " + goldenPath.u8string();
+            outputFailed = !wroteGolden;
+          }
+        }
+        else if (!haveGolden)
+        {
+          outputResult = "no golden output at " + goldenPath.u8string() + " (run with --update)";
+          outputFailed = true;
+        }
+        else if (golden.size() != output.size())
+        {
+          outputResult = "length " + std::to_string(output.size()) + " != golden " + std::to_string(golden.size());
+          outputFailed = true;
+        }
+        else
+        {
+          double maxError = 0.0;
+          for (size_t s = 0; s < output.size(); s++)
+            maxError = std::max(maxError, fabs(output[s] - (double)golden[s]));
+          std::ostringstream ss;
+          ss << "max error " << maxError;
+          outputResult = ss.str();
+          outputFailed = maxError > options.tolerance;
+        }
+
+        // Throughput
+        std::ostringstream perfResult;
+        perfResult << realtimeFactor << "x real time";
+        bool perfFailed = false;
+        const auto it = baseline.find(name);
+        if (!options.updateBaseline && it != baseline.end())
+        {
+          const double change = 100.0 * (realtimeFactor / it->second - 1.0);
+          perfResult << " (" << (change >= 0.0 ? "+" : "") << change << "% vs baseline)";
+          perfFailed = change < -options.maxRegressionPercent;
+        }
+        else if (!options.updateBaseline)
+        {
+          perfResult << " (no baseline; run with --update-baseline)";
+          skipped = true;
+        }
+
+        const bool failed = outputFailed || perfFailed;
+        numCases++;
+        numFailures += failed ? 1 : 0;
+        numSkipped += !failed && skipped ? 1 : 0;
+        std::cout << (failed ? "FAIL " : skipped ? "skip " : "ok   ") << name << ": " << outputResult << "; "
+                  << perfResult.str() << std::endl;
+      }
+
+      numFailures += CheckOversizeBlocks(c, sampleRate, input, goldenPath, options.tolerance) ? 0 : 1;
+    }
+  }
+
+  for (const Case& c : cases)
+    numFailures += CheckPrewarm(c, options.tolerance) ? 0 : 1;
+
+  if (options.updateBaseline)
+  {
+    if (!WriteBaseline(options.baseline, newBaseline))
+    {
+      std::cerr << "Failed to write " << options.baseline.u8string() << std::endl;
+      return 1;
+    }
+    std::cout << "Wrote " << options.baseline.u8string() << std::endl;
+  }
+
+  // Writing the goldens or the baseline isn't a check, so nothing counts as skipped then.
+  const bool allSkipped = numCases > 0 && numSkipped == numCases && !options.update && !options.updateBaseline;
+  if (allSkipped)
+    std::cout << "Every case was skipped for want of a baseline, so no throughput was checked" << std::endl;
+  else
+    std::cout << (numFailures == 0 ? "All cases passed" : std::to_string(numFailures) + " case(s) failed");
+  if (!allSkipped && numSkipped > 0)
+    std::cout << " (" << numSkipped << " skipped for want of a baseline)";
+  std::cout << std::endl;
+  return numFailures == 0 && !allSkipped ? 0 : 1;
+}
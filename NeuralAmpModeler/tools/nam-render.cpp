@@ -0,0 +1,185 @@
+// Renders a WAV file through the full chain (see Engine.h), the way the plugin would with its knobs at the defaults.
+//
+// Reading and writing both stream (see WavIO.h), so memory use doesn't depend on the length of the file. Multichannel
+// input is mixed down to mono like the plugin does. The output is aligned with the input (the chain's latency is
+// removed) and has the same length.
+//
+// Up to four IRs are blended (see IRBlend.h); --ir-gain and --ir-delay apply to the --ir before them.
+//
+// Usage: nam-render --model <.nam> [--ir <.wav> [--ir-gain <dB>] [--ir-delay <ms>]]... [--block <size (512)>]
+//                   [--format pcm16|pcm24|float32 (float32)] <input.wav> <output.wav>
+
+#include <algorithm> // std::min
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Engine.h"
+#include "WavIO.h"
+
+namespace
+{
+namespace fs = std::filesystem;
+
+void PrintUsage(const char* name)
+{
+  std::cerr << "Usage: " << name
+            << " --model <.nam> [--ir <.wav> [--ir-gain <dB>] [--ir-delay <ms>]]... [--block <size>]"
+               " [--format pcm16|pcm24|float32] <input.wav> <output.wav>"
+            << std::endl;
+}
+
+struct IROption
+{
+  fs::path path;
+  double gainDB = 0.0;
+  double delayMs = 0.0;
+};
+}; // namespace
+
+int main(int argc, char* argv[])
+{
+  fs::path modelPath, inputPath, outputPath;
+  std::vector<IROption> irs;
+  int blockSize = 512;
+  wav_io::SampleFormat format = wav_io::SampleFormat::Float32;
+  std::vector<std::string> positional;
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    if (arg == "--model" && i + 1 < argc)
+      modelPath = fs::u8path(argv[++i]);
+    else if (arg == "--ir" && i + 1 < argc && (int)irs.size() < ir_blend::kMaxIRs)
+      irs.push_back({fs::u8path(argv[++i])});
+    else if (arg == "--ir-gain" && i + 1 < argc && !irs.empty())
+      irs.back().gainDB = std::atof(argv[++i]);
+    else if (arg == "--ir-delay" && i + 1 < argc && !irs.empty())
+      irs.back().delayMs = std::atof(argv[++i]);
+    else if (arg == "--block" && i + 1 < argc)
+      blockSize = std::atoi(argv[++i]);
+    else if (arg == "--format" && i + 1 < argc)
+    {
+      const std::string name = argv[++i];
+      if (name == "pcm16")
+        format = wav_io::SampleFormat::PCM16;
+      else if (name == "pcm24")
+        format = wav_io::SampleFormat::PCM24;
+      else if (name == "float32")
+        format = wav_io::SampleFormat::Float32;
+      else
+      {
+        PrintUsage(argv[0]);
+        return 2;
+      }
+    }
+    else if (!arg.empty() && arg[0] != '-')
+      positional.push_back(arg);
+    else
+    {
+      PrintUsage(argv[0]);
+      return 2;
+    }
+  }
+  if (modelPath.empty() || positional.size() != 2 || blockSize <= 0)
+  {
+    PrintUsage(argv[0]);
+    return 2;
+  }
+  inputPath = fs::u8path(positional[0]);
+  outputPath = fs::u8path(positional[1]);
+
+  wav_io::WavReader reader;
+  const dsp::wav::LoadReturnCode readResult = reader.Open(inputPath);
+  if (readResult != dsp::wav::LoadReturnCode::SUCCESS)
+  {
+    std::cerr << "Failed to open " << inputPath.u8string() << ": " << dsp::wav::GetMsgForLoadReturnCode(readResult)
+              << std::endl;
+    return 1;
+  }
+  const double sampleRate = reader.GetSampleRate();
+
+  // Loudness is worked out up front (below) rather than in the background so that it's the same from start to end.
+  engine::Options chainOptions;
+  chainOptions.analyzeLoudness = false;
+  engine::Engine chain(chainOptions);
+  // Offline, so there's no reason to trade accuracy for speed.
+  chain.SetActivationAccuracy(dsp::activations::Accuracy::Exact);
+  chain.Reset(sampleRate, blockSize);
+  nam::dspData modelData;
+  const std::string modelError = chain.StageModel(modelPath, &modelData);
+  if (!modelError.empty())
+  {
+    std::cerr << "Failed to load " << modelPath.u8string() << ": " << modelError << std::endl;
+    return 1;
+  }
+  for (int slot = 0; slot < (int)irs.size(); slot++)
+  {
+    chain.SetIRGain(slot, irs[slot].gainDB);
+    chain.SetIRDelay(slot, irs[slot].delayMs);
+    const dsp::wav::LoadReturnCode irResult = chain.StageIR(irs[slot].path, slot);
+    if (irResult != dsp::wav::LoadReturnCode::SUCCESS)
+    {
+      std::cerr << "Failed to load " << irs[slot].path.u8string() << ": "
+                << dsp::wav::GetMsgForLoadReturnCode(irResult) << std::endl;
+      return 1;
+    }
+  }
+  chain.ApplyStaging();
+  if (!chain.GetModel()->HasLoudness() && !modelData.architecture.empty())
+  {
+    loudness::BackgroundAnalyzer analyzer;
+    double modelLoudness = 0.0;
+    if (analyzer.Analyze(modelData, modelLoudness))
+    {
+      chain.SetModelLoudness(modelLoudness);
+      loudness::Calibration& calibration = analyzer.GetCalibration();
+      std::cerr << "Analyzed loudness: " << modelLoudness << " dB";
+      if (calibration.GetNumModels() < loudness::Calibration::kMinModels)
+        std::cerr << " (not calibrated yet)" << std::endl;
+      else
+        std::cerr << " (typically within " << calibration.GetSpread() << " dB of the trainer's)" << std::endl;
+    }
+  }
+
+  wav_io::WavWriter writer;
+  if (!writer.Open(outputPath, sampleRate, 1, format))
+  {
+    std::cerr << "Failed to open " << outputPath.u8string() << " for writing" << std::endl;
+    return 1;
+  }
+
+  // Feed silence past the end of the file to flush the latency out.
+  const size_t numFrames = reader.GetNumFrames();
+  size_t toSkip = (size_t)chain.GetLatency();
+  size_t written = 0;
+  std::vector<DSP_SAMPLE> buffer(blockSize);
+  const auto start = std::chrono::steady_clock::now();
+  while (written < numFrames)
+  {
+    const size_t numRead = reader.Read(buffer.data(), buffer.size());
+    std::fill(buffer.begin() + numRead, buffer.end(), (DSP_SAMPLE)0);
+    DSP_SAMPLE* pointers[] = {buffer.data()};
+    chain.Process(pointers, 1, pointers, 1, buffer.size());
+    const size_t skipped = std::min(toSkip, buffer.size());
+    toSkip -= skipped;
+    const size_t toWrite = std::min(buffer.size() - skipped, numFrames - written);
+    if (!writer.Write(buffer.data() + skipped, toWrite))
+    {
+      std::cerr << "Failed to write " << outputPath.u8string() << std::endl;
+      return 1;
+    }
+    written += toWrite;
+  }
+  const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (!writer.Close())
+  {
+    std::cerr << "Failed to write " << outputPath.u8string() << std::endl;
+    return 1;
+  }
+  std::cout << "Rendered " << numFrames / sampleRate << " s in " << elapsed << " s ("
+            << numFrames / sampleRate / elapsed << "x real time)" << std::endl;
+  return 0;
+}
@@ -0,0 +1,221 @@
+// Replays a black box recording (see BlackBox.h) through the headless chain: the same input, block sizes, settings and
+// model/IR swaps as the plugin saw, to reproduce a click or a spike.
+//
+// Prints a CSV line per block on stdout:
+//
+//   block,frames,deadline_ms,recorded_ms,replayed_ms
+//
+// and how many blocks went over their deadline, when recorded and when replayed, on stderr. With --paced, each block
+// starts at the same time after the first as it did when it was recorded, so the gaps between blocks (and what they do
+// to the caches) are reproduced too.
+//
+// The models and IRs are loaded from the paths that were recorded. --model and --ir load these instead, for a
+// recording from another machine.
+//
+// Usage: nam-replay <recording.nambb> [--model <path>] [--ir <path>] [--paced] [--output <wav>]
+
+#include <algorithm> // std::fill, std::max
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BlackBox.h"
+#include "Engine.h"
+#include "WavIO.h"
+
+namespace
+{
+namespace fs = std::filesystem;
+
+struct Options
+{
+  fs::path recording;
+  fs::path model;
+  fs::path ir;
+  fs::path output;
+  bool paced = false;
+};
+
+bool ParseArgs(int argc, char* argv[], Options& options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    if (arg == "--model" && i + 1 < argc)
+      options.model = fs::u8path(argv[++i]);
+    else if (arg == "--ir" && i + 1 < argc)
+      options.ir = fs::u8path(argv[++i]);
+    else if (arg == "--output" && i + 1 < argc)
+      options.output = fs::u8path(argv[++i]);
+    else if (arg == "--paced")
+      options.paced = true;
+    else if (options.recording.empty() && arg.compare(0, 2, "--") != 0)
+      options.recording = fs::u8path(arg);
+    else
+      return false;
+  }
+  return !options.recording.empty();
+}
+
+// Returns false if a model or IR didn't load.
+bool ApplyStaging(const black_box::Staging& staging, const Options& options, engine::Engine& chain)
+{
+  using Type = black_box::Staging::Type;
+  switch (staging.type)
+  {
+    case Type::Model:
+    {
+      const fs::path path = options.model.empty() ? staging.path : options.model;
+      chain.SetActivationAccuracy((dsp::activations::Accuracy)staging.accuracy);
+      const std::string error = chain.StageModel(path);
+      if (!error.empty())
+      {
+        std::cerr << "Failed to load " << path.u8string() << ": " << error << std::endl;
+        return false;
+      }
+      return true;
+    }
+    case Type::ClearModel: chain.ClearModel(); return true;
+    case Type::IR:
+    {
+      const fs::path path = options.ir.empty() ? staging.path : options.ir;
+      const dsp::wav::LoadReturnCode result = chain.StageIR(path);
+      if (result != dsp::wav::LoadReturnCode::SUCCESS)
+      {
+        std::cerr << "Failed to load " << path.u8string() << ": " << dsp::wav::GetMsgForLoadReturnCode(result)
+                  << std::endl;
+        return false;
+      }
+      return true;
+    }
+    case Type::ClearIR: chain.ClearIR(); return true;
+    default: return true;
+  }
+}
+}; // namespace
+
+int main(int argc, char* argv[])
+{
+  Options options;
+  if (!ParseArgs(argc, argv, options))
+  {
+    std::cerr << "Usage: " << argv[0]
+              << " <recording.nambb> [--model <path>] [--ir <path>] [--paced] [--output <wav>]" << std::endl;
+    return 2;
+  }
+
+  black_box::Recording recording;
+  const std::string error = recording.Read(options.recording);
+  if (!error.empty())
+  {
+    std::cerr << error << std::endl;
+    return 2;
+  }
+  if (recording.events.empty() || recording.events.front().type != black_box::Event::Type::Format)
+  {
+    std::cerr << options.recording.u8string() << " doesn't start with a keyframe" << std::endl;
+    return 2;
+  }
+
+  // The plugin's own setup
+  engine::Engine chain;
+  wav_io::WavWriter writer;
+  const double firstTime = recording.events.front().time;
+  const auto replayStart = std::chrono::steady_clock::now();
+  double sampleRate = 0.0;
+  size_t nextStaging = 0;
+  int numBlocks = 0, numRecordedOver = 0, numReplayedOver = 0, numUnrecorded = 0;
+  double maxRecorded = 0.0, maxReplayed = 0.0;
+  std::vector<DSP_SAMPLE> silence, left, right;
+
+  std::cout << "block,frames,deadline_ms,recorded_ms,replayed_ms" << std::endl;
+  for (const black_box::Event& event : recording.events)
+  {
+    switch (event.type)
+    {
+      case black_box::Event::Type::Format:
+        if (event.b == 1 || sampleRate == 0.0)
+        {
+          sampleRate = event.value;
+          chain.Reset(sampleRate, (int)event.a);
+          if (!options.output.empty() && !writer.IsOpen()
+              && !writer.Open(options.output, sampleRate, 1, wav_io::SampleFormat::Float32))
+          {
+            std::cerr << "Failed to open " << options.output.u8string() << " for writing" << std::endl;
+            return 1;
+          }
+        }
+        break;
+      case black_box::Event::Type::Setting:
+        black_box::ApplySetting(chain, (black_box::Setting)event.a, event.value);
+        break;
+      case black_box::Event::Type::Block:
+      {
+        // Staging that went live at the start of this block
+        for (; nextStaging < recording.stagings.size() && recording.stagings[nextStaging].block <= event.block;
+             nextStaging++)
+        {
+          if (!ApplyStaging(recording.stagings[nextStaging], options, chain))
+            return 1;
+        }
+
+        const size_t numFrames = event.a;
+        const DSP_SAMPLE* audio = recording.GetAudio(event);
+        const size_t numChannels = audio != nullptr ? event.b : 1;
+        if (audio == nullptr)
+        {
+          silence.assign(numFrames, (DSP_SAMPLE)0);
+          audio = silence.data();
+          numUnrecorded++;
+        }
+        // The plugin processes in place, so work on a copy.
+        std::vector<DSP_SAMPLE> inputs(audio, audio + numChannels * numFrames);
+        DSP_SAMPLE* inputPointers[black_box::kMaxChannels];
+        for (size_t c = 0; c < numChannels; c++)
+          inputPointers[c] = inputs.data() + c * numFrames;
+        left.resize(numFrames);
+        right.resize(numFrames);
+        DSP_SAMPLE* outputPointers[] = {left.data(), right.data()};
+
+        if (options.paced)
+        {
+          const auto due = replayStart + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                           std::chrono::duration<double>(event.time - firstTime));
+          std::this_thread::sleep_until(due);
+        }
+        const auto start = std::chrono::steady_clock::now();
+        chain.Process(inputPointers, numChannels, outputPointers, 2, numFrames);
+        const double replayed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        const double deadline = (double)numFrames / sampleRate;
+        numBlocks++;
+        numRecordedOver += event.value > deadline ? 1 : 0;
+        numReplayedOver += replayed > deadline ? 1 : 0;
+        maxRecorded = std::max(maxRecorded, event.value);
+        maxReplayed = std::max(maxReplayed, replayed);
+        std::cout << event.block << "," << numFrames << "," << 1000.0 * deadline << "," << 1000.0 * event.value << ","
+                  << 1000.0 * replayed << "\n";
+        if (writer.IsOpen() && !writer.Write(left.data(), numFrames))
+        {
+          std::cerr << "Failed to write " << options.output.u8string() << std::endl;
+          return 1;
+        }
+        break;
+      }
+      default: break;
+    }
+  }
+  if (writer.IsOpen() && !writer.Close())
+  {
+    std::cerr << "Failed to write " << options.output.u8string() << std::endl;
+    return 1;
+  }
+
+  std::cerr << numBlocks << " blocks (" << numUnrecorded << " without audio); over the deadline: " << numRecordedOver
+            << " recorded (max " << 1000.0 * maxRecorded << " ms), " << numReplayedOver << " replayed (max "
+            << 1000.0 * maxReplayed << " ms)" << std::endl;
+  return 0;
+}
@@ -0,0 +1,148 @@
+// Wall-clock cost of a rig (see Engine.h) as branches are added, with the branches run one after another and in
+// parallel (see engine::Options::parallelBranches).
+//
+// Every branch runs the same model on REAPER/Guitar DI.wav (looped). Output is CSV on stdout:
+//
+//   branches,parallel,block,load_percent
+//
+// load_percent is the time that Process() took relative to the audio's duration. With enough cores, the parallel
+// rows should stay close to the single-branch one.
+//
+// Usage: nam-rig-bench [--root <repo dir>] [--model <.nam (REAPER/model.nam)>] [--seconds <of audio (10)>]
+//                      [--block <size (64)>]
+
+#include <algorithm> // std::min
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Engine.h"
+#include "WavIO.h"
+
+#ifndef NAM_REPO_DIR
+  #define NAM_REPO_DIR "."
+#endif
+
+namespace
+{
+namespace fs = std::filesystem;
+
+const double kSampleRate = 48000.0;
+
+struct Options
+{
+  fs::path root = fs::u8path(NAM_REPO_DIR);
+  fs::path model;
+  double seconds = 10.0;
+  int blockSize = 64;
+};
+
+bool ParseArgs(int argc, char* argv[], Options& options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    if (arg == "--root" && i + 1 < argc)
+      options.root = fs::u8path(argv[++i]);
+    else if (arg == "--model" && i + 1 < argc)
+      options.model = fs::u8path(argv[++i]);
+    else if (arg == "--seconds" && i + 1 < argc)
+      options.seconds = std::atof(argv[++i]);
+    else if (arg == "--block" && i + 1 < argc)
+      options.blockSize = std::atoi(argv[++i]);
+    else
+      return false;
+  }
+  if (options.model.empty())
+    options.model = options.root / "REAPER" / "model.nam";
+  return options.seconds > 0.0 && options.blockSize > 0;
+}
+
+// Returns the seconds that processing took, or a negative number if the model didn't load.
+double Run(const Options& options, const std::vector<DSP_SAMPLE>& di, const int numBranches, const bool parallel)
+{
+  engine::Options chainOptions;
+  chainOptions.analyzeLoudness = false;
+  chainOptions.bypassSilence = false;
+  chainOptions.parallelBranches = parallel;
+  engine::Engine chain(chainOptions);
+  chain.Reset(kSampleRate, options.blockSize);
+  for (int branch = 0; branch < numBranches; branch++)
+  {
+    const std::string error = chain.StageBranchModel(branch, options.model);
+    if (!error.empty())
+    {
+      std::cerr << "Failed to load " << options.model.u8string() << ": " << error << std::endl;
+      return -1.0;
+    }
+  }
+  chain.ApplyStaging();
+  if (parallel && numBranches > 1 && !chain.IsRunningBranchesInParallel())
+    std::cerr << "Branches aren't running in parallel (one core, or blocks over "
+              << pipeline::kMaxParallelBlockSize << " samples)" << std::endl;
+
+  const size_t numFrames = (size_t)(options.seconds * kSampleRate);
+  std::vector<DSP_SAMPLE> input(options.blockSize), output(options.blockSize);
+  double elapsed = 0.0;
+  for (size_t s = 0; s < numFrames; s += options.blockSize)
+  {
+    const size_t n = std::min<size_t>(options.blockSize, numFrames - s);
+    for (size_t i = 0; i < n; i++)
+      input[i] = di[(s + i) % di.size()];
+    DSP_SAMPLE* inputPointers[] = {input.data()};
+    DSP_SAMPLE* outputPointers[] = {output.data()};
+    const auto start = std::chrono::steady_clock::now();
+    chain.Process(inputPointers, 1, outputPointers, 1, n);
+    elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+  return elapsed;
+}
+}; // namespace
+
+int main(int argc, char* argv[])
+{
+  Options options;
+  if (!ParseArgs(argc, argv, options))
+  {
+    std::cerr << "Usage: " << argv[0] << " [--root <repo dir>] [--model <.nam>] [--seconds <s>] [--block <size>]"
+              << std::endl;
+    return 2;
+  }
+
+  const fs::path diPath = options.root / "REAPER" / "Guitar DI.wav";
+  wav_io::WavReader reader;
+  const dsp::wav::LoadReturnCode result = reader.Open(diPath);
+  if (result != dsp::wav::LoadReturnCode::SUCCESS)
+  {
+    std::cerr << "Failed to open " << diPath.u8string() << ": " << dsp::wav::GetMsgForLoadReturnCode(result)
+              << std::endl;
+    return 2;
+  }
+  std::vector<DSP_SAMPLE> di(reader.GetNumFrames());
+  di.resize(reader.Read(di.data(), di.size()));
+  if (di.empty())
+  {
+    std::cerr << diPath.u8string() << " is empty" << std::endl;
+    return 2;
+  }
+
+  std::cout << "branches,parallel,block,load_percent" << std::endl;
+  for (int numBranches = 1; numBranches <= engine::kMaxModelBranches; numBranches++)
+  {
+    for (const bool parallel : {false, true})
+    {
+      // Nothing to run in parallel
+      if (parallel && numBranches == 1)
+        continue;
+      const double elapsed = Run(options, di, numBranches, parallel);
+      if (elapsed < 0.0)
+        return 1;
+      std::cout << numBranches << "," << (parallel ? "on" : "off") << "," << options.blockSize << ","
+                << 100.0 * elapsed / options.seconds << std::endl;
+    }
+  }
+  return 0;
+}
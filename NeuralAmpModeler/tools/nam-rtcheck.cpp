@@ -0,0 +1,162 @@
+// Drives the engine through the things that tend to glitch in production, with the real-time sanitizer watching every
+// block (see RealtimeSanitizer.h):
+//
+// * Model swaps (alternating between every model that ships in the repo)
+// * IR swaps
+// * Parameter automation on every block, the way a host delivers it on the audio thread
+// * Resets to other sample rates and block sizes, and blocks shorter than the max
+//
+// Every violation is printed with a stack trace as it happens. Exits with 1 if there were any.
+//
+// Usage: nam-rtcheck [--root <repo dir>] [--blocks <number of blocks (5000)>]
+
+#include <algorithm> // std::sort
+#include <cmath> // sin, exp
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Engine.h"
+#include "RealtimeSanitizer.h"
+
+#ifndef NAM_RT_SANITIZER
+  #error "nam-rtcheck needs to be built with NAM_RT_SANITIZER"
+#endif
+
+#ifndef NAM_REPO_DIR
+  #define NAM_REPO_DIR "."
+#endif
+
+namespace
+{
+namespace fs = std::filesystem;
+
+struct HostSettings
+{
+  double sampleRate;
+  int maxBlockSize;
+};
+
+// What the host might switch between
+const HostSettings kHostSettings[] = {{48000.0, 64}, {44100.0, 256}, {96000.0, 32}, {48000.0, 1024}};
+const int kBlocksPerModelSwap = 150;
+const int kBlocksPerIRSwap = 110;
+const int kBlocksPerReset = 1000;
+
+std::vector<fs::path> FindModels(const fs::path& root)
+{
+  std::vector<fs::path> models;
+  const fs::path modelsDir = root / "Models";
+  if (fs::is_directory(modelsDir))
+    for (const auto& entry : fs::directory_iterator(modelsDir))
+      if (entry.is_directory())
+        models.push_back(entry.path());
+  if (fs::exists(root / "REAPER" / "model.nam"))
+    models.push_back(root / "REAPER" / "model.nam");
+  std::sort(models.begin(), models.end());
+  return models;
+}
+
+dsp::ImpulseResponse::IRData MakeIR(const int length, const unsigned int seed)
+{
+  dsp::ImpulseResponse::IRData irData;
+  irData.mRawAudioSampleRate = 48000.0;
+  std::minstd_rand rng(seed);
+  std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+  for (int i = 0; i < length; i++)
+    irData.mRawAudio.push_back(noise(rng) * std::exp(-5.0f * i / length));
+  return irData;
+}
+}; // namespace
+
+int main(int argc, char* argv[])
+{
+  fs::path root = fs::u8path(NAM_REPO_DIR);
+  int numBlocks = 5000;
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    if (arg == "--root" && i + 1 < argc)
+      root = fs::u8path(argv[++i]);
+    else if (arg == "--blocks" && i + 1 < argc)
+      numBlocks = std::atoi(argv[++i]);
+    else
+    {
+      std::cerr << "Usage: " << argv[0] << " [--root <repo dir>] [--blocks <n>]" << std::endl;
+      return 2;
+    }
+  }
+
+  const std::vector<fs::path> models = FindModels(root);
+  if (models.empty())
+  {
+    std::cerr << "No models found under " << root.u8string() << std::endl;
+    return 2;
+  }
+
+  const int maxBlockSize = 1024;
+  std::vector<DSP_SAMPLE> input(maxBlockSize), output(maxBlockSize);
+  std::minstd_rand rng(0);
+  std::uniform_int_distribution<int> blockSizeJitter(0, 3);
+  size_t phase = 0;
+
+  engine::Engine chain;
+  size_t hostSettingsIndex = 0;
+  HostSettings host = kHostSettings[0];
+  chain.Reset(host.sampleRate, host.maxBlockSize);
+  size_t modelIndex = 0;
+  chain.StageModel(models[0]);
+  unsigned int irSeed = 0;
+
+  for (int block = 0; block < numBlocks; block++)
+  {
+    // Things that happen on other threads, between blocks
+    if (block > 0 && block % kBlocksPerReset == 0)
+    {
+      hostSettingsIndex = (hostSettingsIndex + 1) % (sizeof(kHostSettings) / sizeof(kHostSettings[0]));
+      host = kHostSettings[hostSettingsIndex];
+      std::cout << "Reset: " << host.sampleRate << " Hz, " << host.maxBlockSize << " samples" << std::endl;
+      chain.Reset(host.sampleRate, host.maxBlockSize);
+    }
+    if (block > 0 && block % kBlocksPerModelSwap == 0)
+    {
+      modelIndex = (modelIndex + 1) % models.size();
+      std::cout << "Model: " << models[modelIndex].u8string() << std::endl;
+      chain.StageModel(models[modelIndex]);
+    }
+    if (block % kBlocksPerIRSwap == 0)
+    {
+      const int irLength = (irSeed % 2 == 0) ? 2048 : 8192;
+      std::cout << "IR: " << irLength << " samples" << std::endl;
+      chain.StageIR(MakeIR(irLength, irSeed++));
+    }
+
+    // Hosts sometimes send less than the max
+    const int numFrames = blockSizeJitter(rng) == 0 ? std::max(1, host.maxBlockSize / 3) : host.maxBlockSize;
+    for (int s = 0; s < numFrames; s++, phase++)
+      input[s] = 0.3 * sin(2.0 * 3.14159265358979 * 110.0 * phase / host.sampleRate);
+
+    {
+      NAM_RT_SANITIZER_SCOPE("ProcessBlock");
+      // Automation arrives on the audio thread in most hosts.
+      chain.SetNoiseGateThreshold(-80.0 + 20.0 * (block % 100) / 100.0);
+      chain.SetBass(5.0 + 4.0 * sin(0.01 * block));
+      chain.SetTreble(5.0 - 4.0 * sin(0.013 * block));
+      chain.SetInputLevel(3.0 * sin(0.007 * block));
+      chain.SetOutputMode((engine::OutputMode)((block / 400) % 3));
+      chain.SetNoiseGateActive((block / 500) % 2 == 0);
+      chain.SetToneStackActive((block / 700) % 2 == 0);
+      chain.SetIRActive((block / 300) % 3 != 0);
+      DSP_SAMPLE* inputPointers[] = {input.data()};
+      DSP_SAMPLE* outputPointers[] = {output.data()};
+      chain.Process(inputPointers, 1, outputPointers, 1, numFrames);
+    }
+  }
+
+  const size_t numViolations = rt_sanitizer::GetNumViolations();
+  std::cout << numBlocks << " blocks, " << numViolations << " real-time safety violation(s)" << std::endl;
+  return numViolations == 0 ? 0 : 1;
+}
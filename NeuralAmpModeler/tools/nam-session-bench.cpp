@@ -0,0 +1,153 @@
+// CPU for a session's worth of plugin instances, most of them on idle tracks.
+//
+// Every instance runs the same model. The active ones play REAPER/Guitar DI.wav (looped); the rest get digital
+// silence, like tracks with nothing on them at that point in the song. Each configuration is run with and without the
+// silence bypass (see engine::Options::bypassSilence). Output is CSV on stdout:
+//
+//   bypass,tracks,active,load_percent
+//
+// load_percent is the time spent processing relative to the audio's duration, i.e. how much of one core the session
+// would take.
+//
+// Usage: nam-session-bench [--root <repo dir>] [--model <.nam (REAPER/model.nam)>] [--tracks <n (50)>]
+//                          [--active <n (5)>] [--seconds <of audio (10)>] [--block <size (256)>]
+
+#include <algorithm> // std::min
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Engine.h"
+#include "WavIO.h"
+
+#ifndef NAM_REPO_DIR
+  #define NAM_REPO_DIR "."
+#endif
+
+namespace
+{
+namespace fs = std::filesystem;
+
+const double kSampleRate = 48000.0;
+
+struct Options
+{
+  fs::path root = fs::u8path(NAM_REPO_DIR);
+  fs::path model;
+  int tracks = 50;
+  int active = 5;
+  double seconds = 10.0;
+  int blockSize = 256;
+};
+
+bool ParseArgs(int argc, char* argv[], Options& options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    if (arg == "--root" && i + 1 < argc)
+      options.root = fs::u8path(argv[++i]);
+    else if (arg == "--model" && i + 1 < argc)
+      options.model = fs::u8path(argv[++i]);
+    else if (arg == "--tracks" && i + 1 < argc)
+      options.tracks = std::atoi(argv[++i]);
+    else if (arg == "--active" && i + 1 < argc)
+      options.active = std::atoi(argv[++i]);
+    else if (arg == "--seconds" && i + 1 < argc)
+      options.seconds = std::atof(argv[++i]);
+    else if (arg == "--block" && i + 1 < argc)
+      options.blockSize = std::atoi(argv[++i]);
+    else
+      return false;
+  }
+  if (options.model.empty())
+    options.model = options.root / "REAPER" / "model.nam";
+  return options.tracks > 0 && options.active >= 0 && options.active <= options.tracks && options.seconds > 0.0
+         && options.blockSize > 0;
+}
+
+// Returns the seconds that processing took, or a negative number if the model didn't load.
+double Run(const Options& options, const std::vector<DSP_SAMPLE>& di, const bool bypassSilence)
+{
+  std::vector<std::unique_ptr<engine::Engine>> chains;
+  for (int t = 0; t < options.tracks; t++)
+  {
+    engine::Options chainOptions;
+    chainOptions.analyzeLoudness = false;
+    chainOptions.bypassSilence = bypassSilence;
+    auto chain = std::make_unique<engine::Engine>(chainOptions);
+    chain->Reset(kSampleRate, options.blockSize);
+    const std::string error = chain->StageModel(options.model);
+    if (!error.empty())
+    {
+      std::cerr << "Failed to load " << options.model.u8string() << ": " << error << std::endl;
+      return -1.0;
+    }
+    chain->ApplyStaging();
+    chains.push_back(std::move(chain));
+  }
+
+  const size_t numFrames = (size_t)(options.seconds * kSampleRate);
+  std::vector<DSP_SAMPLE> input(options.blockSize), silence(options.blockSize, 0.0), output(options.blockSize);
+  double elapsed = 0.0;
+  for (size_t s = 0; s < numFrames; s += options.blockSize)
+  {
+    const size_t n = std::min<size_t>(options.blockSize, numFrames - s);
+    for (size_t i = 0; i < n; i++)
+      input[i] = di[(s + i) % di.size()];
+    const auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < options.tracks; t++)
+    {
+      DSP_SAMPLE* inputPointers[] = {t < options.active ? input.data() : silence.data()};
+      DSP_SAMPLE* outputPointers[] = {output.data()};
+      chains[t]->Process(inputPointers, 1, outputPointers, 1, n);
+    }
+    elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+  return elapsed;
+}
+}; // namespace
+
+int main(int argc, char* argv[])
+{
+  Options options;
+  if (!ParseArgs(argc, argv, options))
+  {
+    std::cerr << "Usage: " << argv[0]
+              << " [--root <repo dir>] [--model <.nam>] [--tracks <n>] [--active <n>] [--seconds <s>] [--block <size>]"
+              << std::endl;
+    return 2;
+  }
+
+  const fs::path diPath = options.root / "REAPER" / "Guitar DI.wav";
+  wav_io::WavReader reader;
+  const dsp::wav::LoadReturnCode result = reader.Open(diPath);
+  if (result != dsp::wav::LoadReturnCode::SUCCESS)
+  {
+    std::cerr << "Failed to open " << diPath.u8string() << ": " << dsp::wav::GetMsgForLoadReturnCode(result)
+              << std::endl;
+    return 2;
+  }
+  std::vector<DSP_SAMPLE> di(reader.GetNumFrames());
+  di.resize(reader.Read(di.data(), di.size()));
+  if (di.empty())
+  {
+    std::cerr << diPath.u8string() << " is empty" << std::endl;
+    return 2;
+  }
+
+  std::cout << "bypass,tracks,active,load_percent" << std::endl;
+  for (const bool bypassSilence : {false, true})
+  {
+    const double elapsed = Run(options, di, bypassSilence);
+    if (elapsed < 0.0)
+      return 1;
+    std::cout << (bypassSilence ? "on" : "off") << "," << options.tracks << "," << options.active << ","
+              << 100.0 * elapsed / options.seconds << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,157 @@
+// A top-style view of every plugin instance on the machine (for this user), from the telemetry that they publish (see
+// Telemetry.h). Sorted by average load, heaviest first.
+//
+// Columns: process, slot, model hash, architecture, sample rate, block size, flags (R: resampling, I: idle (silent
+// input), P: pipelined, G: rig), average/max load (percent of the buffer's duration), the pipeline worker's average
+// load, average/max time per ProcessBlock() (ms), blocks that overran their deadline, black box recordings written
+// (and "/n" if n couldn't be, see BlackBox.h), steps of quality given up to keep up (see DeadlineMonitor.h), the last
+// model load (ms), memory (MB) and seconds since the instance last published.
+//
+// With --ui, the columns are for drawing the UI instead (see DrawStats.h): frames per second, average/max time per
+// frame (ms), and meter updates drawn and skipped (the levels that moved a meter by less than a pixel), over the last
+// couple of seconds (0 for instances whose UI is closed); then the last opening of the UI (ms until the first frame,
+// of which creating the graphics and laying out the controls) and building the settings page (ms).
+//
+// Usage: nam-top [--once] [--interval <seconds (1)>] [--all] [--ui]
+//
+// --once prints one table and exits (for scripts). Instances whose process has died are hidden unless --all is given.
+
+#include <algorithm> // std::sort
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Telemetry.h"
+
+namespace
+{
+struct Options
+{
+  bool once = false;
+  bool all = false;
+  bool ui = false;
+  double interval = 1.0;
+};
+
+bool ParseArgs(int argc, char* argv[], Options& options)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    if (arg == "--once")
+      options.once = true;
+    else if (arg == "--all")
+      options.all = true;
+    else if (arg == "--ui")
+      options.ui = true;
+    else if (arg == "--interval" && i + 1 < argc)
+      options.interval = std::atof(argv[++i]);
+    else
+      return false;
+  }
+  return options.interval > 0.0;
+}
+
+std::string FlagString(const uint32_t flags)
+{
+  std::string s;
+  s += (flags & telemetry::kResampling) ? 'R' : '-';
+  s += (flags & telemetry::kIdle) ? 'I' : '-';
+  s += (flags & telemetry::kPipelined) ? 'P' : '-';
+  s += (flags & telemetry::kRig) ? 'G' : '-';
+  return s;
+}
+
+void PrintUITable(const std::vector<telemetry::Snapshot>& snapshots)
+{
+  std::printf("%7s %4s %-16s %6s %8s %8s %8s %8s %7s %7s %9s %11s %5s\n", "PID", "SLOT", "MODEL", "FPS", "FRAME_MS",
+              "MAX_MS", "METERS", "SKIPPED", "OPEN_MS", "GFX_MS", "LAYOUT_MS", "SETTINGS_MS", "AGE");
+  for (const telemetry::Snapshot& s : snapshots)
+  {
+    char model[17] = "-";
+    if (s.stats.modelHash != 0)
+      std::snprintf(model, sizeof(model), "%016llx", (unsigned long long)s.stats.modelHash);
+    std::printf("%7u %4d %-16s %6.1f %8.2f %8.2f %8u %8u %7.1f %7.1f %9.1f %11.1f %5.1f%s\n", s.processID, s.slot,
+                model, s.stats.framesPerSecond, s.stats.averageFrameMs, s.stats.maxFrameMs, s.stats.meterUpdatesDrawn,
+                s.stats.meterUpdatesSkipped, s.stats.uiOpenMs, s.stats.uiGraphicsMs, s.stats.uiLayoutMs,
+                s.stats.settingsBuildMs, 0.001 * (double)s.age, s.alive ? "" : " (dead)");
+  }
+}
+
+void PrintTable(std::vector<telemetry::Snapshot> snapshots, const bool all, const bool ui)
+{
+  if (!all)
+    snapshots.erase(std::remove_if(snapshots.begin(), snapshots.end(),
+                                   [](const telemetry::Snapshot& s) { return !s.alive; }),
+                    snapshots.end());
+  std::sort(snapshots.begin(), snapshots.end(), [](const telemetry::Snapshot& a, const telemetry::Snapshot& b) {
+    return a.stats.averageLoad > b.stats.averageLoad;
+  });
+
+  double totalLoad = 0.0, totalMemory = 0.0;
+  for (const telemetry::Snapshot& s : snapshots)
+  {
+    totalLoad += s.stats.averageLoad;
+    totalMemory += (double)s.stats.memoryBytes;
+  }
+  std::printf("%zu instances, %.1f%% load in total, %.1f MB\n\n", snapshots.size(), 100.0 * totalLoad,
+              totalMemory / (1024.0 * 1024.0));
+  if (ui)
+  {
+    PrintUITable(snapshots);
+    return;
+  }
+  std::printf("%7s %4s %-16s %-10s %6s %5s %5s %6s %6s %6s %7s %7s %6s %5s %3s %7s %7s %5s\n", "PID", "SLOT",
+              "MODEL", "ARCH", "RATE", "BLOCK", "FLAGS", "LOAD%", "MAX%", "WORK%", "AVG_MS", "MAX_MS", "OVER", "DUMPS",
+              "DEG", "LOAD_MS", "MEM_MB", "AGE");
+  for (const telemetry::Snapshot& s : snapshots)
+  {
+    char model[17] = "-";
+    if (s.stats.modelHash != 0)
+      std::snprintf(model, sizeof(model), "%016llx", (unsigned long long)s.stats.modelHash);
+    char dumps[24];
+    if (s.stats.blackBoxDumpFailures > 0)
+      std::snprintf(dumps, sizeof(dumps), "%u/%u", s.stats.blackBoxDumps, s.stats.blackBoxDumpFailures);
+    else
+      std::snprintf(dumps, sizeof(dumps), "%u", s.stats.blackBoxDumps);
+    std::printf("%7u %4d %-16s %-10.10s %6.0f %5d %5s %6.1f %6.1f %6.1f %7.3f %7.3f %6llu %5s %3u %7.1f %7.1f "
+                "%5.1f%s\n",
+                s.processID, s.slot, model, s.stats.architecture[0] != '\0' ? s.stats.architecture : "-",
+                s.stats.sampleRate, s.stats.blockSize, FlagString(s.stats.flags).c_str(), 100.0 * s.stats.averageLoad,
+                100.0 * s.stats.maxLoad, 100.0 * s.stats.workerAverageLoad, s.stats.averageProcessMs,
+                s.stats.maxProcessMs, (unsigned long long)s.stats.overruns, dumps, s.stats.degradation,
+                s.stats.modelLoadMs, (double)s.stats.memoryBytes / (1024.0 * 1024.0), 0.001 * (double)s.age,
+                s.alive ? "" : " (dead)");
+  }
+}
+}; // namespace
+
+int main(int argc, char* argv[])
+{
+  Options options;
+  if (!ParseArgs(argc, argv, options))
+  {
+    std::cerr << "Usage: " << argv[0] << " [--once] [--interval <seconds>] [--all] [--ui]" << std::endl;
+    return 2;
+  }
+
+  telemetry::Reader reader;
+  while (true)
+  {
+    const bool open = reader.Open();
+    if (!options.once)
+      std::printf("\x1b[H\x1b[2J");
+    if (open)
+      PrintTable(reader.Read(), options.all, options.ui);
+    else
+      std::printf("No instances have published yet (%s)\n", telemetry::GetSegmentName().c_str());
+    std::fflush(stdout);
+    if (options.once)
+      return open ? 0 : 1;
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.interval));
+  }
+}